@@ -2,6 +2,9 @@ import numpy as np
 import pandas
 from scipy.stats import ks_2samp
 from enum import auto, Enum
+from feature_table import load_feature_table
+from correlation import prune_correlated_features
+from pca import fit_pca_to_variance
 # from sklearn.decomposition import PCA
 
 class Error(Enum):
@@ -19,78 +22,36 @@ class Constant(Enum):
 
 # Feature Selection
 # Look at Principal Component Analysis
-def pearson_correlation(raw_data: dict) -> dict:
+def pearson_correlation(raw_data) -> pandas.DataFrame:
     # Check to make sure data exists
-    if raw_data == None:
+    if raw_data is None:
         print(f'[pearson_correlation] Data was not found in the raw_data input.\n')
         return Error.NO_DATA
-    # Assign an importance of 1 to each feature. The idea is to compare two features for correlation and if they are correlated, reduce the importance of one feature to 0.
-    feature_importance: dict = {key:1 for key in raw_data.keys()}
-    n: int = max(raw_data[raw_data.keys()[0]]) # n needs to be the number of rows in the data
-    for index_left in range(n-1):
-        left_feature: str = raw_data[index_left]
-        for index_right in range(index_left, n-1):
-            right_feature: str = raw_data[index_right]
-            if(feature_importance[left_feature] and feature_importance[right_feature]):
-                #  The link to the formula used: https://www.geeksforgeeks.org/pearson-correlation-coefficient/
-                x_data: list = raw_data[index_left]
-                y_data: list = raw_data[index_right]
-                xy_data: list = [x+y for x in x_data for y in y_data]
-                x_squared: list = [x*x for x in x_data]
-                y_squared: list = [y*y for y in y_data]
-
-                x_sum: int = sum(x_data)
-                y_sum: int = sum(y_data)
-                xy_sum: int = sum(xy_data)
-                x_squared_sum: int = sum(x_squared)
-                y_squared_sum: int = sum(y_squared)
-
-                r_numerator = ( n * xy_sum ) - ( x_sum * y_sum )
-                r_denomenator_left = ( n * x_squared_sum ) - ( x_sum ** 2 )
-                r_denomenator_right = ( n * y_squared_sum ) - ( y_sum ** 2 )
-
-                r_value = r_numerator / ( ( r_denomenator_left * r_denomenator_right ) ** .5 )
-
-                if(r_value < Constant.CORRELATION_COEFFICIENT):
-                    feature_importance[right_feature] = 0
-    # returning the feature importance dictionary. This will be used to know which features are important if they have a 1. 
-    for feature in raw_data:
-        if(feature_importance[feature] == 0):
-            raw_data.drop(columns=[feature], inplace=True)
-    return raw_data
-
-
-
-
-def principal_component_analysis(raw_data) -> dict:
-    # to perform PCA:
-    # 1. Standardize the data (Convert all data to have a mean of 0 and standard deviation of 1)
-    # standard_data: dict = {feature:[ ( feature_index - mean(raw_data[feature] ) ) / stdev(raw_data[feature]) for feature_index in raw_data[feature]] for feature in raw_data.keys()}
-
-    # # 2. Get the covariance matrix
-    # covariance_matrix: list[list[float]] = np.cov(raw_data_as_2d_array)
-
-    raw_mean = raw_data.mean()
-    raw_standard_deviation = raw_data.std()
-    z = (raw_data - raw_mean) / raw_standard_deviation
+    raw_data = pandas.DataFrame(raw_data)
 
-    covariance_matrix = z.cov()
+    # Compare every two features for correlation (over the sessions that have both, since -1 means missing), and if they are correlated, drop the later one. See correlation.py.
+    features: list = [column for column in raw_data.columns if column not in ("SequenceNumber", "User")]
+    values = raw_data[features].to_numpy(dtype=np.float64)
+    kept = prune_correlated_features(values, values == -1, Constant.CORRELATION_COEFFICIENT.value)
 
-    eigenvalues, eigenvectors = np.linalg.eig(covariance_matrix)
+    # Dropping the correlated features, so only the important ones are left.
+    return raw_data.drop(columns=[feature for feature, keep in zip(features, kept) if not keep])
 
-    eigen_index_descending = eigenvalues.argsort()[::-1]
-    eigenvalues = eigenvalues[eigen_index_descending]
-    eigenvectors = eigenvectors[:,eigen_index_descending]
 
-    explained_var = np.cumsum(eigenvalues) / np.sum(eigenvalues)
 
-    number_of_principal_components: int = np.argmax(explained_var >= 0.8) + 1
 
-    unit_matrix = eigenvectors[:,:number_of_principal_components]
+def principal_component_analysis(raw_data, variance: float = 0.8, projection_path: str = None) -> pandas.DataFrame:
+    # to perform PCA:
+    # 1. Standardize the data (Convert all data to have a mean of 0 and standard deviation of 1)
+    # 2. Find the fewest principal components that explain `variance` of the variance. This uses a randomized truncated SVD (see pca.py) instead of the covariance matrix and its eigenvectors, which need features x features memory.
+    projection = fit_pca_to_variance(raw_data, variance)
 
-    unit_matrix_data_frame = pandas.DataFrame(unit_matrix, index=raw_data.columns.to_numpy().tolist(), columns=[f"PC.{x}" for x in range(number_of_principal_components)])
+    # 3. Keep the fitted projection, so new sessions can be projected without refitting (pca.load_projection)
+    if projection_path is not None:
+        projection.save(projection_path)
 
-    selected_dataframe = z @ unit_matrix_data_frame
+    # 4. Project the data onto the principal components
+    selected_dataframe = pandas.DataFrame(projection.transform(raw_data), index=raw_data.index, columns=[f"PC.{x}" for x in range(projection.n_components)])
 
 
     return selected_dataframe
@@ -143,13 +104,15 @@ def kolmogorov_smirnov_test(train_data: pandas.DataFrame, test_data: pandas.Data
 
 
 def csv_to_python() -> dict:
-    with open('master_dict_output.csv', 'r') as csv:
-        matrix: list[str] = csv.readlines()
-        csv.close()
-    max_sequence_number = len(matrix)
-    # row[0] represents the features. The following rows are the data in matrix-ish form. i represents a given row, j represents a column such that data that shares the same j index is in the same column of the table
-    features: list[str] = matrix[0].split(',')
-    raw_data_dictionary: dict = { features[j].strip():[ float(matrix[i].split(',')[j].strip()) for i in range( 1, max_sequence_number ) ] for j in range( len( features ) ) }
+    # The CSV is parsed once into typed columns (see feature_table.py), and memory-mapped from
+    # its sidecar file on later calls until the CSV changes
+    table = load_feature_table('master_dict_output.csv')
+    if table is None:
+        return Error.NO_DATA
+
+    # Column name -> column of values. Missing values are -1, see table.missing for a mask.
+    raw_data_dictionary: dict = { "SequenceNumber": table.sequence_numbers, "User": table.users }
+    raw_data_dictionary.update({ feature: table.column(feature) for feature in table.feature_names })
     
     return raw_data_dictionary
 
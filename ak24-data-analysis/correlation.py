@@ -0,0 +1,94 @@
+import numpy as np
+
+# All-pairs Pearson correlation of feature columns with missing values, and greedy pruning of
+# correlated features. Each pair of features is correlated over the rows where both have a
+# value (pairwise-complete), which for a session x grapheme table is usually a small fraction
+# of the rows.
+#
+# With M the 0/1 matrix of present values and Z the standardized values (0 where missing),
+# the sums every pair needs are matrix products:
+#     n   = M^T M      (rows where both are present)
+#     sx  = Z^T M      (sum of column i over those rows; sy is its transpose)
+#     sxx = (Z*Z)^T M  (sum of squares of column i over those rows)
+#     sxy = Z^T Z
+# The products are computed one block of columns at a time, so memory stays at a few
+# block_size x features matrices, and go through NumPy's BLAS, which blocks and multithreads
+# them. Standardizing first keeps n*sxx - sx*sx from cancelling catastrophically.
+DEFAULT_BLOCK_SIZE = 512
+DEFAULT_MINIMUM_OVERLAP = 3     # fewer shared rows than this and a pair counts as uncorrelated
+
+# Returns the standardized values (0 where missing) and the 0/1 mask of present values
+def standardize(values, missing):
+    present = ~missing
+    counts = present.sum(axis=0)
+    safe_counts = np.maximum(counts, 1)
+    zeroed = np.where(present, values, 0.0)
+    means = zeroed.sum(axis=0) / safe_counts
+    centered = np.where(present, values - means, 0.0)
+    deviations = np.sqrt((centered * centered).sum(axis=0) / safe_counts)
+    deviations[deviations == 0] = 1.0
+    return centered / deviations, present.astype(np.float64)
+
+# Correlations of the columns in block (indices) with the columns in targets (indices)
+def _block_correlation(standardized, present, block, targets, minimum_overlap):
+    z_block, m_block = standardized[:, block], present[:, block]
+    z_targets, m_targets = standardized[:, targets], present[:, targets]
+
+    n = m_block.T @ m_targets
+    sx = z_block.T @ m_targets
+    sy = m_block.T @ z_targets
+    sxx = (z_block * z_block).T @ m_targets
+    syy = m_block.T @ (z_targets * z_targets)
+    sxy = z_block.T @ z_targets
+
+    with np.errstate(invalid="ignore", divide="ignore"):
+        numerator = n * sxy - sx * sy
+        denominator = np.sqrt(np.maximum(n * sxx - sx * sx, 0.0) * np.maximum(n * syy - sy * sy, 0.0))
+        correlation = numerator / denominator
+
+    # Too little overlap, or a constant column over the overlap: nothing to go on
+    correlation[(n < minimum_overlap) | ~np.isfinite(correlation)] = 0.0
+    return np.clip(correlation, -1.0, 1.0)
+
+# Full correlation matrix (features x features). Only for when it is needed as a whole; pruning
+# does not build it.
+def correlation_matrix(values, missing, block_size=DEFAULT_BLOCK_SIZE, minimum_overlap=DEFAULT_MINIMUM_OVERLAP):
+    standardized, present = standardize(np.asarray(values, dtype=np.float64), np.asarray(missing, dtype=bool))
+    feature_count = standardized.shape[1]
+    all_features = np.arange(feature_count)
+
+    matrix = np.empty((feature_count, feature_count))
+    for start in range(0, feature_count, block_size):
+        block = all_features[start:start + block_size]
+        matrix[block] = _block_correlation(standardized, present, block, all_features, minimum_overlap)
+    return matrix
+
+# Greedy pruning: going through the features in order, a feature is kept unless an earlier kept
+# feature correlates with it at |r| >= threshold, and every later feature that correlates with
+# a kept one is dropped. Returns a boolean mask of the kept features.
+#
+# Blocks are only computed for the features still kept, against the later features still kept,
+# so the more features are dropped, the less there is left to compute.
+def prune_correlated_features(values, missing, threshold, block_size=DEFAULT_BLOCK_SIZE, minimum_overlap=DEFAULT_MINIMUM_OVERLAP):
+    standardized, present = standardize(np.asarray(values, dtype=np.float64), np.asarray(missing, dtype=bool))
+    feature_count = standardized.shape[1]
+    kept = np.ones(feature_count, dtype=bool)
+
+    for start in range(0, feature_count, block_size):
+        block = np.flatnonzero(kept[start:start + block_size]) + start
+        targets = np.flatnonzero(kept[start:]) + start
+        if len(block) == 0:
+            continue
+
+        correlated = np.abs(_block_correlation(standardized, present, block, targets, minimum_overlap)) >= threshold
+        # Only later features can be dropped by a feature
+        correlated &= targets[np.newaxis, :] > block[:, np.newaxis]
+
+        # Within the block the order matters: a feature dropped by an earlier one in the block
+        # no longer drops others
+        for row, feature in enumerate(block):
+            if not kept[feature]:
+                continue
+            kept[targets[correlated[row]]] = False
+
+    return kept
@@ -0,0 +1,145 @@
+import hashlib
+import os
+import numpy as np
+
+# On-disk cache of the feature rows extracted from each session file. Session files never
+# change after collection, so an entry is found by the SHA-256 of the file's contents (not its
+# name or modification time) together with a fingerprint of the extraction settings. Changing
+# the settings, or bumping the extractor version when the extraction code changes, makes every
+# old entry unreachable instead of stale.
+#
+# An entry holds the feature rows of one session file: a header of six little-endian int64s
+# (after CACHE_MAGIC), then these arrays back to back, so it is read with a single read():
+#     row_lengths  int64[rows]          -> number of features in each row
+#     values       float64[features]    -> every row's feature values, one row after the other
+#     key_offsets  int64[features + 1]  -> where each feature name starts in the key text
+#     user_offsets int64[rows + 1]      -> where each row's user starts in the user text
+#     key text     UTF-8 (key_bytes)    -> the feature names back to back
+#     user text    UTF-8 (user_bytes)   -> the users back to back
+# Offsets count characters, not bytes, so the text is decoded once and sliced.
+DEFAULT_CACHE_DIRECTORY = ".feature_cache"
+CACHE_MAGIC = b"AK24FC1\0"
+HEADER_DTYPE = np.dtype([("rows", "<i8"), ("features", "<i8"), ("key_bytes", "<i8"),
+                         ("user_bytes", "<i8"), ("reserved", "<i8", (2,))])
+
+# Fingerprint of whatever decides the feature rows. settings should be a string that changes
+# whenever they would, e.g. the extractor version, grapheme type and aggregations.
+def settings_fingerprint(settings: str) -> str:
+    return hashlib.sha256(settings.encode("utf-8")).hexdigest()[:16]
+
+def hash_file(file_path: str) -> str:
+    with open(file_path, "rb") as file:
+        return hashlib.sha256(file.read()).hexdigest()
+
+def cache_entry_path(cache_directory: str, file_hash: str, fingerprint: str) -> str:
+    return os.path.join(cache_directory, f"{file_hash}-{fingerprint}.features")
+
+def _string_offsets(strings):
+    offsets = np.zeros(len(strings) + 1, dtype=np.int64)
+    np.cumsum([len(string) for string in strings], out=offsets[1:])
+    return offsets
+
+def _split_text(text, offsets):
+    offsets = offsets.tolist()
+    return [text[offsets[i]:offsets[i + 1]] for i in range(len(offsets) - 1)]
+
+# Returns the cached feature rows, or None if there is no (readable) entry
+def load_feature_rows(entry_path: str):
+    try:
+        with open(entry_path, "rb") as file:
+            data = file.read()
+    except FileNotFoundError:
+        return None
+    except OSError as error:
+        print(f"[load_feature_rows] Ignoring unreadable cache entry {entry_path}: {error}")
+        return None
+
+    try:
+        if not data.startswith(CACHE_MAGIC):
+            raise ValueError("not a feature cache entry")
+        position = len(CACHE_MAGIC)
+        header = np.frombuffer(data, dtype=HEADER_DTYPE, count=1, offset=position)[0]
+        position += HEADER_DTYPE.itemsize
+        rows, features = int(header["rows"]), int(header["features"])
+
+        arrays = []
+        for dtype, count in [("<i8", rows), ("<f8", features), ("<i8", features + 1), ("<i8", rows + 1)]:
+            arrays.append(np.frombuffer(data, dtype=dtype, count=count, offset=position))
+            position += arrays[-1].nbytes
+        row_lengths, values, key_offsets, user_offsets = arrays
+
+        key_text = data[position:position + int(header["key_bytes"])].decode("utf-8")
+        position += int(header["key_bytes"])
+        user_text = data[position:position + int(header["user_bytes"])].decode("utf-8")
+        if position + int(header["user_bytes"]) != len(data):
+            raise ValueError("entry has the wrong size")
+    except ValueError as error:
+        print(f"[load_feature_rows] Ignoring unreadable cache entry {entry_path}: {error}")
+        return None
+
+    keys = _split_text(key_text, key_offsets)
+    values = values.tolist()
+    users = _split_text(user_text, user_offsets)
+
+    feature_rows = []
+    start = 0
+    for row_length, user in zip(row_lengths.tolist(), users):
+        row = dict(zip(keys[start:start + row_length], values[start:start + row_length]))
+        row["user"] = user
+        feature_rows.append(row)
+        start += row_length
+
+    return feature_rows
+
+def store_feature_rows(entry_path: str, feature_rows):
+    keys = []
+    values = []
+    row_lengths = []
+    users = []
+    for row in feature_rows:
+        features = [key for key in row if key != "user"]
+        keys.extend(features)
+        values.extend(row[key] for key in features)
+        row_lengths.append(len(features))
+        users.append(row["user"])
+
+    key_bytes = "".join(keys).encode("utf-8")
+    user_bytes = "".join(users).encode("utf-8")
+    header = np.zeros(1, dtype=HEADER_DTYPE)
+    header["rows"] = len(row_lengths)
+    header["features"] = len(keys)
+    header["key_bytes"] = len(key_bytes)
+    header["user_bytes"] = len(user_bytes)
+
+    # Written under a temporary name and renamed, so that workers storing the same entry at once
+    # (or a run that is interrupted) never leave a partial entry behind
+    os.makedirs(os.path.dirname(entry_path) or ".", exist_ok=True)
+    temporary_path = f"{entry_path}.{os.getpid()}.tmp"
+    try:
+        with open(temporary_path, "wb") as file:
+            file.write(CACHE_MAGIC)
+            file.write(header.tobytes())
+            file.write(np.array(row_lengths, dtype="<i8").tobytes())
+            file.write(np.array(values, dtype="<f8").tobytes())
+            file.write(_string_offsets(keys).astype("<i8").tobytes())
+            file.write(_string_offsets(users).astype("<i8").tobytes())
+            file.write(key_bytes)
+            file.write(user_bytes)
+        os.replace(temporary_path, entry_path)
+    except OSError as error:
+        print(f"[store_feature_rows] Could not write cache entry {entry_path}: {error}")
+        if os.path.exists(temporary_path):
+            os.remove(temporary_path)
+
+# Returns the feature rows of file_path from the cache, calling extract(file_path) and storing
+# its result on a miss. Also returns whether it was a hit.
+def cached_feature_rows(file_path: str, cache_directory: str, fingerprint: str, extract):
+    entry_path = cache_entry_path(cache_directory, hash_file(file_path), fingerprint)
+
+    feature_rows = load_feature_rows(entry_path)
+    if feature_rows is not None:
+        return feature_rows, True
+
+    feature_rows = extract(file_path)
+    store_feature_rows(entry_path, feature_rows)
+    return feature_rows, False
@@ -0,0 +1,199 @@
+import csv
+import itertools
+import json
+import os
+import numpy as np
+import pandas
+
+# Columnar loader for the master CSV written by masterDictionaryBuilder.write_to_csv
+# ("SequenceNumber", "User", then one column per grapheme feature, -1 where a session has no
+# value). The CSV is parsed once, a chunk of rows at a time, into one float64 array per feature
+# (stored column-major, so each feature is contiguous) and a mask of the missing (-1) values.
+#
+# The parsed table is saved next to the CSV in a sidecar file (CSV path + SIDECAR_SUFFIX) and
+# memory-mapped on later loads, as long as the CSV has not changed since. Sidecar layout:
+#     SIDECAR_MAGIC, uint64 (little-endian) length of the JSON header, the JSON header
+#     (names, users, sequence numbers, shape, the CSV's size and modification time),
+#     padding to SIDECAR_ALIGNMENT, then the values as float64, column-major
+SIDECAR_SUFFIX = ".columns"
+SIDECAR_MAGIC = b"AK24COL1"
+SIDECAR_ALIGNMENT = 64
+DEFAULT_CHUNK_ROWS = 1024
+MISSING_VALUE = -1
+
+class FeatureTable:
+    def __init__(self, sequence_numbers, users, feature_names, values):
+        self.sequence_numbers = sequence_numbers    # int64[rows]
+        self.users = users                          # str[rows]
+        self.feature_names = feature_names          # list of str
+        self.values = values                        # float64[rows, features], column-major
+        self.missing = values == MISSING_VALUE      # bool[rows, features]
+        self._feature_index = {name: j for j, name in enumerate(feature_names)}
+
+    @property
+    def shape(self):
+        return self.values.shape
+
+    # One feature's values (a view, no copy)
+    def column(self, feature_name):
+        return self.values[:, self._feature_index[feature_name]]
+
+    # Features as a DataFrame, like pandas.read_csv(...).drop(columns=["SequenceNumber", "User"]).
+    # Missing values stay -1 unless missing_as_nan is set.
+    def to_dataframe(self, missing_as_nan=False):
+        values = np.where(self.missing, np.nan, self.values) if missing_as_nan else self.values
+        return pandas.DataFrame(values, columns=self.feature_names, copy=False)
+
+# Fast path for a chunk of data lines as write_to_csv writes them: every field quoted, and
+# only the user can hold quotes, commas or line breaks. The numbers of the whole chunk are
+# parsed by NumPy in one go. Returns None if a line needs the full CSV parser.
+def _parse_quoted_lines(lines, feature_count):
+    sequence_numbers, users, numbers = [], [], []
+    for line in lines:
+        fields = line.rstrip("\r\n").split('","', 2)
+        if len(fields) != 3 or fields[0][:1] != '"' or fields[2][-1:] != '"' or '"' in fields[1]:
+            return None
+        sequence_numbers.append(fields[0][1:])
+        users.append(fields[1])
+        numbers.append(fields[2][:-1])
+
+    try:
+        values = np.fromstring(",".join(numbers).replace('","', ","), dtype=np.float64, sep=",")
+        sequence_numbers = np.array(sequence_numbers, dtype=np.int64)
+    except ValueError:
+        return None
+    if values.size != len(lines) * feature_count:
+        return None
+
+    return sequence_numbers, users, values.reshape(len(lines), feature_count)
+
+# Parses rows from a csv.reader, chunk_rows at a time
+def _parse_rows(reader, column_count, chunk_rows):
+    while True:
+        rows = list(itertools.islice(reader, chunk_rows))
+        if not rows:
+            return
+        if any(len(row) != column_count for row in rows):
+            raise ValueError(f"a row does not have {column_count} columns")
+
+        yield (np.array([row[0] for row in rows], dtype=np.int64),
+               [row[1] for row in rows],
+               np.array([row[2:] for row in rows], dtype=np.float64).reshape(len(rows), column_count - 2))
+
+# Parses the CSV in chunks of chunk_rows rows. Returns a FeatureTable, or None on error.
+def parse_feature_csv(csv_path, chunk_rows=DEFAULT_CHUNK_ROWS):
+    chunks = []
+    try:
+        with open(csv_path, newline='') as file:
+            # The header goes through csv.reader, since graphemes can hold commas, quotes and
+            # line breaks. It reads no further than the header's last line.
+            header = next(csv.reader(file), None)
+            if header is None or header[:2] != ["SequenceNumber", "User"]:
+                print(f"[parse_feature_csv] {csv_path} does not start with the SequenceNumber and User columns.")
+                return None
+            feature_names = header[2:]
+
+            while True:
+                lines = list(itertools.islice(file, chunk_rows))
+                if not lines:
+                    break
+
+                chunk = _parse_quoted_lines(lines, len(feature_names))
+                if chunk is None:
+                    # Not a line the fast path handles, so parse the rest with csv.reader
+                    chunks.extend(_parse_rows(csv.reader(itertools.chain(lines, file)), len(header), chunk_rows))
+                    break
+                chunks.append(chunk)
+    except (OSError, ValueError) as error:
+        print(f"[parse_feature_csv] Could not parse {csv_path}: {error}")
+        return None
+
+    if chunks:
+        sequence_numbers = np.concatenate([chunk[0] for chunk in chunks])
+        users = [user for chunk in chunks for user in chunk[1]]
+        values = np.asfortranarray(np.concatenate([chunk[2] for chunk in chunks]))
+    else:
+        sequence_numbers = np.empty(0, dtype=np.int64)
+        users = []
+        values = np.empty((0, len(feature_names)), dtype=np.float64, order='F')
+
+    return FeatureTable(sequence_numbers, np.array(users, dtype=str), feature_names, values)
+
+def _source_stamp(csv_path):
+    status = os.stat(csv_path)
+    return {"source_size": status.st_size, "source_mtime_ns": status.st_mtime_ns}
+
+def write_sidecar(table, sidecar_path, source_stamp):
+    rows, columns = table.shape
+    header = dict(source_stamp, rows=rows, columns=columns,
+                  feature_names=table.feature_names,
+                  users=table.users.tolist(),
+                  sequence_numbers=table.sequence_numbers.tolist())
+    header_bytes = json.dumps(header).encode("utf-8")
+    data_offset = len(SIDECAR_MAGIC) + 8 + len(header_bytes)
+    padding = -data_offset % SIDECAR_ALIGNMENT
+
+    temporary_path = f"{sidecar_path}.{os.getpid()}.tmp"
+    try:
+        with open(temporary_path, "wb") as file:
+            file.write(SIDECAR_MAGIC)
+            file.write(len(header_bytes).to_bytes(8, "little"))
+            file.write(header_bytes)
+            file.write(b"\0" * padding)
+            # Column-major, so the transpose is C-contiguous and written without a copy
+            file.write(np.ascontiguousarray(table.values.T, dtype="<f8").tobytes())
+        os.replace(temporary_path, sidecar_path)
+    except OSError as error:
+        print(f"[write_sidecar] Could not write {sidecar_path}: {error}")
+        if os.path.exists(temporary_path):
+            os.remove(temporary_path)
+
+# Memory-maps a sidecar. Returns None if it is missing, unreadable, or not from this version of
+# the CSV.
+def read_sidecar(sidecar_path, source_stamp):
+    try:
+        with open(sidecar_path, "rb") as file:
+            if file.read(len(SIDECAR_MAGIC)) != SIDECAR_MAGIC:
+                return None
+            header_length = int.from_bytes(file.read(8), "little")
+            header = json.loads(file.read(header_length).decode("utf-8"))
+    except (OSError, ValueError):
+        return None
+
+    if any(header.get(key) != value for key, value in source_stamp.items()):
+        return None
+
+    data_offset = len(SIDECAR_MAGIC) + 8 + header_length
+    data_offset += -data_offset % SIDECAR_ALIGNMENT
+    rows, columns = header["rows"], header["columns"]
+    if os.path.getsize(sidecar_path) != data_offset + rows * columns * 8:
+        return None
+
+    if rows * columns == 0:
+        values = np.empty((rows, columns), dtype=np.float64, order='F')
+    else:
+        values = np.memmap(sidecar_path, dtype="<f8", mode="r", offset=data_offset, shape=(rows, columns), order='F')
+    return FeatureTable(np.array(header["sequence_numbers"], dtype=np.int64),
+                        np.array(header["users"], dtype=str),
+                        header["feature_names"], values)
+
+# Loads the master CSV, from its sidecar when it is up to date, and otherwise by parsing the
+# CSV (and then saving the sidecar for next time). Returns a FeatureTable, or None on error.
+def load_feature_table(csv_path="master_dict_output.csv", use_sidecar=True, chunk_rows=DEFAULT_CHUNK_ROWS):
+    sidecar_path = csv_path + SIDECAR_SUFFIX
+    try:
+        source_stamp = _source_stamp(csv_path)
+    except OSError as error:
+        print(f"[load_feature_table] Could not open {csv_path}: {error}")
+        return None
+
+    if use_sidecar:
+        table = read_sidecar(sidecar_path, source_stamp)
+        if table is not None:
+            return table
+
+    table = parse_feature_csv(csv_path, chunk_rows)
+    if table is not None and use_sidecar:
+        write_sidecar(table, sidecar_path, source_stamp)
+
+    return table
@@ -0,0 +1,153 @@
+import ctypes
+import json
+import os
+import numpy as np
+
+# One-vs-all linear SVM over the grapheme features, trained by native/liblinearsvm (build it with
+# native/build). Features are standardized over the sessions that have them, and missing ones
+# (-1) become 0, so each session is a sparse row holding only the graphemes it has. Every user
+# gets a binary classifier against everyone else; they are trained in parallel.
+#
+# A trained model is saved as a compact binary file:
+#     MODEL_MAGIC, then int64 classes, features and the length of the labels' JSON,
+#     the labels as a JSON list (UTF-8), then float64 mean[features], float64 scale[features]
+#     and float32 weights[classes][features + 1] (the last one of each class is its bias)
+NATIVE_LIBRARY_PATH = os.path.join(os.path.dirname(os.path.abspath(__file__)), "native", "liblinearsvm.so")
+MODEL_MAGIC = b"AK24LSV1"
+MISSING_VALUE = -1
+
+LOSS_SQUARED_HINGE = 0
+LOSS_HINGE = 1
+
+class _Problem(ctypes.Structure):
+    _fields_ = [("rows", ctypes.c_size_t),
+                ("features", ctypes.c_size_t),
+                ("row_offsets", ctypes.POINTER(ctypes.c_int64)),
+                ("columns", ctypes.POINTER(ctypes.c_int32)),
+                ("values", ctypes.POINTER(ctypes.c_double)),
+                ("labels", ctypes.POINTER(ctypes.c_int32)),
+                ("classes", ctypes.c_int32)]
+
+class _Parameters(ctypes.Structure):
+    _fields_ = [("C", ctypes.c_double),
+                ("epsilon", ctypes.c_double),
+                ("max_iterations", ctypes.c_int),
+                ("bias", ctypes.c_double),
+                ("loss", ctypes.c_int),
+                ("threads", ctypes.c_int),
+                ("seed", ctypes.c_uint64)]
+
+_library = None
+
+# Returns the native library, or None if it has not been built
+def load_native_library():
+    global _library
+    if _library is None:
+        if not os.path.exists(NATIVE_LIBRARY_PATH):
+            print(f"[load_native_library] {NATIVE_LIBRARY_PATH} was not found. Build it with native/build.")
+            return None
+        _library = ctypes.CDLL(NATIVE_LIBRARY_PATH)
+        _library.linear_svm_default_parameters.argtypes = [ctypes.POINTER(_Parameters)]
+        _library.linear_svm_default_parameters.restype = None
+        _library.linear_svm_train.argtypes = [ctypes.POINTER(_Problem), ctypes.POINTER(_Parameters),
+                                              ctypes.POINTER(ctypes.c_double), ctypes.POINTER(ctypes.c_int32)]
+        _library.linear_svm_train.restype = ctypes.c_int
+    return _library
+
+def _pointer(array, ctype):
+    return array.ctypes.data_as(ctypes.POINTER(ctype))
+
+class LinearSVMModel:
+    def __init__(self, labels, mean, scale, weights):
+        self.labels = np.asarray(labels)    # label of each class
+        self.mean = mean                    # float64[features], over the sessions that have the feature
+        self.scale = scale                  # float64[features]
+        self.weights = weights              # [classes, features + 1], the last column is the bias
+
+    # Standardized features, 0 where missing
+    def standardize(self, X):
+        X = np.asarray(X, dtype=np.float64)
+        return np.where(X == MISSING_VALUE, 0.0, (X - self.mean) / self.scale)
+
+    # Decision value of every class for every row (rows x classes)
+    def decision_function(self, X):
+        return self.standardize(X) @ self.weights[:, :-1].T + self.weights[:, -1]
+
+    def predict(self, X):
+        return self.labels[np.argmax(self.decision_function(X), axis=1)]
+
+    def save(self, path):
+        labels = json.dumps(self.labels.tolist()).encode("utf-8")
+        classes, columns = self.weights.shape
+        with open(path, "wb") as file:
+            file.write(MODEL_MAGIC)
+            file.write(np.array([classes, columns - 1, len(labels)], dtype="<i8").tobytes())
+            file.write(labels)
+            file.write(np.asarray(self.mean, dtype="<f8").tobytes())
+            file.write(np.asarray(self.scale, dtype="<f8").tobytes())
+            file.write(np.asarray(self.weights, dtype="<f4").tobytes())
+
+def load_linear_svm(path):
+    with open(path, "rb") as file:
+        data = file.read()
+    if not data.startswith(MODEL_MAGIC):
+        raise ValueError(f"[load_linear_svm] {path} is not a linear SVM model.")
+
+    position = len(MODEL_MAGIC)
+    classes, features, labels_length = np.frombuffer(data, dtype="<i8", count=3, offset=position).tolist()
+    position += 24
+    labels = json.loads(data[position:position + labels_length].decode("utf-8"))
+    position += labels_length
+    mean = np.frombuffer(data, dtype="<f8", count=features, offset=position)
+    position += mean.nbytes
+    scale = np.frombuffer(data, dtype="<f8", count=features, offset=position)
+    position += scale.nbytes
+    weights = np.frombuffer(data, dtype="<f4", count=classes * (features + 1), offset=position)
+    return LinearSVMModel(labels, mean, scale, weights.reshape(classes, features + 1).astype(np.float64))
+
+# Trains one classifier per label in y. Returns a LinearSVMModel, or None if the native library
+# is not available or training failed.
+def train_linear_svm(X, y, C=1.0, loss=LOSS_SQUARED_HINGE, threads=0, epsilon=None, max_iterations=None, seed=1):
+    library = load_native_library()
+    if library is None:
+        return None
+
+    X = np.asarray(X, dtype=np.float64)
+    labels, label_indices = np.unique(np.asarray(y), return_inverse=True)
+    present = X != MISSING_VALUE
+
+    # Standardize each feature over the sessions that have it
+    counts = np.maximum(present.sum(axis=0), 1)
+    mean = np.where(present, X, 0.0).sum(axis=0) / counts
+    deviations = np.sqrt(np.where(present, (X - mean) ** 2, 0.0).sum(axis=0) / counts)
+    scale = np.where(deviations > 0, deviations, 1.0)
+
+    # CSR rows of the present features
+    rows, columns = np.nonzero(present)
+    row_offsets = np.zeros(len(X) + 1, dtype=np.int64)
+    np.cumsum(present.sum(axis=1), out=row_offsets[1:])
+    columns = columns.astype(np.int32)
+    values = np.ascontiguousarray(((X[rows, columns] - mean[columns]) / scale[columns]), dtype=np.float64)
+    label_indices = label_indices.astype(np.int32)
+
+    problem = _Problem(len(X), X.shape[1], _pointer(row_offsets, ctypes.c_int64), _pointer(columns, ctypes.c_int32),
+                       _pointer(values, ctypes.c_double), _pointer(label_indices, ctypes.c_int32), len(labels))
+    parameters = _Parameters()
+    library.linear_svm_default_parameters(ctypes.byref(parameters))
+    parameters.C = C
+    parameters.loss = loss
+    parameters.threads = threads
+    parameters.seed = seed
+    if epsilon is not None:
+        parameters.epsilon = epsilon
+    if max_iterations is not None:
+        parameters.max_iterations = max_iterations
+
+    weights = np.zeros((len(labels), X.shape[1] + 1), dtype=np.float64)
+    iterations = np.zeros(len(labels), dtype=np.int32)
+    if library.linear_svm_train(ctypes.byref(problem), ctypes.byref(parameters),
+                                _pointer(weights, ctypes.c_double), _pointer(iterations, ctypes.c_int32)) != 0:
+        print("[train_linear_svm] Training failed.")
+        return None
+
+    return LinearSVMModel(labels, mean, scale, weights)
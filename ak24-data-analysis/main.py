@@ -1,6 +1,10 @@
-from read_binary import read_keystroke_logger_output
+from read_binary import read_keystroke_logger_arrays
 from pylibgrapheme import create_grapheme_map, get_combinations, GraphemeType
-from masterDictionaryBuilder import create_combined_dictionary, write_to_csv, update_master_dictionary, print_master_dictionary
+from masterDictionaryBuilder import create_combined_dictionary, write_to_csv, merge_feature_rows
+from feature_cache import cached_feature_rows, settings_fingerprint, DEFAULT_CACHE_DIRECTORY
+from feature_table import load_feature_table
+from pca import fit_pca_to_variance
+from model_store import save_model_store
 
 from knn import knn
 from algorithms import kolmogorov_smirnov_test, Error
@@ -14,40 +18,94 @@ import argparse
 import matplotlib.pyplot as plt
 from sklearn.metrics import accuracy_score, confusion_matrix, classification_report
 from sklearn.model_selection import train_test_split
-from sklearn.decomposition import PCA
 import os
+from concurrent.futures import ProcessPoolExecutor
+from functools import partial
 
+# Feature extraction settings. Bump FEATURE_EXTRACTOR_VERSION whenever the extraction code
+# changes in a way these settings do not show, so cached features are extracted again.
+FEATURE_EXTRACTOR_VERSION = 1
+GRAPHEME_TYPE = GraphemeType.DIGRAPH
+AGGREGATIONS = ("mean",)
 
+PCA_PROJECTION_PATH = "pca_projection.npz"
+SVM_MODEL_PATH = "linear_svm.model"
+NEURAL_NET_MODEL_PATH = "neural_net.mlp"
+MODEL_STORE_PATH = "model_store.bin"
+
+def extraction_settings():
+    return f"version={FEATURE_EXTRACTOR_VERSION};grapheme={GRAPHEME_TYPE.name};aggregations={','.join(AGGREGATIONS)}"
 
 def process_sessions(sessions, user_info):
-   
+    # One feature row (combined dictionary) per session
+    feature_rows = []
+
     for i, session in enumerate(sessions):
         # Create grapheme map for each session
-        grapheme_map_error_code, grapheme_map = create_grapheme_map(session, GraphemeType.DIGRAPH)
-
-        # Temperary fix, since these two lists have 1 less value than the rest
-        grapheme_map["time_delta"].append(-1)
-        grapheme_map["flight_time"].append(-1)
+        grapheme_map_error_code, grapheme_map = create_grapheme_map(session, GRAPHEME_TYPE)
 
         # If a grapheme map exists
         if grapheme_map:
+            # Temperary fix, since these two lists have 1 less value than the rest
+            grapheme_map["time_delta"].append(-1)
+            grapheme_map["flight_time"].append(-1)
+
             # Create a combined_dictionary for it
-            combined_dictionary = create_combined_dictionary(grapheme_map, user_info)
-            
-            # Update master dictionary with combined dictionary
-            update_master_dictionary(combined_dictionary)
+            feature_rows.append(create_combined_dictionary(grapheme_map, user_info, AGGREGATIONS))
 
         else:
             print("[ERROR] Failed to process session.")
 
+    return feature_rows
+
+# Map task: reads one session file and returns its feature rows. It shares nothing with the
+# other files, so files can be processed in any order and in parallel.
+def process_file(file_path):
+    # Read sessions from the binary file
+    user_info, sessions_data = read_keystroke_logger_arrays(file_path)
+
+    if not sessions_data:
+        print(f"[ERROR] No valid session data found in {file_path}.")
+        return []
+
+    return process_sessions(sessions_data, user_info)
+
+# Map task: process_file through the feature cache (if there is one). Returns the feature rows
+# and whether they came from the cache.
+def extract_features(file_path, cache_directory):
+    if cache_directory is None:
+        return process_file(file_path), False
+
+    return cached_feature_rows(file_path, cache_directory, settings_fingerprint(extraction_settings()), process_file)
+
+# Processes the files with a pool of worker processes and merges their feature rows in the
+# order of file_paths, so the output does not depend on which worker finishes first.
+def process_files(file_paths, jobs, cache_directory=None):
+    task = partial(extract_features, cache_directory=cache_directory)
+
+    if jobs <= 1:
+        results = list(map(task, file_paths))
+    else:
+        with ProcessPoolExecutor(max_workers=jobs) as executor:
+            # A few files per task, so workers are not handed files one at a time
+            chunksize = max(1, len(file_paths) // (jobs * 4))
+            results = list(executor.map(task, file_paths, chunksize=chunksize))
+
+    if cache_directory is not None:
+        hits = sum(1 for _, hit in results if hit)
+        print(f"Feature cache: {hits} of {len(results)} files were already extracted.")
+
+    return merge_feature_rows([row for rows, _ in results for row in rows])
+
 # Function to read the CSV and return features and labels
 def read_csv_file(csv_file_path):
     """
     Read the CSV file, return features (X) and labels (y)
     """
-    data_frame = pandas.read_csv(csv_file_path)
-    y = data_frame["User"]
-    X = data_frame.drop(columns=["User", "SequenceNumber"])  # Drop 'User' and 'SequenceNumber' columns
+    # Parsed into typed columns, or memory-mapped from the sidecar if the CSV has not changed
+    table = load_feature_table(csv_file_path)
+    y = pandas.Series(table.users, name="User")
+    X = table.to_dataframe()  # Features only, without the 'User' and 'SequenceNumber' columns
     return X, y
 
 def perform_knn(X, y):
@@ -62,7 +120,7 @@ def perform_knn(X, y):
 
 def perform_svm(X, y):
     # Perform SVM
-    output = ova_svm(X, y)
+    output = ova_svm(X, y, SVM_MODEL_PATH)
 
     # Print results
     print("\nSupport Vector Machine (SVM):")
@@ -70,9 +128,11 @@ def perform_svm(X, y):
     print("final predictions: {}".format(output.final_predictions))
     print("accuracy_score: {}\n".format(output.accuracy_score))
 
+    return output
+
 def perform_neural_net(X, y):
     # Perform Neural Network
-    history = run_neural_net(X, y)
+    history = run_neural_net(X, y, NEURAL_NET_MODEL_PATH)
 
     # Plot accuracy over epochs
     plt.plot(history.history["accuracy"], label="Train Accuracy")
@@ -136,38 +196,50 @@ def parse_arguments():
         help="Paths to the directories of the file"
     )
 
+    # Add argument for the number of worker processes
+    parser.add_argument(
+        '-j', '--jobs',
+        type=int,
+        default=os.cpu_count(),
+        help="Number of files to process at once (default: one per CPU)"
+    )
+
+    # Add arguments for the feature cache
+    parser.add_argument(
+        '--cache-dir',
+        default=DEFAULT_CACHE_DIRECTORY,
+        help=f"Directory of the feature cache (default: {DEFAULT_CACHE_DIRECTORY})"
+    )
+    parser.add_argument(
+        '--no-cache',
+        action='store_true',
+        help="Extract the features of every file, without reading or writing the cache"
+    )
+
     # Parse the arguments
     args = parser.parse_args()
     
-    return args.directories 
+    return args
 
 def main():
     # Get directory paths from arguments
-    directories = parse_arguments()
+    args = parse_arguments()
+    directories = args.directories
 
     # Print out the paths for verification
     print(f"Directories to process: {directories}")
     
-    # Loop through directories
+    # Collect the file paths, sorted so every run lists the sessions in the same order
+    file_paths = []
     for directory in directories:
-        # Loop through the file paths
-        for file_path in os.listdir(directory):
-
-            full_file_path = os.path.join(directory, file_path)
-            
-            # Read sessions from the binary file
-            user_info, sessions_data = read_keystroke_logger_output(full_file_path)
+        for file_path in sorted(os.listdir(directory)):
+            file_paths.append(os.path.join(directory, file_path))
 
-            if sessions_data:
-                # Process sessions and update master dictionary
-                process_sessions(sessions_data, user_info)
+    # Extract the features of every file
+    master_dictionary = process_files(file_paths, args.jobs, None if args.no_cache else args.cache_dir)
 
-            else:
-                print("[ERROR] No valid session data found.")
-
-    
     # Write the master dictionary to a csv file
-    write_to_csv()
+    write_to_csv(master_dictionary)
 
     # Read in the csv file data to use with classifers
     X, y = read_csv_file("master_dict_output.csv")
@@ -182,9 +254,13 @@ def main():
     print(X_selected.shape)  
 
 
-    # Apply PCA to reduce dimensionality further
-    pca = PCA(n_components=0.8)  # Keep 80% of variance
-    X_pca = pca.fit_transform(X_selected)
+    # Apply PCA to reduce dimensionality further, keeping 80% of variance. The features are only
+    # centered, as sklearn's PCA did here, so the number of components kept is unchanged. The
+    # fitted projection is saved, so new sessions can be projected with pca.load_projection()
+    # without refitting.
+    projection = fit_pca_to_variance(X_selected, variance=0.8, standardize=False)
+    projection.save(PCA_PROJECTION_PATH)
+    X_pca = projection.transform(X_selected)
     # Print the shape after PCA
     print(f"\nAfter PCA: {X_pca.shape}")  
 
@@ -201,7 +277,11 @@ def main():
     perform_knn(X_selected, y)
 
     # SVM
-    perform_svm(X_selected, y)
+    svm_output = perform_svm(X_selected, y)
+
+    # Save the scaler, feature vocabulary, user templates and classifier weights in one
+    # memory-mappable file, so scoring services can start without retraining
+    save_model_store(MODEL_STORE_PATH, X_selected, y, extraction_settings(), svm_output.model)
 
     # Neural Net
     perform_neural_net(X_selected, y)
@@ -1,4 +1,4 @@
-import pandas as pd
+import numpy as np
 import csv
 
 # Global variable to store the master dictionary
@@ -68,26 +68,107 @@ def update_master_dictionary(combined_dictionary):
     # Call helper function to add -1's where needed
     fill_in_empty_values()
 
-def create_combined_dictionary(grapheme_map, user_info):
-    # Convert the dictionary to a Pandas DataFrame
-    df = pd.DataFrame(grapheme_map)
+# Statistics create_combined_dictionary can compute for each grapheme. "mean" keeps the
+# "grapheme+statistic" key used so far; the others are suffixed, e.g. "th+dwell_time+median".
+AGGREGATIONS = ["mean", "median", "std", "count"]
+GRAPHEME_COLUMNS = ["time_delta", "dwell_time", "flight_time"]
+
+# Aggregates the samples of each group (one row per group, one column per statistic). Samples
+# that are NaN are left out; a group without samples gets NaN (and a count of 0).
+def aggregate_groups(groups, group_count, samples, aggregation):
+    valid = ~np.isnan(samples)
+    counts = np.stack([np.bincount(groups, weights=valid[:, column], minlength=group_count)
+                       for column in range(samples.shape[1])], axis=1)
+    if aggregation == "count":
+        return counts
+
+    with np.errstate(invalid="ignore", divide="ignore"):
+        zeroed = np.where(valid, samples, 0.0)
+        sums = np.stack([np.bincount(groups, weights=zeroed[:, column], minlength=group_count)
+                         for column in range(samples.shape[1])], axis=1)
+        means = sums / counts
+        if aggregation == "mean":
+            return means
+
+        if aggregation == "std":
+            deviations = np.where(valid, samples - means[groups], 0.0) ** 2
+            squares = np.stack([np.bincount(groups, weights=deviations[:, column], minlength=group_count)
+                                for column in range(samples.shape[1])], axis=1)
+            # Sample standard deviation, as pandas computes it
+            return np.where(counts > 1, np.sqrt(squares / (counts - 1)), np.nan)
+
+    # Median: sort each column by group, then by value, and take the middle of each group
+    medians = np.full((group_count, samples.shape[1]), np.nan)
+    for column in range(samples.shape[1]):
+        rows = np.flatnonzero(valid[:, column])
+        order = np.lexsort((samples[rows, column], groups[rows]))
+        ordered = samples[rows[order], column]
+        column_counts = counts[:, column].astype(np.int64)
+        starts = np.cumsum(column_counts) - column_counts
+        present = column_counts > 0
+        lower = starts[present] + (column_counts[present] - 1) // 2
+        upper = starts[present] + column_counts[present] // 2
+        medians[present, column] = (ordered[lower] + ordered[upper]) / 2
+    return medians
+
+def create_combined_dictionary(grapheme_map, user_info, aggregations=("mean",)):
+    for aggregation in aggregations:
+        if aggregation not in AGGREGATIONS:
+            raise ValueError(f"[create_combined_dictionary] Unknown aggregation \"{aggregation}\". Use one of {AGGREGATIONS}.")
+
+    # One row per grapheme occurrence, one column per statistic. Negative values are the -1
+    # padding for the statistics that are one value short, so they are left out.
+    samples = np.array([grapheme_map[column] for column in GRAPHEME_COLUMNS], dtype=np.float64).T
+    samples[samples < 0] = np.nan
+
+    # Number the graphemes in the order they were first typed in, so columns are added to the
+    # master dictionary in the same order as before. A grapheme typed several times in a
+    # session gets the aggregate of all of its samples instead of only the last one.
+    unique_graphemes, first_seen, inverse = np.unique(np.asarray(grapheme_map["grapheme"]), return_index=True, return_inverse=True)
+    typing_order = np.argsort(first_seen)
+    group_numbers = np.empty_like(typing_order)
+    group_numbers[typing_order] = np.arange(len(typing_order))
+    groups = group_numbers[inverse]
+    graphemes = unique_graphemes[typing_order].tolist()
+
+    # grapheme -> aggregation -> statistic
+    aggregates = np.stack([aggregate_groups(groups, len(graphemes), samples, aggregation)
+                           for aggregation in aggregations], axis=1)
+    # A statistic with no samples (or the std of a single sample) is -1, like missing values
+    aggregates = np.nan_to_num(aggregates, nan=-1)
+
+    suffixes = [column if aggregation == "mean" else f"{column}+{aggregation}"
+                for aggregation in aggregations for column in GRAPHEME_COLUMNS]
+    keys = [f"{grapheme}+{suffix}" for grapheme in graphemes for suffix in suffixes]
+
+    combined_dictionary = dict(zip(keys, aggregates.ravel().tolist()))
+    combined_dictionary["user"] = user_info["user"]
 
-    # Initialize an empty dictionary
-    combined_dictionary = {}
+    return combined_dictionary
 
-    # Iterate over the rows and create the keys by combining 'grapheme' with the column names
-    for idx, row in df.iterrows():
-        grapheme = row['grapheme']
-        for column in ['time_delta', 'dwell_time', 'flight_time']:
-            key = f"{grapheme}+{column}"
-            combined_dictionary[key] = row[column]
+# Reducer for feature rows built independently (one combined dictionary per session). Returns
+# the same columns update_master_dictionary would build from the rows in this order: every key
+# in the order it first appears, with -1 wherever a row does not have it.
+def merge_feature_rows(feature_rows):
+    row_count = len(feature_rows)
+    merged = {}
 
-    combined_dictionary["user"] = user_info["user"]
+    # Most rows only have a fraction of the graphemes, so only the values they do have are set
+    for index, row in enumerate(feature_rows):
+        for key, value in row.items():
+            column = merged.get(key)
+            if column is None:
+                column = merged[key] = [-1] * row_count
+            column[index] = value
 
-    return combined_dictionary
+    return merged
 
-def write_to_csv():
+def write_to_csv(dictionary=None):
     global master_dictionary
+    # Write the global master dictionary unless one is given
+    if dictionary is None:
+        dictionary = master_dictionary
+
     # File path where you want to save the CSV
     csv_file_path = "master_dict_output.csv"
 
@@ -101,17 +182,17 @@ def write_to_csv():
         # Set paramaters for csv writer
         writer = csv.writer(file, delimiter=delimiter, quotechar=quotechar, quoting=csv.QUOTE_ALL)
 
-       # Write the header (keys from master_dictionary)
-        headers = list(master_dictionary.keys())
+       # Write the header (keys from dictionary)
+        headers = list(dictionary.keys())
         headers.remove("user")  # Remove the "user" key from the header list
         headers = ["SequenceNumber", "User"] + headers  # Add "user" as the second column
         writer.writerow(headers)
         
         # Extract the user data separately
-        user_data = master_dictionary["user"]
+        user_data = dictionary["user"]
 
         # Transpose the other values to create rows
-        rows = zip(*[v for k, v in master_dictionary.items() if k != "user"])
+        rows = zip(*[v for k, v in dictionary.items() if k != "user"])
 
         # Write rows of the data
         for count, row in enumerate(rows, 1):
@@ -0,0 +1,207 @@
+import ctypes
+import json
+import os
+import numpy as np
+
+# Scoring with the neural network neural_net.py trains, without TensorFlow. export_mlp writes
+# the scaler and the weights of a trained Keras model to a flat file, laid out as described in
+# native/libmlp.h, which native/libmlp (build it with native/build) maps and scores with SIMD
+# kernels. load_mlp opens such a file; without the native library it scores with NumPy.
+NATIVE_LIBRARY_PATH = os.path.join(os.path.dirname(os.path.abspath(__file__)), "native", "libmlp.so")
+MLP_MAGIC = b"AK24MLP1"
+ALIGNMENT = 64
+VECTOR_WIDTH = 16
+MAX_LAYERS = 16
+DEFAULT_BATCH_ROWS = 64
+
+# Activation names as Keras gives them, and their number in the file
+ACTIVATIONS = {"linear": 0, "relu": 1, "sigmoid": 2, "tanh": 3, "softmax": 4}
+
+HEADER = np.dtype([("magic", "S8"), ("layer_count", "<i4"), ("input_features", "<i4"),
+                   ("labels_offset", "<i8"), ("labels_length", "<i8"),
+                   ("mean_offset", "<i8"), ("scale_offset", "<i8")])
+LAYER = np.dtype([("inputs", "<i4"), ("outputs", "<i4"), ("input_stride", "<i4"), ("activation", "<i4"),
+                  ("weights_offset", "<i8"), ("bias_offset", "<i8")])
+
+def _padded(count, multiple):
+    return (count + multiple - 1) // multiple * multiple
+
+# Writes layers, a list of (kernel[inputs, outputs], bias[outputs], activation name) as Keras
+# stores them, with the scaler's mean and scale and the label of each output. Returns True, or
+# False if the layers do not fit together.
+def write_mlp(path, layers, mean, scale, labels):
+    if not 1 <= len(layers) <= MAX_LAYERS:
+        print(f"[write_mlp] A model needs 1 to {MAX_LAYERS} layers, not {len(layers)}.")
+        return False
+    inputs = len(mean)
+    for number, (kernel, bias, activation) in enumerate(layers):
+        if activation not in ACTIVATIONS or np.shape(kernel) != (inputs, len(bias)):
+            print(f"[write_mlp] Layer {number} ({activation}, {np.shape(kernel)}) does not take {inputs} inputs or has an unsupported activation.")
+            return False
+        inputs = len(bias)
+    if inputs != len(labels):
+        print(f"[write_mlp] The last layer has {inputs} outputs but there are {len(labels)} labels.")
+        return False
+
+    # Sections are placed one after the other, each on an ALIGNMENT boundary
+    sections = []
+    position = _padded(HEADER.itemsize + len(layers) * LAYER.itemsize, ALIGNMENT)
+    def place(data):
+        nonlocal position
+        offset = position
+        sections.append((offset, data))
+        position = _padded(offset + len(data), ALIGNMENT)
+        return offset
+
+    header = np.zeros(1, dtype=HEADER)
+    table = np.zeros(len(layers), dtype=LAYER)
+    label_bytes = json.dumps(np.asarray(labels).tolist()).encode("utf-8")
+    header["magic"] = MLP_MAGIC
+    header["layer_count"] = len(layers)
+    header["input_features"] = len(mean)
+    header["labels_offset"] = place(label_bytes)
+    header["labels_length"] = len(label_bytes)
+    header["mean_offset"] = place(np.asarray(mean, dtype="<f4").tobytes())
+    header["scale_offset"] = place(np.asarray(scale, dtype="<f4").tobytes())
+
+    for number, (kernel, bias, activation) in enumerate(layers):
+        kernel = np.asarray(kernel, dtype=np.float32)
+        # One row per output neuron, padded with zeros to a whole number of vectors
+        stride = _padded(kernel.shape[0], VECTOR_WIDTH)
+        weights = np.zeros((kernel.shape[1], stride), dtype="<f4")
+        weights[:, :kernel.shape[0]] = kernel.T
+        table[number] = (kernel.shape[0], kernel.shape[1], stride, ACTIVATIONS[activation],
+                         place(weights.tobytes()), place(np.asarray(bias, dtype="<f4").tobytes()))
+
+    with open(path, "wb") as file:
+        file.write(header.tobytes())
+        file.write(table.tobytes())
+        for offset, data in sections:
+            file.write(b"\0" * (offset - file.tell()))
+            file.write(data)
+    return True
+
+# Exports a trained Keras Sequential model of Dense layers, the StandardScaler its input was
+# scaled with and the label of each output (the OneHotEncoder's categories)
+def export_mlp(model, scaler, labels, path):
+    layers = []
+    for layer in model.layers:
+        weights = layer.get_weights()
+        if len(weights) == 0:
+            continue    # Input and other layers without weights
+        activation = layer.get_config().get("activation")
+        if len(weights) != 2 or not isinstance(activation, str):
+            print(f"[export_mlp] Layer {layer.name} is not a Dense layer with a bias and a named activation.")
+            return False
+        layers.append((weights[0], weights[1], activation))
+    return write_mlp(path, layers, scaler.mean_, scaler.scale_, labels)
+
+_library = None
+
+# Returns the native library, or None if it has not been built
+def load_native_library():
+    global _library
+    if _library is None:
+        if not os.path.exists(NATIVE_LIBRARY_PATH):
+            print(f"[load_native_library] {NATIVE_LIBRARY_PATH} was not found. Build it with native/build.")
+            return None
+        _library = ctypes.CDLL(NATIVE_LIBRARY_PATH)
+        _library.mlp_load.argtypes = [ctypes.c_char_p]
+        _library.mlp_load.restype = ctypes.c_void_p
+        _library.mlp_free.argtypes = [ctypes.c_void_p]
+        _library.mlp_free.restype = None
+        _library.mlp_create_workspace.argtypes = [ctypes.c_void_p, ctypes.c_size_t]
+        _library.mlp_create_workspace.restype = ctypes.c_void_p
+        _library.mlp_free_workspace.argtypes = [ctypes.c_void_p]
+        _library.mlp_free_workspace.restype = None
+        _library.mlp_score.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.POINTER(ctypes.c_double),
+                                       ctypes.c_size_t, ctypes.POINTER(ctypes.c_float)]
+        _library.mlp_score.restype = ctypes.c_int
+    return _library
+
+# A model opened from a file. It has one native workspace, so it scores on one thread at a time;
+# open the file once per thread (the weights are mapped, so they are still shared).
+class MLPModel:
+    def __init__(self, path, native=True):
+        self.path = path
+        self._library = None
+        self._model = None
+        self._workspace = None
+        mapping = np.memmap(path, dtype=np.uint8, mode="r")
+        header = np.frombuffer(mapping, dtype=HEADER, count=1)[0]
+        if header["magic"] != MLP_MAGIC:
+            raise ValueError(f"[MLPModel] {path} is not a model exported by export_mlp.")
+
+        def floats(offset, count):
+            return np.frombuffer(mapping, dtype="<f4", count=count, offset=int(offset))
+
+        features = int(header["input_features"])
+        self.labels = np.asarray(json.loads(bytes(mapping[header["labels_offset"]:header["labels_offset"] + header["labels_length"]])))
+        self.mean = floats(header["mean_offset"], features)
+        self.scale = floats(header["scale_offset"], features)
+        self.layers = []    # (weights[outputs, inputs], bias[outputs], activation number), views of the file
+        for layer in np.frombuffer(mapping, dtype=LAYER, count=int(header["layer_count"]), offset=HEADER.itemsize):
+            weights = floats(layer["weights_offset"], int(layer["outputs"]) * int(layer["input_stride"]))
+            weights = weights.reshape(int(layer["outputs"]), int(layer["input_stride"]))[:, :int(layer["inputs"])]
+            self.layers.append((weights, floats(layer["bias_offset"], int(layer["outputs"])), int(layer["activation"])))
+
+        self._library = load_native_library() if native else None
+        if self._library is not None:
+            self._model = self._library.mlp_load(os.fsencode(path))
+            self._workspace = self._library.mlp_create_workspace(self._model, DEFAULT_BATCH_ROWS) if self._model else None
+            if not self._workspace:
+                print(f"[MLPModel] The native library could not load {path}. Scoring with NumPy.")
+                self.close()
+
+    @property
+    def native(self):
+        return self._workspace is not None
+
+    def close(self):
+        if self._library is not None:
+            if self._workspace:
+                self._library.mlp_free_workspace(self._workspace)
+            if self._model:
+                self._library.mlp_free(self._model)
+        self._workspace = None
+        self._model = None
+
+    def __del__(self):
+        self.close()
+
+    def _predict_proba_numpy(self, X):
+        values = ((X - self.mean) / self.scale).astype(np.float32)
+        for weights, bias, activation in self.layers:
+            values = values @ weights.T + bias
+            if activation == ACTIVATIONS["relu"]:
+                values = np.maximum(values, 0.0)
+            elif activation == ACTIVATIONS["sigmoid"]:
+                values = 1.0 / (1.0 + np.exp(-values))
+            elif activation == ACTIVATIONS["tanh"]:
+                values = np.tanh(values)
+            elif activation == ACTIVATIONS["softmax"]:
+                values = np.exp(values - values.max(axis=1, keepdims=True))
+                values /= values.sum(axis=1, keepdims=True)
+        return values
+
+    # Output of the last layer for each row of unscaled features (rows x classes)
+    def predict_proba(self, X):
+        X = np.ascontiguousarray(np.atleast_2d(np.asarray(X, dtype=np.float64)))
+        if X.shape[1] != len(self.mean):
+            raise ValueError(f"[predict_proba] The model takes {len(self.mean)} features, not {X.shape[1]}.")
+        if not self.native:
+            return self._predict_proba_numpy(X)
+
+        probabilities = np.empty((len(X), len(self.labels)), dtype=np.float32)
+        if self._library.mlp_score(self._model, self._workspace, X.ctypes.data_as(ctypes.POINTER(ctypes.c_double)),
+                                   len(X), probabilities.ctypes.data_as(ctypes.POINTER(ctypes.c_float))) != 0:
+            raise RuntimeError("[predict_proba] Native scoring failed.")
+        return probabilities
+
+    def predict(self, X):
+        return self.labels[np.argmax(self.predict_proba(X), axis=1)]
+
+# Opens a model written by export_mlp. With native=False, or if the native library is not
+# built, it is scored with NumPy.
+def load_mlp(path, native=True):
+    return MLPModel(path, native)
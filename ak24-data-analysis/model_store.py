@@ -0,0 +1,165 @@
+import os
+import numpy as np
+
+# A single versioned file holding the trained artifacts a scoring service needs, so it can start
+# without retraining: the scaler, the feature vocabulary, a template per user, the KNN training
+# set and the linear SVM's weights. Each is a named section, aligned so it can be used straight
+# out of a memory map; open_model_store here and native/libmodelstore (for C) open a store
+# without parsing or copying anything, and processes that open the same store share it through
+# the page cache. The layout is described in native/libmodelstore.h.
+#
+# Stores are written to a temporary file that is then renamed over the old one, so processes
+# that have the old store mapped keep reading it undisturbed.
+STORE_MAGIC = b"AK24MST1"
+STORE_VERSION = 1
+ALIGNMENT = 64
+NAME_LENGTH = 32
+
+TYPE_STRINGS = 0
+# Numeric section types and their dtypes
+TYPES = {1: np.dtype("<i4"), 2: np.dtype("<i8"), 3: np.dtype("<f4"), 4: np.dtype("<f8")}
+
+HEADER = np.dtype([("magic", "S8"), ("version", "<u4"), ("section_count", "<u4"),
+                   ("file_size", "<u8"), ("reserved", "<u8")])
+SECTION = np.dtype([("name", f"S{NAME_LENGTH}"), ("type", "<u4"), ("reserved", "<u4"), ("rows", "<i8"),
+                    ("columns", "<i8"), ("offset", "<i8"), ("length", "<i8")])
+
+def _padded(count, multiple):
+    return (count + multiple - 1) // multiple * multiple
+
+# Bytes and shape of a section: strings for a list of str, otherwise a 1 or 2 dimensional array
+def _encode_section(values):
+    if isinstance(values, (list, tuple)) and all(isinstance(value, str) for value in values):
+        encoded = [value.encode("utf-8") for value in values]
+        offsets = np.zeros(len(encoded) + 1, dtype="<i8")
+        np.cumsum([len(value) for value in encoded], out=offsets[1:])
+        return TYPE_STRINGS, len(encoded), 1, offsets.tobytes() + b"".join(encoded)
+
+    array = np.asarray(values)
+    if array.ndim not in (1, 2):
+        raise ValueError(f"[write_model_store] Sections are 1 or 2 dimensional, not {array.ndim}.")
+    for number, dtype in TYPES.items():
+        if array.dtype == dtype.newbyteorder("="):
+            rows, columns = array.shape if array.ndim == 2 else (len(array), 1)
+            return number, rows, columns, np.ascontiguousarray(array, dtype=dtype).tobytes()
+    raise ValueError(f"[write_model_store] Sections of type {array.dtype} are not supported.")
+
+# Writes sections, a dict of name -> list of str or a NumPy array (int32, int64, float32 or
+# float64, 1 or 2 dimensional), to path
+def write_model_store(path, sections):
+    table = np.zeros(len(sections), dtype=SECTION)
+    data = []
+    position = _padded(HEADER.itemsize + len(sections) * SECTION.itemsize, ALIGNMENT)
+    for index, (name, values) in enumerate(sections.items()):
+        encoded_name = name.encode("utf-8")
+        if len(encoded_name) >= NAME_LENGTH:
+            raise ValueError(f"[write_model_store] Section names are shorter than {NAME_LENGTH} bytes: {name}")
+        section_type, rows, columns, payload = _encode_section(values)
+        table[index] = (encoded_name, section_type, 0, rows, columns, position, len(payload))
+        data.append((position, payload))
+        position = _padded(position + len(payload), ALIGNMENT)
+
+    header = np.zeros(1, dtype=HEADER)
+    header["magic"] = STORE_MAGIC
+    header["version"] = STORE_VERSION
+    header["section_count"] = len(sections)
+    header["file_size"] = data[-1][0] + len(data[-1][1]) if data else HEADER.itemsize
+
+    temporary_path = f"{path}.{os.getpid()}.tmp"
+    with open(temporary_path, "wb") as file:
+        file.write(header.tobytes())
+        file.write(table.tobytes())
+        for offset, payload in data:
+            file.write(b"\0" * (offset - file.tell()))
+            file.write(payload)
+        # The data has to be on disk before the rename is, or a crash can leave an empty or
+        # partial store under the real name
+        file.flush()
+        os.fsync(file.fileno())
+    os.replace(temporary_path, path)
+    directory = os.open(os.path.dirname(os.path.abspath(path)), os.O_RDONLY)
+    try:
+        os.fsync(directory)
+    finally:
+        os.close(directory)
+
+class ModelStore:
+    def __init__(self, path):
+        self.path = path
+        self._mapping = np.memmap(path, dtype=np.uint8, mode="r")
+        if len(self._mapping) < HEADER.itemsize:
+            raise ValueError(f"[open_model_store] {path} is too small to be a model store.")
+        header = np.frombuffer(self._mapping, dtype=HEADER, count=1)[0]
+        if header["magic"] != STORE_MAGIC:
+            raise ValueError(f"[open_model_store] {path} is not a model store.")
+        if header["version"] != STORE_VERSION:
+            raise ValueError(f"[open_model_store] {path} is version {header['version']}, expected {STORE_VERSION}.")
+        if header["file_size"] != len(self._mapping):
+            raise ValueError(f"[open_model_store] {path} is {len(self._mapping)} bytes, but its header says {header['file_size']}.")
+        self.sections = {section["name"].decode("utf-8"): section for section in
+                         np.frombuffer(self._mapping, dtype=SECTION, count=int(header["section_count"]), offset=HEADER.itemsize)}
+
+    def __contains__(self, name):
+        return name in self.sections
+
+    def names(self):
+        return list(self.sections)
+
+    # A numeric section as a read-only array backed by the file
+    def array(self, name):
+        section = self.sections[name]
+        if int(section["type"]) not in TYPES:
+            raise ValueError(f"[array] Section {name} is not numeric.")
+        dtype = TYPES[int(section["type"])]
+        values = np.frombuffer(self._mapping, dtype=dtype, count=int(section["rows"] * section["columns"]), offset=int(section["offset"]))
+        return values.reshape(int(section["rows"]), int(section["columns"])) if section["columns"] != 1 else values
+
+    # A strings section as a list of str
+    def strings(self, name):
+        section = self.sections[name]
+        if int(section["type"]) != TYPE_STRINGS:
+            raise ValueError(f"[strings] Section {name} is not strings.")
+        rows, offset = int(section["rows"]), int(section["offset"])
+        offsets = np.frombuffer(self._mapping, dtype="<i8", count=rows + 1, offset=offset)
+        text = bytes(self._mapping[offset + offsets.nbytes:offset + int(section["length"])])
+        return [text[offsets[i]:offsets[i + 1]].decode("utf-8") for i in range(rows)]
+
+def open_model_store(path):
+    return ModelStore(path)
+
+# Builds the store main.py saves from the features X (DataFrame), their users y and the extraction
+# settings they were made with. The scaler standardizes like StandardScaler; the template of a
+# user is the mean of their standardized sessions; the KNN training set is every standardized
+# session with the index of its user. svm_model (a LinearSVMModel) adds the SVM's sections.
+def save_model_store(path, X, y, settings, svm_model=None):
+    features = [str(column) for column in X.columns]
+    X = np.asarray(X, dtype=np.float64)
+    users, user_indices = np.unique(np.asarray(y).astype(str), return_inverse=True)
+
+    mean = X.mean(axis=0)
+    deviations = X.std(axis=0)
+    scale = np.where(deviations > 0, deviations, 1.0)
+    scaled = ((X - mean) / scale).astype(np.float32)
+
+    session_counts = np.bincount(user_indices, minlength=len(users))
+    templates = np.zeros((len(users), len(features)), dtype=np.float64)
+    np.add.at(templates, user_indices, scaled)
+    templates /= np.maximum(session_counts, 1)[:, np.newaxis]
+
+    sections = {
+        "settings": [settings],
+        "features": features,
+        "users": list(users),
+        "scaler.mean": mean,
+        "scaler.scale": scale,
+        "templates": templates.astype(np.float32),
+        "templates.sessions": session_counts.astype(np.int32),
+        "knn.samples": scaled,
+        "knn.users": user_indices.astype(np.int32),
+    }
+    if svm_model is not None:
+        sections["svm.users"] = [str(label) for label in svm_model.labels]
+        sections["svm.mean"] = np.asarray(svm_model.mean, dtype=np.float64)
+        sections["svm.scale"] = np.asarray(svm_model.scale, dtype=np.float64)
+        sections["svm.weights"] = np.asarray(svm_model.weights, dtype=np.float32)
+    write_model_store(path, sections)
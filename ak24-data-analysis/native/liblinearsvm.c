@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "liblinearsvm.h"
+
+void linear_svm_default_parameters(struct linear_svm_parameters *parameters) {
+	parameters->C = LINEAR_SVM_DEFAULT_C;
+	parameters->epsilon = LINEAR_SVM_DEFAULT_EPSILON;
+	parameters->max_iterations = LINEAR_SVM_DEFAULT_MAX_ITERATIONS;
+	parameters->bias = LINEAR_SVM_DEFAULT_BIAS;
+	parameters->loss = LINEAR_SVM_SQUARED_HINGE;
+	parameters->threads = 0;
+	parameters->seed = 1;
+}
+
+// xorshift64*, one per class so the visiting order does not depend on thread scheduling
+static uint64_t next_random(uint64_t *state) {
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static double sparse_dot(const struct linear_svm_problem *problem, size_t row, const double *w, double bias) {
+	double sum = bias * w[problem->features];
+	for(int64_t j = problem->row_offsets[row]; j < problem->row_offsets[row + 1]; j++)
+		sum += w[problem->columns[j]] * problem->values[j];
+	return sum;
+}
+
+static void sparse_add(const struct linear_svm_problem *problem, size_t row, double *w, double bias, double scale) {
+	for(int64_t j = problem->row_offsets[row]; j < problem->row_offsets[row + 1]; j++)
+		w[problem->columns[j]] += scale * problem->values[j];
+	w[problem->features] += scale * bias;
+}
+
+// Scratch space for training one class, reused by a thread for every class it trains
+struct class_workspace {
+	double *alpha;
+	double *diagonal;	// x_i . x_i + D_ii
+	size_t *order;
+};
+
+// Trains class k against the rest. Returns the number of passes it took.
+static int train_class(const struct linear_svm_problem *problem, const struct linear_svm_parameters *parameters, int32_t k, double *w, struct class_workspace *workspace) {
+	size_t rows = problem->rows;
+	double *alpha = workspace->alpha;
+	size_t *order = workspace->order;
+
+	// L2-loss: no upper bound on alpha, and 1/2C added to the diagonal. L1-loss: the reverse.
+	double upper_bound = parameters->loss == LINEAR_SVM_HINGE ? parameters->C : INFINITY;
+	double diagonal_shift = parameters->loss == LINEAR_SVM_HINGE ? 0.0 : 0.5 / parameters->C;
+
+	memset(w, 0, (problem->features + 1) * sizeof(double));
+	for(size_t i = 0; i < rows; i++) {
+		alpha[i] = 0.0;
+		order[i] = i;
+		workspace->diagonal[i] += diagonal_shift;
+	}
+
+	uint64_t random_state = parameters->seed * 0x9E3779B97F4A7C15ULL + (uint64_t) k + 1;
+	int iteration;
+	for(iteration = 0; iteration < parameters->max_iterations; iteration++) {
+		// Visit the rows in a new random order every pass
+		for(size_t i = rows; i > 1; i--) {
+			size_t j = next_random(&random_state) % i;
+			size_t swap = order[i - 1];
+			order[i - 1] = order[j];
+			order[j] = swap;
+		}
+
+		double largest_gradient = -INFINITY;
+		double smallest_gradient = INFINITY;
+		for(size_t position = 0; position < rows; position++) {
+			size_t i = order[position];
+			double y = problem->labels[i] == k ? 1.0 : -1.0;
+			double gradient = y * sparse_dot(problem, i, w, parameters->bias) - 1.0 + diagonal_shift * alpha[i];
+
+			// Projected gradient: 0 where alpha is at a bound and the gradient points past it
+			double projected = gradient;
+			if(alpha[i] == 0.0 && gradient > 0.0)
+				projected = 0.0;
+			else if(alpha[i] == upper_bound && gradient < 0.0)
+				projected = 0.0;
+			if(projected > largest_gradient) largest_gradient = projected;
+			if(projected < smallest_gradient) smallest_gradient = projected;
+
+			if(fabs(projected) > 1e-12 && workspace->diagonal[i] > 0.0) {
+				double previous = alpha[i];
+				double updated = previous - gradient / workspace->diagonal[i];
+				alpha[i] = updated < 0.0 ? 0.0 : (updated > upper_bound ? upper_bound : updated);
+				sparse_add(problem, i, w, parameters->bias, (alpha[i] - previous) * y);
+			}
+		}
+
+		if(largest_gradient - smallest_gradient < parameters->epsilon)
+			break;
+	}
+
+	for(size_t i = 0; i < rows; i++)
+		workspace->diagonal[i] -= diagonal_shift;
+
+	// The bias was learned as the weight of a constant feature of value bias
+	w[problem->features] *= parameters->bias;
+	return iteration + 1;
+}
+
+struct training_jobs {
+	const struct linear_svm_problem *problem;
+	const struct linear_svm_parameters *parameters;
+	double *weights;
+	int32_t *iterations;
+	const double *squared_norms;
+	atomic_int next;	// The next class to train. A class taken from here is always trained.
+};
+
+static void *train_classes(void *argument) {
+	struct training_jobs *jobs = argument;
+	const struct linear_svm_problem *problem = jobs->problem;
+
+	size_t rows = problem->rows > 0 ? problem->rows : 1;
+	struct class_workspace workspace;
+	workspace.alpha = malloc(rows * sizeof(double));
+	workspace.diagonal = malloc(rows * sizeof(double));
+	workspace.order = malloc(rows * sizeof(size_t));
+	// Without a workspace this thread trains nothing and leaves its classes to the others
+	if(workspace.alpha == NULL || workspace.diagonal == NULL || workspace.order == NULL)
+		fprintf(stderr, "[train_classes] Not enough memory for the workspace of %zu rows.\n", problem->rows);
+	else {
+		memcpy(workspace.diagonal, jobs->squared_norms, problem->rows * sizeof(double));
+		for(int32_t k = atomic_fetch_add(&jobs->next, 1); k < problem->classes; k = atomic_fetch_add(&jobs->next, 1)) {
+			int passes = train_class(problem, jobs->parameters, k, jobs->weights + (size_t) k * (problem->features + 1), &workspace);
+			if(jobs->iterations != NULL)
+				jobs->iterations[k] = passes;
+		}
+	}
+
+	free(workspace.alpha);
+	free(workspace.diagonal);
+	free(workspace.order);
+	return NULL;
+}
+
+// Trains every class. weights must hold classes * (features + 1) doubles; iterations (which may be
+// NULL) gets the number of passes each class took. Returns 0, or -1 on error.
+int linear_svm_train(const struct linear_svm_problem *problem, const struct linear_svm_parameters *parameters, double *weights, int32_t *iterations) {
+	if(problem->classes < 1 || parameters->C <= 0.0 || parameters->max_iterations < 1) {
+		fprintf(stderr, "[linear_svm_train] Need at least one class, a positive C and at least one iteration.\n");
+		return -1;
+	}
+	for(size_t i = 0; i < problem->rows; i++) {
+		if(problem->labels[i] < 0 || problem->labels[i] >= problem->classes) {
+			fprintf(stderr, "[linear_svm_train] Row %zu has label %d, outside 0 .. %d.\n", i, problem->labels[i], problem->classes - 1);
+			return -1;
+		}
+	}
+	for(int64_t j = 0; j < problem->row_offsets[problem->rows]; j++) {
+		if(problem->columns[j] < 0 || (size_t) problem->columns[j] >= problem->features) {
+			fprintf(stderr, "[linear_svm_train] Column %d is outside 0 .. %zu.\n", problem->columns[j], problem->features - 1);
+			return -1;
+		}
+	}
+
+	// x_i . x_i (with the bias feature) is the same for every class, so it is computed once
+	double *squared_norms = malloc((problem->rows > 0 ? problem->rows : 1) * sizeof(double));
+	if(squared_norms == NULL) {
+		fprintf(stderr, "[linear_svm_train] Not enough memory for %zu rows.\n", problem->rows);
+		return -1;
+	}
+	for(size_t i = 0; i < problem->rows; i++) {
+		double sum = parameters->bias * parameters->bias;
+		for(int64_t j = problem->row_offsets[i]; j < problem->row_offsets[i + 1]; j++)
+			sum += problem->values[j] * problem->values[j];
+		squared_norms[i] = sum;
+	}
+
+	int threads = parameters->threads;
+	if(threads <= 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cpus > 0 ? (int) cpus : 1;
+	}
+	if(threads > problem->classes)
+		threads = problem->classes;
+
+	struct training_jobs jobs = {
+		.problem = problem,
+		.parameters = parameters,
+		.weights = weights,
+		.iterations = iterations,
+		.squared_norms = squared_norms
+	};
+	atomic_init(&jobs.next, 0);
+
+	// The calling thread trains classes too
+	pthread_t *workers = malloc((size_t) threads * sizeof(pthread_t));
+	int started = 0;
+	if(workers != NULL) {
+		for(; started < threads - 1; started++) {
+			int error = pthread_create(&workers[started], NULL, train_classes, &jobs);
+			if(error != 0) {
+				fprintf(stderr, "[linear_svm_train] Could not start a training thread: %s. Continuing with %d.\n", strerror(error), started + 1);
+				break;
+			}
+		}
+	}
+	train_classes(&jobs);
+	for(int i = 0; i < started; i++)
+		pthread_join(workers[i], NULL);
+
+	free(workers);
+	free(squared_norms);
+
+	// Only fails if no thread could train the classes that were left
+	if(atomic_load(&jobs.next) < problem->classes) {
+		fprintf(stderr, "[linear_svm_train] Only %d of %d classes were trained.\n", atomic_load(&jobs.next), problem->classes);
+		return -1;
+	}
+	return 0;
+}
+
+// decision_values[i * classes + k] = w_k . x_i + b_k
+void linear_svm_decision_values(const struct linear_svm_problem *problem, const double *weights, double *decision_values) {
+	for(size_t i = 0; i < problem->rows; i++) {
+		for(int32_t k = 0; k < problem->classes; k++) {
+			const double *w = weights + (size_t) k * (problem->features + 1);
+			decision_values[i * problem->classes + k] = sparse_dot(problem, i, w, 1.0);
+		}
+	}
+}
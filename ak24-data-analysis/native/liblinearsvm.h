@@ -0,0 +1,54 @@
+#include <stddef.h>
+#include <stdint.h>
+#ifndef LIBLINEARSVM_H
+#define LIBLINEARSVM_H
+
+/*
+ * One-vs-all linear SVM trainer. Each class gets a binary L2-regularized SVM (its sessions
+ * against everyone else's), trained by dual coordinate descent (Hsieh et al., "A Dual
+ * Coordinate Descent Method for Large-scale Linear SVM", the method LIBLINEAR uses). A pass
+ * over the data costs one sparse dot product and one sparse update per row, so training is
+ * linear in the number of stored values, and the classes are trained in parallel, one per
+ * thread, since they share nothing but the (read-only) data.
+ *
+ * Rows are given in CSR form: the features of row i are columns[row_offsets[i] ..
+ * row_offsets[i + 1]) with the matching values. Features that are not stored are 0, which
+ * for standardized grapheme features means "missing" (most of them are).
+ *
+ * The weights of class k are weights[k * (features + 1) .. (k + 1) * (features + 1)), the last
+ * one being the bias. The decision value of a row x for class k is w_k . x + b_k.
+ */
+#define LINEAR_SVM_DEFAULT_C 1.0
+#define LINEAR_SVM_DEFAULT_EPSILON 0.1		// stop once the projected gradients span less than this
+#define LINEAR_SVM_DEFAULT_MAX_ITERATIONS 1000	// passes over the data, per class
+#define LINEAR_SVM_DEFAULT_BIAS 1.0		// value of the constant feature the bias is learned on
+
+enum linear_svm_loss {	LINEAR_SVM_SQUARED_HINGE = 0,	// L2-loss, LIBLINEAR's default
+			LINEAR_SVM_HINGE = 1		// L1-loss, the standard SVM
+		};
+
+struct linear_svm_problem {
+	size_t rows;
+	size_t features;
+	const int64_t *row_offsets;	// rows + 1 of them
+	const int32_t *columns;
+	const double *values;
+	const int32_t *labels;		// class of each row, 0 .. classes - 1
+	int32_t classes;
+};
+
+struct linear_svm_parameters {
+	double C;
+	double epsilon;
+	int max_iterations;
+	double bias;			// 0 trains without a bias
+	enum linear_svm_loss loss;
+	int threads;			// 0 uses one per class, up to the number of CPUs
+	uint64_t seed;			// for the order rows are visited in, so runs repeat exactly
+};
+
+void linear_svm_default_parameters(struct linear_svm_parameters *parameters);
+int linear_svm_train(const struct linear_svm_problem *problem, const struct linear_svm_parameters *parameters, double *weights, int32_t *iterations);
+void linear_svm_decision_values(const struct linear_svm_problem *problem, const double *weights, double *decision_values);
+
+#endif
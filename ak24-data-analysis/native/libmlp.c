@@ -0,0 +1,290 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "libmlp.h"
+
+// MLP_VECTOR_WIDTH floats. GCC turns arithmetic on these into whatever SIMD instructions the
+// target has: one AVX-512 instruction, two AVX ones, four SSE or NEON ones.
+typedef float mlp_vector __attribute__((vector_size(MLP_VECTOR_WIDTH * sizeof(float))));
+
+#define ROWS_PER_BLOCK 4	// rows multiplied by each weight row while it is in registers
+
+static size_t padded(size_t count, size_t multiple) {
+	return (count + multiple - 1) / multiple * multiple;
+}
+
+// Whether [offset, offset + length) lies within the file and offset is aligned
+static int valid_section(const struct mlp_model *model, int64_t offset, int64_t length) {
+	return offset >= 0 && length >= 0 && offset % MLP_ALIGNMENT == 0 && (uint64_t) offset + (uint64_t) length <= model->mapping_size;
+}
+
+struct mlp_model *mlp_load(const char *path) {
+	int fd = open(path, O_RDONLY);
+	if(fd == -1) {
+		fprintf(stderr, "[mlp_load] Could not open %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+	struct stat status;
+	if(fstat(fd, &status) == -1 || (size_t) status.st_size < sizeof(struct mlp_file_header)) {
+		fprintf(stderr, "[mlp_load] %s is too small to be a model.\n", path);
+		close(fd);
+		return NULL;
+	}
+	void *mapping = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(mapping == MAP_FAILED) {
+		fprintf(stderr, "[mlp_load] Could not map %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+
+	struct mlp_model *model = calloc(1, sizeof(struct mlp_model));
+	if(model == NULL) {
+		fprintf(stderr, "[mlp_load] Not enough memory for the model.\n");
+		munmap(mapping, status.st_size);
+		return NULL;
+	}
+	model->mapping = mapping;
+	model->mapping_size = status.st_size;
+
+	const char *base = mapping;
+	const struct mlp_file_header *header = mapping;
+	if(memcmp(header->magic, MLP_MAGIC, sizeof(header->magic)) != 0) {
+		fprintf(stderr, "[mlp_load] %s is not a model exported by mlp_inference.\n", path);
+		goto invalid;
+	}
+	if(header->layer_count < 1 || header->layer_count > MLP_MAX_LAYERS || header->input_features < 1 ||
+	   sizeof(struct mlp_file_header) + header->layer_count * sizeof(struct mlp_file_layer) > model->mapping_size) {
+		fprintf(stderr, "[mlp_load] %s has %d layers and %d features, expected 1 .. %d layers and at least 1 feature.\n", path, header->layer_count, header->input_features, MLP_MAX_LAYERS);
+		goto invalid;
+	}
+	model->layer_count = header->layer_count;
+	model->input_features = header->input_features;
+
+	int64_t scaler_size = (int64_t) header->input_features * sizeof(float);
+	if(!valid_section(model, header->labels_offset, header->labels_length) || !valid_section(model, header->mean_offset, scaler_size) || !valid_section(model, header->scale_offset, scaler_size)) {
+		fprintf(stderr, "[mlp_load] The labels or scaler of %s lie outside the file.\n", path);
+		goto invalid;
+	}
+	model->labels = base + header->labels_offset;
+	model->labels_length = header->labels_length;
+	model->mean = (const float *) (base + header->mean_offset);
+	model->scale = (const float *) (base + header->scale_offset);
+
+	const struct mlp_file_layer *file_layers = (const struct mlp_file_layer *) (header + 1);
+	int32_t inputs = header->input_features;
+	for(int32_t l = 0; l < model->layer_count; l++) {
+		const struct mlp_file_layer *file_layer = &file_layers[l];
+		struct mlp_layer *layer = &model->layers[l];
+		if(file_layer->inputs != inputs || file_layer->outputs < 1 || file_layer->input_stride != (int32_t) padded(inputs, MLP_VECTOR_WIDTH) ||
+		   file_layer->activation < MLP_LINEAR || file_layer->activation > MLP_SOFTMAX) {
+			fprintf(stderr, "[mlp_load] Layer %d of %s does not fit the layer before it, or has an unknown activation.\n", l, path);
+			goto invalid;
+		}
+		if(!valid_section(model, file_layer->weights_offset, (int64_t) file_layer->outputs * file_layer->input_stride * sizeof(float)) ||
+		   !valid_section(model, file_layer->bias_offset, (int64_t) file_layer->outputs * sizeof(float))) {
+			fprintf(stderr, "[mlp_load] The weights of layer %d of %s lie outside the file.\n", l, path);
+			goto invalid;
+		}
+		layer->inputs = file_layer->inputs;
+		layer->outputs = file_layer->outputs;
+		layer->input_stride = file_layer->input_stride;
+		layer->output_stride = padded(file_layer->outputs, MLP_VECTOR_WIDTH);
+		layer->activation = file_layer->activation;
+		layer->weights = (const float *) (base + file_layer->weights_offset);
+		layer->bias = (const float *) (base + file_layer->bias_offset);
+		inputs = file_layer->outputs;
+	}
+	model->classes = inputs;
+	return model;
+
+invalid:
+	mlp_free(model);
+	return NULL;
+}
+
+void mlp_free(struct mlp_model *model) {
+	if(model == NULL)
+		return;
+	munmap(model->mapping, model->mapping_size);
+	free(model);
+}
+
+struct mlp_workspace *mlp_create_workspace(const struct mlp_model *model, size_t batch_rows) {
+	if(batch_rows == 0)
+		batch_rows = MLP_DEFAULT_BATCH_ROWS;
+	size_t stride = padded(model->input_features, MLP_VECTOR_WIDTH);
+	for(int32_t l = 0; l < model->layer_count; l++) {
+		if((size_t) model->layers[l].output_stride > stride)
+			stride = model->layers[l].output_stride;
+	}
+
+	struct mlp_workspace *workspace = malloc(sizeof(struct mlp_workspace));
+	if(workspace == NULL) {
+		fprintf(stderr, "[mlp_create_workspace] Not enough memory for the workspace.\n");
+		return NULL;
+	}
+	workspace->batch_rows = batch_rows;
+	workspace->stride = stride;
+	workspace->buffers[0] = aligned_alloc(MLP_ALIGNMENT, batch_rows * stride * sizeof(float));
+	workspace->buffers[1] = aligned_alloc(MLP_ALIGNMENT, batch_rows * stride * sizeof(float));
+	if(workspace->buffers[0] == NULL || workspace->buffers[1] == NULL) {
+		fprintf(stderr, "[mlp_create_workspace] Not enough memory for %zu rows of %zu values.\n", batch_rows, stride);
+		mlp_free_workspace(workspace);
+		return NULL;
+	}
+	return workspace;
+}
+
+void mlp_free_workspace(struct mlp_workspace *workspace) {
+	if(workspace == NULL)
+		return;
+	free(workspace->buffers[0]);
+	free(workspace->buffers[1]);
+	free(workspace);
+}
+
+static float horizontal_sum(mlp_vector v) {
+	float sum = 0.0f;
+	for(int k = 0; k < MLP_VECTOR_WIDTH; k++)
+		sum += v[k];
+	return sum;
+}
+
+// out[r][o] = weights[o] . in[r] + bias[o] for the rows of a batch, ROWS_PER_BLOCK rows by two
+// neurons at a time, so each vector loaded is used for several products
+static void multiply(const struct mlp_layer *layer, const float *in, float *out, size_t rows, size_t stride) {
+	size_t blocks = layer->input_stride / MLP_VECTOR_WIDTH;
+	int32_t o = 0;
+	for(; o + 2 <= layer->outputs; o += 2) {
+		const mlp_vector *w0 = (const mlp_vector *) (layer->weights + (size_t) o * layer->input_stride);
+		const mlp_vector *w1 = (const mlp_vector *) (layer->weights + (size_t) (o + 1) * layer->input_stride);
+		size_t r = 0;
+		for(; r + ROWS_PER_BLOCK <= rows; r += ROWS_PER_BLOCK) {
+			const mlp_vector *x0 = (const mlp_vector *) (in + r * stride);
+			const mlp_vector *x1 = (const mlp_vector *) (in + (r + 1) * stride);
+			const mlp_vector *x2 = (const mlp_vector *) (in + (r + 2) * stride);
+			const mlp_vector *x3 = (const mlp_vector *) (in + (r + 3) * stride);
+			mlp_vector a0 = {0}, a1 = {0}, a2 = {0}, a3 = {0}, b0 = {0}, b1 = {0}, b2 = {0}, b3 = {0};
+			for(size_t b = 0; b < blocks; b++) {
+				a0 += w0[b] * x0[b]; b0 += w1[b] * x0[b];
+				a1 += w0[b] * x1[b]; b1 += w1[b] * x1[b];
+				a2 += w0[b] * x2[b]; b2 += w1[b] * x2[b];
+				a3 += w0[b] * x3[b]; b3 += w1[b] * x3[b];
+			}
+			out[r * stride + o] = horizontal_sum(a0) + layer->bias[o];
+			out[(r + 1) * stride + o] = horizontal_sum(a1) + layer->bias[o];
+			out[(r + 2) * stride + o] = horizontal_sum(a2) + layer->bias[o];
+			out[(r + 3) * stride + o] = horizontal_sum(a3) + layer->bias[o];
+			out[r * stride + o + 1] = horizontal_sum(b0) + layer->bias[o + 1];
+			out[(r + 1) * stride + o + 1] = horizontal_sum(b1) + layer->bias[o + 1];
+			out[(r + 2) * stride + o + 1] = horizontal_sum(b2) + layer->bias[o + 1];
+			out[(r + 3) * stride + o + 1] = horizontal_sum(b3) + layer->bias[o + 1];
+		}
+		for(; r < rows; r++) {
+			const mlp_vector *x = (const mlp_vector *) (in + r * stride);
+			mlp_vector a = {0}, b = {0};
+			for(size_t k = 0; k < blocks; k++) {
+				a += w0[k] * x[k];
+				b += w1[k] * x[k];
+			}
+			out[r * stride + o] = horizontal_sum(a) + layer->bias[o];
+			out[r * stride + o + 1] = horizontal_sum(b) + layer->bias[o + 1];
+		}
+	}
+	for(; o < layer->outputs; o++) {
+		const mlp_vector *w = (const mlp_vector *) (layer->weights + (size_t) o * layer->input_stride);
+		for(size_t r = 0; r < rows; r++) {
+			const mlp_vector *x = (const mlp_vector *) (in + r * stride);
+			mlp_vector sum = {0};
+			for(size_t b = 0; b < blocks; b++)
+				sum += w[b] * x[b];
+			out[r * stride + o] = horizontal_sum(sum) + layer->bias[o];
+		}
+	}
+}
+
+static void activate(const struct mlp_layer *layer, float *values) {
+	int32_t n = layer->outputs;
+	switch(layer->activation) {
+		case MLP_LINEAR:
+			break;
+		case MLP_RELU:
+			for(int32_t o = 0; o < n; o++)
+				values[o] = values[o] > 0.0f ? values[o] : 0.0f;
+			break;
+		case MLP_SIGMOID:
+			for(int32_t o = 0; o < n; o++)
+				values[o] = 1.0f / (1.0f + expf(-values[o]));
+			break;
+		case MLP_TANH:
+			for(int32_t o = 0; o < n; o++)
+				values[o] = tanhf(values[o]);
+			break;
+		case MLP_SOFTMAX: {
+			float largest = values[0];
+			for(int32_t o = 1; o < n; o++)
+				largest = values[o] > largest ? values[o] : largest;
+			float sum = 0.0f;
+			for(int32_t o = 0; o < n; o++) {
+				values[o] = expf(values[o] - largest);
+				sum += values[o];
+			}
+			for(int32_t o = 0; o < n; o++)
+				values[o] /= sum;
+			break;
+		}
+	}
+	// The padding is multiplied by the next layer's (zero) padding weights, so it must not be NaN
+	memset(values + n, 0, (layer->output_stride - n) * sizeof(float));
+}
+
+// Scores rows of unscaled features (rows x input_features). probabilities gets rows x classes
+// values, the output of the last layer. Returns 0, or -1 if the workspace is not for this model.
+int mlp_score(const struct mlp_model *model, struct mlp_workspace *workspace, const double *features, size_t rows, float *probabilities) {
+	size_t stride = workspace->stride;
+	if(stride < padded(model->input_features, MLP_VECTOR_WIDTH)) {
+		fprintf(stderr, "[mlp_score] The workspace was created for a smaller model.\n");
+		return -1;
+	}
+	for(int32_t l = 0; l < model->layer_count; l++) {
+		if((size_t) model->layers[l].output_stride > stride) {
+			fprintf(stderr, "[mlp_score] The workspace was created for a smaller model.\n");
+			return -1;
+		}
+	}
+
+	size_t input_stride = padded(model->input_features, MLP_VECTOR_WIDTH);
+	for(size_t start = 0; start < rows; start += workspace->batch_rows) {
+		size_t batch = rows - start < workspace->batch_rows ? rows - start : workspace->batch_rows;
+
+		float *in = workspace->buffers[0];
+		float *out = workspace->buffers[1];
+		for(size_t r = 0; r < batch; r++) {
+			const double *row = features + (start + r) * model->input_features;
+			float *scaled = in + r * stride;
+			for(int32_t i = 0; i < model->input_features; i++)
+				scaled[i] = ((float) row[i] - model->mean[i]) / model->scale[i];
+			memset(scaled + model->input_features, 0, (input_stride - model->input_features) * sizeof(float));
+		}
+
+		for(int32_t l = 0; l < model->layer_count; l++) {
+			const struct mlp_layer *layer = &model->layers[l];
+			multiply(layer, in, out, batch, stride);
+			for(size_t r = 0; r < batch; r++)
+				activate(layer, out + r * stride);
+			float *swap = in;
+			in = out;
+			out = swap;
+		}
+
+		for(size_t r = 0; r < batch; r++)
+			memcpy(probabilities + (start + r) * model->classes, in + r * stride, model->classes * sizeof(float));
+	}
+	return 0;
+}
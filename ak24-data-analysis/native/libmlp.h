@@ -0,0 +1,91 @@
+#include <stddef.h>
+#include <stdint.h>
+#ifndef LIBMLP_H
+#define LIBMLP_H
+
+/*
+ * Inference for the multilayer perceptron neural_net.py trains, without TensorFlow. The model
+ * is exported by mlp_inference.export_mlp to a flat file that mlp_load maps into memory as is:
+ * nothing is parsed or copied, so loading takes as long as an mmap and the weights are shared
+ * by every process scoring with the same file.
+ *
+ * File layout (little-endian, every section starts on a MLP_ALIGNMENT boundary, at the offset
+ * the header or its layer gives):
+ *     struct mlp_file_header, then struct mlp_file_layer[layer_count]
+ *     labels: labels_length bytes of JSON (the class of each output, for the Python side)
+ *     float mean[input_features] and float scale[input_features]	(the StandardScaler)
+ *     for each layer: float weights[outputs][input_stride] and float bias[outputs]
+ *
+ * The weights of a layer are stored one output neuron per row, each row padded with zeros to
+ * input_stride (a multiple of MLP_VECTOR_WIDTH floats), so a neuron is one aligned dot product
+ * with no remainder to handle.
+ */
+#define MLP_MAGIC "AK24MLP1"
+#define MLP_ALIGNMENT 64
+#define MLP_VECTOR_WIDTH 16		// floats per padded block (one AVX-512 register, two AVX ones)
+#define MLP_MAX_LAYERS 16
+#define MLP_DEFAULT_BATCH_ROWS 64	// rows a workspace scores at a time
+
+enum mlp_activation {	MLP_LINEAR = 0,
+			MLP_RELU = 1,
+			MLP_SIGMOID = 2,
+			MLP_TANH = 3,
+			MLP_SOFTMAX = 4
+		};
+
+struct mlp_file_header {
+	char magic[8];
+	int32_t layer_count;
+	int32_t input_features;
+	int64_t labels_offset;
+	int64_t labels_length;
+	int64_t mean_offset;
+	int64_t scale_offset;
+};
+
+struct mlp_file_layer {
+	int32_t inputs;
+	int32_t outputs;
+	int32_t input_stride;
+	int32_t activation;
+	int64_t weights_offset;
+	int64_t bias_offset;
+};
+
+struct mlp_layer {
+	int32_t inputs;
+	int32_t outputs;
+	int32_t input_stride;
+	int32_t output_stride;		// input_stride of the next layer
+	enum mlp_activation activation;
+	const float *weights;
+	const float *bias;
+};
+
+struct mlp_model {
+	void *mapping;
+	size_t mapping_size;
+	int32_t layer_count;
+	int32_t input_features;
+	int32_t classes;
+	const char *labels;		// not terminated; labels_length bytes
+	int64_t labels_length;
+	const float *mean;
+	const float *scale;
+	struct mlp_layer layers[MLP_MAX_LAYERS];
+};
+
+// Scratch space for scoring up to batch_rows rows at a time. One per thread.
+struct mlp_workspace {
+	size_t batch_rows;
+	size_t stride;			// floats per row of the buffers, the widest layer
+	float *buffers[2];		// activations go back and forth between the two
+};
+
+struct mlp_model *mlp_load(const char *path);
+void mlp_free(struct mlp_model *model);
+struct mlp_workspace *mlp_create_workspace(const struct mlp_model *model, size_t batch_rows);
+void mlp_free_workspace(struct mlp_workspace *workspace);
+int mlp_score(const struct mlp_model *model, struct mlp_workspace *workspace, const double *features, size_t rows, float *probabilities);
+
+#endif
@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "libmodelstore.h"
+
+static const size_t type_sizes[] = {
+	[MODEL_STORE_STRINGS] = 1,
+	[MODEL_STORE_INT32] = sizeof(int32_t),
+	[MODEL_STORE_INT64] = sizeof(int64_t),
+	[MODEL_STORE_FLOAT32] = sizeof(float),
+	[MODEL_STORE_FLOAT64] = sizeof(double)
+};
+
+// Checks that a section lies within the file, is aligned, is as long as its shape says and has
+// a terminated name. Returns 0, or -1 if it does not.
+static int check_section(const struct model_store_section *section, size_t file_size) {
+	if(memchr(section->name, '\0', MODEL_STORE_NAME_LENGTH) == NULL)
+		return -1;
+	if(section->type > MODEL_STORE_FLOAT64 || section->rows < 0 || section->columns < 0 || section->offset < 0 || section->length < 0)
+		return -1;
+	if(section->offset % MODEL_STORE_ALIGNMENT != 0 || (uint64_t) section->offset + (uint64_t) section->length > file_size)
+		return -1;
+	if(section->type == MODEL_STORE_STRINGS)
+		return (uint64_t) section->length >= ((uint64_t) section->rows + 1) * sizeof(int64_t) ? 0 : -1;
+	return (uint64_t) section->rows * (uint64_t) section->columns * type_sizes[section->type] == (uint64_t) section->length ? 0 : -1;
+}
+
+struct model_store *model_store_open(const char *path) {
+	int fd = open(path, O_RDONLY);
+	if(fd == -1) {
+		fprintf(stderr, "[model_store_open] Could not open %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+	struct stat status;
+	if(fstat(fd, &status) == -1 || (size_t) status.st_size < sizeof(struct model_store_file_header)) {
+		fprintf(stderr, "[model_store_open] %s is too small to be a model store.\n", path);
+		close(fd);
+		return NULL;
+	}
+	void *mapping = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(mapping == MAP_FAILED) {
+		fprintf(stderr, "[model_store_open] Could not map %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+
+	const struct model_store_file_header *header = mapping;
+	size_t size = status.st_size;
+	if(memcmp(header->magic, MODEL_STORE_MAGIC, sizeof(header->magic)) != 0) {
+		fprintf(stderr, "[model_store_open] %s is not a model store.\n", path);
+		munmap(mapping, size);
+		return NULL;
+	}
+	if(header->version != MODEL_STORE_VERSION) {
+		fprintf(stderr, "[model_store_open] %s is version %u, expected %d.\n", path, header->version, MODEL_STORE_VERSION);
+		munmap(mapping, size);
+		return NULL;
+	}
+	if(header->file_size != size || sizeof(struct model_store_file_header) + (uint64_t) header->section_count * sizeof(struct model_store_section) > size) {
+		fprintf(stderr, "[model_store_open] %s is %zu bytes, but its header says %lu. It may have been cut short.\n", path, size, (unsigned long) header->file_size);
+		munmap(mapping, size);
+		return NULL;
+	}
+
+	const struct model_store_section *sections = (const struct model_store_section *) (header + 1);
+	for(uint32_t i = 0; i < header->section_count; i++) {
+		if(check_section(&sections[i], size) == -1) {
+			fprintf(stderr, "[model_store_open] Section %u of %s is malformed.\n", i, path);
+			munmap(mapping, size);
+			return NULL;
+		}
+	}
+
+	struct model_store *store = malloc(sizeof(struct model_store));
+	if(store == NULL) {
+		fprintf(stderr, "[model_store_open] Not enough memory for the store.\n");
+		munmap(mapping, size);
+		return NULL;
+	}
+	store->mapping = mapping;
+	store->mapping_size = size;
+	store->section_count = header->section_count;
+	store->sections = sections;
+	return store;
+}
+
+void model_store_close(struct model_store *store) {
+	if(store == NULL)
+		return;
+	munmap(store->mapping, store->mapping_size);
+	free(store);
+}
+
+// Returns the section called name, or NULL if the store has none
+const struct model_store_section *model_store_find(const struct model_store *store, const char *name) {
+	for(uint32_t i = 0; i < store->section_count; i++) {
+		if(strncmp(store->sections[i].name, name, MODEL_STORE_NAME_LENGTH) == 0)
+			return &store->sections[i];
+	}
+	return NULL;
+}
+
+const void *model_store_data(const struct model_store *store, const struct model_store_section *section) {
+	return (const char *) store->mapping + section->offset;
+}
+
+// String index of a strings section, not terminated; its length goes in length. Returns NULL if
+// index is out of range or the string lies outside the section.
+const char *model_store_string(const struct model_store *store, const struct model_store_section *section, int64_t index, size_t *length) {
+	if(section->type != MODEL_STORE_STRINGS || index < 0 || index >= section->rows)
+		return NULL;
+	const int64_t *offsets = model_store_data(store, section);
+	const char *text = (const char *) (offsets + section->rows + 1);
+	int64_t text_length = section->length - (section->rows + 1) * (int64_t) sizeof(int64_t);
+	if(offsets[index] < 0 || offsets[index] > offsets[index + 1] || offsets[index + 1] > text_length)
+		return NULL;
+	*length = offsets[index + 1] - offsets[index];
+	return text + offsets[index];
+}
+
+// Index of the string equal to text in a strings section, or -1 if there is none
+int64_t model_store_string_index(const struct model_store *store, const struct model_store_section *section, const char *text) {
+	size_t text_length = strlen(text);
+	for(int64_t i = 0; i < section->rows; i++) {
+		size_t length;
+		const char *string = model_store_string(store, section, i, &length);
+		if(string != NULL && length == text_length && memcmp(string, text, length) == 0)
+			return i;
+	}
+	return -1;
+}
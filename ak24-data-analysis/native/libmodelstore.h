@@ -0,0 +1,69 @@
+#include <stddef.h>
+#include <stdint.h>
+#ifndef LIBMODELSTORE_H
+#define LIBMODELSTORE_H
+
+/*
+ * Reader for the model store model_store.py writes: one file holding every trained artifact a
+ * scoring service needs (scaler, feature vocabulary, per-user templates, classifier weights),
+ * as named sections that are used straight out of a read-only shared mapping. Opening a store
+ * is an mmap and a check of the section table, and every process that opens the same file
+ * shares one copy of it in the page cache.
+ *
+ * File layout (little-endian):
+ *     struct model_store_file_header
+ *     struct model_store_section[section_count]
+ *     the data of each section, starting on a MODEL_STORE_ALIGNMENT boundary
+ *
+ * A numeric section is a rows x columns array, row-major. A strings section holds rows
+ * strings: int64 offsets[rows + 1] (relative to the first string), then the UTF-8 text of
+ * every string, one after the other; string i is text[offsets[i] .. offsets[i + 1]).
+ *
+ * Stores are replaced, never modified in place (model_store.py renames a new file over the
+ * old one), so a process keeps a consistent store for as long as it has it open.
+ */
+#define MODEL_STORE_MAGIC "AK24MST1"
+#define MODEL_STORE_VERSION 1
+#define MODEL_STORE_ALIGNMENT 64
+#define MODEL_STORE_NAME_LENGTH 32
+
+enum model_store_type {	MODEL_STORE_STRINGS = 0,
+			MODEL_STORE_INT32 = 1,
+			MODEL_STORE_INT64 = 2,
+			MODEL_STORE_FLOAT32 = 3,
+			MODEL_STORE_FLOAT64 = 4
+		};
+
+struct model_store_file_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t section_count;
+	uint64_t file_size;
+	uint64_t reserved;
+};
+
+struct model_store_section {
+	char name[MODEL_STORE_NAME_LENGTH];	// NUL-padded
+	uint32_t type;
+	uint32_t reserved;
+	int64_t rows;
+	int64_t columns;		// 1 for one-dimensional arrays and strings
+	int64_t offset;			// from the start of the file
+	int64_t length;			// in bytes
+};
+
+struct model_store {
+	void *mapping;
+	size_t mapping_size;
+	uint32_t section_count;
+	const struct model_store_section *sections;
+};
+
+struct model_store *model_store_open(const char *path);
+void model_store_close(struct model_store *store);
+const struct model_store_section *model_store_find(const struct model_store *store, const char *name);
+const void *model_store_data(const struct model_store *store, const struct model_store_section *section);
+const char *model_store_string(const struct model_store *store, const struct model_store_section *section, int64_t index, size_t *length);
+int64_t model_store_string_index(const struct model_store *store, const struct model_store_section *section, const char *text);
+
+#endif
@@ -10,11 +10,14 @@ import matplotlib.pyplot as plt
 from sklearn.preprocessing import OneHotEncoder, StandardScaler
 from sklearn.model_selection import train_test_split
 from tensorflow.keras.callbacks import EarlyStopping # type: ignore
+from mlp_inference import export_mlp
 
 # Print TensorFlow version
 print(f"Using TensorFlow version: {tf.__version__}")
 
-def run_neural_net(X, y):
+# Trains the network. With export_path, the trained weights and scaler are also written there for
+# scoring without TensorFlow (see mlp_inference.py).
+def run_neural_net(X, y, export_path=None):
 
     scaler = StandardScaler()
     X_scaled = scaler.fit_transform(X)
@@ -48,6 +51,9 @@ def run_neural_net(X, y):
     # Train the model with early stopping
     history = model.fit(train_dataset, epochs=100, validation_data=test_dataset, callbacks=[early_stopping])
 
+    if export_path is not None and export_mlp(model, scaler, ohe.categories_[0], export_path):
+        print(f"Neural network exported to '{export_path}'.")
+
     return history
 
 def main():
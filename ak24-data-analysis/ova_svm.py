@@ -5,6 +5,8 @@ from sklearn.model_selection import train_test_split
 from sklearn.svm import SVC
 from sklearn.metrics import accuracy_score
 
+from linear_svm import train_linear_svm, LinearSVMModel
+
 from typing import Type, List
 from dataclasses import dataclass
 
@@ -21,6 +23,7 @@ class SVMOutput:
     decision_scores: list
     final_predictions: list
     accuracy_score: float
+    model: object = None    # the trained LinearSVMModel, or None if it fell back to SVC
 
 def ova_svm_demo_with_wine():
     """
@@ -66,19 +69,24 @@ def ova_svm_demo_with_wine():
     ova_accuracy_score = accuracy_score(y_testing_data, final_prediction_ova)
     print("OvA accuracy: {}".format(ova_accuracy_score))
 
-def ova_svm(x_data: list[list], y_data: list) -> SVMOutput:
+def ova_svm(x_data: list[list], y_data: list, model_path: str = None) -> SVMOutput:
     # Split into training and testing data
     x_train, x_test, y_train, y_test = train_test_split(x_data, y_data, test_size = TEST_SIZE, random_state = 42)
 
-    # Create the SVM classifier
-    svm_ova = SVC(decision_function_shape="ovr", probability=True)
-    svm_ova.fit(x_train, y_train)
+    # Create the SVM classifier. The native linear one trains every user's classifier in parallel
+    # in well under a second (see linear_svm.py); without it, fall back to scikit-learn's SVC.
+    svm_ova = train_linear_svm(x_train, y_train)
+    if svm_ova is None:
+        svm_ova = SVC(decision_function_shape="ovr", probability=True)
+        svm_ova.fit(x_train, y_train)
+    elif model_path is not None:
+        svm_ova.save(model_path)
 
     # Get predictions, final prediction, and accuracy score
     decision_scores = svm_ova.decision_function(x_test)
     final_predictions = svm_ova.predict(x_test)
     svm_accuracy_score = accuracy_score(y_test, final_predictions)
-    output = SVMOutput(decision_scores, final_predictions, svm_accuracy_score)
+    output = SVMOutput(decision_scores, final_predictions, svm_accuracy_score, svm_ova if isinstance(svm_ova, LinearSVMModel) else None)
     
     return output
 
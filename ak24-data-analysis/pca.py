@@ -0,0 +1,191 @@
+import json
+import numpy as np
+
+# Principal component analysis without the features x features covariance matrix. Two ways to
+# fit a projection of standardized features onto their first principal components:
+#
+#  - fit_randomized_pca: randomized truncated SVD (Halko, Martinsson & Tropp) of the whole
+#    matrix. The standardization is applied implicitly inside the matrix products, so besides
+#    the input only a few rows x (components + oversamples) and features x (components +
+#    oversamples) matrices are allocated. With standardize=False the features are only centered,
+#    as sklearn.decomposition.PCA does.
+#  - PCAProjection.partial_fit: incremental SVD (Ross et al.), one batch of rows at a time, so
+#    sessions can be added without refitting. Each update takes an SVD of a
+#    (components + batch rows + 1) x features matrix. The scale of each feature is fixed by the
+#    first batch (its standard deviation there), so later batches are projected the same way
+#    earlier ones were.
+#
+# A fitted projection is saved with save() and loaded with load_projection(), so new sessions can
+# be projected with transform() without refitting.
+DEFAULT_OVERSAMPLES = 10
+DEFAULT_POWER_ITERATIONS = 7
+PROJECTION_FORMAT_VERSION = 1
+
+# Flips the sign of each component so that its largest loading is positive, so that fits of the
+# same data give the same signs
+def _flip_signs(components):
+    largest = np.argmax(np.abs(components), axis=1)
+    signs = np.sign(components[np.arange(len(components)), largest])
+    signs[signs == 0] = 1
+    return components * signs[:, np.newaxis]
+
+def _column_scale(deviations):
+    # Constant features are left unscaled (they are all 0 once centered)
+    return np.where(deviations > 0, deviations, 1.0)
+
+class PCAProjection:
+    def __init__(self, feature_names, mean, scale, components, singular_values, total_variance, samples_seen, variance_sum=None, requested_components=None):
+        self.feature_names = list(feature_names)        # list of str, or [] if the input had none
+        self.mean = mean                                # float64[features], in the input's units
+        self.scale = scale                              # float64[features]
+        self.components = components                    # float64[components, features]
+        self.singular_values = singular_values          # float64[components]
+        self.total_variance = total_variance            # of the scaled features
+        self.samples_seen = samples_seen
+        # Sum of squared deviations of each scaled feature, for partial_fit
+        self.variance_sum = variance_sum if variance_sum is not None else np.zeros(len(mean))
+        # Components partial_fit keeps (fewer until it has seen that many rows)
+        self.requested_components = requested_components if requested_components is not None else len(components)
+
+    @property
+    def n_components(self):
+        return len(self.components)
+
+    @property
+    def explained_variance(self):
+        return self.singular_values ** 2 / max(self.samples_seen - 1, 1)
+
+    @property
+    def explained_variance_ratio(self):
+        return self.explained_variance / self.total_variance if self.total_variance > 0 else np.zeros(self.n_components)
+
+    # Projects rows of features onto the components
+    def transform(self, X):
+        X = np.asarray(X, dtype=np.float64)
+        if X.shape[-1] != len(self.mean):
+            raise ValueError(f"[transform] The projection was fitted on {len(self.mean)} features, not {X.shape[-1]}.")
+        return ((X - self.mean) / self.scale) @ self.components.T
+
+    # Updates the projection with another batch of rows
+    def partial_fit(self, batch):
+        batch = np.asarray(batch, dtype=np.float64)
+        batch_rows = len(batch)
+        if batch_rows == 0:
+            return self
+        if batch.shape[1] != len(self.mean):
+            raise ValueError(f"[partial_fit] The projection was fitted on {len(self.mean)} features, not {batch.shape[1]}.")
+
+        if self.samples_seen == 0:
+            self.scale = _column_scale(batch.std(axis=0, ddof=1) if batch_rows > 1 else np.zeros(batch.shape[1]))
+        scaled = batch / self.scale
+        batch_mean = scaled.mean(axis=0)
+        batch_centered = scaled - batch_mean
+
+        seen = self.samples_seen
+        total = seen + batch_rows
+        previous_mean = self.mean / self.scale
+        new_mean = (seen * previous_mean + batch_rows * batch_mean) / total
+
+        # Per-feature variance, merged as in Chan et al., for the explained variance ratio
+        self.variance_sum = (self.variance_sum + (batch_centered ** 2).sum(axis=0)
+                             + (previous_mean - batch_mean) ** 2 * seen * batch_rows / total)
+
+        if seen == 0:
+            stacked = batch_centered
+        else:
+            # The old components (weighted by their singular values), the new rows, and a row
+            # that moves the old rows to the new mean
+            stacked = np.vstack([self.singular_values[:, np.newaxis] * self.components,
+                                 batch_centered,
+                                 np.sqrt(seen * batch_rows / total) * (previous_mean - batch_mean)])
+
+        _, singular_values, components = np.linalg.svd(stacked, full_matrices=False)
+        n_components = self.requested_components
+        self.components = _flip_signs(components[:n_components])
+        self.singular_values = singular_values[:n_components]
+        self.mean = new_mean * self.scale
+        self.samples_seen = total
+        self.total_variance = float(self.variance_sum.sum() / max(total - 1, 1))
+        return self
+
+    def save(self, path):
+        names = np.frombuffer(json.dumps(self.feature_names).encode("utf-8"), dtype=np.uint8)
+        with open(path, "wb") as file:
+            np.savez(file, version=np.int64(PROJECTION_FORMAT_VERSION), feature_names=names,
+                     mean=self.mean, scale=self.scale, components=self.components,
+                     singular_values=self.singular_values, total_variance=np.float64(self.total_variance),
+                     samples_seen=np.int64(self.samples_seen), variance_sum=self.variance_sum,
+                     requested_components=np.int64(self.requested_components))
+
+def load_projection(path):
+    with np.load(path, allow_pickle=False) as saved:
+        if int(saved["version"]) != PROJECTION_FORMAT_VERSION:
+            raise ValueError(f"[load_projection] {path} is version {int(saved['version'])}, expected {PROJECTION_FORMAT_VERSION}.")
+        return PCAProjection(json.loads(saved["feature_names"].tobytes().decode("utf-8")),
+                             saved["mean"], saved["scale"], saved["components"],
+                             saved["singular_values"], float(saved["total_variance"]),
+                             int(saved["samples_seen"]), saved["variance_sum"], int(saved["requested_components"]))
+
+# An empty projection for n_components components, to be fitted batch by batch with partial_fit.
+# It has fewer components until it has seen n_components rows.
+def incremental_pca(feature_names, feature_count, n_components):
+    return PCAProjection(feature_names, np.zeros(feature_count), np.ones(feature_count),
+                         np.zeros((0, feature_count)), np.zeros(0), 0.0, 0,
+                         requested_components=n_components)
+
+def _feature_names(X):
+    return [str(column) for column in X.columns] if hasattr(X, "columns") else []
+
+# Fits n_components components of the standardized (or, with standardize=False, only centered) X
+# with a randomized truncated SVD
+def fit_randomized_pca(X, n_components, oversamples=DEFAULT_OVERSAMPLES, power_iterations=DEFAULT_POWER_ITERATIONS, seed=0, standardize=True):
+    feature_names = _feature_names(X)
+    X = np.asarray(X, dtype=np.float64)
+    rows, features = X.shape
+    n_components = min(n_components, rows, features)
+
+    # Z = (X - mean) / scale is never built: Z @ W and Z^T @ Q are computed from X
+    mean = X.mean(axis=0)
+    deviations = X.std(axis=0, ddof=1) if rows > 1 else np.zeros(features)
+    scale = _column_scale(deviations) if standardize else np.ones(features)
+    shift = mean / scale
+    z_times = lambda W: X @ (W / scale[:, np.newaxis]) - shift @ W
+    z_transposed_times = lambda Q: (X.T @ Q) / scale[:, np.newaxis] - np.outer(shift, Q.sum(axis=0))
+
+    # Range finder: a basis Q for (most of) the column space of Z, sharpened by power iterations
+    sketch_size = min(n_components + oversamples, rows, features)
+    random = np.random.default_rng(seed)
+    Q, _ = np.linalg.qr(z_times(random.standard_normal((features, sketch_size))))
+    for _ in range(power_iterations):
+        Q, _ = np.linalg.qr(z_transposed_times(Q))
+        Q, _ = np.linalg.qr(z_times(Q))
+
+    # SVD of the small matrix Q^T Z
+    _, singular_values, components = np.linalg.svd(z_transposed_times(Q).T, full_matrices=False)
+
+    # Variance of each standardized feature is 1, except constant ones, which are 0
+    variance_sum = np.where(deviations > 0, rows - 1.0, 0.0) if standardize else deviations ** 2 * max(rows - 1, 0)
+    return PCAProjection(feature_names, mean, scale, _flip_signs(components[:n_components]),
+                         singular_values[:n_components], float(variance_sum.sum() / max(rows - 1, 1)), rows,
+                         variance_sum=variance_sum)
+
+# Fits as few components as explain at least `variance` of the variance: starts with
+# initial_components and doubles them until enough is explained. options go to
+# fit_randomized_pca (standardize=False to match sklearn's PCA)
+def fit_pca_to_variance(X, variance=0.8, initial_components=32, **options):
+    rows, features = np.shape(X)
+    n_components = min(initial_components, rows, features)
+    while True:
+        projection = fit_randomized_pca(X, n_components, **options)
+        explained = np.cumsum(projection.explained_variance_ratio)
+        if (len(explained) and explained[-1] >= variance) or n_components >= min(rows, features):
+            break
+        n_components = min(n_components * 2, rows, features)
+
+    needed = int(np.searchsorted(explained, variance) + 1) if len(explained) else 0
+    needed = min(needed, projection.n_components)
+    projection.components = projection.components[:needed]
+    projection.singular_values = projection.singular_values[:needed]
+    # partial_fit keeps this many components
+    projection.requested_components = needed
+    return projection
@@ -32,7 +32,7 @@ class LibGraphemeError(IntEnum):
 
 # returns tuple (x, y) where x is a LibGraphemeError code and y is the return value
 def get_combinations(content: str, combination_length: int, combination_type) -> list: 
-    if (content == None):
+    if (content is None):
         print("[get_combinations] Provided text cannot be empty or NULL.")
         return (LibGraphemeError.ERROR_EMPTY_CONTENT, [])
      
@@ -110,6 +110,7 @@ def get_combinations(content: str, combination_length: int, combination_type) ->
 #     Session["time_deltas"]  -> list of time deltas
 #     Session["dwell_times"]  -> list of dwell times
 #     Session["flight_times"] -> list of flight times
+#     (or the same as numpy arrays, from read_binary.read_keystroke_logger_arrays)
 #
 # (2) Returns (x, y) where x is a LibGraphemeError and y is a dictionary (table)
 def create_grapheme_map(session: dict, grapheme_type) -> dict:
@@ -136,8 +137,12 @@ def create_grapheme_map(session: dict, grapheme_type) -> dict:
     # (1) Get the graphemes for the graphemes column
     columns = ["time delta", "dwell time", "flight time"]
     
-    keystroke_keys = [ session["keystrokes"][x]["key"] for x in range(len(session["keystrokes"])) ] 
-    original_text = "".join(keystroke_keys)
+    # Sessions from read_keystroke_logger_arrays hold the keys as one byte array
+    if hasattr(session["keystrokes"], "dtype"):
+        original_text = session["keystrokes"]["key"].tobytes().decode("utf-8")
+    else:
+        keystroke_keys = [ session["keystrokes"][x]["key"] for x in range(len(session["keystrokes"])) ] 
+        original_text = "".join(keystroke_keys)
     (error_code, graphemes) = get_combinations(original_text, combination_length, CombinationType.TEXT)
 
     if (graphemes == []):
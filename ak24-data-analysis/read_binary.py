@@ -1,5 +1,6 @@
 import os
 import struct
+import numpy as np
 
 # Reads the binary file data output from the keystroke logger
 def read_keystroke_logger_output(file_path):
@@ -61,12 +62,165 @@ def read_keystroke_logger_output(file_path):
             flight_times_length = struct.unpack("Q", file.read(8))[0]  # [8 bytes] (Q for unsigned long long integer)
             flight_times = list(struct.unpack(f"{flight_times_length}Q", file.read(flight_times_length * 8)))
             session["flight_times"] = [abs(convert_to_signed(ft)) for ft in flight_times]
+            # Overload accounting defaults, for files written before the LOSS extension block existed
+            session["syn_dropped_count"] = 0
+            session["discarded_events"] = 0
+            for keystroke in keystrokes:
+                keystroke["tainted"] = False
+            # Overlap feature defaults, for files written before the OVLP extension block existed
+            session["release_to_press"] = []
+            session["release_to_release"] = []
+            session["overlapped_keystrokes"] = 0
+            session["max_rollover"] = 0
+            for keystroke in keystrokes:
+                keystroke["rollover"] = 0
+
             # Save the current session to the list of all sessions in the file
             sessions_data.append(session)
 
+        # Read extension blocks (4 byte tag, 8 byte payload size, payload) until the end of the file
+        read_extension_blocks(file, sessions_data)
+
     # Return user_info and the session data
     return user_info, sessions_data
 
+KEYSTROKE_FLAG_TAINTED = 0x01
+
+def read_extension_blocks(file, sessions_data):
+    while True:
+        header = file.read(12)
+        if len(header) < 12:
+            return
+
+        tag, payload_size = struct.unpack("=4sQ", header)
+        if tag == b"OVLP":
+            read_overlap_block(file, sessions_data)
+            continue
+        if tag != b"LOSS":
+            # Unknown block, skip it
+            file.seek(payload_size, os.SEEK_CUR)
+            continue
+
+        # Per session: SYN_DROPPED count, discarded events, keystrokes length, then one flags byte per keystroke
+        for session in sessions_data:
+            syn_dropped_count, discarded_events, flags_length = struct.unpack("3Q", file.read(24))
+            flags = file.read(flags_length)
+            session["syn_dropped_count"] = syn_dropped_count
+            session["discarded_events"] = discarded_events
+            for keystroke, flag in zip(session["keystrokes"], flags):
+                keystroke["tainted"] = bool(flag & KEYSTROKE_FLAG_TAINTED)
+
+def read_overlap_block(file, sessions_data):
+    # Per session: overlapped keystrokes, max rollover, keystrokes length, one rollover byte per keystroke,
+    # then signed release-to-press and release-to-release times (milliseconds), each preceded by its length
+    for session in sessions_data:
+        overlapped_keystrokes, max_rollover, rollover_length = struct.unpack("3Q", file.read(24))
+        rollovers = file.read(rollover_length)
+        session["overlapped_keystrokes"] = overlapped_keystrokes
+        session["max_rollover"] = max_rollover
+        for keystroke, rollover in zip(session["keystrokes"], rollovers):
+            keystroke["rollover"] = rollover
+        for name in ("release_to_press", "release_to_release"):
+            length = struct.unpack("Q", file.read(8))[0]
+            session[name] = list(struct.unpack(f"{length}q", file.read(length * 8))) if length > 0 else []
+
+# On-disk layouts, packed the way kdt writes them (fields back to back, no padding)
+USER_INFO_DTYPE = np.dtype([("user", "S64"), ("email", "S64"), ("major", "S64"), ("typing_duration", "<i2")])
+KEYSTROKE_RECORD_DTYPE = np.dtype([
+    ("key", "S1"),
+    ("press_time_tv_sec", "<i8"),
+    ("press_time_tv_nsec", "<i8"),
+    ("release_time_tv_sec", "<i8"),
+    ("release_time_tv_nsec", "<i8"),
+])  # 33 bytes
+
+# Same data as read_keystroke_logger_output, without building a Python object per value. The file is
+# memory-mapped and every array in a session is a numpy view into it (flight times, which are made
+# non-negative like the other reader does, are the only copy):
+#     session["keystrokes"]   -> structured array with KEYSTROKE_RECORD_DTYPE fields
+#     session["time_deltas"], session["dwell_times"] -> uint64 arrays
+#     session["flight_times"] -> int64 array
+#     session["flags"], session["rollover"] -> uint8 arrays, one per keystroke (zeros for older files)
+#     session["release_to_press"], session["release_to_release"] -> int64 arrays (empty for older files)
+def read_keystroke_logger_arrays(file_path):
+    if os.path.getsize(file_path) < USER_INFO_DTYPE.itemsize + 8:
+        raise ValueError(f"{file_path} is too short to be a keystroke logger file")
+
+    data = np.memmap(file_path, dtype=np.uint8, mode="r")
+    header = data[:USER_INFO_DTYPE.itemsize].view(USER_INFO_DTYPE)[0]
+    user_info = {
+        "user": header["user"].split(b"\x00", 1)[0].decode("utf-8"),
+        "email": header["email"].split(b"\x00", 1)[0].decode("utf-8"),
+        "major": header["major"].split(b"\x00", 1)[0].decode("utf-8"),
+        "typing_duration": int(header["typing_duration"]),
+    }
+
+    offset = USER_INFO_DTYPE.itemsize
+    session_count, offset = _read_length(data, offset)
+
+    sessions_data = []
+    for _ in range(session_count):
+        session = {}
+        keystrokes_length, offset = _read_length(data, offset)
+        session["keystrokes"], offset = _read_view(data, offset, keystrokes_length, KEYSTROKE_RECORD_DTYPE)
+
+        time_deltas_length, offset = _read_length(data, offset)
+        session["time_deltas"], offset = _read_view(data, offset, time_deltas_length, "<u8")
+        dwell_times_length, offset = _read_length(data, offset)
+        session["dwell_times"], offset = _read_view(data, offset, dwell_times_length, "<u8")
+        flight_times_length, offset = _read_length(data, offset)
+        flight_times, offset = _read_view(data, offset, flight_times_length, "<i8")
+        session["flight_times"] = np.abs(flight_times)
+
+        # Defaults, for files written before the LOSS and OVLP extension blocks existed
+        session["syn_dropped_count"] = 0
+        session["discarded_events"] = 0
+        session["flags"] = np.zeros(keystrokes_length, dtype=np.uint8)
+        session["overlapped_keystrokes"] = 0
+        session["max_rollover"] = 0
+        session["rollover"] = np.zeros(keystrokes_length, dtype=np.uint8)
+        session["release_to_press"] = np.empty(0, dtype=np.int64)
+        session["release_to_release"] = np.empty(0, dtype=np.int64)
+
+        sessions_data.append(session)
+
+    # Extension blocks (4 byte tag, 8 byte payload size, payload) until the end of the file
+    while offset + 12 <= len(data):
+        tag = data[offset:offset + 4].tobytes()
+        payload_size, offset = _read_length(data, offset + 4)
+        end = offset + payload_size
+
+        if tag == b"LOSS":
+            for session in sessions_data:
+                session["syn_dropped_count"], offset = _read_length(data, offset)
+                session["discarded_events"], offset = _read_length(data, offset)
+                flags_length, offset = _read_length(data, offset)
+                session["flags"], offset = _read_view(data, offset, flags_length, np.uint8)
+        elif tag == b"OVLP":
+            for session in sessions_data:
+                session["overlapped_keystrokes"], offset = _read_length(data, offset)
+                session["max_rollover"], offset = _read_length(data, offset)
+                rollover_length, offset = _read_length(data, offset)
+                session["rollover"], offset = _read_view(data, offset, rollover_length, np.uint8)
+                for name in ("release_to_press", "release_to_release"):
+                    length, offset = _read_length(data, offset)
+                    session[name], offset = _read_view(data, offset, length, "<i8")
+        offset = end
+
+    return user_info, sessions_data
+
+def _read_length(data, offset):
+    if offset + 8 > len(data):
+        raise ValueError("keystroke logger file ends in the middle of a length")
+    return int(data[offset:offset + 8].view("<u8")[0]), offset + 8
+
+def _read_view(data, offset, count, dtype):
+    dtype = np.dtype(dtype)
+    end = offset + count * dtype.itemsize
+    if end > len(data):
+        raise ValueError("keystroke logger file ends in the middle of an array")
+    return data[offset:end].view(dtype), end
+
 def convert_to_signed(value, threshold=500000):
     if value > threshold:
         return value - (1 << 64)
@@ -0,0 +1,62 @@
+import os
+import sys
+
+import numpy as np
+import pandas
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."))
+from correlation import correlation_matrix, prune_correlated_features
+
+# Checks the blocked correlations against pandas' pairwise-complete DataFrame.corr, and the
+# blocked pruning against a plain greedy loop over that matrix. Run with pytest, or directly.
+THRESHOLD = 0.8
+MINIMUM_OVERLAP = 3
+
+# Sessions x features with -1 for missing values, like the master table: groups of features
+# that follow a common signal, constant features and features that are mostly missing
+def feature_table(seed=0, rows=120, features=90):
+    random = np.random.default_rng(seed)
+    signals = random.standard_normal((rows, 6))
+    values = signals[:, random.integers(0, 6, features)] * random.uniform(0.5, 3.0, features)
+    values += random.standard_normal((rows, features)) * random.uniform(0.05, 1.5, features)
+    values += 50.0
+    values[:, 10] = 7.0
+    missing = random.random((rows, features)) < random.uniform(0.0, 0.9, features)
+    missing[:, 20] = True
+    missing[3:, 21] = True
+    return values, missing
+
+def naive_correlations(values, missing):
+    frame = pandas.DataFrame(np.where(missing, np.nan, values))
+    return np.nan_to_num(frame.corr(min_periods=MINIMUM_OVERLAP).to_numpy(), nan=0.0)
+
+def naive_prune(correlations):
+    kept = np.ones(len(correlations), dtype=bool)
+    for i in range(len(correlations)):
+        if not kept[i]:
+            continue
+        for j in range(i + 1, len(correlations)):
+            if abs(correlations[i, j]) >= THRESHOLD:
+                kept[j] = False
+    return kept
+
+def test_correlation_matrix():
+    values, missing = feature_table()
+    expected = naive_correlations(values, missing)
+    for block_size in (7, 64, 512):
+        actual = correlation_matrix(values, missing, block_size=block_size, minimum_overlap=MINIMUM_OVERLAP)
+        assert np.allclose(actual, expected, atol=1e-9), block_size
+
+def test_prune_correlated_features():
+    for seed in range(3):
+        values, missing = feature_table(seed)
+        expected = naive_prune(naive_correlations(values, missing))
+        assert 0 < expected.sum() < len(expected)
+        for block_size in (1, 7, 64, 512):
+            kept = prune_correlated_features(values, missing, THRESHOLD, block_size=block_size, minimum_overlap=MINIMUM_OVERLAP)
+            assert kept.tolist() == expected.tolist(), (seed, block_size)
+
+if __name__ == "__main__":
+    test_correlation_matrix()
+    test_prune_correlated_features()
+    print("[test_correlation] Blocked correlations and pruning match the naive ones.")
@@ -0,0 +1,79 @@
+import os
+import sys
+import tempfile
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."))
+from read_binary import read_keystroke_logger_arrays
+from pylibgrapheme import create_grapheme_map, GraphemeType
+from masterDictionaryBuilder import create_combined_dictionary
+from feature_cache import cached_feature_rows, load_feature_rows, store_feature_rows, cache_entry_path, hash_file, settings_fingerprint
+
+# Checks that feature rows come back from the cache exactly as they were stored (values, key
+# order and users), and that an entry is only used for the same file contents and settings.
+# Run with pytest, or directly.
+SESSION_FILE = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "..", "kdt-keystroke-collection", "data", "10-second-tests", "ben-d10-1.bin")
+
+# The feature rows main.py extracts from a session file
+def extract(file_path):
+    user_info, sessions = read_keystroke_logger_arrays(file_path)
+    feature_rows = []
+    for session in sessions:
+        _, grapheme_map = create_grapheme_map(session, GraphemeType.DIGRAPH)
+        grapheme_map["time_delta"].append(-1)
+        grapheme_map["flight_time"].append(-1)
+        feature_rows.append(create_combined_dictionary(grapheme_map, user_info, ("mean", "std")))
+    return feature_rows
+
+def assert_same_rows(expected, actual):
+    assert len(expected) == len(actual)
+    for expected_row, actual_row in zip(expected, actual):
+        assert list(expected_row.items()) == list(actual_row.items())
+
+def test_round_trip():
+    rows = extract(SESSION_FILE)
+    # Names and users outside ASCII, and a row with no features
+    rows.append({"é+ü+dwell_time": 0.1, "日本+flight_time": -1.0, "user": "zoë"})
+    rows.append({"user": "empty"})
+
+    with tempfile.TemporaryDirectory() as directory:
+        entry_path = os.path.join(directory, "entry.features")
+        store_feature_rows(entry_path, rows)
+        assert_same_rows(rows, load_feature_rows(entry_path))
+
+        # A cut-short entry is ignored rather than misread
+        with open(entry_path, "r+b") as file:
+            file.truncate(os.path.getsize(entry_path) - 1)
+        assert load_feature_rows(entry_path) is None
+
+def test_hits_and_misses():
+    calls = []
+    def counting_extract(file_path):
+        calls.append(file_path)
+        return extract(file_path)
+
+    with tempfile.TemporaryDirectory() as directory:
+        fingerprint = settings_fingerprint("test")
+        first, hit = cached_feature_rows(SESSION_FILE, directory, fingerprint, counting_extract)
+        assert not hit
+        second, hit = cached_feature_rows(SESSION_FILE, directory, fingerprint, counting_extract)
+        assert hit and len(calls) == 1
+        assert_same_rows(first, second)
+        assert os.path.exists(cache_entry_path(directory, hash_file(SESSION_FILE), fingerprint))
+
+        # Other settings, or the same name with other contents, miss
+        _, hit = cached_feature_rows(SESSION_FILE, directory, settings_fingerprint("other"), counting_extract)
+        assert not hit
+        copy_path = os.path.join(directory, "copy.bin")
+        with open(SESSION_FILE, "rb") as source, open(copy_path, "wb") as copy:
+            copy.write(source.read())
+        _, hit = cached_feature_rows(copy_path, directory, fingerprint, counting_extract)
+        assert hit
+        with open(copy_path, "ab") as copy:
+            copy.write(b"\0")
+        _, hit = cached_feature_rows(copy_path, directory, fingerprint, counting_extract)
+        assert not hit and len(calls) == 3
+
+if __name__ == "__main__":
+    test_round_trip()
+    test_hits_and_misses()
+    print("[test_feature_cache] Cached feature rows match.")
@@ -0,0 +1,40 @@
+import os
+import sys
+
+import numpy as np
+from sklearn.svm import LinearSVC
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."))
+from linear_svm import train_linear_svm, NATIVE_LIBRARY_PATH, LOSS_HINGE, LOSS_SQUARED_HINGE
+
+# Checks the native one-vs-all training against sklearn's LinearSVC (liblinear, which also
+# learns the bias as the weight of a constant feature) on a small separable problem, with one
+# thread and with several. Needs native/liblinearsvm.so (native/build). Run with pytest, or
+# directly.
+CLASSES = 4
+
+# Sessions x features in CLASSES well separated clusters, with no missing features
+def separable_problem(seed=0, rows_per_class=30, features=6):
+    random = np.random.default_rng(seed)
+    centers = random.standard_normal((CLASSES, features)) * 6.0
+    X = np.repeat(centers, rows_per_class, axis=0) + random.standard_normal((CLASSES * rows_per_class, features))
+    y = np.repeat([f"user{label}" for label in range(CLASSES)], rows_per_class)
+    return X + 20.0, y
+
+def test_matches_linear_svc():
+    assert os.path.exists(NATIVE_LIBRARY_PATH), f"{NATIVE_LIBRARY_PATH} was not found. Build it with native/build."
+    X, y = separable_problem()
+    for loss, sklearn_loss in ((LOSS_SQUARED_HINGE, "squared_hinge"), (LOSS_HINGE, "hinge")):
+        for threads in (1, 3):
+            model = train_linear_svm(X, y, C=0.5, loss=loss, threads=threads, epsilon=1e-7, max_iterations=100000)
+            assert model is not None
+            # sklearn is given the rows standardized the way the native training saw them
+            standardized = model.standardize(X)
+            expected = LinearSVC(C=0.5, loss=sklearn_loss, dual=True, tol=1e-9, max_iter=1000000).fit(standardized, y)
+            assert model.labels.tolist() == expected.classes_.tolist()
+            assert np.allclose(model.decision_function(X), expected.decision_function(standardized), atol=1e-5), (loss, threads)
+            assert (model.predict(X) == y).all()
+
+if __name__ == "__main__":
+    test_matches_linear_svc()
+    print("[test_linear_svm] Native training matches LinearSVC.")
@@ -0,0 +1,70 @@
+import os
+import sys
+import tempfile
+
+import numpy as np
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."))
+from mlp_inference import export_mlp, load_mlp, NATIVE_LIBRARY_PATH
+
+# Checks that the native kernels score an exported network like NumPy does, for layer widths
+# that are not whole vectors and batches that are not whole blocks of rows. Needs native/libmlp.so
+# (native/build). Run with pytest, or directly.
+WIDTHS = [37, 23, 11, 9, 5]
+ACTIVATIONS = ["relu", "tanh", "sigmoid", "softmax"]
+BATCH_SIZES = [1, 3, 7, 66, 131]
+
+# Stands in for a trained Keras Dense layer, with what export_mlp reads from it
+class DenseLayer:
+    def __init__(self, name, kernel, bias, activation):
+        self.name = name
+        self._weights = [kernel, bias]
+        self._activation = activation
+
+    def get_weights(self):
+        return self._weights
+
+    def get_config(self):
+        return {"activation": self._activation}
+
+class Model:
+    def __init__(self, layers):
+        self.layers = layers
+
+class Scaler:
+    def __init__(self, mean, scale):
+        self.mean_ = mean
+        self.scale_ = scale
+
+def random_model(random):
+    layers = [DenseLayer(f"dense_{number}", random.standard_normal((inputs, outputs)) / np.sqrt(inputs),
+                         random.standard_normal(outputs) * 0.1, activation)
+              for number, (inputs, outputs, activation) in enumerate(zip(WIDTHS, WIDTHS[1:], ACTIVATIONS))]
+    scaler = Scaler(random.standard_normal(WIDTHS[0]) * 5.0, random.uniform(0.5, 3.0, WIDTHS[0]))
+    return Model(layers), scaler
+
+def test_native_matches_numpy():
+    assert os.path.exists(NATIVE_LIBRARY_PATH), f"{NATIVE_LIBRARY_PATH} was not found. Build it with native/build."
+    random = np.random.default_rng(0)
+    model, scaler = random_model(random)
+    labels = [f"user{number}" for number in range(WIDTHS[-1])]
+
+    with tempfile.TemporaryDirectory() as directory:
+        path = os.path.join(directory, "model.mlp")
+        assert export_mlp(model, scaler, labels, path)
+        native = load_mlp(path)
+        numpy = load_mlp(path, native=False)
+        assert native.native and not numpy.native
+
+        for rows in BATCH_SIZES:
+            X = scaler.mean_ + random.standard_normal((rows, WIDTHS[0])) * scaler.scale_
+            expected = numpy.predict_proba(X)
+            actual = native.predict_proba(X)
+            assert actual.shape == (rows, WIDTHS[-1])
+            assert np.allclose(actual, expected, rtol=1e-4, atol=1e-5), rows
+            assert np.allclose(actual.sum(axis=1), 1.0, atol=1e-5), rows
+        native.close()
+
+if __name__ == "__main__":
+    test_native_matches_numpy()
+    print("[test_mlp_inference] Native and NumPy scores match.")
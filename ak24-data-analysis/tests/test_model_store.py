@@ -0,0 +1,112 @@
+import ctypes
+import os
+import sys
+import tempfile
+
+import numpy as np
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."))
+from model_store import write_model_store, open_model_store, ALIGNMENT
+
+# Checks that a model store reads back the same through model_store.py and through
+# native/libmodelstore, with every section aligned, and that both reject a store cut short.
+# Needs native/libmodelstore.so (native/build). Run with pytest, or directly.
+NATIVE_LIBRARY_PATH = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "native", "libmodelstore.so")
+
+class Section(ctypes.Structure):
+    _fields_ = [("name", ctypes.c_char * 32), ("type", ctypes.c_uint32), ("reserved", ctypes.c_uint32),
+                ("rows", ctypes.c_int64), ("columns", ctypes.c_int64), ("offset", ctypes.c_int64), ("length", ctypes.c_int64)]
+
+class Store(ctypes.Structure):
+    _fields_ = [("mapping", ctypes.c_void_p), ("mapping_size", ctypes.c_size_t),
+                ("section_count", ctypes.c_uint32), ("sections", ctypes.POINTER(Section))]
+
+def load_library():
+    assert os.path.exists(NATIVE_LIBRARY_PATH), f"{NATIVE_LIBRARY_PATH} was not found. Build it with native/build."
+    library = ctypes.CDLL(NATIVE_LIBRARY_PATH)
+    library.model_store_open.argtypes = [ctypes.c_char_p]
+    library.model_store_open.restype = ctypes.POINTER(Store)
+    library.model_store_close.argtypes = [ctypes.POINTER(Store)]
+    library.model_store_close.restype = None
+    library.model_store_find.argtypes = [ctypes.POINTER(Store), ctypes.c_char_p]
+    library.model_store_find.restype = ctypes.POINTER(Section)
+    library.model_store_data.argtypes = [ctypes.POINTER(Store), ctypes.POINTER(Section)]
+    library.model_store_data.restype = ctypes.c_void_p
+    library.model_store_string.argtypes = [ctypes.POINTER(Store), ctypes.POINTER(Section), ctypes.c_int64, ctypes.POINTER(ctypes.c_size_t)]
+    library.model_store_string.restype = ctypes.c_void_p
+    library.model_store_string_index.argtypes = [ctypes.POINTER(Store), ctypes.POINTER(Section), ctypes.c_char_p]
+    library.model_store_string_index.restype = ctypes.c_int64
+    return library
+
+# Sections of every type, with lengths that do not fill whole ALIGNMENT blocks
+def store_sections():
+    random = np.random.default_rng(0)
+    return {
+        "settings": ['{"graphemes": "digraph"}'],
+        "features": ["a+b+dwell_time", "é+ü+flight_time", "日本+time_delta", ""],
+        "scaler.mean": random.standard_normal(7),
+        "templates": random.standard_normal((3, 5)).astype(np.float32),
+        "knn.users": np.arange(9, dtype=np.int32),
+        "counts": np.arange(-3, 2, dtype=np.int64),
+    }
+
+def read_native(library, store, name, values):
+    section = library.model_store_find(store, name.encode("utf-8"))
+    assert section, name
+    section = section.contents
+    data = library.model_store_data(store, section)
+    assert (data - store.contents.mapping) % ALIGNMENT == 0 and section.offset % ALIGNMENT == 0, name
+    if isinstance(values, list):
+        strings = []
+        for index in range(section.rows):
+            length = ctypes.c_size_t()
+            text = library.model_store_string(store, section, index, ctypes.byref(length))
+            strings.append(ctypes.string_at(text, length.value).decode("utf-8"))
+        return strings
+    array = np.ctypeslib.as_array(ctypes.cast(data, ctypes.POINTER(np.ctypeslib.as_ctypes_type(values.dtype))),
+                                  shape=(section.rows * section.columns,))
+    return array.reshape(values.shape).copy()
+
+def test_round_trip():
+    library = load_library()
+    sections = store_sections()
+    with tempfile.TemporaryDirectory() as directory:
+        path = os.path.join(directory, "model_store.bin")
+        write_model_store(path, sections)
+        assert os.listdir(directory) == ["model_store.bin"]
+
+        store = open_model_store(path)
+        assert store.names() == list(sections)
+        native = library.model_store_open(os.fsencode(path))
+        assert native and native.contents.section_count == len(sections)
+        try:
+            for name, values in sections.items():
+                if isinstance(values, list):
+                    assert store.strings(name) == values, name
+                else:
+                    assert store.array(name).dtype == values.dtype and np.array_equal(store.array(name), values), name
+                    assert store.array(name).ctypes.data % ALIGNMENT == 0, name
+                actual = read_native(library, native, name, values)
+                assert actual == values if isinstance(values, list) else np.array_equal(actual, values), name
+
+            features = library.model_store_find(native, b"features")
+            assert library.model_store_string_index(native, features, "日本+time_delta".encode("utf-8")) == 2
+            assert library.model_store_string_index(native, features, b"missing") == -1
+            assert not library.model_store_find(native, b"missing")
+        finally:
+            library.model_store_close(native)
+            del store
+
+        # Both reject a store cut short
+        with open(path, "r+b") as file:
+            file.truncate(os.path.getsize(path) - 1)
+        assert not library.model_store_open(os.fsencode(path))
+        try:
+            open_model_store(path)
+            assert False, "a truncated store was opened"
+        except ValueError:
+            pass
+
+if __name__ == "__main__":
+    test_round_trip()
+    print("[test_model_store] Python and C read the same store.")
@@ -0,0 +1,43 @@
+import os
+import sys
+
+import numpy as np
+from sklearn.decomposition import PCA
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."))
+from pca import fit_pca_to_variance
+
+# Checks that a projection fitted to a variance target keeps as many components as sklearn's PCA
+# needs for it, and that updating it with partial_fit does not change that number. Run with
+# pytest, or directly.
+VARIANCE = 0.8
+
+# Sessions x features driven by a few latent signals, with noise
+def feature_table(seed=0, rows=200, features=60, signals=8):
+    random = np.random.default_rng(seed)
+    weights = np.linspace(3.0, 0.5, signals)
+    values = (random.standard_normal((rows, signals)) * weights) @ random.standard_normal((signals, features))
+    return values + random.standard_normal((rows, features)) * 0.3
+
+def test_components_for_variance():
+    X = feature_table()
+    projection = fit_pca_to_variance(X, variance=VARIANCE, initial_components=2, standardize=False)
+    expected = PCA(n_components=VARIANCE, svd_solver="full").fit(X)
+    assert projection.n_components == expected.n_components_
+    assert np.allclose(projection.explained_variance_ratio, expected.explained_variance_ratio_, rtol=1e-6)
+
+def test_partial_fit_keeps_components():
+    X = feature_table()
+    # More components are fitted than are kept
+    projection = fit_pca_to_variance(X[:150], variance=VARIANCE, initial_components=32, standardize=False)
+    n_components = projection.n_components
+    assert 0 < n_components < X.shape[1]
+
+    projection.partial_fit(X[150:])
+    assert projection.n_components == n_components
+    assert projection.transform(X).shape == (len(X), n_components)
+
+if __name__ == "__main__":
+    test_components_for_variance()
+    test_partial_fit_keeps_components()
+    print("[test_pca] Projections fitted to a variance target keep their components.")
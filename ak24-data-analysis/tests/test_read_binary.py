@@ -0,0 +1,80 @@
+import os
+import struct
+import sys
+import tempfile
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."))
+from read_binary import read_keystroke_logger_output, read_keystroke_logger_arrays
+
+# Checks that the memory-mapped reader returns the same data as the struct-based one, for the
+# session files in data/ (written before the LOSS and OVLP blocks) and for a file with both
+# blocks and an unknown one. Run with pytest, or directly.
+DATA_DIRECTORY = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "..", "kdt-keystroke-collection", "data")
+
+def assert_readers_agree(path):
+    old_user_info, old_sessions = read_keystroke_logger_output(path)
+    new_user_info, new_sessions = read_keystroke_logger_arrays(path)
+    assert old_user_info == new_user_info, path
+    assert len(old_sessions) == len(new_sessions), path
+
+    for old, new in zip(old_sessions, new_sessions):
+        keystrokes = new["keystrokes"]
+        assert [keystroke["key"] for keystroke in old["keystrokes"]] == [key.decode("utf-8") for key in keystrokes["key"]], path
+        for field in ("press_time_tv_sec", "press_time_tv_nsec", "release_time_tv_sec", "release_time_tv_nsec"):
+            assert [keystroke[field] for keystroke in old["keystrokes"]] == keystrokes[field].tolist(), (path, field)
+        assert [keystroke["tainted"] for keystroke in old["keystrokes"]] == [bool(flag & 1) for flag in new["flags"]], path
+        assert [keystroke["rollover"] for keystroke in old["keystrokes"]] == new["rollover"].tolist(), path
+
+        for field in ("time_deltas", "dwell_times", "flight_times", "release_to_press", "release_to_release"):
+            assert list(old[field]) == new[field].tolist(), (path, field)
+        for field in ("syn_dropped_count", "discarded_events", "overlapped_keystrokes", "max_rollover"):
+            assert old[field] == new[field], (path, field)
+
+def test_data_files():
+    # The first session file of every user, for every duration
+    checked = 0
+    for directory in sorted(os.listdir(DATA_DIRECTORY)):
+        seen_users = set()
+        for name in sorted(os.listdir(os.path.join(DATA_DIRECTORY, directory))):
+            user = name.split("-d")[0]
+            if name.endswith(".bin") and user not in seen_users:
+                seen_users.add(user)
+                assert_readers_agree(os.path.join(DATA_DIRECTORY, directory, name))
+                checked += 1
+    assert checked > 0
+
+def _lengths_and_values(values, code):
+    return struct.pack("Q", len(values)) + struct.pack(f"{len(values)}{code}", *values)
+
+def test_extension_blocks():
+    keystrokes = [(b"a", 10, 0, 10, 90000000), (b"b", 10, 50000000, 10, 150000000), (b"c", 11, 0, 11, 80000000)]
+    session = struct.pack("Q", len(keystrokes))
+    for keystroke in keystrokes:
+        session += struct.pack("=cqqqq", *keystroke)
+    session += _lengths_and_values([50, 950], "Q") + _lengths_and_values([90, 100, 80], "Q")
+    session += _lengths_and_values([-40, 850], "q")
+
+    loss = struct.pack("3Q", 2, 7, len(keystrokes)) + bytes([0, 1, 0])
+    overlap = struct.pack("3Q", 1, 2, len(keystrokes)) + bytes([0, 1, 0])
+    overlap += _lengths_and_values([-40, 850], "q") + _lengths_and_values([10, 900], "q")
+
+    contents = struct.pack("64s64s64sh", b"dave", b"dave@coolmail.com", b"computer science", 10)
+    contents += struct.pack("Q", 1) + session
+    for tag, payload in ((b"LOSS", loss), (b"ZZZZ", b"skipped"), (b"OVLP", overlap)):
+        contents += struct.pack("=4sQ", tag, len(payload)) + payload
+
+    with tempfile.TemporaryDirectory() as directory:
+        path = os.path.join(directory, "blocks.bin")
+        with open(path, "wb") as file:
+            file.write(contents)
+        assert_readers_agree(path)
+
+        _, sessions = read_keystroke_logger_arrays(path)
+        assert sessions[0]["syn_dropped_count"] == 2 and sessions[0]["discarded_events"] == 7
+        assert sessions[0]["flight_times"].tolist() == [40, 850]
+        assert sessions[0]["release_to_release"].tolist() == [10, 900]
+
+if __name__ == "__main__":
+    test_data_files()
+    test_extension_blocks()
+    print("[test_read_binary] Both readers agree.")
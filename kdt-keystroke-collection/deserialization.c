@@ -5,98 +5,18 @@
 #include "libkdt.h"
 
 
-/*
- * Function to deserialize the data and verify it was stored correctly
- * Takes in a file pointer to file to read from, 
- * a pointer to a pointer to hold the array of sessions,
- * and a pointer to the variable that store the number of sessions
- */
-int load_sessions(FILE *file, struct user_info **user_info, struct session **sessions, size_t *session_count) {
-     // Make sure file pointer is valid
-    if (!file) {
-        fprintf(stderr, "Invalid file pointer for loading sessions.\n");
-        return -1;
-    }
-
-    // Allocate memory for user_info
-    *user_info = malloc(sizeof(struct user_info));
-    if (!(*user_info)) {
-        return -1;
-    }
-
-    // Read user_info fields from file (64 bytes each for user, email, and major, and 2 bytes for typing_duration)
-    fread((*user_info)->user, sizeof(char), 64, file);
-    fread((*user_info)->email, sizeof(char), 64, file);
-    fread((*user_info)->major, sizeof(char), 64, file);
-    fread(&(*user_info)->typing_duration, sizeof(short), 1, file);
-
-    // Read number of sessions (8 bytes)
-    fread(session_count, sizeof(size_t), 1, file);
-    *sessions = malloc(sizeof(struct session) * (*session_count));
-    if (!(*sessions)) {
-        return -1;
-    }
-
-    // Loop through the number of sessions (determined from reading the session_count bytes)
-    for (size_t i = 0; i < *session_count; i++) {
-        // Read number of keystrokes (8 bytes)
-        fread(&(*sessions)[i].keystrokes_length, sizeof(size_t), 1, file);
-
-        // Allocate memory for keystrokes
-        (*sessions)[i].keystrokes = malloc(sizeof(struct keystroke) * (*sessions)[i].keystrokes_length);
-
-        // Read keystrokes (33 Bytes total)
-        for (size_t j = 0; j < (*sessions)[i].keystrokes_length; j++) {
-            fread(&(*sessions)[i].keystrokes[j].c, sizeof(char), 1, file);  // Keystroke key (1 byte)
-            fread(&(*sessions)[i].keystrokes[j].press_time.tv_sec, sizeof(long), 1, file);  // Press timestamp (8 bytes)
-            fread(&(*sessions)[i].keystrokes[j].press_time.tv_nsec, sizeof(long), 1, file);   // Nanoseconds (8 bytes)
-            fread(&(*sessions)[i].keystrokes[j].release_time.tv_sec, sizeof(long), 1, file);  // Release timestamp (8 bytes)
-            fread(&(*sessions)[i].keystrokes[j].release_time.tv_nsec, sizeof(long), 1, file);   // Nanoseconds (8 bytes)
-        }
-
-        // Read time deltas length (8 Bytes)
-        fread(&(*sessions)[i].time_deltas_length, sizeof(size_t), 1, file);
-        // Read the time deltas using the length
-        if ((*sessions)[i].time_deltas_length > 0) {
-            (*sessions)[i].time_deltas = malloc(sizeof(unsigned long) * (*sessions)[i].time_deltas_length);
-            fread((*sessions)[i].time_deltas, sizeof(unsigned long), (*sessions)[i].time_deltas_length, file);
-        } else {
-            (*sessions)[i].time_deltas = NULL;
-        }
-
-        // Read dwell times length
-        fread(&(*sessions)[i].dwell_times_length, sizeof(size_t), 1, file);
-        // Read the dwell times using the length
-        if ((*sessions)[i].dwell_times_length > 0) {
-            (*sessions)[i].dwell_times = malloc(sizeof(unsigned long) * (*sessions)[i].dwell_times_length);
-            fread((*sessions)[i].dwell_times, sizeof(unsigned long), (*sessions)[i].dwell_times_length, file);
-        } else {
-            (*sessions)[i].dwell_times = NULL;
-        }
-
-        // Read flight times length
-        fread(&(*sessions)[i].flight_times_length, sizeof(size_t), 1, file);
-        // Read the dwell using the length
-        if ((*sessions)[i].flight_times_length > 0) {
-            (*sessions)[i].flight_times = malloc(sizeof(unsigned long) * (*sessions)[i].flight_times_length);
-            fread((*sessions)[i].flight_times, sizeof(unsigned long), (*sessions)[i].flight_times_length, file);
-        } else {
-            (*sessions)[i].flight_times = NULL;
-        }
-    }
-
-    return 0;
-}
-
 void print_sessions(struct session *sessions, size_t session_count) {
     for (size_t i = 0; i < session_count; i++) {
         printf("Session %zu:\n", i + 1);
         printf("  Keystrokes Length: %zu\n", sessions[i].keystrokes_length);
+        printf("  SYN_DROPPED Reports: %zu | Discarded Events: %zu | Tainted Keystrokes: %zu\n",
+               sessions[i].syn_dropped_count, sessions[i].discarded_events, sessions[i].tainted_keystrokes);
         for (size_t j = 0; j < sessions[i].keystrokes_length; j++) {
-            printf("    Keystroke %zu: %c | Press Time: %ld.%ld | Release Time: %ld.%ld\n",
+            printf("    Keystroke %zu: %c | Press Time: %ld.%ld | Release Time: %ld.%ld%s\n",
                    j, sessions[i].keystrokes[j].c,
                    sessions[i].keystrokes[j].press_time.tv_sec, sessions[i].keystrokes[j].press_time.tv_nsec,
-                   sessions[i].keystrokes[j].release_time.tv_sec, sessions[i].keystrokes[j].release_time.tv_nsec);
+                   sessions[i].keystrokes[j].release_time.tv_sec, sessions[i].keystrokes[j].release_time.tv_nsec,
+                   (sessions[i].keystrokes[j].flags & KEYSTROKE_FLAG_TAINTED) ? " | TAINTED" : "");
         }
 
         printf("  Time Deltas: ");
@@ -115,7 +35,20 @@ void print_sessions(struct session *sessions, size_t session_count) {
         for (size_t j = 0; j < sessions[i].flight_times_length; j++) {
             printf("%lu ", sessions[i].flight_times[j]);
         }
-        printf("\n\n");
+        printf("\n");
+
+        printf("  Release-to-Press Times: ");
+        for (size_t j = 0; j < sessions[i].release_to_press_length; j++) {
+            printf("%ld ", sessions[i].release_to_press[j]);
+        }
+        printf("\n");
+
+        printf("  Release-to-Release Times: ");
+        for (size_t j = 0; j < sessions[i].release_to_release_length; j++) {
+            printf("%ld ", sessions[i].release_to_release[j]);
+        }
+        printf("\n");
+        printf("  Overlapped Keystrokes: %zu | Max Rollover: %zu\n\n", sessions[i].overlapped_keystrokes, sessions[i].max_rollover);
     }
 }
 
@@ -161,6 +94,8 @@ int main(int argc, char *argv[]) {
         free(sessions[i].time_deltas);
         free(sessions[i].dwell_times);
         free(sessions[i].flight_times);
+        free(sessions[i].release_to_press);
+        free(sessions[i].release_to_release);
     }
     free(sessions);
 
@@ -0,0 +1,572 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include "libkdt.h"
+
+/*
+ * kdt-export: dumps session files as tables for analysis elsewhere, as CSV, JSON Lines or
+ * NumPy .npy files holding one structured array. Rows refer to their input by its position
+ * among the inputs (column "file", counted from 0).
+ *
+ *	./kdt-export --table keystrokes --format csv --output keystrokes.csv data/10-second-tests/[session files]
+ *	./kdt-export --table statistics --format npy --output-dir exported --jobs 8 data/10-second-tests/[session files]
+ *
+ * Tables:
+ *	sessions	one row per session: user, keystrokes, overload and overlap counts
+ *	keystrokes	one row per keystroke: key code, flags, rollover, press and release times, dwell
+ *	statistics	one row per pair of consecutive keystrokes: time delta, flight, release-to-press
+ *			and release-to-release times
+ *
+ * Values are formatted by hand into large buffers that are written out with write(), so
+ * exporting is bound by the disk rather than by printf. With --output-dir, every input is
+ * exported to its own file (named after the input) by --jobs threads.
+ */
+
+#define EXPORT_BUFFER_SIZE (1 << 20)
+#define EXPORT_INPUT_BUFFER_SIZE (1 << 20)
+#define EXPORT_NPY_HEADER_SIZE 512	// fixed, so the row count can be filled in once it is known
+#define EXPORT_MAX_COLUMNS 12
+
+enum export_format { EXPORT_CSV, EXPORT_JSONL, EXPORT_NPY };
+enum export_table { EXPORT_SESSIONS, EXPORT_KEYSTROKES, EXPORT_STATISTICS };
+enum export_type { EXPORT_U1, EXPORT_U4, EXPORT_U8, EXPORT_I8, EXPORT_TEXT64 };
+
+struct export_column {
+	const char *name;
+	enum export_type type;
+};
+
+static const struct export_column session_columns[] = {
+	{ "file", EXPORT_U4 }, { "session", EXPORT_U4 }, { "user", EXPORT_TEXT64 }, { "keystrokes", EXPORT_U8 },
+	{ "syn_dropped", EXPORT_U8 }, { "discarded_events", EXPORT_U8 }, { "tainted_keystrokes", EXPORT_U8 },
+	{ "overlapped_keystrokes", EXPORT_U8 }, { "max_rollover", EXPORT_U8 }
+};
+static const struct export_column keystroke_columns[] = {
+	{ "file", EXPORT_U4 }, { "session", EXPORT_U4 }, { "index", EXPORT_U4 }, { "key", EXPORT_U1 },
+	{ "flags", EXPORT_U1 }, { "rollover", EXPORT_U1 }, { "press_ns", EXPORT_I8 }, { "release_ns", EXPORT_I8 },
+	{ "dwell_ms", EXPORT_I8 }
+};
+static const struct export_column statistic_columns[] = {
+	{ "file", EXPORT_U4 }, { "session", EXPORT_U4 }, { "index", EXPORT_U4 }, { "time_delta_ms", EXPORT_I8 },
+	{ "flight_ms", EXPORT_I8 }, { "release_to_press_ms", EXPORT_I8 }, { "release_to_release_ms", EXPORT_I8 }
+};
+
+struct export_layout {
+	const char *name;		// as given to --table
+	const struct export_column *columns;
+	size_t columns_length;
+};
+
+static const struct export_layout layouts[] = {
+	[EXPORT_SESSIONS] = { "sessions", session_columns, sizeof(session_columns) / sizeof(session_columns[0]) },
+	[EXPORT_KEYSTROKES] = { "keystrokes", keystroke_columns, sizeof(keystroke_columns) / sizeof(keystroke_columns[0]) },
+	[EXPORT_STATISTICS] = { "statistics", statistic_columns, sizeof(statistic_columns) / sizeof(statistic_columns[0]) }
+};
+static const char *format_extensions[] = { [EXPORT_CSV] = "csv", [EXPORT_JSONL] = "jsonl", [EXPORT_NPY] = "npy" };
+
+// One row, as the columns of its layout expect them. Text columns use text, numbers value.
+struct export_row {
+	int64_t values[EXPORT_MAX_COLUMNS];
+	const char *text;
+};
+
+struct export_output {
+	int fd;
+	enum export_format format;
+	const struct export_layout *layout;
+	char *buffer;
+	size_t length;
+	uint64_t rows;
+	int error;			// errno of the first failed write, or 0
+};
+
+static void display_usage(char *program) {
+	fprintf(stderr, "Usage: %s --table sessions|keystrokes|statistics --format csv|jsonl|npy (--output FILE | --output-dir DIR [--jobs N]) FILE...\n", program);
+}
+
+static void output_flush(struct export_output *out) {
+	size_t written = 0;
+	while(written < out->length && out->error == 0) {
+		ssize_t result = write(out->fd, out->buffer + written, out->length - written);
+		if(result < 0 && errno != EINTR)
+			out->error = errno;
+		else if(result > 0)
+			written += result;
+	}
+	out->length = 0;
+}
+
+// Make room for at least 64 more bytes, which is more than any single value takes
+static inline char *output_reserve(struct export_output *out) {
+	if(EXPORT_BUFFER_SIZE - out->length < 64)
+		output_flush(out);
+	return out->buffer + out->length;
+}
+
+static inline void output_bytes(struct export_output *out, const void *data, size_t length) {
+	if(EXPORT_BUFFER_SIZE - out->length < length)
+		output_flush(out);
+	memcpy(out->buffer + out->length, data, length);
+	out->length += length;
+}
+
+static inline void output_char(struct export_output *out, char c) {
+	*output_reserve(out) = c;
+	out->length++;
+}
+
+static inline void output_string(struct export_output *out, const char *s) {
+	output_bytes(out, s, strlen(s));
+}
+
+// Decimal digits, written backwards into a scratch buffer and copied out in one go
+static inline void output_unsigned(struct export_output *out, uint64_t value) {
+	char digits[20];
+	size_t length = 0;
+	do {
+		digits[sizeof(digits) - ++length] = '0' + value % 10;
+		value /= 10;
+	} while(value != 0);
+
+	memcpy(output_reserve(out), digits + sizeof(digits) - length, length);
+	out->length += length;
+}
+
+static inline void output_signed(struct export_output *out, int64_t value) {
+	if(value < 0) {
+		output_char(out, '-');
+		output_unsigned(out, -(uint64_t) value);
+	}
+	else {
+		output_unsigned(out, (uint64_t) value);
+	}
+}
+
+// Text is quoted, with quotes (and backslashes and control characters for JSON) escaped
+static void output_text(struct export_output *out, const char *text, size_t capacity) {
+	output_char(out, '"');
+	for(size_t i = 0; i < capacity && text[i] != '\0'; i++) {
+		unsigned char c = text[i];
+		if(out->format == EXPORT_CSV) {
+			if(c == '"')
+				output_char(out, '"');
+			output_char(out, c);
+		}
+		else if(c == '"' || c == '\\') {
+			output_char(out, '\\');
+			output_char(out, c);
+		}
+		else if(c < 0x20) {
+			static const char hex[] = "0123456789abcdef";
+			char escaped[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF] };
+			output_bytes(out, escaped, sizeof(escaped));
+		}
+		else {
+			output_char(out, c);
+		}
+	}
+	output_char(out, '"');
+}
+
+static const char *npy_type(enum export_type type) {
+	switch(type) {
+		case EXPORT_U1:		return "|u1";
+		case EXPORT_U4:		return "<u4";
+		case EXPORT_U8:		return "<u8";
+		case EXPORT_I8:		return "<i8";
+		case EXPORT_TEXT64:	return "|S64";
+	}
+	return NULL;
+}
+
+static size_t npy_size(enum export_type type) {
+	switch(type) {
+		case EXPORT_U1:		return 1;
+		case EXPORT_U4:		return 4;
+		case EXPORT_U8:		return 8;
+		case EXPORT_I8:		return 8;
+		case EXPORT_TEXT64:	return 64;
+	}
+	return 0;
+}
+
+// .npy version 1.0 header for a one dimensional structured array of rows rows, padded with
+// spaces to EXPORT_NPY_HEADER_SIZE bytes. Values are written little endian, as x86 and ARM
+// Linux store them.
+static void npy_header(const struct export_layout *layout, uint64_t rows, char header[EXPORT_NPY_HEADER_SIZE]) {
+	memset(header, ' ', EXPORT_NPY_HEADER_SIZE);
+	memcpy(header, "\x93NUMPY\x01\x00", 8);
+	uint16_t dictionary_length = EXPORT_NPY_HEADER_SIZE - 10;
+	memcpy(header + 8, &dictionary_length, sizeof(dictionary_length));
+
+	char dictionary[EXPORT_NPY_HEADER_SIZE];
+	int length = snprintf(dictionary, sizeof(dictionary), "{'descr': [");
+	for(size_t i = 0; i < layout->columns_length; i++)
+		length += snprintf(dictionary + length, sizeof(dictionary) - length, "('%s', '%s'), ", layout->columns[i].name, npy_type(layout->columns[i].type));
+	length += snprintf(dictionary + length, sizeof(dictionary) - length, "], 'fortran_order': False, 'shape': (%llu,), }", (unsigned long long) rows);
+
+	memcpy(header + 10, dictionary, length);
+	header[EXPORT_NPY_HEADER_SIZE - 1] = '\n';
+}
+
+static void output_begin(struct export_output *out) {
+	const struct export_layout *layout = out->layout;
+	if(out->format == EXPORT_NPY) {
+		char header[EXPORT_NPY_HEADER_SIZE];
+		npy_header(layout, 0, header);
+		output_bytes(out, header, sizeof(header));
+	}
+	else if(out->format == EXPORT_CSV) {
+		for(size_t i = 0; i < layout->columns_length; i++) {
+			if(i > 0)
+				output_char(out, ',');
+			output_string(out, layout->columns[i].name);
+		}
+		output_char(out, '\n');
+	}
+}
+
+// Write what is still buffered and, for .npy, the final row count. Returns 0 or an errno.
+static int output_end(struct export_output *out) {
+	output_flush(out);
+	if(out->format == EXPORT_NPY && out->error == 0) {
+		char header[EXPORT_NPY_HEADER_SIZE];
+		npy_header(out->layout, out->rows, header);
+		if(pwrite(out->fd, header, sizeof(header), 0) != sizeof(header))
+			out->error = errno != 0 ? errno : EIO;
+	}
+	return out->error;
+}
+
+static void output_row(struct export_output *out, const struct export_row *row) {
+	const struct export_layout *layout = out->layout;
+	out->rows++;
+
+	if(out->format == EXPORT_NPY) {
+		for(size_t i = 0; i < layout->columns_length; i++) {
+			if(layout->columns[i].type == EXPORT_TEXT64) {
+				char text[64] = { 0 };
+				strncpy(text, row->text, sizeof(text));
+				output_bytes(out, text, sizeof(text));
+			}
+			else {
+				output_bytes(out, &row->values[i], npy_size(layout->columns[i].type));
+			}
+		}
+		return;
+	}
+
+	if(out->format == EXPORT_JSONL)
+		output_char(out, '{');
+	for(size_t i = 0; i < layout->columns_length; i++) {
+		if(i > 0)
+			output_char(out, ',');
+		if(out->format == EXPORT_JSONL) {
+			output_char(out, '"');
+			output_string(out, layout->columns[i].name);
+			output_bytes(out, "\":", 2);
+		}
+
+		switch(layout->columns[i].type) {
+			case EXPORT_TEXT64:
+				output_text(out, row->text, 64);
+				break;
+			case EXPORT_I8:
+				output_signed(out, row->values[i]);
+				break;
+			default:
+				output_unsigned(out, (uint64_t) row->values[i]);
+				break;
+		}
+	}
+	if(out->format == EXPORT_JSONL)
+		output_char(out, '}');
+	output_char(out, '\n');
+}
+
+static int64_t timespec_to_ns(struct timespec t) {
+	return (int64_t) t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+static void export_session(struct export_output *out, uint32_t file_number, uint32_t session_number, const struct user_info *user_info, struct session *s) {
+	struct export_row row;
+	row.values[0] = file_number;
+	row.values[1] = session_number;
+	row.text = user_info->user;
+
+	switch(out->layout - layouts) {
+		case EXPORT_SESSIONS:
+			row.values[3] = s->keystrokes_length;
+			row.values[4] = s->syn_dropped_count;
+			row.values[5] = s->discarded_events;
+			row.values[6] = s->tainted_keystrokes;
+			row.values[7] = s->overlapped_keystrokes;
+			row.values[8] = s->max_rollover;
+			output_row(out, &row);
+			break;
+
+		case EXPORT_KEYSTROKES:
+			for(size_t i = 0; i < s->keystrokes_length; i++) {
+				struct keystroke *k = &s->keystrokes[i];
+				row.values[2] = i;
+				row.values[3] = (unsigned char) k->c;
+				row.values[4] = k->flags;
+				row.values[5] = k->rollover;
+				row.values[6] = timespec_to_ns(k->press_time);
+				row.values[7] = timespec_to_ns(k->release_time);
+				row.values[8] = i < s->dwell_times_length ? (long) s->dwell_times[i] : (timespec_to_ns(k->release_time) - timespec_to_ns(k->press_time)) / 1000000;
+				output_row(out, &row);
+			}
+			break;
+
+		case EXPORT_STATISTICS:
+			for(size_t i = 0; i < s->time_deltas_length && i < s->flight_times_length && i < s->release_to_press_length && i < s->release_to_release_length; i++) {
+				row.values[2] = i;
+				row.values[3] = (long) s->time_deltas[i];
+				row.values[4] = (long) s->flight_times[i];
+				row.values[5] = s->release_to_press[i];
+				row.values[6] = s->release_to_release[i];
+				output_row(out, &row);
+			}
+			break;
+	}
+}
+
+// Export every session of one input. Returns -1 if it could not be read.
+static int export_file(struct export_output *out, const char *path, uint32_t file_number, char *input_buffer) {
+	FILE *file = fopen(path, "rb");
+	if(file == NULL) {
+		fprintf(stderr, "Failed to open \"%s\": %s.\n", path, strerror(errno));
+		return -1;
+	}
+	setvbuf(file, input_buffer, _IOFBF, EXPORT_INPUT_BUFFER_SIZE);
+
+	struct user_info *user_info = NULL;
+	struct session *sessions = NULL;
+	size_t session_count = 0;
+	int result = load_sessions(file, &user_info, &sessions, &session_count);
+	fclose(file);
+	if(result != 0) {
+		fprintf(stderr, "Failed to load sessions from \"%s\".\n", path);
+		free(user_info);
+		free(sessions);
+		return -1;
+	}
+
+	for(size_t i = 0; i < session_count; i++) {
+		// Files written before the overlap block existed still have the timestamps to compute it
+		// from, rollover included (their rollover bytes are all 0)
+		if(sessions[i].release_to_press == NULL && sessions[i].keystrokes_length >= 2) {
+			set_session_rollover_from_times(&sessions[i]);
+			set_session_overlap_data(&sessions[i]);
+		}
+		export_session(out, file_number, (uint32_t) i, user_info, &sessions[i]);
+
+		free(sessions[i].keystrokes);
+		free(sessions[i].time_deltas);
+		free(sessions[i].dwell_times);
+		free(sessions[i].flight_times);
+		free(sessions[i].release_to_press);
+		free(sessions[i].release_to_release);
+	}
+	free(sessions);
+	free(user_info);
+	return 0;
+}
+
+static int output_open(struct export_output *out, const char *path, enum export_format format, const struct export_layout *layout) {
+	out->fd = strcmp(path, "-") == 0 ? STDOUT_FILENO : open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if(out->fd < 0) {
+		fprintf(stderr, "Failed to create \"%s\": %s.\n", path, strerror(errno));
+		return -1;
+	}
+	out->buffer = malloc(EXPORT_BUFFER_SIZE);
+	if(out->buffer == NULL) {
+		fprintf(stderr, "Failed to allocate memory for the output buffer.\n");
+		if(out->fd != STDOUT_FILENO)
+			close(out->fd);
+		return -1;
+	}
+	out->format = format;
+	out->layout = layout;
+	out->length = 0;
+	out->rows = 0;
+	out->error = 0;
+	output_begin(out);
+	return 0;
+}
+
+// Returns -1 if anything failed to be written
+static int output_close(struct export_output *out, const char *path) {
+	int error = output_end(out);
+	if(out->fd != STDOUT_FILENO && close(out->fd) != 0 && error == 0)
+		error = errno;
+	free(out->buffer);
+	if(error != 0) {
+		fprintf(stderr, "Failed to write \"%s\": %s.\n", path, strerror(error));
+		return -1;
+	}
+	return 0;
+}
+
+// --output-dir: inputs are handed out to the threads one at a time, in order
+struct export_jobs {
+	char **inputs;
+	size_t inputs_length;
+	atomic_size_t next;
+	const char *directory;
+	enum export_format format;
+	const struct export_layout *layout;
+	atomic_int failures;
+};
+
+static void *export_worker(void *argument) {
+	struct export_jobs *jobs = argument;
+	char *input_buffer = malloc(EXPORT_INPUT_BUFFER_SIZE);
+	if(input_buffer == NULL) {
+		atomic_fetch_add(&jobs->failures, 1);
+		return NULL;
+	}
+
+	for(size_t i = atomic_fetch_add(&jobs->next, 1); i < jobs->inputs_length; i = atomic_fetch_add(&jobs->next, 1)) {
+		const char *name = strrchr(jobs->inputs[i], '/');
+		name = name != NULL ? name + 1 : jobs->inputs[i];
+		size_t name_length = strlen(name);
+		if(name_length > 4 && strcmp(name + name_length - 4, ".bin") == 0)
+			name_length -= 4;
+
+		char path[4096];
+		if(snprintf(path, sizeof(path), "%s/%.*s.%s.%s", jobs->directory, (int) name_length, name, jobs->layout->name, format_extensions[jobs->format]) >= (int) sizeof(path)) {
+			fprintf(stderr, "The output path for \"%s\" is too long.\n", jobs->inputs[i]);
+			atomic_fetch_add(&jobs->failures, 1);
+			continue;
+		}
+
+		struct export_output out;
+		if(output_open(&out, path, jobs->format, jobs->layout) != 0) {
+			atomic_fetch_add(&jobs->failures, 1);
+			continue;
+		}
+		int result = export_file(&out, jobs->inputs[i], (uint32_t) i, input_buffer);
+		if(output_close(&out, path) != 0 || result != 0)
+			atomic_fetch_add(&jobs->failures, 1);
+	}
+
+	free(input_buffer);
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+	const char *output_path = NULL;
+	const char *output_directory = NULL;
+	long jobs_count = sysconf(_SC_NPROCESSORS_ONLN);
+	int format = -1;
+	int table = -1;
+	int first_input = argc;
+
+	for(int i = 1; i < argc; i++) {
+		bool has_value = i + 1 < argc;
+		if(strcmp(argv[i], "--format") == 0 && has_value) {
+			i++;
+			for(int f = 0; f < 3; f++) {
+				if(strcmp(argv[i], format_extensions[f]) == 0)
+					format = f;
+			}
+		}
+		else if(strcmp(argv[i], "--table") == 0 && has_value) {
+			i++;
+			for(int t = 0; t < 3; t++) {
+				if(strcmp(argv[i], layouts[t].name) == 0)
+					table = t;
+			}
+		}
+		else if(strcmp(argv[i], "--output") == 0 && has_value)
+			output_path = argv[++i];
+		else if(strcmp(argv[i], "--output-dir") == 0 && has_value)
+			output_directory = argv[++i];
+		else if(strcmp(argv[i], "--jobs") == 0 && has_value)
+			jobs_count = atol(argv[++i]);
+		else if(argv[i][0] != '-' || argv[i][1] == '\0') {
+			first_input = i;
+			break;
+		}
+		else {
+			display_usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if(format < 0 || table < 0 || first_input >= argc || (output_path == NULL) == (output_directory == NULL) || jobs_count <= 0) {
+		display_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	if(format == EXPORT_NPY && output_path != NULL && strcmp(output_path, "-") == 0) {
+		fprintf(stderr, ".npy files need their row count filled in at the end, so they cannot be written to stdout.\n");
+		return EXIT_FAILURE;
+	}
+
+	char **inputs = &argv[first_input];
+	size_t inputs_length = argc - first_input;
+
+	// Everything into one file, in input order
+	if(output_path != NULL) {
+		struct export_output out;
+		char *input_buffer = malloc(EXPORT_INPUT_BUFFER_SIZE);
+		if(input_buffer == NULL || output_open(&out, output_path, format, &layouts[table]) != 0) {
+			free(input_buffer);
+			return EXIT_FAILURE;
+		}
+
+		int failures = 0;
+		for(size_t i = 0; i < inputs_length; i++) {
+			if(export_file(&out, inputs[i], (uint32_t) i, input_buffer) != 0)
+				failures++;
+		}
+		uint64_t rows = out.rows;
+		if(output_close(&out, output_path) != 0)
+			failures++;
+		free(input_buffer);
+
+		fprintf(stderr, "Exported %llu rows from %zu file(s) to %s.\n", (unsigned long long) rows, inputs_length, output_path);
+		return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	// One file per input, in parallel
+	if(mkdir(output_directory, 0755) != 0 && errno != EEXIST) {
+		fprintf(stderr, "Failed to create \"%s\": %s.\n", output_directory, strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	struct export_jobs jobs = { .inputs = inputs, .inputs_length = inputs_length, .directory = output_directory, .format = format, .layout = &layouts[table] };
+	atomic_init(&jobs.next, 0);
+	atomic_init(&jobs.failures, 0);
+
+	if((size_t) jobs_count > inputs_length)
+		jobs_count = inputs_length;
+	pthread_t *threads = malloc(sizeof(pthread_t) * jobs_count);
+	if(threads == NULL) {
+		fprintf(stderr, "Failed to allocate memory for %ld threads.\n", jobs_count);
+		return EXIT_FAILURE;
+	}
+
+	long started = 0;
+	while(started < jobs_count && pthread_create(&threads[started], NULL, export_worker, &jobs) == 0)
+		started++;
+	if(started == 0)
+		export_worker(&jobs);
+	for(long t = 0; t < started; t++)
+		pthread_join(threads[t], NULL);
+	free(threads);
+
+	int failures = atomic_load(&jobs.failures);
+	fprintf(stderr, "Exported %zu file(s) to %s with %ld thread(s)%s.\n", inputs_length - failures, output_directory, started > 0 ? started : 1, failures > 0 ? ", some failed" : "");
+	return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
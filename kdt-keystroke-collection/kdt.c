@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -9,33 +10,843 @@
 #include <linux/input.h>
 #include <linux/input-event-codes.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <poll.h>
+#include <errno.h>
 #include "libkdt.h"
+#include "libwriter.h"
+#include "libjournal.h"
+#include "libarena.h"
 
-// Session structs are put on the stack, so they don't need to be freed, 
-// but their members do need to be freed.
-void cleanup(struct session *sessions, size_t sessions_length) {
-	struct session *current_session; 
-	for(size_t i = 0; i < sessions_length; i++) {
-		current_session = &sessions[i];
-
-		// (1) Free keystrokes
-		if(current_session->keystrokes != NULL)
-			free(current_session->keystrokes);
-
-		// (2) Free time deltas
-		if(current_session->time_deltas != NULL) 
-			free(current_session->time_deltas);
-
-		// (3) Free dwell times 
-		if(current_session->dwell_times != NULL) 
-			free(current_session->dwell_times);
-		
-		// (4) Free flight times
-		if(current_session->flight_times != NULL) 
-			free(current_session->flight_times);
+// Set by SIGUSR1 so that instrumentation can be dumped while a test is running
+static volatile sig_atomic_t instrumentation_dump_requested = 0;
+
+void request_instrumentation_dump(int signal_number) {
+	(void) signal_number;
+	instrumentation_dump_requested = 1;
+}
+
+/*
+ * Every test's session from one device, indexed by test. The table grows as tests are
+ * reported, so its size follows the run rather than being fixed (or put on the stack) up
+ * front. Each session's keystrokes and statistics are one block in the run's arena, so
+ * nothing in the table is freed on its own: the arena frees them all at once.
+ */
+struct session_table {
+	struct session *sessions;
+	size_t length;			// tests stored so far, counting any skipped (and zeroed) ones
+	size_t capacity;
+};
+
+// Store the session of test session_number (counted from 0). Returns -1 if memory ran out.
+static int session_table_store(struct session_table *table, size_t session_number, const struct session *session) {
+	if(session_number >= table->capacity) {
+		size_t capacity = table->capacity > 0 ? table->capacity : 16;
+		while(capacity <= session_number)
+			capacity *= 2;
+
+		struct session *sessions = realloc(table->sessions, capacity * sizeof(struct session));
+		if(sessions == NULL)
+			return -1;
+		table->sessions = sessions;
+		table->capacity = capacity;
+	}
+	if(session_number >= table->length) {
+		memset(&table->sessions[table->length], 0, (session_number + 1 - table->length) * sizeof(struct session));
+		table->length = session_number + 1;
+	}
+
+	table->sessions[session_number] = *session;
+	return 0;
+}
+
+// One keyboard being captured. Every device has its own assembler and sessions, and is saved
+// to its own output file.
+struct capture_device {
+	const char *path;
+	int fd;				// -1 until opened, and again once its stream ends
+	bool stream_ended;
+	struct keystroke_assembler assembler;
+	struct session_table sessions;
+
+	// Write-ahead journal (--journal), or NULL
+	struct journal *journal;
+	size_t journaled;		// keystrokes of this test already in the journal
+	struct timespec last_journaled;
+};
+
+// Time left until deadline, or false if it has already passed
+static bool time_until(const struct timespec *deadline, struct timespec *remaining) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	long nanoseconds = (deadline->tv_sec - now.tv_sec) * 1000000000L + (deadline->tv_nsec - now.tv_nsec);
+	if(nanoseconds <= 0)
+		return false;
+
+	remaining->tv_sec = nanoseconds / 1000000000L;
+	remaining->tv_nsec = nanoseconds % 1000000000L;
+	return true;
+}
+
+/*
+ * Append the keystrokes the device completed since the last append to its journal, once
+ * JOURNAL_BATCH_KEYSTROKES have built up or the oldest has waited for the journal's sync
+ * interval (or right away with force). Returns true if keystrokes are still waiting.
+ */
+static bool journal_keystrokes(struct capture_device *device, int session_number, bool force) {
+	struct journal *journal = device->journal;
+	size_t pending = device->assembler.keystrokes_length - device->journaled;
+	if(journal == NULL || pending == 0)
+		return false;
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	bool waited = timespec_difference_in_nanoseconds(device->last_journaled, now) >= (uint64_t) journal->sync_interval_ms * 1000000;
+	if(!force && !waited && pending < JOURNAL_BATCH_KEYSTROKES)
+		return true;
+
+	journal_append(journal, JOURNAL_KEYSTROKES, (uint32_t) session_number, &device->assembler.keystrokes[device->journaled], pending * sizeof(struct keystroke));
+	device->journaled += pending;
+	device->last_journaled = now;
+	return false;
+}
+
+// Raw mode collection loop: events are read straight into the log and nothing else happens
+// until the test is over. Returns true if the event stream ended before the deadline.
+static bool capture_raw_events(int fd, const struct timespec *deadline, struct raw_log *log) {
+	struct pollfd device = { .fd = fd, .events = POLLIN };
+	struct timespec remaining;
+
+	while(time_until(deadline, &remaining)) {
+		if(ppoll(&device, 1, &remaining, NULL) <= 0)
+			continue;
+
+		if(raw_log_reserve(log, RAW_LOG_READ_BATCH) != KDT_NO_ERROR) {
+			fprintf(stderr, "\nRan out of room in the raw log. This test ends early.\n");
+			return false;
+		}
+
+		// evdev only ever returns whole events, and so does a FIFO fed by kdt-replay
+		ssize_t bytes_read = read(fd, &log->events[log->header->events_length], RAW_LOG_READ_BATCH * sizeof(struct input_event));
+		if(bytes_read == 0)
+			return true;
+		if(bytes_read < 0)
+			continue;
+
+		log->header->events_length += (size_t) bytes_read / sizeof(struct input_event);
+	}
+
+	return false;
+}
+
+/*
+ * Collection loop. One ppoll() watches every device until the deadline, and each device's
+ * events go to its own assembler. The test ends early if every device's stream ends. Returns
+ * false if memory for keystrokes ran out.
+ */
+static bool capture_events(struct capture_device *devices, int device_count, int session_number, const struct timespec *deadline, struct kdt_instrumentation *instrumentation) {
+	struct pollfd pollfds[KDT_MAX_DEVICES];
+	struct input_event events[KDT_READ_BATCH];
+	struct timespec remaining;
+	int open_streams = device_count;
+
+	for(int d = 0; d < device_count; d++) {
+		pollfds[d].fd = devices[d].fd;
+		pollfds[d].events = POLLIN;
+	}
+
+	while(open_streams > 0 && time_until(deadline, &remaining)) {
+		// Keystrokes waiting for the journal must not wait longer than its sync interval
+		bool journal_pending = false;
+		for(int d = 0; d < device_count; d++) {
+			if(journal_keystrokes(&devices[d], session_number, false))
+				journal_pending = true;
+		}
+		if(journal_pending) {
+			int interval_ms = devices[0].journal->sync_interval_ms;
+			if(remaining.tv_sec > interval_ms / 1000 || (remaining.tv_sec == interval_ms / 1000 && remaining.tv_nsec > (interval_ms % 1000) * 1000000L)) {
+				remaining.tv_sec = interval_ms / 1000;
+				remaining.tv_nsec = (interval_ms % 1000) * 1000000L;
+			}
+		}
+
+		int ready = ppoll(pollfds, device_count, &remaining, NULL);
+		if (instrumentation != NULL) {
+			instrumentation->wakeups++;
+			if (ready < 0)
+				instrumentation->interrupted_wakeups++;
+
+			if (instrumentation_dump_requested) {
+				instrumentation_dump_requested = 0;
+				instrumentation_print(stderr, instrumentation);
+			}
+		}
+		if (ready <= 0)
+			continue;
+
+		for (int d = 0; d < device_count; d++) {
+			if (pollfds[d].revents == 0)
+				continue;
+
+			// Device files never report end-of-file, but a FIFO fed by kdt-replay does once the
+			// replay finishes, and an unplugged keyboard fails with ENODEV. Stop watching it.
+			ssize_t bytes_read = read(devices[d].fd, events, sizeof(events));
+			if (bytes_read == 0 || (bytes_read < 0 && errno != EINTR && errno != EAGAIN)) {
+				devices[d].stream_ended = true;
+				pollfds[d].fd = -1;
+				open_streams--;
+				continue;
+			}
+			if (bytes_read < 0)
+				continue;
+
+			size_t events_length = (size_t) bytes_read / sizeof(struct input_event);
+			for (size_t i = 0; i < events_length; i++) {
+				struct input_event *ev = &events[i];
+				if (instrumentation != NULL) {
+					struct timespec now;
+					struct timespec event_time = {
+						.tv_sec = ev->input_event_sec,
+						.tv_nsec = ev->input_event_usec * 1000
+					};
+					clock_gettime(CLOCK_MONOTONIC, &now);
+					instrumentation->events_read++;
+					histogram_record(&instrumentation->capture_latency, timespec_difference_in_nanoseconds(event_time, now));
+				}
+
+				// Pair presses with releases, echoing whatever was typed
+				int echo_character = assembler_process_event(&devices[d].assembler, ev, NULL);
+				if (echo_character == BACKSPACE) {
+					printf("\b \b");
+					fflush(stdout);
+				}
+				else if (echo_character > 0) {
+					printf("%c", echo_character);
+					fflush(stdout);
+				}
+				else if (echo_character < 0) {
+					fprintf(stderr, "\nRan out of memory for keystrokes. This test ends early.\n");
+					return false;
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+// Device 1 is saved to the output path itself. With more than one device, device N (N > 1)
+// is saved next to it with "-devN" inserted before the extension.
+static int device_output_path(const char *path, int device_index, char *buffer, size_t buffer_size) {
+	const char *extension = strrchr(path, '.');
+	const char *last_slash = strrchr(path, '/');
+	if(device_index == 0 || extension == NULL || (last_slash != NULL && extension < last_slash))
+		extension = path + strlen(path);
+
+	int written;
+	if(device_index == 0)
+		written = snprintf(buffer, buffer_size, "%s", path);
+	else
+		written = snprintf(buffer, buffer_size, "%.*s-dev%d%s", (int) (extension - path), path, device_index + 1, extension);
+
+	return written < 0 || (size_t) written >= buffer_size ? -1 : 0;
+}
+
+// Open the device file. When the events need to be comparable with kdt's own clock, have the
+// kernel stamp them with CLOCK_MONOTONIC. This fails harmlessly for FIFOs (kdt-replay
+// already uses it).
+//
+// A FIFO with no writer would block a plain open() until a writer shows up, which may be never
+// (a kdt-replay run that ended during an earlier test). Opening it non-blocking returns at
+// once; the first read then sees end-of-file and the test ends with whatever it has.
+// O_NONBLOCK is cleared afterwards so reads behave as before.
+static int open_device(const char *device_file_path, bool monotonic_timestamps) {
+	int fd = open(device_file_path, O_RDONLY | O_NONBLOCK);
+	if(fd >= 0)
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+	if(fd >= 0 && monotonic_timestamps) {
+		int clock_id = CLOCK_MONOTONIC;
+		ioctl(fd, EVIOCSCLOCKID, &clock_id);
+	}
+	return fd;
+}
+
+// Throw away the events that arrived between tests (such as the ENTER that started this one)
+static void drain_pending_events(int fd) {
+	struct input_event pending[KDT_READ_BATCH];
+	int flags = fcntl(fd, F_GETFL);
+
+	fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+	while(read(fd, pending, sizeof(pending)) > 0)
+		;
+	fcntl(fd, F_SETFL, flags);
+}
+
+// Session data lives in the run's arena, so it is freed in one go with the arena
+void cleanup_devices(struct capture_device *devices, int device_count, struct arena *arena) {
+	for(int d = 0; d < device_count; d++) {
+		free(devices[d].sessions.sessions);
+		devices[d].sessions.sessions = NULL;
+		assembler_free(&devices[d].assembler);
+		if(devices[d].fd >= 0)
+			close(devices[d].fd);
+
+		// Left behind for kdt-recover, since the run did not finish
+		if(devices[d].journal != NULL) {
+			journal_close(devices[d].journal, false);
+			free(devices[d].journal);
+			devices[d].journal = NULL;
+		}
+	}
+	arena_release(arena);
+}
+
+/*
+ * Processing a finished test (sorting, statistics, printing them and, with a plan, saving
+ * the test) happens on a background worker so that the next test can start straight away.
+ * The capture loop only copies each device's keystrokes into a session and hands the
+ * session over as a job. The job owns the session until the main thread reports it and
+ * stores it in the device's session table. The worker prints into the job's report rather than to stdout, so
+ * nothing it prints lands in the middle of a test; the main thread prints finished reports
+ * in between tests, in the order the worker finishes them.
+ */
+struct session_job {
+	struct session session;
+	struct session_table *table;	// where the session is stored once it is reported
+	const char *device_path;
+	int device_number;		// counted from 0
+	int device_count;
+	int session_number;		// counted from 0
+
+	// Copied, because a plan changes the typing duration between tests
+	struct user_info user_info;
+	char output_path[PLAN_MAX_PATH + 16];	// empty unless the session is saved once processed
+
+	// Filled in by the worker
+	int result;			// -1 if memory ran out or the session could not be saved
+	char *report;
+	size_t report_length;
+	uint64_t sort_nanoseconds;
+	uint64_t statistics_nanoseconds;
+	uint64_t save_nanoseconds;
+	struct timespec save_start;
+	FILE *out;			// the report, while the job is being processed
+
+	struct session_job *next;
+};
+
+struct session_pipeline {
+	pthread_t worker;
+	pthread_mutex_t lock;
+	pthread_cond_t job_added;
+	int notify[2];			// the worker writes a byte here every time a job is finished
+	struct async_writer writer;	// only used by the worker
+
+	struct session_job *pending;	// waiting for the worker, oldest first
+	struct session_job *finished;	// waiting to be reported, oldest first
+	size_t outstanding;		// handed over but not yet reported
+	bool closing;
+	bool stopped;			// the worker has been joined
+
+	// With a plan that retries failed tests, which tests are waiting to be taken again (one
+	// flag per test in the plan). NULL otherwise. Only used by the main thread.
+	bool *retakes;
+};
+
+// Append job to the end of a queue
+static void enqueue_job(struct session_job **queue, struct session_job *job) {
+	job->next = NULL;
+	while(*queue != NULL)
+		queue = &(*queue)->next;
+	*queue = job;
+}
+
+/*
+ * Turn a session whose keystrokes were copied in by the capture loop into a finished
+ * session: sort the keystrokes, compute its statistics and print them (into out). Returns -1
+ * if memory ran out.
+ */
+static int finish_session(struct session_job *job, FILE *out) {
+	struct timespec stage_start, stage_end;
+	enum kdt_error error_code;
+	struct session *session = &job->session;
+	struct keystroke *keystrokes = session->keystrokes;
+	size_t keystrokes_length = session->keystrokes_length;
+	int session_number = job->session_number;
+
+	if(job->device_count > 1)
+		fprintf(out, "\n[SYSTEM] Device %d (%s): %zu keystrokes.\n", job->device_number + 1, job->device_path, keystrokes_length);
+
+	// Sort keystrokes based on press time to ensure correct order
+	clock_gettime(CLOCK_MONOTONIC, &stage_start);
+	qsort(keystrokes, keystrokes_length, sizeof(struct keystroke), compare_keystrokes);
+	clock_gettime(CLOCK_MONOTONIC, &stage_end);
+	job->sort_nanoseconds = timespec_difference_in_nanoseconds(stage_start, stage_end);
+
+	if(keystrokes_length == 0) {
+		fprintf(out, "\nNo keystrokes were entered.\n");
+		return 0;
+	}
+
+	// Print the numeric values of keys pressed for current session
+	fprintf(out, "\nNumeric codes entered:\n");
+	fprintf(out, "\n%d", (int) keystrokes[0].c);
+	for(size_t i = 1; i < keystrokes_length ; i++)
+		fprintf(out, ", %d", (int) keystrokes[i].c);
+
+	fprintf(out, "\n");
+
+	for(size_t i = 0; i < keystrokes_length; i++) {
+		if(keystrokes[i].flags & KEYSTROKE_FLAG_TAINTED)
+			session->tainted_keystrokes++;
+	}
+	if(session->syn_dropped_count > 0)
+		fprintf(out, "[SYSTEM] The kernel dropped events %zu time(s) during this test. %zu events were discarded and %zu keystrokes are tainted.\n", session->syn_dropped_count, session->discarded_events, session->tainted_keystrokes);
+
+
+
+	// Store TIME DELTAS in current session (there are always N-1 time deltas where N is the number of keystrokes)
+	clock_gettime(CLOCK_MONOTONIC, &stage_start);
+	fprintf(out, "[DEBUG]Attempting to construct time_delta_array for session %d and have it point to the time deltas found with get_time_deltas_in_milliseconds...\n", session_number + 1);
+
+	error_code = set_session_statistic_data(session, STATISTIC_TIME_DELTAS);
+
+	if(error_code != KDT_NO_ERROR) {
+		fprintf(out, "[DEBUG]Something went wrong when setting the time delta information for session #%d. KDT error code was %d.\n", session_number + 1, error_code);
+	}
+	fprintf(out, "[DEBUG]Successfully found time deltas for session #%d and set the time delta buffer.\n", session_number + 1);
+
+
+
+	// Store DWELL TIMES in current session
+	fprintf(out, "[DEBUG]Attempting to construct dwell times array for session %d and have it point to the dwell times found with get_time_deltas_in_milliseconds...\n", session_number + 1);
+
+	error_code = set_session_statistic_data(session, STATISTIC_DWELL_TIMES);
+
+	if(error_code != KDT_NO_ERROR) {
+		fprintf(out, "[DEBUG]Something went wrong when setting the dwell time information for session #%d. KDT error code was %d.\n", session_number + 1, error_code);
+	}
+	fprintf(out, "[DEBUG]Successfully found dwell times for session #%d and set the dwell times buffer.\n", session_number + 1);
+
+
+
+	// Store FLIGHT TIMES in current session (there are always N-1 flight times where N is the number of keystrokes)
+	fprintf(out, "[DEBUG]Attempting to construct flight times array for session %d and have it point to the flight times found with get_flight_times_in_milliseconds...\n", session_number + 1);
+
+	error_code = set_session_statistic_data(session, STATISTIC_FLIGHT_TIMES);
+
+	if(error_code != KDT_NO_ERROR) {
+		fprintf(out, "[DEBUG]Something went wrong when setting the flight time information for session #%d. KDT error code was %d.\n", session_number + 1, error_code);
+	}
+	fprintf(out, "[DEBUG]Successfully found flight times for session #%d and set the flight times buffer.\n", session_number + 1);
+
+
+
+	// Store OVERLAP FEATURES in current session (signed release-to-press and release-to-release times, rollover)
+	error_code = set_session_overlap_data(session);
+
+	if(error_code != KDT_NO_ERROR) {
+		fprintf(out, "[DEBUG]Something went wrong when setting the overlap information for session #%d. KDT error code was %d.\n", session_number + 1, error_code);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &stage_end);
+	job->statistics_nanoseconds = timespec_difference_in_nanoseconds(stage_start, stage_end);
+
+
+
+	// Display data for current session (statistics that could not be computed are skipped)
+	unsigned long *time_deltas = session->time_deltas;
+	unsigned long *dwell_times = session->dwell_times;
+	unsigned long *flight_times = session->flight_times;
+
+	// (1) Print the time deltas
+	fprintf(out, "Time deltas:\n");
+	for(size_t i = 0; i < session->time_deltas_length; i++) {
+		fprintf(out, i == 0 ? "%ld" : ", %ld", time_deltas[i]);
+	}
+	fprintf(out, "\n");
+
+	// (2) Print the dwell times
+	fprintf(out, "\nDwell Times:\n");
+	for(size_t i = 0; i < session->dwell_times_length; i++)
+		fprintf(out, i == 0 ? "%ld" : ", %ld", dwell_times[i]);
+
+	fprintf(out, "\n");
+
+	// (3) Print the flight times
+	fprintf(out, "\nFlight Times:\n");
+	for(size_t i = 0; i < session->flight_times_length; i++)
+		fprintf(out, i == 0 ? "%ld" : ", %ld", flight_times[i]);
+
+	fprintf(out, "\n");
+
+	// (4) Print the overlap features
+	fprintf(out, "\nRelease-to-Press Times:\n");
+	for(size_t i = 0; i < session->release_to_press_length; i++)
+		fprintf(out, i == 0 ? "%ld" : ", %ld", session->release_to_press[i]);
+
+	fprintf(out, "\n");
+
+	fprintf(out, "\nRelease-to-Release Times:\n");
+	for(size_t i = 0; i < session->release_to_release_length; i++)
+		fprintf(out, i == 0 ? "%ld" : ", %ld", session->release_to_release[i]);
+
+	fprintf(out, "\n");
+	fprintf(out, "\n%zu of %zu keystrokes overlapped another key; at most %zu keys were held at once.\n", session->overlapped_keystrokes, keystrokes_length, session->max_rollover);
+	return 0;
+}
+
+// A job is finished once its report is complete and, if it is saved, its file is in place
+static void finish_job(struct session_pipeline *pipeline, struct session_job *job) {
+	fclose(job->out);
+	job->out = NULL;
+
+	pthread_mutex_lock(&pipeline->lock);
+	enqueue_job(&pipeline->finished, job);
+	// If the pipe is full, plenty of wakeups are already waiting and this one is not needed
+	ssize_t written = write(pipeline->notify[1], "", 1);
+	(void) written;
+	pthread_mutex_unlock(&pipeline->lock);
+}
+
+/*
+ * Everything the worker does for one job. With a plan, every test is saved to its own file
+ * as soon as it is processed, so a crash loses at most the tests not yet in place. The
+ * session is serialized and handed to the writer.
+ * Returns false if the job is waiting for its file to be written.
+ */
+static bool process_session_job(struct session_pipeline *pipeline, struct session_job *job) {
+	job->out = open_memstream(&job->report, &job->report_length);
+	if(job->out == NULL) {
+		job->out = fopen("/dev/null", "w");
+		job->result = -1;
+		return true;
+	}
+
+	job->result = finish_session(job, job->out);
+	if(job->result != 0 || job->output_path[0] == '\0')
+		return true;
+
+	char *serialized;
+	size_t serialized_length;
+	clock_gettime(CLOCK_MONOTONIC, &job->save_start);
+	job->result = save_sessions_to_buffer(&job->user_info, &job->session, 1, &serialized, &serialized_length);
+	if(job->result != 0 || async_writer_submit(&pipeline->writer, job->output_path, serialized, serialized_length, job) != 0) {
+		fprintf(job->out, "Error saving test %d from device %d.\n", job->session_number + 1, job->device_number + 1);
+		job->result = -1;
+		return true;
+	}
+	return false;
+}
+
+// A file handed to the writer is in place, or failed
+static void complete_saved_job(struct session_job *job, int result) {
+	struct timespec stage_end;
+	clock_gettime(CLOCK_MONOTONIC, &stage_end);
+	job->save_nanoseconds = timespec_difference_in_nanoseconds(job->save_start, stage_end);
+
+	if(result == 0) {
+		fprintf(job->out, "[SYSTEM] Test %d saved to %s\n", job->session_number + 1, job->output_path);
+	}
+	else {
+		fprintf(job->out, "Error saving test %d from device %d: %s.\n", job->session_number + 1, job->device_number + 1, strerror(-result));
+		job->result = -1;
+	}
+}
+
+/*
+ * The worker processes jobs as they come and, in between, waits for the writer. It only
+ * blocks on the disk when there is no job to process, and files waiting for their fsync
+ * batch to fill up are left alone until the pipeline closes.
+ */
+static void *session_worker(void *argument) {
+	struct session_pipeline *pipeline = argument;
+	struct async_writer_completion completions[ASYNC_WRITER_QUEUE_DEPTH];
+
+	pthread_mutex_lock(&pipeline->lock);
+	for(;;) {
+		while(pipeline->pending == NULL && !pipeline->closing && !async_writer_busy(&pipeline->writer))
+			pthread_cond_wait(&pipeline->job_added, &pipeline->lock);
+
+		struct session_job *job = pipeline->pending;
+		if(job != NULL) {
+			pipeline->pending = job->next;
+		}
+		else if(pipeline->closing && !async_writer_busy(&pipeline->writer)) {
+			// Sync the last, partial batch, and stop once every file is in place and reported
+			if(pipeline->writer.files == NULL)
+				break;
+			async_writer_flush(&pipeline->writer);
+		}
+		pthread_mutex_unlock(&pipeline->lock);
+
+		if(job != NULL && process_session_job(pipeline, job))
+			finish_job(pipeline, job);
+
+		size_t completions_length = async_writer_reap(&pipeline->writer, job == NULL, completions, ASYNC_WRITER_QUEUE_DEPTH);
+		for(size_t i = 0; i < completions_length; i++) {
+			complete_saved_job(completions[i].tag, completions[i].result);
+			finish_job(pipeline, completions[i].tag);
+		}
+
+		pthread_mutex_lock(&pipeline->lock);
+	}
+	pthread_mutex_unlock(&pipeline->lock);
+
+	return NULL;
+}
+
+// The worker inherits the calling thread's CPU affinity and scheduling policy, so this has to
+// happen before the real-time profile is applied. Otherwise the worker would compete with
+// capture for its CPU, under SCHED_FIFO.
+static int session_pipeline_start(struct session_pipeline *pipeline, unsigned int sync_batch, int writer_flags) {
+	pipeline->pending = NULL;
+	pipeline->finished = NULL;
+	pipeline->outstanding = 0;
+	pipeline->closing = false;
+	pipeline->stopped = false;
+	pipeline->retakes = NULL;
+
+	if(pipe2(pipeline->notify, O_NONBLOCK | O_CLOEXEC) != 0)
+		return -1;
+	pthread_mutex_init(&pipeline->lock, NULL);
+	pthread_cond_init(&pipeline->job_added, NULL);
+	async_writer_open(&pipeline->writer, sync_batch, writer_flags);
+
+	if(pthread_create(&pipeline->worker, NULL, session_worker, pipeline) != 0) {
+		async_writer_close(&pipeline->writer);
+		close(pipeline->notify[0]);
+		close(pipeline->notify[1]);
+		return -1;
+	}
+	return 0;
+}
+
+// The worker finishes every job already handed over before it stops
+static void stop_worker(struct session_pipeline *pipeline) {
+	if(pipeline->stopped)
+		return;
+
+	pthread_mutex_lock(&pipeline->lock);
+	pipeline->closing = true;
+	pthread_cond_signal(&pipeline->job_added);
+	pthread_mutex_unlock(&pipeline->lock);
+	pthread_join(pipeline->worker, NULL);
+	async_writer_close(&pipeline->writer);
+	pipeline->stopped = true;
+}
+
+// Jobs already handed over are still processed and saved, but nobody reports them
+static void session_pipeline_stop(struct session_pipeline *pipeline) {
+	stop_worker(pipeline);
+
+	struct session_job *job = pipeline->finished;
+	while(job != NULL) {
+		struct session_job *next = job->next;
+		free(job->report);
+		free(job);
+		job = next;
+	}
+	close(pipeline->notify[0]);
+	close(pipeline->notify[1]);
+	free(pipeline->retakes);
+	pipeline->retakes = NULL;
+}
+
+/*
+ * Hand a device's keystrokes from the test that just ended to the worker. They are copied
+ * into a session here, so the assembler can be reused for the next test at once. The session
+ * is one block from arena, with room for the statistics the worker computes. Returns -1 if
+ * memory ran out.
+ */
+static int session_pipeline_submit(struct session_pipeline *pipeline, struct capture_device *device, int device_number, int device_count, int session_number, const struct user_info *user_info, const char *output_path, struct arena *arena, struct kdt_instrumentation *instrumentation) {
+	struct timespec stage_start, stage_end;
+	size_t keystrokes_length = device->assembler.keystrokes_length;
+
+	struct session_job *job = calloc(1, sizeof(struct session_job));
+	if(job == NULL) {
+		fprintf(stderr, "Failed to allocate memory for session %d's processing.\n", session_number + 1);
+		return -1;
+	}
+	struct session *session = &job->session;
+	job->table = &device->sessions;
+	job->device_path = device->path;
+	job->device_number = device_number;
+	job->device_count = device_count;
+	job->session_number = session_number;
+	job->user_info = *user_info;
+	if(output_path != NULL)
+		strcpy(job->output_path, output_path);
+
+	// Move data into nearest, unused session struct
+	clock_gettime(CLOCK_MONOTONIC, &stage_start);
+	if(keystrokes_length > 0) {
+		void *block = arena_alloc(arena, session_block_size(keystrokes_length));
+		if(block == NULL) {
+			fprintf(stderr, "Failed to allocate memory for session %d's keystrokes buffer.\n", session_number + 1);
+			free(job);
+			return -1;
+		}
+		session_use_block(session, block, keystrokes_length);
+		memcpy(session->keystrokes, device->assembler.keystrokes, sizeof(struct keystroke) * keystrokes_length);
+	}
+	session->syn_dropped_count = device->assembler.syn_dropped_count;
+	session->discarded_events = device->assembler.discarded_events;
+	clock_gettime(CLOCK_MONOTONIC, &stage_end);
+	if(instrumentation != NULL)
+		histogram_record(&instrumentation->stage_copy, timespec_difference_in_nanoseconds(stage_start, stage_end));
+
+	pthread_mutex_lock(&pipeline->lock);
+	enqueue_job(&pipeline->pending, job);
+	pipeline->outstanding++;
+	pthread_cond_signal(&pipeline->job_added);
+	pthread_mutex_unlock(&pipeline->lock);
+	return 0;
+}
+
+/*
+ * Print the reports of the jobs the worker has finished and record how long their stages
+ * took. A test that failed is marked to be taken again if the plan retries failed tests and
+ * the run is not over yet. Returns -1 if any other failed.
+ */
+static int session_pipeline_report(struct session_pipeline *pipeline, struct kdt_instrumentation *instrumentation) {
+	int result = 0;
+	char wakeups[64];
+
+	while(read(pipeline->notify[0], wakeups, sizeof(wakeups)) > 0)
+		;
+
+	pthread_mutex_lock(&pipeline->lock);
+	struct session_job *job = pipeline->finished;
+	pipeline->finished = NULL;
+	pthread_mutex_unlock(&pipeline->lock);
+
+	while(job != NULL) {
+		struct session_job *next = job->next;
+		fwrite(job->report, 1, job->report_length, stdout);
+		if(job->result != 0 && pipeline->retakes != NULL && !pipeline->closing) {
+			if(!pipeline->retakes[job->session_number])
+				printf("[SYSTEM] Test %d will be taken again.\n", job->session_number + 1);
+			pipeline->retakes[job->session_number] = true;
+		}
+		else if(job->result != 0 || session_table_store(job->table, job->session_number, &job->session) != 0)
+			result = -1;
+		if(instrumentation != NULL) {
+			histogram_record(&instrumentation->stage_sort, job->sort_nanoseconds);
+			histogram_record(&instrumentation->stage_statistics, job->statistics_nanoseconds);
+			if(job->output_path[0] != '\0')
+				histogram_record(&instrumentation->stage_save, job->save_nanoseconds);
+		}
+		free(job->report);
+		free(job);
+		pipeline->outstanding--;
+		job = next;
+	}
+	fflush(stdout);
+
+	return result;
+}
+
+// Wait for every job handed over to be processed and saved (syncing a partial fsync batch),
+// report them and stop the worker. Returns -1 if any of them failed.
+static int session_pipeline_finish(struct session_pipeline *pipeline, struct kdt_instrumentation *instrumentation) {
+	stop_worker(pipeline);
+	int result = session_pipeline_report(pipeline, instrumentation);
+	session_pipeline_stop(pipeline);
+	return result;
+}
+
+#define NEXT_TEST_PROMPT "\n[SYSTEM] Press ENTER to take next test... "
+
+/*
+ * Rest between tests: wait for the user to answer prompt with ENTER, or for pause_seconds if it
+ * is not PLAN_PAUSE_FOR_ENTER. The first character of the answer goes in answer, if it is not
+ * NULL. Reports are printed as soon as the worker finishes them, so the user sees a test's
+ * results without having to wait for them before starting the next one. Returns -1 if
+ * processing a session failed.
+ */
+static int wait_between_tests(struct session_pipeline *pipeline, int pause_seconds, const char *prompt, int *answer, struct kdt_instrumentation *instrumentation) {
+	struct pollfd watched[2] = {
+		{ .fd = pipeline->notify[0], .events = POLLIN },
+		{ .fd = STDIN_FILENO, .events = POLLIN }
+	};
+	struct timespec deadline, remaining;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += pause_seconds;
+
+	if(pause_seconds == PLAN_PAUSE_FOR_ENTER)
+		printf("%s", prompt);
+	else
+		printf("[SYSTEM] The next test starts in %d seconds...\n", pause_seconds);
+	fflush(stdout);
+
+	for(;;) {
+		bool waiting_for_enter = pause_seconds == PLAN_PAUSE_FOR_ENTER;
+		if(!waiting_for_enter && !time_until(&deadline, &remaining))
+			return 0;
+
+		if(ppoll(watched, waiting_for_enter ? 2 : 1, waiting_for_enter ? NULL : &remaining, NULL) <= 0)
+			continue;
+
+		if(watched[0].revents != 0) {
+			size_t outstanding = pipeline->outstanding;
+			if(session_pipeline_report(pipeline, instrumentation) != 0)
+				return -1;
+			if(waiting_for_enter && pipeline->outstanding != outstanding) {
+				printf("%s", prompt);
+				fflush(stdout);
+			}
+		}
+		if(waiting_for_enter && watched[1].revents != 0) {
+			int c = fgetc(stdin);
+			if(answer != NULL)
+				*answer = c;
+			while(c != '\n' && c != EOF)
+				c = fgetc(stdin);
+			return 0;
+		}
 	}
 }
 
+// The first test waiting to be taken again, among the first tests_started, or -1
+static int next_retake(const struct session_pipeline *pipeline, int tests_started) {
+	for(int i = 0; pipeline->retakes != NULL && i < tests_started; i++) {
+		if(pipeline->retakes[i])
+			return i;
+	}
+	return -1;
+}
+
+// A plan with "retry" takes a test that could not be taken again, the way runner used to
+// launch kdt again for it. The user gets a moment to fix what went wrong (an unplugged
+// keyboard, say) first. Returns -1 if processing a session failed meanwhile.
+static int retake_test(struct session_pipeline *pipeline, int session_number, int pause_seconds, struct kdt_instrumentation *instrumentation) {
+	printf("\n[SYSTEM] Something went wrong while taking test %d. It will be taken again.\n", session_number + 1);
+	pipeline->retakes[session_number] = true;
+	return wait_between_tests(pipeline, pause_seconds == 0 ? 1 : pause_seconds, NEXT_TEST_PROMPT, NULL, instrumentation);
+}
+
+/*
+ * A plan with "checkpoint" stops before every step after the first, as runner did between
+ * durations, to report progress and ask whether to go on. Returns 1 to take the next step, 0
+ * if the user declined and -1 if processing a session failed meanwhile.
+ */
+static int plan_checkpoint(struct session_pipeline *pipeline, const struct test_plan *plan, int step, long seconds_typed, struct kdt_instrumentation *instrumentation) {
+	const struct plan_step *finished = &plan->steps[step - 1];
+	const struct plan_step *next = &plan->steps[step];
+
+	printf("\nCHECKPOINT: You just finished all %d of the %d-second tests.\n", finished->repetitions, finished->typing_duration);
+	printf("----------- The next %d tests will last for %d seconds.\n", next->repetitions, next->typing_duration);
+	printf("            So far, you have typed for %ld seconds total. That's %.2f minutes, and %.2f hours.\n", seconds_typed, seconds_typed / 60.0, seconds_typed / 3600.0);
+
+	char prompt[96];
+	int answer = 0;
+	snprintf(prompt, sizeof(prompt), "Begin next %d tests (%d sec/each)? [Y/N]: ", next->repetitions, next->typing_duration);
+	if(wait_between_tests(pipeline, PLAN_PAUSE_FOR_ENTER, prompt, &answer, instrumentation) != 0)
+		return -1;
+	return answer == 'y' || answer == 'Y';
+}
 
 int main(int argc, char **argv) {
 	// Provide usage instructions (e.g. --help) if no arguments are provided
@@ -56,12 +867,22 @@ int main(int argc, char **argv) {
 
 
 	short number_of_tests = 0;
-	char output_file_path[64];
+	char output_file_path[64] = "";
 	FILE *output_file_fh = NULL;
 	char device_file_path[64];
 	byte mode = MODE_FREE_TEXT;
+	struct kdt_options options = {
+		.instrument = false,
+		.raw = false,
+		.keymap_file_path = "",
+		.plan_file_path = "",
+		.realtime_cpu = -1,
+		.bypass_cache = false,
+		.sync_batch = 1,
+		.journal_interval_ms = -1
+	};
 
-	error_code = parse_command_line_arguments(user_info->user, user_info->email, user_info->major, &mode, &number_of_tests, &user_info->typing_duration, device_file_path, output_file_path, output_file_fh, argc, argv);
+	error_code = parse_command_line_arguments(user_info->user, user_info->email, user_info->major, &mode, &number_of_tests, &user_info->typing_duration, device_file_path, output_file_path, output_file_fh, &options, argc, argv);
 	switch(error_code) {
 		case KDT_NO_ERROR:
 			break;
@@ -86,305 +907,449 @@ int main(int argc, char **argv) {
 			break;
 	}
 
-	//printf("The typing collection will last for %d seconds.\n", typing_duration);
-	display_environment_details(user_info->user, user_info->email, user_info->major, user_info->typing_duration, number_of_tests, output_file_path, device_file_path, mode);
-
-	// Initialize shared data for timer fucntion
-	struct timer_state timer = {
-		.flag = true,
-		.seconds = user_info->typing_duration
-	};
-	
-	size_t keystrokes_length = 0;
-	size_t keystrokes_capacity = 2048;
-	struct keystroke *keystrokes = malloc(sizeof(struct keystroke) * keystrokes_capacity);
-	if(keystrokes == NULL) {
-		fprintf(stderr, "Failed to allocate memory for initial 2048 keystrokes.\n");
+	// A plan stands in for -d, -n and -o: it lists every test to take and where each is saved
+	struct test_plan plan;
+	bool planned = options.plan_file_path[0] != '\0';
+	short test_number = 0;
+	if(options.journal_interval_ms >= 0 && (planned || options.raw)) {
+		fprintf(stderr, "--journal protects the one output file written at the end of a run. --plan saves every test as soon as it is processed and --raw writes every event as it is read, so neither needs it.\n");
 		exit(EXIT_FAILURE);
 	}
-
-	unsigned char c;
-	//unsigned char bytes_read = 0;
-
-	struct session sessions[number_of_tests];
-	// make sure members are initialized. This can cause problems later otherwise
-	for(byte i = 0; i < number_of_tests; i++) {
-		sessions[i].keystrokes = NULL;
-		sessions[i].keystrokes_length = 0;
-
-		sessions[i].time_deltas = NULL;
-		sessions[i].time_deltas_length = 0;
-
-		sessions[i].dwell_times = NULL;
-		sessions[i].dwell_times_length = 0;
-
-		sessions[i].flight_times = NULL;
-		sessions[i].flight_times_length = 0;
+	if(planned) {
+		if(options.raw) {
+			fprintf(stderr, "--raw writes one raw log for the whole run, so it cannot be combined with --plan.\n");
+			exit(EXIT_FAILURE);
+		}
+		if(plan_load(&plan, options.plan_file_path) != 0) {
+			fprintf(stderr, "Failed to load plan \"%s\".\n", options.plan_file_path);
+			exit(EXIT_FAILURE);
+		}
+		number_of_tests = plan_test_count(&plan);
+		plan_test_at(&plan, 0, &user_info->typing_duration, &test_number);
 	}
-	byte sessions_length = 0;
-	unsigned long *time_deltas;
-	unsigned long *dwell_times;
-    	unsigned long *flight_times;
-
-	// Variables to track Shift state and Caps toggle
-	int shift_pressed = 0;
-	int caps_lock = 0;
-
-	pthread_t timer_thread;
-	for(int session_number = 0; session_number < number_of_tests; session_number++) {
-		// Prompt
-		printf("kdt$ "); 
-		fflush(stdout);
-
-		// Enter non-canonical mode without echoing to collect raw data
-		disable_buffering_and_echoing();
 
-		// Set timer appropriately
-		timer.flag = true;
-
-		// Create thread for timer function
-		if(pthread_create(&timer_thread, NULL, (void*)timer_function, &timer) != 0) {
-			fprintf(stderr, "Error creating timer thread.\n");
-			cleanup(sessions, number_of_tests);
+	//printf("The typing collection will last for %d seconds.\n", typing_duration);
+	display_environment_details(user_info->user, user_info->email, user_info->major, user_info->typing_duration, number_of_tests, planned ? plan.output_pattern : output_file_path, device_file_path, mode);
+	if(planned)
+		printf("[SYSTEM] Following plan \"%s\": %d tests in %zu steps.\n", options.plan_file_path, number_of_tests, plan.steps_length);
+
+	// Characters are looked up in the US QWERTY layout unless a keymap file was given
+	const struct keymap *keymap = &keymap_us_qwerty;
+	struct keymap loaded_keymap;
+	if(options.keymap_file_path[0] != '\0') {
+		if(keymap_load(&loaded_keymap, options.keymap_file_path) != 0) {
+			fprintf(stderr, "Failed to load keymap \"%s\".\n", options.keymap_file_path);
 			exit(EXIT_FAILURE);
 		}
-	
-		// Open event file for reading
-		struct input_event ev;
-		int fd = open(device_file_path, O_RDONLY);
-		if (fd == -1) {
-		    perror("Error opening device");
-		    cleanup(sessions, number_of_tests);
-		    exit(EXIT_FAILURE);
+		keymap = &loaded_keymap;
+	}
+	printf("[SYSTEM] Using keymap \"%s\".\n", keymap->name);
+
+	// Instrumentation is dumped at exit, or whenever the process receives SIGUSR1
+	struct kdt_instrumentation *instrumentation = NULL;
+	struct timespec stage_start, stage_end;
+	if(options.instrument) {
+		instrumentation = malloc(sizeof(struct kdt_instrumentation));
+		if(instrumentation == NULL) {
+			fprintf(stderr, "Failed to allocate memory for instrumentation.\n");
+			exit(EXIT_FAILURE);
 		}
-	
-		shift_pressed = 0;
-		caps_lock = 0;
-		
-		// **Active keys map**: Track keys that are pressed but not yet released
-		struct keystroke active_keys[KEY_MAX + 1];  // Store the active keys and their press times
-		int active_keys_count = 0;
-
-		// Actually collect the raw data
-		while(timer.flag == true) {
-			// Read from event file. If there is nothing *new* to read, don't do anything (continue)
-			if (read(fd, &ev, sizeof(struct input_event)) <= 0) 
-				continue;
-			
-			// New event was a key press or a key release
-			if (ev.type == EV_KEY) {
-				// Handle Shift Modifiers (Left Shift, Right Shift)
-				if (ev.code == KEY_LEFTSHIFT || ev.code == KEY_RIGHTSHIFT) {
-					// Track if the shift key is being held or released
-					shift_pressed = ev.value;
-					continue;
-				}
-				// Handle Capslock toggle (Pressing the capslock key)
-				else if(ev.code == KEY_CAPSLOCK && ev.value == 1) {
-					// Toggle stored flag
-					caps_lock = !caps_lock;
-					continue;
-				}
+		instrumentation_init(instrumentation);
 
-				// Get ASCII code based on modifers (shift and capslock)
-				int ascii_character = keycode_to_ascii(ev.code, shift_pressed, caps_lock);
-
-				// Case 1: Key Pressed
-				if (ev.value == 1) {
-					clock_gettime(CLOCK_MONOTONIC, &(active_keys[ev.code].press_time));
-
-					// Handles backspace
-					if(ascii_character == '\b' && keystrokes_length > 0) {
-						active_keys[ev.code].c = 127;
-						active_keys_count++;
-
-						printf("\b \b");
-						fflush(stdout);
-					}
-					// Handles all other characters
-					else if (ascii_character) {
-						active_keys[ev.code].c = ascii_character;
-						active_keys_count++;
-						printf("%c", ascii_character);
-						fflush(stdout);
-					}
-				}
-				// Case 2: Key Released AND it is in active keys with a already set character
-				else if (ev.value == 0 && (int) active_keys[ev.code].c != 0) {
-					clock_gettime(CLOCK_MONOTONIC, &(active_keys[ev.code].release_time));
-
-					// Store the full keystroke in the keystrokes array
-					keystrokes[keystrokes_length] = active_keys[ev.code];
-					keystrokes_length++;
-					
-					// Clear active key after release
-					active_keys[ev.code].c = 0; // Clear active key
-					active_keys_count--;
-				}
-			} // end ev.type == EV_KEY
-		} // end data collection loop
-
-		memset(active_keys, 0, sizeof(active_keys));
-		active_keys_count = 0;
-	    
-		// Close the event file we are reading from
-		close(fd);
-		// Sort keystrokes based on press time to ensure correct order
-		qsort(keystrokes, keystrokes_length, sizeof(struct keystroke), compare_keystrokes);
-			
-		// Restore canonical mode and echoing
-		fflush(stdout);
-		enable_buffering_and_echoing();
-
-		// Print the numeric values of keys pressed for current session
-		printf("\nNumeric codes entered:\n");
-		printf("\n%d", (int) keystrokes[0].c);
-		for(size_t i = 1; i < keystrokes_length ; i++)
-			printf(", %d", (int) keystrokes[i].c);
+		// No SA_RESTART: the signal should interrupt a blocked ppoll() so the dump happens promptly
+		struct sigaction dump_action = { .sa_handler = request_instrumentation_dump };
+		sigemptyset(&dump_action.sa_mask);
+		sigaction(SIGUSR1, &dump_action, NULL);
+		printf("[SYSTEM] Instrumentation enabled. Send SIGUSR1 to process %d to dump it.\n", getpid());
+	}
 
+	// Every device given with -v is captured at once, each into its own sessions and file
+	int device_count = options.device_count;
+	if(device_count > 1) {
+		if(options.raw) {
+			fprintf(stderr, "--raw records a single device, but %d were given.\n", device_count);
+			exit(EXIT_FAILURE);
+		}
+		printf("[SYSTEM] Capturing from %d devices:", device_count);
+		for(int d = 0; d < device_count; d++)
+			printf(" %s", options.device_file_paths[d]);
 		printf("\n");
-				
-		// Join thread
-		printf("[DEBUG] Attempting to join timer pthread...\n");
-		pthread_join(timer_thread, NULL);
-		printf("[DEBUG] Timer pthread joined!\n");
-
-		// Move data into nearest, unused session struct
-		printf("[DEBUG] Attempting to allocate memory for session %d's keystrokes buffer...\n", session_number + 1);
-		sessions[session_number].keystrokes = malloc(sizeof(struct keystroke) * keystrokes_length);
-		if(sessions[session_number].keystrokes == NULL) {
-			fprintf(stderr, "Failed to allocate memory for session %d's keystrokes buffer.\n", session_number + 1);
-
-			// Free other sessions to prevent memory leak
-			for(int i = 0; i < session_number; i++) {
-				if(sessions[session_number].keystrokes != NULL) 
-					free(sessions[i].keystrokes);
-				
-				if(sessions[session_number].time_deltas != NULL) 
-					free(sessions[i].time_deltas);
-				
-				if(sessions[session_number].dwell_times != NULL)
-					free(sessions[i].dwell_times);
+	}
 
-				if(sessions[i].flight_times != NULL)
-					free(sessions[i].flight_times);
-			}	
+	// In raw mode the output file is a raw log that events are read straight into. It is
+	// preallocated for the whole run, and keystrokes are assembled later by kdt-rebuild.
+	struct raw_log raw_log;
+	if(options.raw) {
+		size_t events_capacity = (size_t) RAW_LOG_EVENTS_PER_SECOND * user_info->typing_duration * number_of_tests + RAW_LOG_READ_BATCH;
+		if(raw_log_create(&raw_log, output_file_path, user_info, events_capacity, CLOCK_MONOTONIC) != KDT_NO_ERROR) {
+			fprintf(stderr, "Failed to create raw log \"%s\".\n", output_file_path);
+			exit(EXIT_FAILURE);
 		}
-		printf("[DEBUG] Session %d's keystrokes buffer was allocated successfully!\n", session_number + 1);
-		printf("[DEBUG] Attempting to copy %zu keystrokes into session %d's keystrokes buffer...\n", keystrokes_length, session_number + 1);
-
-
-
-		// Copy temporary keystrokes buffer into the current session
-		memcpy(sessions[session_number].keystrokes, keystrokes, sizeof(struct keystroke) * keystrokes_length);
-		printf("[DEBUG] Memory copied!\n");
-		sessions[session_number].keystrokes_length = keystrokes_length;
-		
-
+		printf("[SYSTEM] Raw capture enabled. Typing is not echoed; run kdt-rebuild on \"%s\" afterwards.\n", output_file_path);
+	}
 
-		// Store TIME DELTAS in current session (there are always N-1 time deltas where N is the number of keystrokes) 
-		printf("[DEBUG]Attempting to construct time_delta_array for session %d and have it point to the time deltas found with get_time_deltas_in_milliseconds...\n", session_number + 1);
-		
-		error_code = set_session_statistic_data(&sessions[session_number], STATISTIC_TIME_DELTAS); 
+	unsigned char c;
+	//unsigned char bytes_read = 0;
 
-		if(error_code != KDT_NO_ERROR) {
-			printf("[DEBUG]Something went wrong when setting the time delta information for session #%d. KDT error code was %d.\n", session_number + 1, error_code);
+	struct capture_device devices[KDT_MAX_DEVICES];
+	struct arena arena;		// every session's keystrokes and statistics, for the whole run
+	arena_init(&arena, ARENA_CHUNK_SIZE);
+	for(int d = 0; d < device_count; d++) {
+		// Devices stay open for the whole run. One is only reopened if its stream ends (a FIFO
+		// whose writer went away), so that the next test can wait for a new writer.
+		devices[d].path = options.device_file_paths[d];
+		devices[d].fd = -1;
+		devices[d].stream_ended = false;
+		devices[d].sessions = (struct session_table) { NULL, 0, 0 };
+		devices[d].journal = NULL;
+
+		// Pairs presses with releases. Its device is set once the device file is opened.
+		if(assembler_init(&devices[d].assembler, keymap, -1) != KDT_NO_ERROR) {
+			fprintf(stderr, "Failed to allocate memory for the keystroke assembler.\n");
+			exit(EXIT_FAILURE);
 		}
-		printf("[DEBUG]Successfully found time deltas for session #%d and set the time delta buffer.\n", session_number + 1);
-
+	}
 
+	// Each device's journal sits next to its output file until that file is saved
+	for(int d = 0; options.journal_interval_ms >= 0 && d < device_count; d++) {
+		char journal_path[sizeof(output_file_path) + 32];
+		if(device_output_path(output_file_path, d, journal_path, sizeof(journal_path) - 8) != 0) {
+			fprintf(stderr, "The journal path for device %d is too long.\n", d + 1);
+			cleanup_devices(devices, device_count, &arena);
+			exit(EXIT_FAILURE);
+		}
+		strcat(journal_path, ".journal");
+
+		devices[d].journal = malloc(sizeof(struct journal));
+		if(devices[d].journal == NULL || journal_create(devices[d].journal, journal_path, user_info, options.journal_interval_ms) != 0) {
+			fprintf(stderr, "Failed to create journal \"%s\".\n", journal_path);
+			free(devices[d].journal);
+			devices[d].journal = NULL;
+			cleanup_devices(devices, device_count, &arena);
+			exit(EXIT_FAILURE);
+		}
+		printf("[SYSTEM] Journaling to %s. If kdt dies, run kdt-recover on it.\n", journal_path);
+	}
 
-		// Store DWELL TIMES in current session 	
-		printf("[DEBUG]Attempting to construct dwell times array for session %d and have it point to the dwell times found with get_time_deltas_in_milliseconds...\n", session_number + 1);
+	// Finished tests are processed in the background while the next one is taken
+	struct session_pipeline pipeline;
+	int writer_flags = options.bypass_cache ? ASYNC_WRITER_DIRECT : 0;
+	if(session_pipeline_start(&pipeline, options.sync_batch, writer_flags) != 0) {
+		fprintf(stderr, "Failed to start the session processing worker.\n");
+		exit(EXIT_FAILURE);
+	}
+	printf("[SYSTEM] Output files are written with %s%s, fsynced %u at a time.\n", async_writer_backend(&pipeline.writer), options.bypass_cache ? " and O_DIRECT" : "", options.sync_batch);
+
+	// The real-time profile is applied once everything long-lived has been allocated, and the
+	// keystroke buffers are sized for the longest test so capture never allocates or faults
+	if(options.realtime_cpu >= 0) {
+		struct realtime_report realtime_report;
+		realtime_profile_apply(options.realtime_cpu, &realtime_report);
+
+		short longest_duration = user_info->typing_duration;
+		for(size_t i = 0; planned && i < plan.steps_length; i++) {
+			if(plan.steps[i].typing_duration > longest_duration)
+				longest_duration = plan.steps[i].typing_duration;
+		}
+		for(int d = 0; d < device_count; d++) {
+			if(assembler_prefault(&devices[d].assembler, (size_t) REALTIME_KEYSTROKES_PER_SECOND * longest_duration) != KDT_NO_ERROR) {
+				fprintf(stderr, "Failed to allocate memory for the keystroke assembler.\n");
+				exit(EXIT_FAILURE);
+			}
+		}
 
-		error_code = set_session_statistic_data(&sessions[session_number], STATISTIC_DWELL_TIMES);
+		realtime_report_print(stdout, &realtime_report);
+	}
 
-		if(error_code != KDT_NO_ERROR) {
-			printf("[DEBUG]Something went wrong when setting the dwell time information for session #%d. KDT error code was %d.\n", session_number + 1, error_code);
+	if(planned && plan.retry) {
+		pipeline.retakes = calloc(number_of_tests, sizeof(bool));
+		if(pipeline.retakes == NULL) {
+			fprintf(stderr, "Failed to allocate memory for the tests to take again.\n");
+			session_pipeline_stop(&pipeline);
+			cleanup_devices(devices, device_count, &arena);
+			exit(EXIT_FAILURE);
 		}
-		printf("[DEBUG]Successfully found dwell times for session #%d and set the dwell times buffer.\n", session_number + 1);
+	}
 
+	// Tests are taken in order, except that a test waiting to be taken again goes first
+	int tests_started = 0;
+	long seconds_typed = 0;
+	bool declined = false;
+	for(;;) {
+		// Results of the previous test the worker has finished since the user was last prompted
+		if(session_pipeline_report(&pipeline, instrumentation) != 0) {
+			session_pipeline_stop(&pipeline);
+			cleanup_devices(devices, device_count, &arena);
+			exit(EXIT_FAILURE);
+		}
 
+		int session_number = next_retake(&pipeline, tests_started);
+		if(session_number >= 0)
+			pipeline.retakes[session_number] = false;
+		else if(tests_started < number_of_tests)
+			session_number = tests_started++;
+		else
+			break;
 
-		// Store FLIGHT TIMES in current session (there are always N-1 flight times where N is the number of keystrokes) 
-		printf("[DEBUG]Attempting to construct flight times array for session %d and have it point to the flight times found with get_flight_times_in_milliseconds...\n", session_number + 1);
+		if(planned) {
+			plan_test_at(&plan, session_number, &user_info->typing_duration, &test_number);
+			printf("[SYSTEM] Test %d of %d (%d seconds):\n", session_number + 1, number_of_tests, user_info->typing_duration);
+		}
 
-		error_code = set_session_statistic_data(&sessions[session_number], STATISTIC_FLIGHT_TIMES);
+		// Prompt
+		printf("kdt$ "); 
+		fflush(stdout);
 
-		if(error_code != KDT_NO_ERROR) {
-			printf("[DEBUG]Something went wrong when setting the flight time information for session #%d. KDT error code was %d.\n", session_number + 1, error_code);
+		// Enter non-canonical mode without echoing to collect raw data
+		disable_buffering_and_echoing();
+	
+		// Open event files for reading, or discard what they queued since the last test
+		bool test_failed = false;
+		for(int d = 0; d < device_count; d++) {
+			if (devices[d].fd >= 0) {
+				drain_pending_events(devices[d].fd);
+			}
+			else {
+				if (session_number > 0)
+					printf("\n[SYSTEM] The stream from %s ended during an earlier test. Without a new writer this test ends at once.\nkdt$ ", devices[d].path);
+				devices[d].fd = open_device(devices[d].path, instrumentation != NULL || options.raw);
+				if (devices[d].fd == -1) {
+				    perror("Error opening device");
+				    if (pipeline.retakes != NULL) {
+					    test_failed = true;
+					    break;
+				    }
+				    session_pipeline_stop(&pipeline);
+				    cleanup_devices(devices, device_count, &arena);
+				    exit(EXIT_FAILURE);
+				}
+			}
+			devices[d].stream_ended = false;
+	
+			// Shift, caps lock and the active keys start fresh for every test
+			assembler_reset(&devices[d].assembler);
+			devices[d].assembler.fd = devices[d].fd;
+
+			if(devices[d].journal != NULL) {
+				journal_append(devices[d].journal, JOURNAL_SESSION_START, (uint32_t) session_number, NULL, 0);
+				devices[d].journaled = 0;
+				clock_gettime(CLOCK_MONOTONIC, &devices[d].last_journaled);
+			}
 		}
-		printf("[DEBUG]Successfully found flight times for session #%d and set the flight times buffer.\n", session_number + 1);
 
+		// The test lasts until its deadline; there is no timer thread
+		struct timespec deadline;
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += user_info->typing_duration;
 
-		
-		// Display data for current session
-		time_deltas = sessions[session_number].time_deltas;
-		dwell_times = sessions[session_number].dwell_times;
-		flight_times = sessions[session_number].flight_times;
+		size_t events_before = 0;
+		if(options.raw) {
+			raw_log_mark_session(&raw_log);
+			events_before = raw_log.header->events_length;
+			devices[0].stream_ended = capture_raw_events(devices[0].fd, &deadline, &raw_log);
+		}
+		else {
+			// Actually collect the raw data. Running out of memory for keystrokes ends the run, as
+			// every other allocation failure does (whatever was journaled so far can be
+			// recovered), unless the plan takes the test again.
+			if(!test_failed)
+				test_failed = !capture_events(devices, device_count, session_number, &deadline, instrumentation);
+			if(test_failed && pipeline.retakes == NULL) {
+				enable_buffering_and_echoing();
+				session_pipeline_stop(&pipeline);
+				cleanup_devices(devices, device_count, &arena);
+				exit(EXIT_FAILURE);
+			}
+		}
 
-		// (1) Print the time deltas
-		printf("Time deltas:\n");
-		printf("%ld", time_deltas[0]);
-		for(size_t i = 1; i < sessions[session_number].time_deltas_length; i++) {
-			printf(", %ld", time_deltas[i]); 
-		} 
-		printf("\n");
+		// The test is complete in the journal once its last keystrokes and its loss accounting are in
+		for(int d = 0; d < device_count; d++) {
+			if(devices[d].journal == NULL)
+				continue;
+			journal_keystrokes(&devices[d], session_number, true);
 
-		// (2) Print the dwell times
-		printf("\nDwell Times:\n");
-		printf("%ld", dwell_times[0]);
-		for(size_t i = 1; i < sessions[session_number].keystrokes_length; i++) 
-			printf(", %ld", dwell_times[i]);
+			struct journal_session_end end = {
+				.syn_dropped_count = devices[d].assembler.syn_dropped_count,
+				.discarded_events = devices[d].assembler.discarded_events
+			};
+			journal_append(devices[d].journal, JOURNAL_SESSION_END, (uint32_t) session_number, &end, sizeof(end));
+		}
 
-		printf("\n");
+		// Close the event files there is nothing more to read from
+		for(int d = 0; d < device_count; d++) {
+			if(devices[d].stream_ended) {
+				close(devices[d].fd);
+				devices[d].fd = -1;
+			}
+		}
 
-		// (3) Print the flight times
-		printf("\nFlight Times:\n");
-		printf("%ld", flight_times[0]);
-		for(size_t i = 1; i < sessions[session_number].keystrokes_length - 1; i++) 
-			printf(", %ld", flight_times[i]);
+		// Restore canonical mode and echoing
+		fflush(stdout);
+		enable_buffering_and_echoing();
 
-		printf("\n");
+		if(options.raw) {
+			printf("\n[SYSTEM] Test %d recorded %zu raw events.\n", session_number + 1, (size_t) (raw_log.header->events_length - events_before));
 
+			// Prompt user before continuing to next test
+			printf(NEXT_TEST_PROMPT);
+			c = 1;
+			while(c != '\n') 
+				c = fgetc(stdin);
+			continue;
+		}
 
-		// Reset buffer for next run. There is no need to clear out the keystrokes buffer, because
-		// the session struct has its keystrokes member set using memcpy.
-		keystrokes_length = 0;
+		if(test_failed) {
+			if(retake_test(&pipeline, session_number, plan.pause_seconds, instrumentation) != 0) {
+				session_pipeline_stop(&pipeline);
+				cleanup_devices(devices, device_count, &arena);
+				exit(EXIT_FAILURE);
+			}
+			continue;
+		}
+		seconds_typed += user_info->typing_duration;
+
+		// With a plan, every test is saved to its own file as soon as the worker has processed it
+		char test_output_path[PLAN_MAX_PATH];
+		if(planned && plan_output_path(&plan, user_info->user, user_info->typing_duration, test_number, session_number, test_output_path, sizeof(test_output_path)) != 0) {
+			fprintf(stderr, "The output path for test %d is longer than %d characters.\n", session_number + 1, PLAN_MAX_PATH - 1);
+			session_pipeline_stop(&pipeline);
+			cleanup_devices(devices, device_count, &arena);
+			exit(EXIT_FAILURE);
+		}
 
-		// Prompt user before continuing to next test
-		printf("\n[SYSTEM] Press ENTER to take next test... ");
-		c = 1;
-		while(c != '\n') 
-			c = fgetc(stdin);
+		for(int d = 0; d < device_count; d++) {
+			char device_path[PLAN_MAX_PATH + 16];
+			if(planned && device_output_path(test_output_path, d, device_path, sizeof(device_path)) != 0) {
+				fprintf(stderr, "The output path for test %d from device %d is too long.\n", session_number + 1, d + 1);
+				session_pipeline_stop(&pipeline);
+				cleanup_devices(devices, device_count, &arena);
+				exit(EXIT_FAILURE);
+			}
+			if(session_pipeline_submit(&pipeline, &devices[d], d, device_count, session_number, user_info, planned ? device_path : NULL, &arena, instrumentation) != 0) {
+				session_pipeline_stop(&pipeline);
+				cleanup_devices(devices, device_count, &arena);
+				exit(EXIT_FAILURE);
+			}
+		}
+		printf("\n[SYSTEM] Test %d is being processed.\n", session_number + 1);
+
+		// Rest before the next test, printing results as they become ready. A fixed pause from
+		// the plan replaces the ENTER prompt, and a checkpoint replaces both when the next test
+		// starts a new step.
+		bool first_of_step = false;
+		int step = planned && plan.checkpoint && next_retake(&pipeline, tests_started) < 0 ? plan_step_of(&plan, tests_started, &first_of_step) : -1;
+		int waited = 0;
+		if(step > 0 && first_of_step) {
+			waited = plan_checkpoint(&pipeline, &plan, step, seconds_typed, instrumentation);
+			declined = waited == 0;
+		}
+		else if(tests_started < number_of_tests || next_retake(&pipeline, tests_started) >= 0) {
+			waited = wait_between_tests(&pipeline, planned ? plan.pause_seconds : PLAN_PAUSE_FOR_ENTER, NEXT_TEST_PROMPT, NULL, instrumentation);
+		}
+		if(waited < 0) {
+			session_pipeline_stop(&pipeline);
+			cleanup_devices(devices, device_count, &arena);
+			exit(EXIT_FAILURE);
+		}
+		if(declined)
+			break;
 
 	} // end of main for loop for sessions
 
-	// Open output file for writing (binary mode)
-    	output_file_fh = fopen(output_file_path, "wb");
-	if (output_file_fh == NULL) {
-       		fprintf(stderr, "Error opening file \"%s\" for writing.\n", output_file_path);
+	// Wait for the worker to finish the tests still being processed
+	if(session_pipeline_finish(&pipeline, instrumentation) != 0) {
+		cleanup_devices(devices, device_count, &arena);
+		exit(EXIT_FAILURE);
+	}
+
+	if(planned) {
+		cleanup_devices(devices, device_count, &arena);
+		if(instrumentation != NULL) {
+			instrumentation_print(stderr, instrumentation);
+			free(instrumentation);
+		}
+		if(declined) {
+			printf("No more tests will be taken. The %d tests taken were saved.\n", tests_started);
+			exit(PLAN_DECLINED_EXIT_STATUS);
+		}
+		printf("All %d tests in the plan were saved.\n", number_of_tests);
+		printf("Program terminated [OK].\n");
+		return 0;
+	}
 
-		printf("Performing cleanup...");
-		cleanup(sessions, number_of_tests);
-		printf("\tdone!\n");
+	if(options.raw) {
+		size_t events_length = raw_log.header->events_length;
+		raw_log_close(&raw_log);
+		cleanup_devices(devices, device_count, &arena);
+		if(instrumentation != NULL) {
+			instrumentation_print(stderr, instrumentation);
+			free(instrumentation);
+		}
+		printf("Raw log with %zu events successfully saved to %s\n", events_length, output_file_path);
+		printf("Program terminated [OK].\n");
+		return 0;
+	}
 
-        	exit(EXIT_FAILURE);
-    	}
+	// Save session data, one file per device. Every device's file is written at once, and
+	// they are fsynced together.
+	clock_gettime(CLOCK_MONOTONIC, &stage_start);
+	struct async_writer writer;
+	async_writer_open(&writer, (unsigned int) device_count, writer_flags);
+
+	bool saved = true;
+	char device_paths[KDT_MAX_DEVICES][sizeof(output_file_path) + 16];
+	for(int d = 0; d < device_count; d++) {
+		char *serialized;
+		size_t serialized_length;
+		if (device_output_path(output_file_path, d, device_paths[d], sizeof(device_paths[d])) != 0 || save_sessions_to_buffer(user_info, devices[d].sessions.sessions, devices[d].sessions.length, &serialized, &serialized_length) != 0 || async_writer_submit(&writer, device_paths[d], serialized, serialized_length, device_paths[d]) != 0) {
+			saved = false;
+			break;
+		}
+	}
+	async_writer_flush(&writer);
+
+	struct async_writer_completion completions[KDT_MAX_DEVICES];
+	while(writer.files != NULL) {
+		size_t completions_length = async_writer_reap(&writer, true, completions, KDT_MAX_DEVICES);
+		for(size_t i = 0; i < completions_length; i++) {
+			if(completions[i].result == 0) {
+				printf("Session data successfully saved to %s\n", (char *) completions[i].tag);
+			}
+			else {
+				fprintf(stderr, "Error saving session data to %s: %s.\n", (char *) completions[i].tag, strerror(-completions[i].result));
+				saved = false;
+			}
+		}
+	}
+	async_writer_close(&writer);
 
-	// Save session data
-	if (save_sessions(output_file_fh, user_info, sessions, number_of_tests) != 0) {
+	if (!saved) {
 		fprintf(stderr, "Error saving session data to file.\n");
-		fclose(output_file_fh);
 
 		printf("Performing cleanup...");
-		cleanup(sessions, number_of_tests);
+		cleanup_devices(devices, device_count, &arena);
 		printf("\tdone!\n");
 
 		exit(EXIT_FAILURE);
 	}
-    	fclose(output_file_fh);
-    	printf("Session data successfully saved to %s\n", output_file_path);
+	clock_gettime(CLOCK_MONOTONIC, &stage_end);
+
+	// The output files are in place, so the journals have served their purpose
+	for(int d = 0; d < device_count; d++) {
+		if(devices[d].journal == NULL)
+			continue;
+		journal_close(devices[d].journal, true);
+		journal_print_statistics(stdout, devices[d].journal);
+		free(devices[d].journal);
+		devices[d].journal = NULL;
+	}
+	cleanup_devices(devices, device_count, &arena);
+
+	if(instrumentation != NULL) {
+		histogram_record(&instrumentation->stage_save, timespec_difference_in_nanoseconds(stage_start, stage_end));
+		instrumentation_print(stderr, instrumentation);
+		free(instrumentation);
+	}
 
 	printf("Program terminated [OK].\n");
 	return 0;
@@ -0,0 +1,62 @@
+#include <stdlib.h>
+#include <stddef.h>
+#include "libarena.h"
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;
+	size_t used;
+	_Alignas(ARENA_ALIGNMENT) unsigned char data[];
+};
+
+void arena_init(struct arena *arena, size_t chunk_size) {
+	arena->chunks = NULL;
+	arena->chunk_size = chunk_size > 0 ? chunk_size : ARENA_CHUNK_SIZE;
+	arena->bytes_allocated = 0;
+	arena->bytes_reserved = 0;
+}
+
+// Returns NULL if size is 0 or memory ran out
+void *arena_alloc(struct arena *arena, size_t size) {
+	if(size == 0)
+		return NULL;
+	size = (size + ARENA_ALIGNMENT - 1) & ~(size_t) (ARENA_ALIGNMENT - 1);
+
+	struct arena_chunk *chunk = arena->chunks;
+	if(chunk == NULL || chunk->size - chunk->used < size) {
+		size_t chunk_size = size > arena->chunk_size ? size : arena->chunk_size;
+		struct arena_chunk *added = malloc(sizeof(struct arena_chunk) + chunk_size);
+		if(added == NULL)
+			return NULL;
+		added->size = chunk_size;
+		added->used = 0;
+		arena->bytes_reserved += chunk_size;
+
+		// An oversized allocation gets a chunk of its own, behind the one still being
+		// filled, so the space left in that one is not wasted
+		if(chunk != NULL && chunk_size > arena->chunk_size) {
+			added->next = chunk->next;
+			chunk->next = added;
+		}
+		else {
+			added->next = chunk;
+			arena->chunks = added;
+		}
+		chunk = added;
+	}
+
+	void *allocation = chunk->data + chunk->used;
+	chunk->used += size;
+	arena->bytes_allocated += size;
+	return allocation;
+}
+
+void arena_release(struct arena *arena) {
+	struct arena_chunk *chunk = arena->chunks;
+	while(chunk != NULL) {
+		struct arena_chunk *next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+	arena_init(arena, arena->chunk_size);
+}
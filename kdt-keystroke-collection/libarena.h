@@ -0,0 +1,28 @@
+#include <stddef.h>
+#ifndef LIBARENA_H
+#define LIBARENA_H
+
+/*
+ * Bump allocator for data that lives until the end of a run. Memory is handed out from
+ * chunks of ARENA_CHUNK_SIZE bytes (or one chunk of its own for anything bigger), so an
+ * allocation is a pointer increment most of the time, and everything is freed at once by
+ * arena_release, one chunk at a time. Nothing can be freed on its own. An arena is not thread
+ * safe; allocate from one thread.
+ */
+#define ARENA_CHUNK_SIZE (1024 * 1024)
+#define ARENA_ALIGNMENT 16
+
+struct arena_chunk;
+
+struct arena {
+	struct arena_chunk *chunks;	// newest first; allocations come from the first one
+	size_t chunk_size;
+	size_t bytes_allocated;		// handed out, including alignment padding
+	size_t bytes_reserved;		// held in chunks
+};
+
+void arena_init(struct arena *arena, size_t chunk_size);
+void *arena_alloc(struct arena *arena, size_t size);
+void arena_release(struct arena *arena);
+
+#endif
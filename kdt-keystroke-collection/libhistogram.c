@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "libhistogram.h"
+
+void histogram_init(struct histogram *h, const char *name, const char *unit, uint64_t unit_divisor) {
+	h->name = name;
+	h->unit = unit;
+	h->unit_divisor = unit_divisor == 0 ? 1 : unit_divisor;
+	histogram_reset(h);
+}
+
+void histogram_reset(struct histogram *h) {
+	memset(h->counts, 0, sizeof(h->counts));
+	h->total_count = 0;
+	h->min = UINT64_MAX;
+	h->max = 0;
+	h->sum = 0;
+}
+
+// Values below HISTOGRAM_SUB_BUCKET_COUNT get a bucket each. Above that, the bucket is
+// picked by the position of the highest set bit (exponent) and the next 6 bits below it.
+static size_t bucket_index(uint64_t value) {
+	if(value < HISTOGRAM_SUB_BUCKET_COUNT)
+		return (size_t) value;
+
+	int highest_bit = 63 - __builtin_clzll(value);
+	int exponent = highest_bit - (HISTOGRAM_SUB_BUCKET_BITS - 1);
+	uint64_t sub_bucket = (value >> exponent) - HISTOGRAM_SUB_BUCKET_HALF_COUNT;
+
+	return HISTOGRAM_SUB_BUCKET_COUNT + (size_t) (exponent - 1) * HISTOGRAM_SUB_BUCKET_HALF_COUNT + (size_t) sub_bucket;
+}
+
+// Highest value that would land in the given bucket
+static uint64_t bucket_highest_value(size_t index) {
+	if(index < HISTOGRAM_SUB_BUCKET_COUNT)
+		return (uint64_t) index;
+
+	size_t offset = index - HISTOGRAM_SUB_BUCKET_COUNT;
+	int exponent = (int) (offset / HISTOGRAM_SUB_BUCKET_HALF_COUNT) + 1;
+	uint64_t sub_bucket = (offset % HISTOGRAM_SUB_BUCKET_HALF_COUNT) + HISTOGRAM_SUB_BUCKET_HALF_COUNT;
+
+	return ((sub_bucket + 1) << exponent) - 1;
+}
+
+void histogram_record(struct histogram *h, uint64_t value) {
+	h->counts[bucket_index(value)]++;
+	h->total_count++;
+	h->sum += value;
+	if(value < h->min) h->min = value;
+	if(value > h->max) h->max = value;
+}
+
+uint64_t histogram_value_at_percentile(struct histogram *h, double percentile) {
+	if(h->total_count == 0)
+		return 0;
+
+	uint64_t target = (uint64_t) ((percentile / 100.0) * h->total_count + 0.5);
+	if(target < 1) target = 1;
+
+	uint64_t seen = 0;
+	for(size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		seen += h->counts[i];
+		if(seen >= target)
+			return bucket_highest_value(i) < h->max ? bucket_highest_value(i) : h->max;
+	}
+
+	return h->max;
+}
+
+void histogram_print(FILE *out, struct histogram *h) {
+	if(h->total_count == 0) {
+		fprintf(out, "  %-28s no samples\n", h->name);
+		return;
+	}
+
+	double d = (double) h->unit_divisor;
+	fprintf(out, "  %-28s n=%-8lu min=%.1f p50=%.1f p90=%.1f p99=%.1f p99.9=%.1f max=%.1f mean=%.1f (%s)\n",
+		h->name,
+		h->total_count,
+		h->min / d,
+		histogram_value_at_percentile(h, 50.0) / d,
+		histogram_value_at_percentile(h, 90.0) / d,
+		histogram_value_at_percentile(h, 99.0) / d,
+		histogram_value_at_percentile(h, 99.9) / d,
+		h->max / d,
+		(h->sum / d) / h->total_count,
+		h->unit
+	);
+}
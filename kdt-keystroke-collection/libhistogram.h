@@ -0,0 +1,36 @@
+#include <stdio.h>
+#include <stdint.h>
+#ifndef LIBHISTOGRAM_H
+#define LIBHISTOGRAM_H
+
+/*
+ * High-dynamic-range histogram. Values are bucketed log-linearly: every power of two is
+ * split into HISTOGRAM_SUB_BUCKET_HALF_COUNT linear sub-buckets, so any recorded value
+ * is reported to within 1/64 (~1.6%) of its true value, whether it is 3 ns or 3 hours.
+ * Recording is a couple of shifts and an increment, so it is cheap enough to sit on the
+ * per-event path.
+ */
+#define HISTOGRAM_SUB_BUCKET_BITS 7
+#define HISTOGRAM_SUB_BUCKET_COUNT (1 << HISTOGRAM_SUB_BUCKET_BITS)                // 128
+#define HISTOGRAM_SUB_BUCKET_HALF_COUNT (HISTOGRAM_SUB_BUCKET_COUNT / 2)           // 64
+#define HISTOGRAM_BUCKETS (HISTOGRAM_SUB_BUCKET_COUNT + (64 - HISTOGRAM_SUB_BUCKET_BITS) * HISTOGRAM_SUB_BUCKET_HALF_COUNT)
+
+struct histogram {
+	const char *name;
+	const char *unit;		// unit values are printed in
+	uint64_t unit_divisor;		// recorded value / unit_divisor = printed value
+
+	uint64_t counts[HISTOGRAM_BUCKETS];
+	uint64_t total_count;
+	uint64_t min;
+	uint64_t max;
+	uint64_t sum;
+};
+
+void histogram_init(struct histogram *h, const char *name, const char *unit, uint64_t unit_divisor);
+void histogram_reset(struct histogram *h);
+void histogram_record(struct histogram *h, uint64_t value);
+uint64_t histogram_value_at_percentile(struct histogram *h, double percentile);
+void histogram_print(FILE *out, struct histogram *h);
+
+#endif
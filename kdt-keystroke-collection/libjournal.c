@@ -0,0 +1,346 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/uio.h>
+#include "libjournal.h"
+
+static uint32_t fnv1a(uint32_t hash, const void *data, size_t length) {
+	const unsigned char *bytes = data;
+	for(size_t i = 0; i < length; i++) {
+		hash ^= bytes[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static uint32_t record_checksum(const struct journal_record *record, const void *payload) {
+	uint32_t hash = fnv1a(2166136261u, record, offsetof(struct journal_record, checksum));
+	return fnv1a(hash, payload, record->length);
+}
+
+static void journal_set_error(struct journal *journal, int error) {
+	pthread_mutex_lock(&journal->lock);
+	if(journal->error == 0)
+		journal->error = error;
+	pthread_mutex_unlock(&journal->lock);
+}
+
+// fdatasync whatever was appended since the last sync
+static void journal_sync(struct journal *journal) {
+	uint64_t bytes_written = __atomic_load_n(&journal->bytes_written, __ATOMIC_ACQUIRE);
+	if(bytes_written == journal->bytes_synced)
+		return;
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if(fdatasync(journal->fd) != 0)
+		journal_set_error(journal, errno);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	histogram_record(&journal->sync_latency, timespec_difference_in_nanoseconds(start, end));
+	journal->bytes_synced = bytes_written;
+}
+
+// Sync the journal every interval until it is closed
+static void *journal_syncer(void *argument) {
+	struct journal *journal = argument;
+
+	pthread_mutex_lock(&journal->lock);
+	while(!journal->stopping) {
+		struct timespec wake;
+		clock_gettime(CLOCK_REALTIME, &wake);
+		wake.tv_sec += journal->sync_interval_ms / 1000;
+		wake.tv_nsec += (long) (journal->sync_interval_ms % 1000) * 1000000L;
+		if(wake.tv_nsec >= 1000000000L) {
+			wake.tv_sec++;
+			wake.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait(&journal->stop_requested, &journal->lock, &wake);
+
+		pthread_mutex_unlock(&journal->lock);
+		journal_sync(journal);
+		pthread_mutex_lock(&journal->lock);
+	}
+	pthread_mutex_unlock(&journal->lock);
+
+	return NULL;
+}
+
+/*
+ * Start a journal at path (replacing any journal there) for a run by user_info. With
+ * sync_interval_ms > 0, a thread fdatasyncs it that often; with 0, every append is synced
+ * before it returns. Returns -1 if the journal could not be created.
+ */
+int journal_create(struct journal *journal, const char *path, const struct user_info *user_info, int sync_interval_ms) {
+	memset(journal, 0, sizeof(struct journal));
+	histogram_init(&journal->append_latency, "journal: append", "us", 1000);
+	histogram_init(&journal->sync_latency, "journal: fdatasync", "us", 1000);
+	journal->sync_interval_ms = sync_interval_ms;
+
+	if(snprintf(journal->path, sizeof(journal->path), "%s", path) >= (int) sizeof(journal->path)) {
+		fprintf(stderr, "[journal_create] Path \"%s\" is too long.\n", path);
+		return -1;
+	}
+
+	journal->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0666);
+	if(journal->fd < 0) {
+		fprintf(stderr, "[journal_create] Error opening journal \"%s\" for writing.\n", path);
+		return -1;
+	}
+
+	struct journal_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+	header.keystroke_size = sizeof(struct keystroke);
+	header.user_info = *user_info;
+	if(write(journal->fd, &header, sizeof(header)) != (ssize_t) sizeof(header) || fsync(journal->fd) != 0) {
+		fprintf(stderr, "[journal_create] Failed to write the header of \"%s\".\n", path);
+		close(journal->fd);
+		unlink(path);
+		return -1;
+	}
+	journal->bytes_written = sizeof(header);
+	journal->bytes_synced = sizeof(header);
+
+	pthread_mutex_init(&journal->lock, NULL);
+	pthread_cond_init(&journal->stop_requested, NULL);
+	if(sync_interval_ms > 0) {
+		if(pthread_create(&journal->syncer, NULL, journal_syncer, journal) != 0) {
+			fprintf(stderr, "[journal_create] Failed to start the journal's sync thread.\n");
+			close(journal->fd);
+			unlink(path);
+			return -1;
+		}
+		journal->syncer_running = true;
+	}
+
+	return 0;
+}
+
+/*
+ * Append one record. The record is written with a single write(), so once this returns it
+ * survives kdt crashing; it survives the machine crashing once it has been synced. Returns
+ * -1 if the write failed, after which the journal is no longer complete.
+ */
+int journal_append(struct journal *journal, enum journal_record_type type, uint32_t session_number, const void *payload, size_t length) {
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	struct journal_record record = {
+		.type = (uint32_t) type,
+		.session_number = session_number,
+		.length = (uint32_t) length
+	};
+	record.checksum = record_checksum(&record, payload);
+
+	struct iovec pieces[2] = {
+		{ .iov_base = &record, .iov_len = sizeof(record) },
+		{ .iov_base = (void *) payload, .iov_len = length }
+	};
+	ssize_t written = writev(journal->fd, pieces, length > 0 ? 2 : 1);
+	if(written != (ssize_t) (sizeof(record) + length)) {
+		journal_set_error(journal, written < 0 ? errno : EIO);
+		return -1;
+	}
+
+	journal->records++;
+	__atomic_add_fetch(&journal->bytes_written, (uint64_t) written, __ATOMIC_RELEASE);
+	if(journal->sync_interval_ms == 0)
+		journal_sync(journal);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	histogram_record(&journal->append_latency, timespec_difference_in_nanoseconds(start, end));
+	return 0;
+}
+
+// Stop syncing and close the journal, syncing it one last time. Once the output file it
+// protects is saved, it is no longer needed and remove_file deletes it.
+void journal_close(struct journal *journal, bool remove_file) {
+	if(journal->syncer_running) {
+		pthread_mutex_lock(&journal->lock);
+		journal->stopping = true;
+		pthread_cond_signal(&journal->stop_requested);
+		pthread_mutex_unlock(&journal->lock);
+		pthread_join(journal->syncer, NULL);
+		journal->syncer_running = false;
+	}
+
+	journal_sync(journal);
+	close(journal->fd);
+	journal->fd = -1;
+
+	if(remove_file)
+		unlink(journal->path);
+}
+
+void journal_print_statistics(FILE *out, struct journal *journal) {
+	fprintf(out, "[SYSTEM] Journal \"%s\": %zu records, %lu bytes, ", journal->path, journal->records, (unsigned long) journal->bytes_written);
+	if(journal->sync_interval_ms > 0)
+		fprintf(out, "synced every %d ms.\n", journal->sync_interval_ms);
+	else
+		fprintf(out, "synced on every append.\n");
+	if(journal->error != 0)
+		fprintf(out, "[SYSTEM] The journal is incomplete: %s.\n", strerror(journal->error));
+
+	histogram_print(out, &journal->append_latency);
+	histogram_print(out, &journal->sync_latency);
+}
+
+// Make sure sessions has room for session_number, clearing any new sessions
+static enum kdt_error recovery_reserve(struct session **sessions, bool **started, size_t *sessions_length, uint32_t session_number) {
+	if(session_number < *sessions_length)
+		return KDT_NO_ERROR;
+
+	size_t new_length = (size_t) session_number + 1;
+	struct session *new_sessions = realloc(*sessions, new_length * sizeof(struct session));
+	if(new_sessions == NULL)
+		return KDT_MALLOC_FAILURE;
+	*sessions = new_sessions;
+
+	bool *new_started = realloc(*started, new_length * sizeof(bool));
+	if(new_started == NULL)
+		return KDT_MALLOC_FAILURE;
+	*started = new_started;
+
+	memset(&new_sessions[*sessions_length], 0, (new_length - *sessions_length) * sizeof(struct session));
+	memset(&new_started[*sessions_length], 0, (new_length - *sessions_length) * sizeof(bool));
+	*sessions_length = new_length;
+	return KDT_NO_ERROR;
+}
+
+/*
+ * Rebuild the sessions recorded in a journal: every session that was started, whether it
+ * ended or not, in the order they were taken. Reading stops at the first record that is
+ * incomplete or fails its checksum, which is where the crash happened.
+ */
+enum kdt_error journal_recover(const char *path, struct user_info **user_info, struct session **sessions, size_t *session_count, struct journal_recovery *recovery) {
+	memset(recovery, 0, sizeof(struct journal_recovery));
+	*user_info = NULL;
+	*sessions = NULL;
+	*session_count = 0;
+
+	FILE *journal_fh = fopen(path, "rb");
+	if(journal_fh == NULL) {
+		fprintf(stderr, "[journal_recover] Failed to open journal \"%s\".\n", path);
+		return KDT_INVALID_ARGUMENT_VALUE;
+	}
+
+	struct journal_header header;
+	if(fread(&header, sizeof(header), 1, journal_fh) != 1 || memcmp(header.magic, JOURNAL_MAGIC, sizeof(header.magic)) != 0) {
+		fprintf(stderr, "[journal_recover] \"%s\" is not a kdt journal.\n", path);
+		fclose(journal_fh);
+		return KDT_INVALID_ARGUMENT_VALUE;
+	}
+	if(header.keystroke_size != sizeof(struct keystroke)) {
+		fprintf(stderr, "[journal_recover] \"%s\" was written by a kdt with a different keystroke layout.\n", path);
+		fclose(journal_fh);
+		return KDT_INVALID_ARGUMENT_VALUE;
+	}
+	recovery->valid_bytes = sizeof(header);
+
+	struct session *recovered = NULL;
+	bool *started = NULL;
+	size_t recovered_length = 0;
+	unsigned char *payload = NULL;
+	size_t payload_capacity = 0;
+	enum kdt_error error_code = KDT_NO_ERROR;
+
+	struct journal_record record;
+	while(error_code == KDT_NO_ERROR && fread(&record, sizeof(record), 1, journal_fh) == 1) {
+		if(record.length > payload_capacity) {
+			unsigned char *new_payload = realloc(payload, record.length);
+			if(new_payload == NULL)
+				break;	// a torn length field can ask for anything
+			payload = new_payload;
+			payload_capacity = record.length;
+		}
+		if(record.length > 0 && fread(payload, record.length, 1, journal_fh) != 1)
+			break;
+		if(record_checksum(&record, payload) != record.checksum)
+			break;
+
+		error_code = recovery_reserve(&recovered, &started, &recovered_length, record.session_number);
+		if(error_code != KDT_NO_ERROR)
+			break;
+		struct session *s = &recovered[record.session_number];
+
+		if(record.type == JOURNAL_SESSION_START) {
+			started[record.session_number] = true;
+			recovery->partial_sessions++;
+		}
+		else if(record.type == JOURNAL_KEYSTROKES && record.length % sizeof(struct keystroke) == 0) {
+			size_t count = record.length / sizeof(struct keystroke);
+			struct keystroke *keystrokes = realloc(s->keystrokes, (s->keystrokes_length + count) * sizeof(struct keystroke));
+			if(keystrokes == NULL) {
+				error_code = KDT_MALLOC_FAILURE;
+				break;
+			}
+			memcpy(&keystrokes[s->keystrokes_length], payload, record.length);
+			s->keystrokes = keystrokes;
+			s->keystrokes_length += count;
+		}
+		else if(record.type == JOURNAL_SESSION_END && record.length == sizeof(struct journal_session_end)) {
+			struct journal_session_end end;
+			memcpy(&end, payload, sizeof(end));
+			s->syn_dropped_count = (size_t) end.syn_dropped_count;
+			s->discarded_events = (size_t) end.discarded_events;
+			recovery->partial_sessions--;
+			recovery->complete_sessions++;
+		}
+
+		recovery->records++;
+		recovery->valid_bytes += sizeof(record) + record.length;
+	}
+	fseek(journal_fh, 0, SEEK_END);
+	recovery->file_bytes = (size_t) ftell(journal_fh);
+	fclose(journal_fh);
+	free(payload);
+
+	// Sessions that were never started (none, unless the journal is damaged) are dropped
+	size_t count = 0;
+	for(size_t i = 0; i < recovered_length; i++) {
+		if(started[i])
+			recovered[count++] = recovered[i];
+		else
+			free(recovered[i].keystrokes);
+	}
+	free(started);
+
+	for(size_t i = 0; error_code == KDT_NO_ERROR && i < count; i++) {
+		struct session *s = &recovered[i];
+		for(size_t j = 0; j < s->keystrokes_length; j++) {
+			if(s->keystrokes[j].flags & KEYSTROKE_FLAG_TAINTED)
+				s->tainted_keystrokes++;
+		}
+		if(compute_session_statistics(s) == KDT_MALLOC_FAILURE)
+			error_code = KDT_MALLOC_FAILURE;
+	}
+
+	*user_info = malloc(sizeof(struct user_info));
+	if(error_code == KDT_NO_ERROR && *user_info == NULL)
+		error_code = KDT_MALLOC_FAILURE;
+	if(error_code != KDT_NO_ERROR) {
+		for(size_t i = 0; i < count; i++) {
+			free(recovered[i].keystrokes);
+			free(recovered[i].time_deltas);
+			free(recovered[i].dwell_times);
+			free(recovered[i].flight_times);
+			free(recovered[i].release_to_press);
+			free(recovered[i].release_to_release);
+		}
+		free(recovered);
+		free(*user_info);
+		*user_info = NULL;
+		return error_code;
+	}
+
+	**user_info = header.user_info;
+	*sessions = recovered;
+	*session_count = count;
+	return KDT_NO_ERROR;
+}
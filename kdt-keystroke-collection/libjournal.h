@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+#include "libkdt.h"
+#ifndef LIBJOURNAL_H
+#define LIBJOURNAL_H
+
+/*
+ * Write-ahead journal. While kdt runs, every completed keystroke is appended to a journal
+ * next to the output file in small batches, and a background thread fdatasyncs it every
+ * sync interval. If kdt dies before the output file is saved, kdt-recover rebuilds it from
+ * the journal, losing at most the keystrokes of about two sync intervals (one waiting to be
+ * appended, one waiting to be synced). Once the output file is saved, the journal is removed.
+ *
+ * The journal is a header followed by records, each checksummed so that a record torn by
+ * the crash (and everything after it) is recognized and ignored.
+ */
+#define JOURNAL_MAGIC "KDTJNL1"
+#define JOURNAL_BATCH_KEYSTROKES 16		// keystrokes appended at once, unless the interval passes first
+#define JOURNAL_DEFAULT_SYNC_INTERVAL_MS 1000
+
+enum journal_record_type {	JOURNAL_SESSION_START = 1,
+				JOURNAL_KEYSTROKES = 2,		// payload: struct keystroke[]
+				JOURNAL_SESSION_END = 3		// payload: struct journal_session_end
+			};
+
+struct journal_header {
+	char magic[8];
+	uint32_t keystroke_size;	// sizeof(struct keystroke) of the machine that wrote it
+	uint32_t reserved;
+	struct user_info user_info;
+};
+
+struct journal_record {
+	uint32_t type;
+	uint32_t session_number;	// counted from 0
+	uint32_t length;		// bytes of payload that follow
+	uint32_t checksum;		// FNV-1a of the three fields above and the payload
+};
+
+struct journal_session_end {
+	uint64_t syn_dropped_count;
+	uint64_t discarded_events;
+};
+
+struct journal {
+	int fd;
+	char path[PATH_MAX];
+	int sync_interval_ms;		// 0 syncs every record as it is appended
+
+	// Background fdatasync
+	pthread_t syncer;
+	bool syncer_running;
+	pthread_mutex_t lock;
+	pthread_cond_t stop_requested;
+	bool stopping;
+
+	uint64_t bytes_written;		// shared with the syncer
+	uint64_t bytes_synced;
+	size_t records;
+	int error;			// errno of the first failed write or sync, or 0
+
+	// What durability costs. Appends are timed on the capture thread, syncs on the syncer.
+	struct histogram append_latency;
+	struct histogram sync_latency;
+};
+
+// What kdt-recover found in a journal
+struct journal_recovery {
+	size_t records;
+	size_t complete_sessions;
+	size_t partial_sessions;	// started but never ended (the crash happened during them)
+	size_t valid_bytes;
+	size_t file_bytes;		// more than valid_bytes if the tail was torn
+};
+
+int journal_create(struct journal *journal, const char *path, const struct user_info *user_info, int sync_interval_ms);
+int journal_append(struct journal *journal, enum journal_record_type type, uint32_t session_number, const void *payload, size_t length);
+void journal_close(struct journal *journal, bool remove_file);
+void journal_print_statistics(FILE *out, struct journal *journal);
+enum kdt_error journal_recover(const char *path, struct user_info **user_info, struct session **sessions, size_t *session_count, struct journal_recovery *recovery);
+
+#endif
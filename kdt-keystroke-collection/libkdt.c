@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -10,6 +11,12 @@
 #include <linux/input-event-codes.h>
 #include <fcntl.h>
 #include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include <sched.h>
+#include <errno.h>
 #include "libkdt.h"
 
 void disable_buffering_and_echoing() {
@@ -38,6 +45,14 @@ void timer_function(void* arg) {
 }
 
 // Statistic function #1: Get time deltas
+static void fill_time_deltas_in_milliseconds(struct keystroke *keystrokes, size_t keystrokes_length, unsigned long *time_deltas) {
+	for(size_t i = 0; i < keystrokes_length - 1; i++) {
+		unsigned long whole_seconds_difference_in_ms = 1000 * (keystrokes[i+1].press_time.tv_sec - keystrokes[i].press_time.tv_sec);
+		unsigned long nanoseconds_difference_in_ms   = (keystrokes[i+1].press_time.tv_nsec - keystrokes[i].press_time.tv_nsec) / 1000000;
+		time_deltas[i] = whole_seconds_difference_in_ms + nanoseconds_difference_in_ms;	
+	}
+}
+
 unsigned long* get_time_deltas_in_milliseconds(struct keystroke *keystrokes, size_t keystrokes_length) {
 	if(keystrokes == NULL) return NULL;
 	
@@ -52,17 +67,19 @@ unsigned long* get_time_deltas_in_milliseconds(struct keystroke *keystrokes, siz
 		return NULL;
 	}
 	
-	// Actually get dwell times
-	for(size_t i = 0; i < keystrokes_length - 1; i++) {
-		unsigned long whole_seconds_difference_in_ms = 1000 * (keystrokes[i+1].press_time.tv_sec - keystrokes[i].press_time.tv_sec);
-		unsigned long nanoseconds_difference_in_ms   = (keystrokes[i+1].press_time.tv_nsec - keystrokes[i].press_time.tv_nsec) / 1000000;
-		time_deltas[i] = whole_seconds_difference_in_ms + nanoseconds_difference_in_ms;	
-	}
-
+	fill_time_deltas_in_milliseconds(keystrokes, keystrokes_length, time_deltas);
 	return time_deltas;
 }
 
 // Statistics function #2: Dwell times (time between press and release of one key)
+static void fill_dwell_times_in_milliseconds(struct keystroke *keystrokes, size_t keystrokes_length, unsigned long *dwell_times) {
+	for(size_t i = 0; i < keystrokes_length; i++) {
+		unsigned long whole_seconds_difference_in_ms = 1000 * (keystrokes[i].release_time.tv_sec - keystrokes[i].press_time.tv_sec);
+		unsigned long nanoseconds_difference_in_ms   = (keystrokes[i].release_time.tv_nsec - keystrokes[i].press_time.tv_nsec) / 1000000;
+		dwell_times[i] = whole_seconds_difference_in_ms + nanoseconds_difference_in_ms;	
+	}
+}
+
 unsigned long* get_dwell_times_in_milliseconds(struct keystroke *keystrokes, size_t keystrokes_length) {
 	if(keystrokes == NULL) return NULL;
 
@@ -77,17 +94,20 @@ unsigned long* get_dwell_times_in_milliseconds(struct keystroke *keystrokes, siz
 		return NULL;
 	}
 
-	// Actually get dwell times
-	for(size_t i = 0; i < keystrokes_length; i++) {
-		unsigned long whole_seconds_difference_in_ms = 1000 * (keystrokes[i].release_time.tv_sec - keystrokes[i].press_time.tv_sec);
-		unsigned long nanoseconds_difference_in_ms   = (keystrokes[i].release_time.tv_nsec - keystrokes[i].press_time.tv_nsec) / 1000000;
-		dwell_times[i] = whole_seconds_difference_in_ms + nanoseconds_difference_in_ms;	
-	}
-
+	fill_dwell_times_in_milliseconds(keystrokes, keystrokes_length, dwell_times);
 	return dwell_times;
 }
 
 // Statistics function #3: Flight times (time between key-up of one key and key-down of another key)
+static void fill_flight_times_in_milliseconds(struct keystroke *keystrokes, size_t keystrokes_length, unsigned long *flight_times) {
+	for(size_t i = 0; i < keystrokes_length - 1; i++) {
+		unsigned long whole_seconds_difference_in_ms = 1000 * labs(keystrokes[i + 1].press_time.tv_sec - keystrokes[i].release_time.tv_sec);
+		unsigned long nanoseconds_difference_in_ms   = labs(keystrokes[i + 1].press_time.tv_nsec - keystrokes[i].release_time.tv_nsec) / 1000000;
+
+		flight_times[i] = whole_seconds_difference_in_ms + nanoseconds_difference_in_ms;
+	}
+}
+
 unsigned long* get_flight_times_in_milliseconds(struct keystroke *keystrokes, size_t keystrokes_length) {
 	if(keystrokes == NULL) return NULL;
 
@@ -102,16 +122,37 @@ unsigned long* get_flight_times_in_milliseconds(struct keystroke *keystrokes, si
 		return NULL;
 	}
 		
-	// Actually find flight times
-	for(size_t i = 0; i < keystrokes_length - 1; i++) {
-		unsigned long whole_seconds_difference_in_ms = 1000 * labs(keystrokes[i + 1].press_time.tv_sec - keystrokes[i].release_time.tv_sec);
-		unsigned long nanoseconds_difference_in_ms   = labs(keystrokes[i + 1].press_time.tv_nsec - keystrokes[i].release_time.tv_nsec) / 1000000;
+	fill_flight_times_in_milliseconds(keystrokes, keystrokes_length, flight_times);
+	return flight_times;
+}
 
-		flight_times[i] = whole_seconds_difference_in_ms + nanoseconds_difference_in_ms;
-	}
+// Bytes needed to hold a session of keystrokes_length keystrokes and all of its statistics
+// in one block (see session_use_block)
+size_t session_block_size(size_t keystrokes_length) {
+	size_t between_keystrokes = keystrokes_length > 0 ? keystrokes_length - 1 : 0;
+	return keystrokes_length * sizeof(struct keystroke) + (keystrokes_length + 2 * between_keystrokes) * sizeof(unsigned long) + 2 * between_keystrokes * sizeof(long);
+}
 
-	
-	return flight_times;
+/*
+ * Lay a session's keystrokes and statistics out in one block of session_block_size bytes, so
+ * the session is a single allocation. The keystrokes still have to be copied in. Since the
+ * statistics arrays are no longer NULL, set_session_statistic_data fills them in place.
+ */
+void session_use_block(struct session *s, void *block, size_t keystrokes_length) {
+	size_t between_keystrokes = keystrokes_length > 0 ? keystrokes_length - 1 : 0;
+
+	s->keystrokes = block;
+	s->keystrokes_length = keystrokes_length;
+	s->time_deltas = (unsigned long *) (s->keystrokes + keystrokes_length);
+	s->time_deltas_length = 0;
+	s->dwell_times = s->time_deltas + between_keystrokes;
+	s->dwell_times_length = 0;
+	s->flight_times = s->dwell_times + keystrokes_length;
+	s->flight_times_length = 0;
+	s->release_to_press = (long *) (s->flight_times + between_keystrokes);
+	s->release_to_press_length = 0;
+	s->release_to_release = s->release_to_press + between_keystrokes;
+	s->release_to_release_length = 0;
 }
 
 // Efficiently set sessions with data. More concise than what we were doing before
@@ -122,38 +163,38 @@ enum kdt_error set_session_statistic_data( struct session *s, enum kdt_statistic
 	}
 	
 	// Determine what statistic we are calculating, then set
-	unsigned long *statistic_array;
+	unsigned long **statistic_array;
 	size_t *statistic_array_length;
+	size_t statistic_length;
+	size_t minimum_keystrokes;
 	unsigned long* (*statistics_function)(struct keystroke*, size_t);
+	void (*fill_function)(struct keystroke*, size_t, unsigned long*);
 	switch(statistic_code) {
 		case STATISTIC_TIME_DELTAS:
+			statistic_array = &(s->time_deltas);
 			statistic_array_length = &(s->time_deltas_length);
-			// Get statistics, then set statistics array and length member
+			statistic_length = s->keystrokes_length - 1;	// times between keystrokes, so there are n-1 of these
+			minimum_keystrokes = 2;
 			statistics_function = get_time_deltas_in_milliseconds;
-			statistic_array = statistics_function(s->keystrokes, s->keystrokes_length);
-			
-			s->time_deltas = statistic_array;
-			s->time_deltas_length = s->keystrokes_length - 1;	// times between keystrokes, so there are n-1 of these
+			fill_function = fill_time_deltas_in_milliseconds;
 			break;
 
 		case STATISTIC_DWELL_TIMES:
+			statistic_array = &(s->dwell_times);
 			statistic_array_length = &(s->dwell_times_length);
-			// Get statistics, then set statistics array and length member
+			statistic_length = s->keystrokes_length;
+			minimum_keystrokes = 1;
 			statistics_function = get_dwell_times_in_milliseconds;
-			statistic_array = statistics_function(s->keystrokes, s->keystrokes_length);
-
-			s->dwell_times = statistic_array;
-			s->dwell_times_length = s->keystrokes_length;
+			fill_function = fill_dwell_times_in_milliseconds;
 			break;
 
 		case STATISTIC_FLIGHT_TIMES:		
+			statistic_array = &(s->flight_times);
 			statistic_array_length = &(s->flight_times_length);
-			// Get statistics, then set statistics array and length member
+			statistic_length = s->keystrokes_length - 1;	// times between keystrokes, so there are n-1 of these
+			minimum_keystrokes = 2;
 			statistics_function = get_flight_times_in_milliseconds;
-			statistic_array = statistics_function(s->keystrokes, s->keystrokes_length);
-			
-			s->flight_times = statistic_array;
-			s->flight_times_length = s->keystrokes_length - 1;	// times between keystrokes, so there are n-1 of these
+			fill_function = fill_flight_times_in_milliseconds;
 			break;
 
 		default:
@@ -162,16 +203,116 @@ enum kdt_error set_session_statistic_data( struct session *s, enum kdt_statistic
 			break;
 	}
 
+	// A session laid out with session_use_block already has room for the statistic
+	if(*statistic_array != NULL && s->keystrokes != NULL && s->keystrokes_length >= minimum_keystrokes) {
+		fill_function(s->keystrokes, s->keystrokes_length, *statistic_array);
+		(*statistic_array_length) = statistic_length;
+		return KDT_NO_ERROR;
+	}
+
+	// Get statistics, then set statistics array and length member
+	*statistic_array = statistics_function(s->keystrokes, s->keystrokes_length);
+
 	// If something went wrong, then our statistics buffer was set to NULL.
-	if(statistic_array == NULL) {
+	if(*statistic_array == NULL) {
 		fprintf(stderr, "[set_session_statistic_data] The statistics function associated with kdt_statistic code \"%d\" returned NULL.\n", statistic_code);
 		(*statistic_array_length) = 0;
 		return KDT_NULL_ERROR;
 	}
+	(*statistic_array_length) = statistic_length;
 	
 	return KDT_NO_ERROR;
 }
 
+static long milliseconds_between(const struct timespec *from, const struct timespec *to) {
+	return ((to->tv_sec - from->tv_sec) * 1000000000L + (to->tv_nsec - from->tv_nsec)) / 1000000;
+}
+
+/*
+ * Overlap features of a session whose keystrokes are sorted by press time: signed
+ * release-to-press and release-to-release times between consecutive keystrokes, in
+ * milliseconds, and how much the keystrokes overlapped, from the rollover the assembler
+ * recorded for each one. Like the other statistics, the arrays are filled in place if the
+ * session was laid out with session_use_block.
+ */
+enum kdt_error set_session_overlap_data(struct session *s) {
+	if(s == NULL || s->keystrokes == NULL) {
+		fprintf(stderr, "[set_session_overlap_data] Cannot use a session without keystrokes.\n");
+		return KDT_INVALID_ARGUMENT_VALUE;
+	}
+
+	s->overlapped_keystrokes = 0;
+	s->max_rollover = 0;
+	for(size_t i = 0; i < s->keystrokes_length; i++) {
+		if(s->keystrokes[i].rollover > 0)
+			s->overlapped_keystrokes++;
+		if((size_t) s->keystrokes[i].rollover + 1 > s->max_rollover)
+			s->max_rollover = (size_t) s->keystrokes[i].rollover + 1;
+	}
+
+	s->release_to_press_length = 0;
+	s->release_to_release_length = 0;
+	if(s->keystrokes_length < 2) {
+		fprintf(stderr, "[set_session_overlap_data] Release times cannot be found with a keystrokes buffer that is less than 2 keystrokes long.\n");
+		return KDT_NULL_ERROR;
+	}
+
+	size_t length = s->keystrokes_length - 1;
+	if(s->release_to_press == NULL)
+		s->release_to_press = malloc(sizeof(long) * length);
+	if(s->release_to_release == NULL)
+		s->release_to_release = malloc(sizeof(long) * length);
+	if(s->release_to_press == NULL || s->release_to_release == NULL) {
+		fprintf(stderr, "[set_session_overlap_data] Error allocating memory for release times buffers.\n");
+		return KDT_MALLOC_FAILURE;
+	}
+
+	for(size_t i = 0; i < length; i++) {
+		s->release_to_press[i] = milliseconds_between(&s->keystrokes[i].release_time, &s->keystrokes[i + 1].press_time);
+		s->release_to_release[i] = milliseconds_between(&s->keystrokes[i].release_time, &s->keystrokes[i + 1].release_time);
+	}
+	s->release_to_press_length = length;
+	s->release_to_release_length = length;
+
+	return KDT_NO_ERROR;
+}
+
+/*
+ * Rollover of each keystroke of a session sorted by press time, found from the press and
+ * release times alone: the keys pressed earlier and not yet released when it was pressed. For
+ * files written before the overlap block existed, whose rollover bytes are all 0; call it
+ * before set_session_overlap_data.
+ */
+enum kdt_error set_session_rollover_from_times(struct session *s) {
+	if(s == NULL || s->keystrokes == NULL) {
+		fprintf(stderr, "[set_session_rollover_from_times] Cannot use a session without keystrokes.\n");
+		return KDT_INVALID_ARGUMENT_VALUE;
+	}
+
+	// Release times of the keys still held, in no particular order
+	struct timespec *held = malloc(sizeof(struct timespec) * (s->keystrokes_length > 0 ? s->keystrokes_length : 1));
+	if(held == NULL) {
+		fprintf(stderr, "[set_session_rollover_from_times] Error allocating memory for %zu held keys.\n", s->keystrokes_length);
+		return KDT_MALLOC_FAILURE;
+	}
+
+	size_t held_count = 0;
+	for(size_t i = 0; i < s->keystrokes_length; i++) {
+		const struct timespec *press = &s->keystrokes[i].press_time;
+		for(size_t h = 0; h < held_count; ) {
+			if(held[h].tv_sec < press->tv_sec || (held[h].tv_sec == press->tv_sec && held[h].tv_nsec <= press->tv_nsec))
+				held[h] = held[--held_count];
+			else
+				h++;
+		}
+		s->keystrokes[i].rollover = held_count > 255 ? 255 : (byte) held_count;
+		held[held_count++] = s->keystrokes[i].release_time;
+	}
+
+	free(held);
+	return KDT_NO_ERROR;
+}
+
 
 void display_help_text() {
 	FILE *help_fh = fopen("res/help.txt", "r");
@@ -220,7 +361,7 @@ void display_environment_details(char user[], char email[], char major[], int du
 	);
 }
 
-enum kdt_error parse_command_line_arguments(char *user, char *email, char *major, byte *mode, short *number_of_tests, short *typing_duration, char *device_file_path, char *output_file_path, FILE *output_file_fh, int argc, char **argv) {	
+enum kdt_error parse_command_line_arguments(char *user, char *email, char *major, byte *mode, short *number_of_tests, short *typing_duration, char *device_file_path, char *output_file_path, FILE *output_file_fh, struct kdt_options *options, int argc, char **argv) {	
 	// Use "any" logic on this buffer. If any are false, then the program cannot run.
 	bool fulfilled_arguments[REQUIRED_ARGUMENTS_COUNT];
 	for(char i = 0; i < REQUIRED_ARGUMENTS_COUNT; i++) 
@@ -462,6 +603,132 @@ enum kdt_error parse_command_line_arguments(char *user, char *email, char *major
 						debug_state(current_token, current_parameter_type, current_state);
 						break;
 
+					// Keymap (optional)
+					case 'k':
+						current_parameter_type = KDT_PARAM_KEYMAP;
+						token_number++;
+						current_state = CLI_SM_READ_VALUE;
+
+						debug_state(current_token, current_parameter_type, current_state);
+						break;
+
+					// Instrumentation (optional, takes no value)
+					case 'i':
+						options->instrument = true;
+						current_parameter_type = KDT_PARAM_NONE;
+
+						// We expect to read a parameter ID after this
+						current_state = CLI_SM_READ_PARAM;
+						token_number++;
+
+						debug_state(current_token, current_parameter_type, current_state);
+						break;
+
+					// Test plan (optional)
+					case 'p':
+						current_parameter_type = KDT_PARAM_PLAN;
+						token_number++;
+						current_state = CLI_SM_READ_VALUE;
+
+						debug_state(current_token, current_parameter_type, current_state);
+						break;
+
+					// Real-time profile (optional)
+					case 't':
+						current_parameter_type = KDT_PARAM_REALTIME;
+						token_number++;
+						current_state = CLI_SM_READ_VALUE;
+
+						debug_state(current_token, current_parameter_type, current_state);
+						break;
+
+					// Write output files with O_DIRECT (optional, takes no value)
+					case 'b':
+						options->bypass_cache = true;
+						current_parameter_type = KDT_PARAM_NONE;
+
+						// We expect to read a parameter ID after this
+						current_state = CLI_SM_READ_PARAM;
+						token_number++;
+
+						debug_state(current_token, current_parameter_type, current_state);
+						break;
+
+					// Files fsynced together (optional)
+					case 's':
+						current_parameter_type = KDT_PARAM_SYNC_BATCH;
+						token_number++;
+						current_state = CLI_SM_READ_VALUE;
+
+						debug_state(current_token, current_parameter_type, current_state);
+						break;
+
+					// Write-ahead journal (optional)
+					case 'j':
+						current_parameter_type = KDT_PARAM_JOURNAL;
+						token_number++;
+						current_state = CLI_SM_READ_VALUE;
+
+						debug_state(current_token, current_parameter_type, current_state);
+						break;
+
+					// Raw capture (optional, takes no value)
+					case 'r':
+						// -r alone maps to --raw, but --r could be --raw or --realtime
+						if(match_start_index == SHORT_ID_MATCH_START) {
+							options->raw = true;
+							current_parameter_type = KDT_PARAM_NONE;
+
+							// We expect to read a parameter ID after this
+							current_state = CLI_SM_READ_PARAM;
+							token_number++;
+
+							debug_state(current_token, current_parameter_type, current_state);
+							break;
+						}
+
+						// to be either "--raw" or "--realtime", the token will have to be
+						// at least 5 characters long.
+						if(token_lengths[token_number] < 5) {
+							current_state = CLI_SM_ERROR_INVALID_PARAM;
+							current_parameter_type = KDT_PARAM_NONE;
+
+							debug_state(current_token, current_parameter_type, current_state);
+							break;
+						}
+
+						// long identifier autocomplete
+						switch(current_token[3]) {
+							case 'a':
+								options->raw = true;
+								current_parameter_type = KDT_PARAM_NONE;
+
+								// This takes no value, so we expect to just read another
+								// parameter after this.
+								current_state = CLI_SM_READ_PARAM;
+								token_number++;
+
+								debug_state(current_token, current_parameter_type, current_state);
+								break;
+
+							case 'e':
+								current_parameter_type = KDT_PARAM_REALTIME;
+								token_number++;
+								current_state = CLI_SM_READ_VALUE;
+
+								debug_state(current_token, current_parameter_type, current_state);
+								break;
+
+							// User misspelled ID completely
+							default:
+								current_state = CLI_SM_ERROR_INVALID_PARAM;
+								current_parameter_type = KDT_PARAM_NONE;
+
+								debug_state(current_token, current_parameter_type, current_state);
+								break;
+						}
+						break;
+
 					// Device file
 					case 'v':
 						current_parameter_type = KDT_PARAM_DEVICE_FILE;
@@ -615,8 +882,16 @@ enum kdt_error parse_command_line_arguments(char *user, char *email, char *major
 							break; 
 						}
 						
+						// Every keyboard given is captured; the first is the one reported as the device file
+						if( options->device_count >= KDT_MAX_DEVICES ) {
+							current_state = CLI_SM_ERROR_TOO_MANY_DEVICES;
+							break;
+						}
+						strcpy(options->device_file_paths[options->device_count++], current_token);
+
 						// Set value
-						strcpy(device_file_path, current_token);
+						if( options->device_count == 1 )
+							strcpy(device_file_path, current_token);
 
 						// update fulfilled arguments
 						fulfilled_arguments[REQUIRED_ARG_DEVICE_FILE] = true;
@@ -624,6 +899,104 @@ enum kdt_error parse_command_line_arguments(char *user, char *email, char *major
 						// Move onto next token
 						token_number++; 
 
+						// We now expect a parameter ID
+						current_state = CLI_SM_READ_PARAM;
+						break;
+
+					case KDT_PARAM_KEYMAP:
+						if( token_lengths[token_number] >= 64 ) {
+							current_state = CLI_SM_ERROR_VALUE_TOO_LONG;
+							break;
+						}
+
+						if( access(current_token, R_OK) != 0 ) {
+							current_state = CLI_SM_ERROR_VALUE_RESOURCE_NON_EXISTENT;
+							break;
+						}
+
+						// Set value (optional, so there is no fulfilled argument to update)
+						strcpy(options->keymap_file_path, current_token);
+
+						// Move onto next token
+						token_number++;
+
+						// We now expect a parameter ID
+						current_state = CLI_SM_READ_PARAM;
+						break;
+
+					case KDT_PARAM_REALTIME:
+						// A CPU number, so unlike other numbers 0 is allowed
+						if( strspn(current_token, "0123456789") != token_lengths[token_number] || token_lengths[token_number] > 4 || atoi(current_token) >= CPU_SETSIZE ) {
+							current_state = CLI_SM_ERROR_NAN;
+							break;
+						}
+
+						// Set value (optional, so there is no fulfilled argument to update)
+						options->realtime_cpu = atoi(current_token);
+
+						// Move onto next token
+						token_number++;
+
+						// We now expect a parameter ID
+						current_state = CLI_SM_READ_PARAM;
+						break;
+
+					case KDT_PARAM_SYNC_BATCH:
+						// A number of files, at least 1
+						if( strspn(current_token, "0123456789") != token_lengths[token_number] || token_lengths[token_number] > 6 || atoi(current_token) <= 0 ) {
+							current_state = CLI_SM_ERROR_NAN;
+							break;
+						}
+
+						// Set value (optional, so there is no fulfilled argument to update)
+						options->sync_batch = (unsigned int) atoi(current_token);
+
+						// Move onto next token
+						token_number++;
+
+						// We now expect a parameter ID
+						current_state = CLI_SM_READ_PARAM;
+						break;
+
+					case KDT_PARAM_JOURNAL:
+						// Milliseconds, where 0 (sync every append) is allowed
+						if( strspn(current_token, "0123456789") != token_lengths[token_number] || token_lengths[token_number] > 7 ) {
+							current_state = CLI_SM_ERROR_NAN;
+							break;
+						}
+
+						// Set value (optional, so there is no fulfilled argument to update)
+						options->journal_interval_ms = atoi(current_token);
+
+						// Move onto next token
+						token_number++;
+
+						// We now expect a parameter ID
+						current_state = CLI_SM_READ_PARAM;
+						break;
+
+					case KDT_PARAM_PLAN:
+						if( token_lengths[token_number] >= 64 ) {
+							current_state = CLI_SM_ERROR_VALUE_TOO_LONG;
+							break;
+						}
+
+						if( access(current_token, R_OK) != 0 ) {
+							current_state = CLI_SM_ERROR_VALUE_RESOURCE_NON_EXISTENT;
+							break;
+						}
+
+						// Set value
+						strcpy(options->plan_file_path, current_token);
+
+						// The plan supplies the durations, the number of tests and the output files
+						fulfilled_arguments[REQUIRED_ARG_TYPING_DURATION] = true;
+						fulfilled_arguments[REQUIRED_ARG_NUMBER_OF_TESTS] = true;
+						fulfilled_arguments[REQUIRED_ARG_OUTPUT_FILE_PATH] = true;
+
+						// Move onto next token
+						token_number++;
+
 						// We now expect a parameter ID
 						current_state = CLI_SM_READ_PARAM;
 						break;
@@ -664,6 +1037,11 @@ enum kdt_error parse_command_line_arguments(char *user, char *email, char *major
 				return KDT_INVALID_ARGUMENT_VALUE;
 				break;
 
+			case CLI_SM_ERROR_TOO_MANY_DEVICES:
+				fprintf(stderr, "Provided value \"%s\" is one device file too many. At most %d devices can be captured at once.\n", current_token, KDT_MAX_DEVICES);
+				return KDT_INVALID_ARGUMENT_VALUE;
+				break;
+
 			case CLI_SM_ERROR_VALUE_RESOURCE_NON_EXISTENT:
 				fprintf(stderr, "Provided value \"%s\" is not a file that exists or can be accessed by this process.\n", current_token);
 				return KDT_INVALID_ARGUMENT_VALUE;
@@ -694,100 +1072,310 @@ enum kdt_error parse_command_line_arguments(char *user, char *email, char *major
 	return KDT_NO_ERROR;
 }
 
-// Convert keycode to ASCII considering Shift
+// Convert keycode to ASCII considering Shift and Caps Lock, using the US QWERTY layout.
+// kdt itself looks characters up in whichever keymap it was given (see libkeymap).
 int keycode_to_ascii(int keycode, int shift, int caps_lock) {
-    static char lower_map[KEY_MAX + 1] = {0};
-    static char upper_map[KEY_MAX + 1] = {0};
-    static int initialized = 0;  // Flag to check if initialized
-
-    // Populate lower_map (normal keys)
-    if(!initialized) {
-        initialized = 1;
-
-        lower_map[KEY_1] = '1'; lower_map[KEY_2] = '2'; lower_map[KEY_3] = '3';
-        lower_map[KEY_4] = '4'; lower_map[KEY_5] = '5'; lower_map[KEY_6] = '6';
-        lower_map[KEY_7] = '7'; lower_map[KEY_8] = '8'; lower_map[KEY_9] = '9';
-        lower_map[KEY_0] = '0';
-
-        lower_map[KEY_Q] = 'q'; lower_map[KEY_W] = 'w'; lower_map[KEY_E] = 'e';
-        lower_map[KEY_R] = 'r'; lower_map[KEY_T] = 't'; lower_map[KEY_Y] = 'y';
-        lower_map[KEY_U] = 'u'; lower_map[KEY_I] = 'i'; lower_map[KEY_O] = 'o';
-        lower_map[KEY_P] = 'p';
-
-        lower_map[KEY_A] = 'a'; lower_map[KEY_S] = 's'; lower_map[KEY_D] = 'd';
-        lower_map[KEY_F] = 'f'; lower_map[KEY_G] = 'g'; lower_map[KEY_H] = 'h';
-        lower_map[KEY_J] = 'j'; lower_map[KEY_K] = 'k'; lower_map[KEY_L] = 'l';
-
-        lower_map[KEY_Z] = 'z'; lower_map[KEY_X] = 'x'; lower_map[KEY_C] = 'c';
-        lower_map[KEY_V] = 'v'; lower_map[KEY_B] = 'b'; lower_map[KEY_N] = 'n';
-        lower_map[KEY_M] = 'm';
-
-        lower_map[KEY_SPACE] = ' ';
-        lower_map[KEY_ENTER] = '\n';
-        lower_map[KEY_BACKSPACE] = '\b';
-
-		lower_map[KEY_COMMA] = ',';			lower_map[KEY_SEMICOLON] = ';';
-		lower_map[KEY_DOT] = '.';			lower_map[KEY_APOSTROPHE] = '\'';
-		lower_map[KEY_SLASH] = '/';			lower_map[KEY_LEFTBRACE] = '[';
-		lower_map[KEY_RIGHTBRACE] = ']'; 	lower_map[KEY_BACKSLASH] = '\\';
-		lower_map[KEY_MINUS] = '-';			lower_map[KEY_EQUAL] = '=';
-		lower_map[KEY_GRAVE] = '`'; 
-
-        // Populate upper_map (Shifted keys)
-        upper_map[KEY_1] = '!'; upper_map[KEY_2] = '@'; upper_map[KEY_3] = '#';
-        upper_map[KEY_4] = '$'; upper_map[KEY_5] = '%'; upper_map[KEY_6] = '^';
-        upper_map[KEY_7] = '&'; upper_map[KEY_8] = '*'; upper_map[KEY_9] = '(';
-        upper_map[KEY_0] = ')';
-
-        upper_map[KEY_Q] = 'Q'; upper_map[KEY_W] = 'W'; upper_map[KEY_E] = 'E';
-        upper_map[KEY_R] = 'R'; upper_map[KEY_T] = 'T'; upper_map[KEY_Y] = 'Y';
-        upper_map[KEY_U] = 'U'; upper_map[KEY_I] = 'I'; upper_map[KEY_O] = 'O';
-        upper_map[KEY_P] = 'P';
-
-        upper_map[KEY_A] = 'A'; upper_map[KEY_S] = 'S'; upper_map[KEY_D] = 'D';
-        upper_map[KEY_F] = 'F'; upper_map[KEY_G] = 'G'; upper_map[KEY_H] = 'H';
-        upper_map[KEY_J] = 'J'; upper_map[KEY_K] = 'K'; upper_map[KEY_L] = 'L';
-
-        upper_map[KEY_Z] = 'Z'; upper_map[KEY_X] = 'X'; upper_map[KEY_C] = 'C';
-        upper_map[KEY_V] = 'V'; upper_map[KEY_B] = 'B'; upper_map[KEY_N] = 'N';
-        upper_map[KEY_M] = 'M';
-
-        upper_map[KEY_SPACE] = ' ';
-        upper_map[KEY_ENTER] = '\n';
-        upper_map[KEY_BACKSPACE] = '\b';
-
-		upper_map[KEY_COMMA] = '<';			upper_map[KEY_DOT] = '>';
-		upper_map[KEY_SEMICOLON] = ':';		upper_map[KEY_APOSTROPHE] = '"';
-		upper_map[KEY_SLASH] = '?';			upper_map[KEY_LEFTBRACE] = '{';
-		upper_map[KEY_RIGHTBRACE] = '}'; 	upper_map[KEY_BACKSLASH] = '|';
-		upper_map[KEY_MINUS] = '_';			upper_map[KEY_EQUAL] = '+';
-		upper_map[KEY_GRAVE] = '~'; 
-    }
+	return keymap_lookup(&keymap_us_qwerty, keycode, shift, caps_lock);
+}
 
-    if (keycode < 0 || keycode > KEY_MAX) return 0;  // Ignore invalid keycodes
+/*
+ * Apply the real-time profile to the calling thread: pin it to cpu, run it under SCHED_FIFO
+ * so ordinary processes cannot delay it, and lock all memory (current and future) so it is
+ * never paged out mid-test. The stack is touched afterwards so that mlockall has faulted it
+ * in. Each part is attempted even if an earlier one was refused, and what was granted is
+ * recorded in the report rather than treated as an error: kdt still works without it.
+ */
+void realtime_profile_apply(int cpu, struct realtime_report *report) {
+	report->cpu = cpu;
 
-    // Handle Caps Lock + Shift behavior
-    if (caps_lock && shift) {
-        if (lower_map[keycode] >= 'a' && lower_map[keycode] <= 'z') {
-            return lower_map[keycode]; // Letters stay lowercase
-        } else {
-            return upper_map[keycode]; // Symbols follow Shift behavior
-        }
-    }
-    // Handle Caps Lock without Shift
-    else if (caps_lock) {
-        if (lower_map[keycode] >= 'a' && lower_map[keycode] <= 'z') {
-            return upper_map[keycode]; // Letters become uppercase
-        } else {
-            return lower_map[keycode]; // Non-letters stay the same
-        }
-    }
-    // Handle Shift without Caps Lock
-    else if (shift) {
-        return upper_map[keycode];
-    }
-    // Default (lowercase)
-    return lower_map[keycode];
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	CPU_SET(cpu, &cpus);
+	report->affinity_error = sched_setaffinity(0, sizeof(cpus), &cpus) == 0 ? 0 : errno;
+
+	struct sched_param parameters = { .sched_priority = REALTIME_PRIORITY };
+	report->scheduler_error = sched_setscheduler(0, SCHED_FIFO, &parameters) == 0 ? 0 : errno;
+
+	report->memory_lock_error = mlockall(MCL_CURRENT | MCL_FUTURE) == 0 ? 0 : errno;
+
+	volatile unsigned char stack[REALTIME_STACK_PREFAULT];
+	for(size_t i = 0; i < sizeof(stack); i += 4096)
+		stack[i] = 0;
+}
+
+void realtime_report_print(FILE *out, const struct realtime_report *report) {
+	fprintf(out, "[SYSTEM] Real-time profile:\n");
+	fprintf(out, "\tPinned to CPU %d:\t%s\n", report->cpu, report->affinity_error == 0 ? "granted" : strerror(report->affinity_error));
+	fprintf(out, "\tSCHED_FIFO priority %d:\t%s\n", REALTIME_PRIORITY, report->scheduler_error == 0 ? "granted" : strerror(report->scheduler_error));
+	fprintf(out, "\tMemory locked:\t\t%s\n", report->memory_lock_error == 0 ? "granted" : strerror(report->memory_lock_error));
+}
+
+uint64_t timespec_difference_in_nanoseconds(struct timespec start, struct timespec end) {
+	int64_t difference = (int64_t) (end.tv_sec - start.tv_sec) * 1000000000 + (end.tv_nsec - start.tv_nsec);
+
+	// Clocks that disagree by a hair should not show up as a huge unsigned value
+	return difference < 0 ? 0 : (uint64_t) difference;
+}
+
+void instrumentation_init(struct kdt_instrumentation *instrumentation) {
+	histogram_init(&instrumentation->capture_latency, "capture latency", "us", 1000);
+	histogram_init(&instrumentation->stage_sort, "stage: sort", "us", 1000);
+	histogram_init(&instrumentation->stage_statistics, "stage: statistics", "us", 1000);
+	histogram_init(&instrumentation->stage_copy, "stage: copy", "us", 1000);
+	histogram_init(&instrumentation->stage_save, "stage: save", "us", 1000);
+
+	instrumentation->wakeups = 0;
+	instrumentation->events_read = 0;
+	instrumentation->interrupted_wakeups = 0;
+}
+
+void instrumentation_print(FILE *out, struct kdt_instrumentation *instrumentation) {
+	fprintf(out, "[INSTRUMENTATION] Read loop: %lu wakeups, %lu events, %lu interrupted.\n",
+		instrumentation->wakeups,
+		instrumentation->events_read,
+		instrumentation->interrupted_wakeups
+	);
+	histogram_print(out, &instrumentation->capture_latency);
+	histogram_print(out, &instrumentation->stage_sort);
+	histogram_print(out, &instrumentation->stage_statistics);
+	histogram_print(out, &instrumentation->stage_copy);
+	histogram_print(out, &instrumentation->stage_save);
+	fflush(out);
+}
+
+enum kdt_error assembler_init(struct keystroke_assembler *assembler, const struct keymap *keymap, int fd) {
+	assembler->keymap = keymap;
+	assembler->fd = fd;
+	assembler->keystrokes_capacity = 2048;
+	assembler->keystrokes = malloc(sizeof(struct keystroke) * assembler->keystrokes_capacity);
+	if(assembler->keystrokes == NULL) {
+		fprintf(stderr, "[assembler_init] Failed to allocate memory for initial 2048 keystrokes.\n");
+		return KDT_MALLOC_FAILURE;
+	}
+
+	assembler_reset(assembler);
+	return KDT_NO_ERROR;
+}
+
+// Forget everything about the previous test, keeping the keystrokes buffer for reuse
+void assembler_reset(struct keystroke_assembler *assembler) {
+	assembler->shift_pressed = 0;
+	assembler->caps_lock = 0;
+	memset(assembler->active_codes, 0, sizeof(assembler->active_codes));
+	assembler->occupied_slots = 0;
+	assembler->active_keys_count = 0;
+	assembler->keystrokes_length = 0;
+	assembler->dropping = false;
+	assembler->syn_dropped_count = 0;
+	assembler->discarded_events = 0;
+}
+
+void assembler_free(struct keystroke_assembler *assembler) {
+	free(assembler->keystrokes);
+	assembler->keystrokes = NULL;
+	assembler->keystrokes_capacity = 0;
+}
+
+// Make room for additional keystrokes
+static enum kdt_error assembler_reserve(struct keystroke_assembler *assembler, size_t additional) {
+	if(assembler->keystrokes_length + additional <= assembler->keystrokes_capacity)
+		return KDT_NO_ERROR;
+
+	size_t new_capacity = assembler->keystrokes_capacity * 2;
+	while(new_capacity < assembler->keystrokes_length + additional)
+		new_capacity *= 2;
+
+	struct keystroke *new_keystrokes = realloc(assembler->keystrokes, sizeof(struct keystroke) * new_capacity);
+	if(new_keystrokes == NULL) {
+		fprintf(stderr, "[assembler_reserve] Failed to allocate memory for %zu keystrokes.\n", new_capacity);
+		return KDT_MALLOC_FAILURE;
+	}
+	assembler->keystrokes = new_keystrokes;
+	assembler->keystrokes_capacity = new_capacity;
+	return KDT_NO_ERROR;
+}
+
+// Grow the keystrokes buffer to hold a whole test up front and touch every page of it, so
+// that neither realloc() nor a page fault happens while keystrokes are being captured
+enum kdt_error assembler_prefault(struct keystroke_assembler *assembler, size_t keystrokes) {
+	if(assembler_reserve(assembler, keystrokes) != KDT_NO_ERROR)
+		return KDT_MALLOC_FAILURE;
+
+	memset(assembler->keystrokes, 0, sizeof(struct keystroke) * assembler->keystrokes_capacity);
+	return KDT_NO_ERROR;
+}
+
+// The keystroke being built for a key that is held, or NULL if it is not
+static struct keystroke *active_key_find(struct keystroke_assembler *assembler, int code) {
+	if(!(assembler->active_codes[code / 64] & (1ULL << (code % 64))))
+		return NULL;
+	return &assembler->active_keys[assembler->active_slot[code]];
+}
+
+// Start tracking a key that was just pressed. Returns NULL if every slot is taken.
+static struct keystroke *active_key_claim(struct keystroke_assembler *assembler, int code) {
+	struct keystroke *active_key = active_key_find(assembler, code);
+	if(active_key != NULL)
+		return active_key;	// pressed again without a release in between
+	if(assembler->occupied_slots == UINT32_MAX)
+		return NULL;
+
+	int slot = __builtin_ctz(~assembler->occupied_slots);
+	assembler->occupied_slots |= 1U << slot;
+	assembler->active_codes[code / 64] |= 1ULL << (code % 64);
+	assembler->active_slot[code] = slot;
+	assembler->active_key_codes[slot] = code;
+	assembler->active_keys_count++;
+	return &assembler->active_keys[slot];
+}
+
+static void active_key_release(struct keystroke_assembler *assembler, int code) {
+	assembler->occupied_slots &= ~(1U << assembler->active_slot[code]);
+	assembler->active_codes[code / 64] &= ~(1ULL << (code % 64));
+	assembler->active_keys_count--;
+}
+
+/*
+ * Feed one input event to the assembler. timestamp is the time to record for a press or
+ * release; pass NULL to read CLOCK_MONOTONIC at that moment (live capture). Returns the
+ * character a key press produced (127 for a backspace) so the caller can echo it, 0 if
+ * the event produced nothing, or -1 if memory ran out.
+ */
+int assembler_process_event(struct keystroke_assembler *assembler, struct input_event *ev, const struct timespec *timestamp) {
+	// The kernel's buffer for this device overflowed and events were lost. Keys held
+	// right now may have lost their releases, so they can no longer be trusted.
+	if (ev->type == EV_SYN && ev->code == SYN_DROPPED) {
+		assembler->dropping = true;
+		assembler->syn_dropped_count++;
+		for (uint32_t slots = assembler->occupied_slots; slots != 0; slots &= slots - 1)
+			assembler->active_keys[__builtin_ctz(slots)].flags |= KEYSTROKE_FLAG_TAINTED;
+		return 0;
+	}
+	if (assembler->dropping) {
+		if (ev->type == EV_SYN && ev->code == SYN_REPORT) {
+			assembler->dropping = false;
+			if (assembler_reserve(assembler, assembler->active_keys_count) != KDT_NO_ERROR)
+				return -1;
+			resync_key_state(assembler);
+		}
+		else {
+			assembler->discarded_events++;
+		}
+		return 0;
+	}
+
+	// Only key presses and key releases matter
+	if (ev->type != EV_KEY || ev->code > KEY_MAX)
+		return 0;
+
+	// Handle Shift Modifiers (Left Shift, Right Shift)
+	if (ev->code == KEY_LEFTSHIFT || ev->code == KEY_RIGHTSHIFT) {
+		// Track if the shift key is being held or released
+		assembler->shift_pressed = ev->value;
+		return 0;
+	}
+	// Handle Capslock toggle (Pressing the capslock key)
+	else if(ev->code == KEY_CAPSLOCK && ev->value == 1) {
+		// Toggle stored flag
+		assembler->caps_lock = !assembler->caps_lock;
+		return 0;
+	}
+
+	// Get ASCII code based on modifers (shift and capslock)
+	int ascii_character = keymap_lookup(assembler->keymap, ev->code, assembler->shift_pressed, assembler->caps_lock);
+
+	// Case 1: Key Pressed
+	if (ev->value == 1) {
+		int c;
+		// Handles backspace
+		if(ascii_character == '\b' && assembler->keystrokes_length > 0)
+			c = BACKSPACE;
+		// Handles all other characters
+		else if (ascii_character)
+			c = ascii_character;
+		else
+			return 0;
+
+		// Every slot is taken: the press is lost, so it is accounted for like dropped events
+		struct keystroke *active_key = active_key_claim(assembler, ev->code);
+		if (active_key == NULL) {
+			assembler->discarded_events++;
+			return 0;
+		}
+		if (timestamp != NULL)
+			active_key->press_time = *timestamp;
+		else
+			clock_gettime(CLOCK_MONOTONIC, &active_key->press_time);
+		active_key->c = c;
+		active_key->flags = 0;
+		active_key->rollover = assembler->active_keys_count - 1 > 255 ? 255 : assembler->active_keys_count - 1;
+		return c;
+	}
+	// Case 2: Key Released AND it is in active keys with a already set character
+	else if (ev->value == 0) {
+		struct keystroke *active_key = active_key_find(assembler, ev->code);
+		if (active_key == NULL)
+			return 0;
+		if (timestamp != NULL)
+			active_key->release_time = *timestamp;
+		else
+			clock_gettime(CLOCK_MONOTONIC, &active_key->release_time);
+
+		// Store the full keystroke in the keystrokes array
+		if (assembler_reserve(assembler, 1) != KDT_NO_ERROR)
+			return -1;
+		assembler->keystrokes[assembler->keystrokes_length] = *active_key;
+		assembler->keystrokes_length++;
+
+		// Clear active key after release
+		active_key_release(assembler, ev->code);
+	}
+
+	return 0;
+}
+
+/*
+ * Rebuild key state once the SYN_REPORT that ends a SYN_DROPPED gap arrives (the kernel's
+ * evdev buffer overflowed and events were lost). Active keys that are no longer held lost
+ * their release, so they are completed at the time of the resync and flagged as tainted.
+ * Shift and caps lock are re-read too. The caller makes room for active_keys_count more
+ * keystrokes beforehand.
+ */
+void resync_key_state(struct keystroke_assembler *assembler) {
+	unsigned char key_state[KEY_MAX / 8 + 1];
+	unsigned char led_state[LED_MAX / 8 + 1];
+	memset(key_state, 0, sizeof(key_state));
+	memset(led_state, 0, sizeof(led_state));
+
+	// Not an evdev device (e.g. a FIFO from kdt-replay, or a raw log being rebuilt). The
+	// active keys were already tainted when the drop was reported, and are completed if
+	// their releases arrive.
+	if(assembler->fd < 0 || ioctl(assembler->fd, EVIOCGKEY(sizeof(key_state)), key_state) < 0) {
+		fprintf(stderr, "[resync_key_state] Could not read key state from the device. Held keys stay tainted.\n");
+		return;
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for(uint32_t slots = assembler->occupied_slots; slots != 0; slots &= slots - 1) {
+		int slot = __builtin_ctz(slots);
+		int code = assembler->active_key_codes[slot];
+		struct keystroke *active_key = &assembler->active_keys[slot];
+		bool held = key_state[code / 8] & (1 << (code % 8));
+		if(held)
+			continue;
+
+		active_key->release_time = now;
+		active_key->flags |= KEYSTROKE_FLAG_TAINTED;
+		assembler->keystrokes[assembler->keystrokes_length] = *active_key;
+		assembler->keystrokes_length++;
+
+		active_key_release(assembler, code);
+	}
+
+	assembler->shift_pressed = (key_state[KEY_LEFTSHIFT / 8] & (1 << (KEY_LEFTSHIFT % 8))) || (key_state[KEY_RIGHTSHIFT / 8] & (1 << (KEY_RIGHTSHIFT % 8)));
+	if(ioctl(assembler->fd, EVIOCGLED(sizeof(led_state)), led_state) >= 0)
+		assembler->caps_lock = (led_state[LED_CAPSL / 8] & (1 << (LED_CAPSL % 8))) != 0;
 }
 
 int compare_keystrokes(const void *a, const void *b) {
@@ -864,5 +1452,527 @@ int save_sessions(FILE *file, struct user_info *user_info, struct session *sessi
         }
     }
 
+    // Extension block: overload accounting. Per session, the SYN_DROPPED count (8 bytes),
+    // discarded events (8 bytes), keystrokes length (8 bytes) and one flags byte per keystroke
+    uint64_t payload_size = 0;
+    for (size_t i = 0; i < session_count; i++)
+        payload_size += 3 * sizeof(size_t) + sessions[i].keystrokes_length;
+
+    fwrite(EXTENSION_TAG_LOSS, sizeof(char), EXTENSION_TAG_LENGTH, file);
+    fwrite(&payload_size, sizeof(uint64_t), 1, file);
+    for (size_t i = 0; i < session_count; i++) {
+        fwrite(&sessions[i].syn_dropped_count, sizeof(size_t), 1, file);
+        fwrite(&sessions[i].discarded_events, sizeof(size_t), 1, file);
+        fwrite(&sessions[i].keystrokes_length, sizeof(size_t), 1, file);
+        for (size_t j = 0; j < sessions[i].keystrokes_length; j++)
+            fwrite(&sessions[i].keystrokes[j].flags, sizeof(byte), 1, file);
+    }
+
+    // Extension block: overlap features. Per session, the overlapped keystrokes (8 bytes),
+    // max rollover (8 bytes), keystrokes length (8 bytes) and one rollover byte per keystroke,
+    // then release-to-press and release-to-release times as a length (8 bytes) and signed
+    // 8 byte values each
+    payload_size = 0;
+    for (size_t i = 0; i < session_count; i++)
+        payload_size += 5 * sizeof(size_t) + sessions[i].keystrokes_length + (sessions[i].release_to_press_length + sessions[i].release_to_release_length) * sizeof(long);
+
+    fwrite(EXTENSION_TAG_OVERLAP, sizeof(char), EXTENSION_TAG_LENGTH, file);
+    fwrite(&payload_size, sizeof(uint64_t), 1, file);
+    for (size_t i = 0; i < session_count; i++) {
+        fwrite(&sessions[i].overlapped_keystrokes, sizeof(size_t), 1, file);
+        fwrite(&sessions[i].max_rollover, sizeof(size_t), 1, file);
+        fwrite(&sessions[i].keystrokes_length, sizeof(size_t), 1, file);
+        for (size_t j = 0; j < sessions[i].keystrokes_length; j++)
+            fwrite(&sessions[i].keystrokes[j].rollover, sizeof(byte), 1, file);
+        fwrite(&sessions[i].release_to_press_length, sizeof(size_t), 1, file);
+        if (sessions[i].release_to_press_length > 0)
+            fwrite(sessions[i].release_to_press, sizeof(long), sessions[i].release_to_press_length, file);
+        fwrite(&sessions[i].release_to_release_length, sizeof(size_t), 1, file);
+        if (sessions[i].release_to_release_length > 0)
+            fwrite(sessions[i].release_to_release, sizeof(long), sessions[i].release_to_release_length, file);
+    }
+
+    return 0;
+}
+
+/*
+ * Save sessions to a file without ever leaving a partial file behind: they are written to
+ * PATH.tmp, flushed to disk and then renamed over PATH, so a crash leaves either the old
+ * file or the complete new one.
+ */
+int save_sessions_to_path(const char *path, struct user_info *user_info, struct session *sessions, size_t session_count) {
+    char temporary_path[PATH_MAX];
+    if (snprintf(temporary_path, sizeof(temporary_path), "%s.tmp", path) >= (int) sizeof(temporary_path)) {
+        fprintf(stderr, "[save_sessions_to_path] Path \"%s\" is too long.\n", path);
+        return -1;
+    }
+
+    FILE *file = fopen(temporary_path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "[save_sessions_to_path] Error opening file \"%s\" for writing.\n", temporary_path);
+        return -1;
+    }
+
+    int result = save_sessions(file, user_info, sessions, session_count);
+    if (result == 0 && (fflush(file) != 0 || fsync(fileno(file)) != 0)) {
+        fprintf(stderr, "[save_sessions_to_path] Failed to flush \"%s\" to disk.\n", temporary_path);
+        result = -1;
+    }
+    if (fclose(file) != 0)
+        result = -1;
+
+    if (result == 0 && rename(temporary_path, path) != 0) {
+        fprintf(stderr, "[save_sessions_to_path] Failed to move \"%s\" to \"%s\".\n", temporary_path, path);
+        result = -1;
+    }
+    if (result != 0)
+        unlink(temporary_path);
+
+    return result;
+}
+
+/*
+ * Serialize sessions into a buffer allocated with malloc, in the same format save_sessions
+ * writes, so that they can be written out later (see libwriter) without holding the
+ * sessions. The caller frees *buffer.
+ */
+int save_sessions_to_buffer(struct user_info *user_info, struct session *sessions, size_t session_count, char **buffer, size_t *length) {
+    FILE *stream = open_memstream(buffer, length);
+    if (stream == NULL) {
+        fprintf(stderr, "[save_sessions_to_buffer] Failed to allocate memory for serialized sessions.\n");
+        return -1;
+    }
+
+    int result = save_sessions(stream, user_info, sessions, session_count);
+    if (fclose(stream) != 0)
+        result = -1;
+
+    if (result != 0) {
+        free(*buffer);
+        *buffer = NULL;
+    }
+    return result;
+}
+
+// Read the signed release times of one session from an overlap extension block
+static long *load_release_times(FILE *file, size_t *length) {
+    long *values = NULL;
+    fread(length, sizeof(size_t), 1, file);
+    if (*length > 0) {
+        values = malloc(sizeof(long) * (*length));
+        if (values == NULL) {
+            fseek(file, *length * sizeof(long), SEEK_CUR);
+            *length = 0;
+            return NULL;
+        }
+        fread(values, sizeof(long), *length, file);
+    }
+    return values;
+}
+
+// Read an overlap extension block into the sessions already loaded from the same file
+static void load_overlap_block(FILE *file, struct session *sessions, size_t session_count) {
+    for (size_t i = 0; i < session_count; i++) {
+        struct session *s = &sessions[i];
+        size_t rollover_length = 0;
+        fread(&s->overlapped_keystrokes, sizeof(size_t), 1, file);
+        fread(&s->max_rollover, sizeof(size_t), 1, file);
+        fread(&rollover_length, sizeof(size_t), 1, file);
+        for (size_t j = 0; j < rollover_length; j++) {
+            byte rollover = 0;
+            fread(&rollover, sizeof(byte), 1, file);
+            if (j < s->keystrokes_length)
+                s->keystrokes[j].rollover = rollover;
+        }
+        s->release_to_press = load_release_times(file, &s->release_to_press_length);
+        s->release_to_release = load_release_times(file, &s->release_to_release_length);
+    }
+}
+
+/*
+ * Function to deserialize the data and verify it was stored correctly
+ * Takes in a file pointer to file to read from, 
+ * a pointer to a pointer to hold the array of sessions,
+ * and a pointer to the variable that store the number of sessions
+ */
+int load_sessions(FILE *file, struct user_info **user_info, struct session **sessions, size_t *session_count) {
+     // Make sure file pointer is valid
+    if (!file) {
+        fprintf(stderr, "Invalid file pointer for loading sessions.\n");
+        return -1;
+    }
+
+    // Allocate memory for user_info
+    *user_info = malloc(sizeof(struct user_info));
+    if (!(*user_info)) {
+        return -1;
+    }
+
+    // Read user_info fields from file (64 bytes each for user, email, and major, and 2 bytes for typing_duration)
+    fread((*user_info)->user, sizeof(char), 64, file);
+    fread((*user_info)->email, sizeof(char), 64, file);
+    fread((*user_info)->major, sizeof(char), 64, file);
+    fread(&(*user_info)->typing_duration, sizeof(short), 1, file);
+
+    // Read number of sessions (8 bytes)
+    fread(session_count, sizeof(size_t), 1, file);
+    *sessions = malloc(sizeof(struct session) * (*session_count));
+    if (!(*sessions)) {
+        return -1;
+    }
+
+    // Loop through the number of sessions (determined from reading the session_count bytes)
+    for (size_t i = 0; i < *session_count; i++) {
+        // Read number of keystrokes (8 bytes)
+        fread(&(*sessions)[i].keystrokes_length, sizeof(size_t), 1, file);
+
+        // Allocate memory for keystrokes
+        (*sessions)[i].keystrokes = malloc(sizeof(struct keystroke) * (*sessions)[i].keystrokes_length);
+
+        // Read keystrokes (33 Bytes total)
+        for (size_t j = 0; j < (*sessions)[i].keystrokes_length; j++) {
+            fread(&(*sessions)[i].keystrokes[j].c, sizeof(char), 1, file);  // Keystroke key (1 byte)
+            (*sessions)[i].keystrokes[j].flags = 0;
+            (*sessions)[i].keystrokes[j].rollover = 0;
+            fread(&(*sessions)[i].keystrokes[j].press_time.tv_sec, sizeof(long), 1, file);  // Press timestamp (8 bytes)
+            fread(&(*sessions)[i].keystrokes[j].press_time.tv_nsec, sizeof(long), 1, file);   // Nanoseconds (8 bytes)
+            fread(&(*sessions)[i].keystrokes[j].release_time.tv_sec, sizeof(long), 1, file);  // Release timestamp (8 bytes)
+            fread(&(*sessions)[i].keystrokes[j].release_time.tv_nsec, sizeof(long), 1, file);   // Nanoseconds (8 bytes)
+        }
+
+        // Read time deltas length (8 Bytes)
+        fread(&(*sessions)[i].time_deltas_length, sizeof(size_t), 1, file);
+        // Read the time deltas using the length
+        if ((*sessions)[i].time_deltas_length > 0) {
+            (*sessions)[i].time_deltas = malloc(sizeof(unsigned long) * (*sessions)[i].time_deltas_length);
+            fread((*sessions)[i].time_deltas, sizeof(unsigned long), (*sessions)[i].time_deltas_length, file);
+        } else {
+            (*sessions)[i].time_deltas = NULL;
+        }
+
+        // Read dwell times length
+        fread(&(*sessions)[i].dwell_times_length, sizeof(size_t), 1, file);
+        // Read the dwell times using the length
+        if ((*sessions)[i].dwell_times_length > 0) {
+            (*sessions)[i].dwell_times = malloc(sizeof(unsigned long) * (*sessions)[i].dwell_times_length);
+            fread((*sessions)[i].dwell_times, sizeof(unsigned long), (*sessions)[i].dwell_times_length, file);
+        } else {
+            (*sessions)[i].dwell_times = NULL;
+        }
+
+        // Read flight times length
+        fread(&(*sessions)[i].flight_times_length, sizeof(size_t), 1, file);
+        // Read the dwell using the length
+        if ((*sessions)[i].flight_times_length > 0) {
+            (*sessions)[i].flight_times = malloc(sizeof(unsigned long) * (*sessions)[i].flight_times_length);
+            fread((*sessions)[i].flight_times, sizeof(unsigned long), (*sessions)[i].flight_times_length, file);
+        } else {
+            (*sessions)[i].flight_times = NULL;
+        }
+
+        // Files written before extension blocks existed carry no overload accounting
+        (*sessions)[i].syn_dropped_count = 0;
+        (*sessions)[i].discarded_events = 0;
+        (*sessions)[i].tainted_keystrokes = 0;
+
+        // ... nor overlap features
+        (*sessions)[i].release_to_press = NULL;
+        (*sessions)[i].release_to_press_length = 0;
+        (*sessions)[i].release_to_release = NULL;
+        (*sessions)[i].release_to_release_length = 0;
+        (*sessions)[i].overlapped_keystrokes = 0;
+        (*sessions)[i].max_rollover = 0;
+    }
+
+    // Read extension blocks until the end of the file, skipping any this reader does not know
+    char tag[EXTENSION_TAG_LENGTH];
+    uint64_t payload_size;
+    while (fread(tag, sizeof(char), EXTENSION_TAG_LENGTH, file) == EXTENSION_TAG_LENGTH && fread(&payload_size, sizeof(uint64_t), 1, file) == 1) {
+        if (memcmp(tag, EXTENSION_TAG_OVERLAP, EXTENSION_TAG_LENGTH) == 0) {
+            load_overlap_block(file, *sessions, *session_count);
+            continue;
+        }
+        if (memcmp(tag, EXTENSION_TAG_LOSS, EXTENSION_TAG_LENGTH) != 0) {
+            fseek(file, payload_size, SEEK_CUR);
+            continue;
+        }
+
+        for (size_t i = 0; i < *session_count; i++) {
+            struct session *s = &(*sessions)[i];
+            size_t flags_length = 0;
+            fread(&s->syn_dropped_count, sizeof(size_t), 1, file);
+            fread(&s->discarded_events, sizeof(size_t), 1, file);
+            fread(&flags_length, sizeof(size_t), 1, file);
+            for (size_t j = 0; j < flags_length; j++) {
+                byte flags = 0;
+                fread(&flags, sizeof(byte), 1, file);
+                if (j >= s->keystrokes_length)
+                    continue;
+
+                s->keystrokes[j].flags = flags;
+                if (flags & KEYSTROKE_FLAG_TAINTED)
+                    s->tainted_keystrokes++;
+            }
+        }
+    }
+
     return 0;
 }
+
+// Sort a session's keystrokes by press time and compute its time deltas, dwell times and
+// flight times, and its overlap features. Returns the first error encountered, but always
+// attempts all of them.
+enum kdt_error compute_session_statistics(struct session *s) {
+	enum kdt_error first_error = KDT_NO_ERROR;
+	enum kdt_statistic statistics[] = { STATISTIC_TIME_DELTAS, STATISTIC_DWELL_TIMES, STATISTIC_FLIGHT_TIMES };
+
+	qsort(s->keystrokes, s->keystrokes_length, sizeof(struct keystroke), compare_keystrokes);
+
+	for(size_t i = 0; i < sizeof(statistics) / sizeof(statistics[0]); i++) {
+		enum kdt_error error_code = set_session_statistic_data(s, statistics[i]);
+		if(error_code != KDT_NO_ERROR && first_error == KDT_NO_ERROR)
+			first_error = error_code;
+	}
+	if(s->keystrokes != NULL) {
+		enum kdt_error error_code = set_session_overlap_data(s);
+		if(error_code != KDT_NO_ERROR && first_error == KDT_NO_ERROR)
+			first_error = error_code;
+	}
+
+	return first_error;
+}
+
+static size_t raw_log_mapping_size(size_t events_capacity) {
+	return RAW_LOG_HEADER_SIZE + events_capacity * sizeof(struct input_event);
+}
+
+static enum kdt_error raw_log_map(struct raw_log *log, size_t mapping_size) {
+	int protection = log->writable ? PROT_READ | PROT_WRITE : PROT_READ;
+	int flags = log->writable ? MAP_SHARED | MAP_POPULATE : MAP_PRIVATE;
+
+	void *mapping = mmap(NULL, mapping_size, protection, flags, log->fd, 0);
+	if(mapping == MAP_FAILED) {
+		perror("[raw_log_map] mmap");
+		return KDT_MALLOC_FAILURE;
+	}
+
+	log->header = (struct raw_log_header *) mapping;
+	log->events = (struct input_event *) ((char *) mapping + RAW_LOG_HEADER_SIZE);
+	log->mapping_size = mapping_size;
+	return KDT_NO_ERROR;
+}
+
+/*
+ * Create a raw log at path with room for events_capacity events. The file is allocated and
+ * mapped up front (MAP_POPULATE faults every page in now) so that capturing is a read()
+ * straight into the mapping, with no page faults or allocation while the user types.
+ */
+enum kdt_error raw_log_create(struct raw_log *log, const char *path, struct user_info *user_info, size_t events_capacity, int clock_id) {
+	log->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(log->fd < 0) {
+		fprintf(stderr, "[raw_log_create] Failed to create raw log \"%s\".\n", path);
+		return KDT_INVALID_OUTPUT_FILE;
+	}
+	log->writable = true;
+
+	size_t mapping_size = raw_log_mapping_size(events_capacity);
+	if(posix_fallocate(log->fd, 0, (off_t) mapping_size) != 0 && ftruncate(log->fd, (off_t) mapping_size) != 0) {
+		fprintf(stderr, "[raw_log_create] Failed to allocate %zu bytes for raw log \"%s\".\n", mapping_size, path);
+		close(log->fd);
+		return KDT_INVALID_OUTPUT_FILE;
+	}
+
+	if(raw_log_map(log, mapping_size) != KDT_NO_ERROR) {
+		close(log->fd);
+		return KDT_MALLOC_FAILURE;
+	}
+
+	memset(log->header, 0, sizeof(struct raw_log_header));
+	memcpy(log->header->magic, RAW_LOG_MAGIC, sizeof(log->header->magic));
+	log->header->events_capacity = events_capacity;
+	log->header->clock_id = clock_id;
+	log->header->user_info = *user_info;
+
+	return KDT_NO_ERROR;
+}
+
+// Make sure there is room for additional events, growing the file and mapping if there is not
+enum kdt_error raw_log_reserve(struct raw_log *log, size_t additional) {
+	uint64_t needed = log->header->events_length + additional;
+	if(needed <= log->header->events_capacity)
+		return KDT_NO_ERROR;
+
+	uint64_t events_capacity = log->header->events_capacity * 2;
+	if(events_capacity < needed)
+		events_capacity = needed;
+
+	size_t mapping_size = raw_log_mapping_size(events_capacity);
+	if(ftruncate(log->fd, (off_t) mapping_size) != 0) {
+		fprintf(stderr, "[raw_log_reserve] Failed to grow raw log to %zu bytes.\n", mapping_size);
+		return KDT_MALLOC_FAILURE;
+	}
+
+	// Everything written so far is in the file, so the old mapping can simply be replaced
+	munmap(log->header, log->mapping_size);
+	if(raw_log_map(log, mapping_size) != KDT_NO_ERROR)
+		return KDT_MALLOC_FAILURE;
+
+	log->header->events_capacity = events_capacity;
+	return KDT_NO_ERROR;
+}
+
+// Start a new test: append a marker event carrying the test's number
+void raw_log_mark_session(struct raw_log *log) {
+	if(raw_log_reserve(log, 1) != KDT_NO_ERROR)
+		return;
+
+	struct timespec now;
+	clock_gettime(log->header->clock_id, &now);
+
+	struct input_event *marker = &log->events[log->header->events_length++];
+	memset(marker, 0, sizeof(struct input_event));
+	marker->input_event_sec = now.tv_sec;
+	marker->input_event_usec = now.tv_nsec / 1000;
+	marker->type = RAW_LOG_SESSION_MARKER;
+	marker->value = (int) log->header->sessions_length++;
+}
+
+// Open an existing raw log read-only
+enum kdt_error raw_log_open(struct raw_log *log, const char *path) {
+	struct stat file_stat;
+
+	log->fd = open(path, O_RDONLY);
+	if(log->fd < 0) {
+		fprintf(stderr, "[raw_log_open] Failed to open raw log \"%s\".\n", path);
+		return KDT_INVALID_ARGUMENT_VALUE;
+	}
+	log->writable = false;
+
+	if(fstat(log->fd, &file_stat) != 0 || (size_t) file_stat.st_size < RAW_LOG_HEADER_SIZE) {
+		fprintf(stderr, "[raw_log_open] \"%s\" is too small to be a raw log.\n", path);
+		close(log->fd);
+		return KDT_INADEQUATE_DATA;
+	}
+
+	if(raw_log_map(log, (size_t) file_stat.st_size) != KDT_NO_ERROR) {
+		close(log->fd);
+		return KDT_MALLOC_FAILURE;
+	}
+
+	if(memcmp(log->header->magic, RAW_LOG_MAGIC, sizeof(log->header->magic)) != 0 || raw_log_mapping_size(log->header->events_length) > log->mapping_size) {
+		fprintf(stderr, "[raw_log_open] \"%s\" is not a raw log, or it is truncated.\n", path);
+		raw_log_close(log);
+		return KDT_INADEQUATE_DATA;
+	}
+
+	return KDT_NO_ERROR;
+}
+
+// Unmap and close a raw log. A log being written is trimmed to the events actually captured.
+void raw_log_close(struct raw_log *log) {
+	size_t used_size = raw_log_mapping_size(log->header->events_length);
+
+	if(log->writable) {
+		log->header->events_capacity = log->header->events_length;
+		msync(log->header, log->mapping_size, MS_SYNC);
+	}
+	munmap(log->header, log->mapping_size);
+
+	if(log->writable && ftruncate(log->fd, (off_t) used_size) != 0)
+		fprintf(stderr, "[raw_log_close] Failed to trim raw log to %zu bytes.\n", used_size);
+	close(log->fd);
+
+	log->header = NULL;
+	log->events = NULL;
+	log->fd = -1;
+}
+
+// Copy what the assembler built for one test into a session and compute its statistics
+static enum kdt_error finish_rebuilt_session(struct session *s, struct keystroke_assembler *assembler) {
+	s->keystrokes_length = assembler->keystrokes_length;
+	s->keystrokes = malloc((assembler->keystrokes_length > 0 ? assembler->keystrokes_length : 1) * sizeof(struct keystroke));
+	if(s->keystrokes == NULL)
+		return KDT_MALLOC_FAILURE;
+	memcpy(s->keystrokes, assembler->keystrokes, assembler->keystrokes_length * sizeof(struct keystroke));
+
+	s->syn_dropped_count = assembler->syn_dropped_count;
+	s->discarded_events = assembler->discarded_events;
+	for(size_t i = 0; i < s->keystrokes_length; i++) {
+		if(s->keystrokes[i].flags & KEYSTROKE_FLAG_TAINTED)
+			s->tainted_keystrokes++;
+	}
+
+	return compute_session_statistics(s);
+}
+
+/*
+ * Rebuild sessions from a raw log exactly as kdt would have built them while capturing,
+ * using the given keymap. Keystrokes are stamped with the kernel's event timestamps. The
+ * device is gone by now, so key state cannot be resynced after SYN_DROPPED; keys held
+ * across a drop are left to be released (or not) by the events that follow.
+ */
+enum kdt_error rebuild_sessions_from_raw_log(struct raw_log *log, const struct keymap *keymap, struct user_info **user_info, struct session **sessions, size_t *session_count) {
+	struct keystroke_assembler *assembler = malloc(sizeof(struct keystroke_assembler));
+	if(assembler == NULL || assembler_init(assembler, keymap, -1) != KDT_NO_ERROR) {
+		free(assembler);
+		return KDT_MALLOC_FAILURE;
+	}
+
+	size_t sessions_length = log->header->sessions_length;
+	*sessions = calloc(sessions_length > 0 ? sessions_length : 1, sizeof(struct session));
+	if(*sessions == NULL) {
+		assembler_free(assembler);
+		free(assembler);
+		return KDT_MALLOC_FAILURE;
+	}
+
+	*user_info = malloc(sizeof(struct user_info));
+	if(*user_info == NULL) {
+		free(*sessions);
+		assembler_free(assembler);
+		free(assembler);
+		return KDT_MALLOC_FAILURE;
+	}
+	**user_info = log->header->user_info;
+
+	enum kdt_error error_code = KDT_NO_ERROR;
+	long current_session = -1;
+	for(uint64_t i = 0; i <= log->header->events_length; i++) {
+		struct input_event *ev = i < log->header->events_length ? &log->events[i] : NULL;
+
+		// A marker, or the end of the log, closes the test in progress
+		if(ev == NULL || ev->type == RAW_LOG_SESSION_MARKER) {
+			if(current_session >= 0 && (size_t) current_session < sessions_length) {
+				enum kdt_error session_error = finish_rebuilt_session(&(*sessions)[current_session], assembler);
+				if(session_error != KDT_NO_ERROR)
+					fprintf(stderr, "[rebuild_sessions_from_raw_log] Session #%ld could not be fully rebuilt. KDT error code was %d.\n", current_session + 1, session_error);
+				if(session_error == KDT_MALLOC_FAILURE)
+					error_code = session_error;
+			}
+
+			if(ev == NULL)
+				break;
+			current_session++;
+			assembler_reset(assembler);
+			continue;
+		}
+
+		// Events before the first marker were read before any test started
+		if(current_session < 0)
+			continue;
+
+		struct timespec timestamp = { .tv_sec = ev->input_event_sec, .tv_nsec = ev->input_event_usec * 1000 };
+		if(assembler_process_event(assembler, ev, &timestamp) < 0) {
+			error_code = KDT_MALLOC_FAILURE;
+			break;
+		}
+	}
+
+	for(size_t i = 0; i < sessions_length; i++)
+		(*sessions)[i].user_info = *user_info;
+	*session_count = sessions_length;
+
+	assembler_free(assembler);
+	free(assembler);
+	return error_code;
+}
@@ -1,5 +1,10 @@
+#include <stdio.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <linux/input.h>
+#include "libhistogram.h"
+#include "libkeymap.h"
+#include "libplan.h"
 #ifndef LIBKDT_H
 #define LIBKDT_H
 
@@ -19,6 +24,33 @@
 #define MODULUS 211
 #define HASH_SCALAR 37
 
+// Keystroke flags
+#define KEYSTROKE_FLAG_TAINTED 0x01	// the kernel dropped events while this key was held
+
+// Extension blocks follow the sessions in an output file as a 4 byte tag, an 8 byte
+// payload size and the payload. Readers that predate a block stop reading after the
+// last session, so adding blocks never breaks them.
+#define EXTENSION_TAG_LENGTH 4
+#define EXTENSION_TAG_LOSS "LOSS"	// per session: SYN_DROPPED count, discarded events, keystroke flags
+#define EXTENSION_TAG_OVERLAP "OVLP"	// per session: overlap counts, rollover per keystroke, signed release times
+
+// Raw logs (kdt --raw) hold the unmodified input_event stream after a RAW_LOG_HEADER_SIZE
+// byte header. Sessions are delimited by marker events kdt writes when each test starts.
+#define RAW_LOG_MAGIC "KDTRAW1"
+#define RAW_LOG_HEADER_SIZE 512
+#define RAW_LOG_SESSION_MARKER 0xFFFF	// input_event.type of the record that starts each test
+#define RAW_LOG_EVENTS_PER_SECOND 200	// used to preallocate the log; it grows if this is exceeded
+#define RAW_LOG_READ_BATCH 64		// events read() straight into the log at a time
+
+#define KDT_MAX_DEVICES 16		// keyboards captured at once (-v may be given this many times)
+#define KDT_READ_BATCH 64		// events read() from a device at a time
+#define ASSEMBLER_ACTIVE_SLOTS 32	// keys that can be held at once; presses beyond that are discarded
+
+// Real-time profile (--realtime)
+#define REALTIME_PRIORITY 50			// SCHED_FIFO priority of the capture thread
+#define REALTIME_STACK_PREFAULT (256 * 1024)	// bytes of stack touched so it is never faulted in mid-test
+#define REALTIME_KEYSTROKES_PER_SECOND 20	// sizes keystroke buffers so they never grow mid-test
+
 enum kdt_error       {  KDT_NO_ERROR,
 			KDT_INVALID_PARAMETER,
 			KDT_INVALID_ARGUMENT_VALUE,
@@ -50,6 +82,7 @@ enum cli_sm_state    {  CLI_SM_START,
 			CLI_SM_ERROR_VALUE_RESOURCE_NON_EXISTENT, 
 			CLI_SM_ERROR_VALUE_RESOURCE_NON_READABLE,
 			CLI_SM_ERROR_VALUE_RESOURCE_NON_WRITABLE,
+			CLI_SM_ERROR_TOO_MANY_DEVICES,
 
 			CLI_SM_DISPLAY_HELP_TEXT
 		     };
@@ -62,7 +95,12 @@ enum kdt_parameter   {  KDT_PARAM_NONE,         // 0
 			KDT_PARAM_REPETITIONS, 	// 5
 			KDT_PARAM_OUTPUT_FILE, 	// 6
 			KDT_PARAM_DEVICE_FILE, 	// 7
-			KDT_PARAM_MODE		// 8
+			KDT_PARAM_MODE,		// 8
+			KDT_PARAM_KEYMAP,	// 9
+			KDT_PARAM_PLAN,		// 10
+			KDT_PARAM_REALTIME,	// 11
+			KDT_PARAM_SYNC_BATCH,	// 12
+			KDT_PARAM_JOURNAL	// 13
 		     };      	
 
 enum required_arguments { REQUIRED_ARG_USER,		 // 0
@@ -78,6 +116,8 @@ enum required_arguments { REQUIRED_ARG_USER,		 // 0
 // Principal data collection object
 struct keystroke {
 	char c;
+	byte flags;
+	byte rollover;			// other keys held when this one was pressed (at most 255)
 	struct timespec press_time;
 	struct timespec release_time;
 };
@@ -103,6 +143,51 @@ struct session {
 
 	unsigned long *flight_times;
 	size_t flight_times_length;
+
+	// Overlap features (see set_session_overlap_data). Unlike flight times these are signed:
+	// a negative release-to-press time means the next key went down before this one came up.
+	long *release_to_press;
+	size_t release_to_press_length;
+	long *release_to_release;
+	size_t release_to_release_length;
+	size_t overlapped_keystrokes;	// keystrokes pressed while another key was held
+	size_t max_rollover;		// most keys held at once
+
+	// Overload accounting (see resync_key_state)
+	size_t syn_dropped_count;	// times the kernel reported SYN_DROPPED during the test
+	size_t discarded_events;	// events thrown away between SYN_DROPPED and the next SYN_REPORT, and
+					// presses made while ASSEMBLER_ACTIVE_SLOTS keys were held
+	size_t tainted_keystrokes;	// keystrokes with KEYSTROKE_FLAG_TAINTED set
+};
+
+
+// Pairs key presses with releases to build keystrokes from a stream of input events. kdt
+// feeds it while capturing; rebuild_sessions_from_raw_log feeds it from a raw log.
+struct keystroke_assembler {
+	const struct keymap *keymap;
+	int fd;						// device to resync from after SYN_DROPPED, or -1
+
+	int shift_pressed;
+	int caps_lock;
+
+	// Keys pressed but not yet released: a bit per key code and, for codes whose bit is set,
+	// the slot holding the keystroke being built. Only the bitset is cleared between tests.
+	uint64_t active_codes[KEY_MAX / 64 + 1];
+	byte active_slot[KEY_MAX + 1];
+	struct keystroke active_keys[ASSEMBLER_ACTIVE_SLOTS];
+	unsigned short active_key_codes[ASSEMBLER_ACTIVE_SLOTS];
+	uint32_t occupied_slots;			// a bit per slot in use
+	int active_keys_count;
+
+	struct keystroke *keystrokes;			// completed keystrokes, in release order
+	size_t keystrokes_length;
+	size_t keystrokes_capacity;
+
+	// Overload accounting. While dropping is true, events are discarded until the
+	// SYN_REPORT that lets key state be resynced.
+	bool dropping;
+	size_t syn_dropped_count;
+	size_t discarded_events;
 };
 
 struct user_info {
@@ -112,6 +197,66 @@ struct user_info {
 	short typing_duration;
 };
 
+struct raw_log_header {
+	char magic[8];
+	uint64_t events_length;
+	uint64_t events_capacity;
+	int32_t clock_id;		// clock the events were stamped with
+	uint32_t sessions_length;
+	struct user_info user_info;
+};
+
+// A raw log mapped into memory. events points just past the header.
+struct raw_log {
+	int fd;
+	bool writable;
+	struct raw_log_header *header;
+	struct input_event *events;
+	size_t mapping_size;
+};
+
+// Parameters that are not required for the program to run
+struct kdt_options {
+	bool instrument;
+	bool raw;			// write the input_event stream to the output file, untouched
+	char keymap_file_path[64];	// empty for the built-in US QWERTY layout
+	char plan_file_path[64];	// empty unless tests are taken from a plan (see libplan)
+
+	int realtime_cpu;		// CPU to pin capture to with the real-time profile, or -1 for none
+
+	// How output files are written (see libwriter)
+	bool bypass_cache;		// O_DIRECT
+	unsigned int sync_batch;	// files fsynced together
+
+	int journal_interval_ms;	// how often the journal is synced (see libjournal), or -1 for no journal
+
+	// Every -v, in order. The first is also the required device_file_path argument.
+	char device_file_paths[KDT_MAX_DEVICES][64];
+	int device_count;
+};
+
+// What the real-time profile asked for and what it got. Each error is 0 if that part of the
+// profile was granted, otherwise the errno it failed with (usually EPERM without root).
+struct realtime_report {
+	int cpu;
+	int affinity_error;
+	int scheduler_error;
+	int memory_lock_error;
+};
+
+// Timing fidelity measurements, collected when kdt is run with --instrument
+struct kdt_instrumentation {
+	struct histogram capture_latency;	// clock_gettime() at read minus ev.time, per event
+	struct histogram stage_sort;
+	struct histogram stage_statistics;
+	struct histogram stage_copy;
+	struct histogram stage_save;
+
+	uint64_t wakeups;			// returns from ppoll() in the collection loop
+	uint64_t events_read;			// events read by those wakeups
+	uint64_t interrupted_wakeups;		// wakeups that delivered nothing (signals, errors)
+};
+
 void timer_function(void* arg);
 
 // Enable/disable raw terminal mode
@@ -124,18 +269,51 @@ enum kdt_error set_session_statistic_data( struct session *s, enum kdt_statistic
 unsigned long* get_time_deltas_in_milliseconds(struct keystroke *keystrokes, size_t keystrokes_length);
 unsigned long* get_dwell_times_in_milliseconds(struct keystroke *keystrokes, size_t keystrokes_length);
 unsigned long* get_flight_times_in_milliseconds(struct keystroke *keystrokes, size_t keystrokes_length);
+size_t session_block_size(size_t keystrokes_length);
+void session_use_block(struct session *s, void *block, size_t keystrokes_length);
+enum kdt_error set_session_overlap_data(struct session *s);
+enum kdt_error set_session_rollover_from_times(struct session *s);
 
 // Debugging stuff
 void display_help_text();
 void display_environment_details(char user[], char email[], char major[], int duration, short number_of_samples, char output_file_path[], char device_file_path[], byte mode);
 
 // CLI paraser
-enum kdt_error parse_command_line_arguments(char *user, char *email, char *major, byte *mode, short *number_of_tests, short *typing_duration, char *device_file_path, char *output_file_path, FILE *output_file_fh, int argc, char **argv); 
+enum kdt_error parse_command_line_arguments(char *user, char *email, char *major, byte *mode, short *number_of_tests, short *typing_duration, char *device_file_path, char *output_file_path, FILE *output_file_fh, struct kdt_options *options, int argc, char **argv); 
 
 // Interpreting event file 
 int keycode_to_ascii(int keycode, int shift, int caps_lock);
+
+// Keystroke assembly
+enum kdt_error assembler_init(struct keystroke_assembler *assembler, const struct keymap *keymap, int fd);
+void assembler_reset(struct keystroke_assembler *assembler);
+int assembler_process_event(struct keystroke_assembler *assembler, struct input_event *ev, const struct timespec *timestamp);
+void assembler_free(struct keystroke_assembler *assembler);
+void resync_key_state(struct keystroke_assembler *assembler);
+enum kdt_error assembler_prefault(struct keystroke_assembler *assembler, size_t keystrokes);
+enum kdt_error compute_session_statistics(struct session *s);
+
+// Raw capture
+enum kdt_error raw_log_create(struct raw_log *log, const char *path, struct user_info *user_info, size_t events_capacity, int clock_id);
+enum kdt_error raw_log_reserve(struct raw_log *log, size_t additional);
+void raw_log_mark_session(struct raw_log *log);
+enum kdt_error raw_log_open(struct raw_log *log, const char *path);
+void raw_log_close(struct raw_log *log);
+enum kdt_error rebuild_sessions_from_raw_log(struct raw_log *log, const struct keymap *keymap, struct user_info **user_info, struct session **sessions, size_t *session_count);
 int compare_keystrokes(const void *a, const void *b);
 
+// Real-time profile
+void realtime_profile_apply(int cpu, struct realtime_report *report);
+void realtime_report_print(FILE *out, const struct realtime_report *report);
+
+// Instrumentation
+uint64_t timespec_difference_in_nanoseconds(struct timespec start, struct timespec end);
+void instrumentation_init(struct kdt_instrumentation *instrumentation);
+void instrumentation_print(FILE *out, struct kdt_instrumentation *instrumentation);
+
 int save_sessions(FILE *file, struct user_info *user_info, struct session *sessions, size_t session_count);
+int save_sessions_to_path(const char *path, struct user_info *user_info, struct session *sessions, size_t session_count);
+int save_sessions_to_buffer(struct user_info *user_info, struct session *sessions, size_t session_count, char **buffer, size_t *length);
+int load_sessions(FILE *file, struct user_info **user_info, struct session **sessions, size_t *session_count);
 
 #endif
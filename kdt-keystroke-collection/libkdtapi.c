@@ -0,0 +1,360 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+#include "libkdt.h"
+#include "libkdtapi.h"
+
+/*
+ * Implementation of the public libkdt.so interface (see libkdtapi.h). It is a thin layer
+ * over the same keystroke assembler, statistics and serialization kdt uses. libkdt.so is
+ * built with hidden visibility, so only the functions marked KDT_API are exported.
+ */
+#define KDT_API_READ_BATCH 64
+
+_Static_assert(sizeof(struct kdt_keystroke) == sizeof(struct keystroke), "struct kdt_keystroke must match struct keystroke");
+
+struct kdt_capture {
+	int fd;
+	struct keymap keymap;
+	struct keystroke_assembler assembler;
+
+	bool session_active;
+	size_t keystrokes_returned;	// keystrokes of the current session already handed out by kdt_capture_poll
+
+	struct user_info user_info;
+	struct session *sessions;
+	size_t sessions_length;
+	size_t sessions_capacity;
+};
+
+unsigned int kdt_api_version(void) {
+	return KDT_API_VERSION;
+}
+
+const char *kdt_status_string(int status) {
+	switch(status) {
+		case KDT_STATUS_OK:			return "no error";
+		case KDT_STATUS_INVALID_ARGUMENT:	return "invalid argument";
+		case KDT_STATUS_IO_ERROR:		return "input/output error";
+		case KDT_STATUS_NO_MEMORY:		return "out of memory";
+		case KDT_STATUS_WRONG_STATE:		return "not allowed in the current state";
+		case KDT_STATUS_STREAM_ENDED:		return "the event stream ended";
+		default:				return "unknown status";
+	}
+}
+
+kdt_capture *kdt_capture_open(const char *device_path, const char *keymap_path, int *status) {
+	int ignored_status;
+	if(status == NULL)
+		status = &ignored_status;
+
+	if(device_path == NULL) {
+		*status = KDT_STATUS_INVALID_ARGUMENT;
+		return NULL;
+	}
+
+	kdt_capture *capture = calloc(1, sizeof(kdt_capture));
+	if(capture == NULL) {
+		*status = KDT_STATUS_NO_MEMORY;
+		return NULL;
+	}
+
+	if(keymap_path == NULL)
+		capture->keymap = keymap_us_qwerty;
+	else if(keymap_load(&capture->keymap, keymap_path) != 0) {
+		free(capture);
+		*status = KDT_STATUS_IO_ERROR;
+		return NULL;
+	}
+
+	// Opened blocking, like kdt does, so a FIFO waits for its writer; reads are non-blocking
+	// from then on because kdt_capture_poll does the waiting
+	capture->fd = open(device_path, O_RDONLY);
+	if(capture->fd < 0) {
+		free(capture);
+		*status = KDT_STATUS_IO_ERROR;
+		return NULL;
+	}
+	fcntl(capture->fd, F_SETFL, fcntl(capture->fd, F_GETFL) | O_NONBLOCK);
+
+	// Keystrokes are stamped with the kernel's event times, on the same clock kdt uses
+	int clock_id = CLOCK_MONOTONIC;
+	ioctl(capture->fd, EVIOCSCLOCKID, &clock_id);
+
+	if(assembler_init(&capture->assembler, &capture->keymap, capture->fd) != KDT_NO_ERROR) {
+		close(capture->fd);
+		free(capture);
+		*status = KDT_STATUS_NO_MEMORY;
+		return NULL;
+	}
+
+	*status = KDT_STATUS_OK;
+	return capture;
+}
+
+void kdt_capture_close(kdt_capture *capture) {
+	if(capture == NULL)
+		return;
+
+	for(size_t i = 0; i < capture->sessions_length; i++) {
+		free(capture->sessions[i].keystrokes);
+		free(capture->sessions[i].time_deltas);
+		free(capture->sessions[i].dwell_times);
+		free(capture->sessions[i].flight_times);
+		free(capture->sessions[i].release_to_press);
+		free(capture->sessions[i].release_to_release);
+	}
+	free(capture->sessions);
+
+	assembler_free(&capture->assembler);
+	close(capture->fd);
+	free(capture);
+}
+
+int kdt_capture_set_user(kdt_capture *capture, const char *user, const char *email, const char *major, short typing_duration) {
+	if(capture == NULL || user == NULL || email == NULL || major == NULL)
+		return KDT_STATUS_INVALID_ARGUMENT;
+	if(strlen(user) >= sizeof(capture->user_info.user) || strlen(email) >= sizeof(capture->user_info.email) || strlen(major) >= sizeof(capture->user_info.major))
+		return KDT_STATUS_INVALID_ARGUMENT;
+
+	memset(&capture->user_info, 0, sizeof(struct user_info));
+	strcpy(capture->user_info.user, user);
+	strcpy(capture->user_info.email, email);
+	strcpy(capture->user_info.major, major);
+	capture->user_info.typing_duration = typing_duration;
+	return KDT_STATUS_OK;
+}
+
+// Read everything the device has queued. With a session active the events are assembled into
+// keystrokes; without one they are thrown away.
+static int capture_read_pending(kdt_capture *capture) {
+	struct input_event events[KDT_API_READ_BATCH];
+
+	for(;;) {
+		ssize_t bytes_read = read(capture->fd, events, sizeof(events));
+		if(bytes_read == 0)
+			return KDT_STATUS_STREAM_ENDED;
+		if(bytes_read < 0)
+			return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? KDT_STATUS_OK : KDT_STATUS_IO_ERROR;
+
+		size_t events_length = (size_t) bytes_read / sizeof(struct input_event);
+		for(size_t i = 0; capture->session_active && i < events_length; i++) {
+			struct timespec timestamp = { .tv_sec = events[i].input_event_sec, .tv_nsec = events[i].input_event_usec * 1000 };
+			if(assembler_process_event(&capture->assembler, &events[i], &timestamp) < 0)
+				return KDT_STATUS_NO_MEMORY;
+		}
+
+		// A short read means the queue is empty, which saves a read() that would fail
+		if((size_t) bytes_read < sizeof(events))
+			return KDT_STATUS_OK;
+	}
+}
+
+int kdt_capture_start_session(kdt_capture *capture) {
+	if(capture == NULL)
+		return KDT_STATUS_INVALID_ARGUMENT;
+	if(capture->session_active)
+		return KDT_STATUS_WRONG_STATE;
+
+	// Whatever was typed before the session started is not part of it
+	int status = capture_read_pending(capture);
+	if(status == KDT_STATUS_IO_ERROR)
+		return status;
+
+	assembler_reset(&capture->assembler);
+	capture->keystrokes_returned = 0;
+	capture->session_active = true;
+	return KDT_STATUS_OK;
+}
+
+int kdt_capture_poll(kdt_capture *capture, int timeout_ms, struct kdt_keystroke *keystrokes, size_t capacity, size_t *count) {
+	if(capture == NULL || count == NULL || (keystrokes == NULL && capacity > 0))
+		return KDT_STATUS_INVALID_ARGUMENT;
+	*count = 0;
+	if(!capture->session_active)
+		return KDT_STATUS_WRONG_STATE;
+
+	// Keystrokes left over from the last poll are handed out before waiting for more
+	int status = KDT_STATUS_OK;
+	struct keystroke_assembler *assembler = &capture->assembler;
+	if(capture->keystrokes_returned == assembler->keystrokes_length) {
+		struct pollfd device = { .fd = capture->fd, .events = POLLIN };
+		int ready = poll(&device, 1, timeout_ms);
+		if(ready < 0 && errno != EINTR)
+			return KDT_STATUS_IO_ERROR;
+		if(ready > 0)
+			status = capture_read_pending(capture);
+		if(status != KDT_STATUS_OK && status != KDT_STATUS_STREAM_ENDED)
+			return status;
+	}
+
+	size_t available = assembler->keystrokes_length - capture->keystrokes_returned;
+	*count = available < capacity ? available : capacity;
+	if(*count > 0) {
+		memcpy(keystrokes, &assembler->keystrokes[capture->keystrokes_returned], *count * sizeof(struct kdt_keystroke));
+		capture->keystrokes_returned += *count;
+	}
+
+	return status;
+}
+
+int kdt_capture_stop_session(kdt_capture *capture) {
+	if(capture == NULL)
+		return KDT_STATUS_INVALID_ARGUMENT;
+	if(!capture->session_active)
+		return KDT_STATUS_WRONG_STATE;
+
+	// Pick up anything typed right up to the end
+	int status = capture_read_pending(capture);
+	if(status == KDT_STATUS_NO_MEMORY || status == KDT_STATUS_IO_ERROR)
+		return status;
+	capture->session_active = false;
+
+	if(capture->sessions_length == capture->sessions_capacity) {
+		size_t new_capacity = capture->sessions_capacity == 0 ? 4 : capture->sessions_capacity * 2;
+		struct session *new_sessions = realloc(capture->sessions, new_capacity * sizeof(struct session));
+		if(new_sessions == NULL)
+			return KDT_STATUS_NO_MEMORY;
+		capture->sessions = new_sessions;
+		capture->sessions_capacity = new_capacity;
+	}
+
+	struct keystroke_assembler *assembler = &capture->assembler;
+	struct session *s = &capture->sessions[capture->sessions_length];
+	memset(s, 0, sizeof(struct session));
+	s->user_info = &capture->user_info;
+	s->keystrokes = malloc((assembler->keystrokes_length > 0 ? assembler->keystrokes_length : 1) * sizeof(struct keystroke));
+	if(s->keystrokes == NULL)
+		return KDT_STATUS_NO_MEMORY;
+	memcpy(s->keystrokes, assembler->keystrokes, assembler->keystrokes_length * sizeof(struct keystroke));
+	s->keystrokes_length = assembler->keystrokes_length;
+
+	s->syn_dropped_count = assembler->syn_dropped_count;
+	s->discarded_events = assembler->discarded_events;
+	for(size_t i = 0; i < s->keystrokes_length; i++) {
+		if(s->keystrokes[i].flags & KEYSTROKE_FLAG_TAINTED)
+			s->tainted_keystrokes++;
+	}
+
+	// Statistics need at least two keystrokes; shorter sessions are kept without them
+	if(s->keystrokes_length >= 2 && compute_session_statistics(s) == KDT_MALLOC_FAILURE)
+		return KDT_STATUS_NO_MEMORY;
+
+	capture->sessions_length++;
+	return KDT_STATUS_OK;
+}
+
+size_t kdt_capture_session_count(const kdt_capture *capture) {
+	return capture == NULL ? 0 : capture->sessions_length;
+}
+
+static double mean_in_milliseconds(const unsigned long *values, size_t length) {
+	if(values == NULL || length == 0)
+		return 0.0;
+
+	double sum = 0.0;
+	for(size_t i = 0; i < length; i++)
+		sum += values[i];
+	return sum / length;
+}
+
+int kdt_capture_session_stats(const kdt_capture *capture, size_t session_index, struct kdt_session_stats *stats) {
+	if(capture == NULL || stats == NULL || session_index >= capture->sessions_length)
+		return KDT_STATUS_INVALID_ARGUMENT;
+
+	const struct session *s = &capture->sessions[session_index];
+	stats->keystrokes = s->keystrokes_length;
+	stats->mean_time_delta_ms = mean_in_milliseconds(s->time_deltas, s->time_deltas_length);
+	stats->mean_dwell_time_ms = mean_in_milliseconds(s->dwell_times, s->dwell_times_length);
+	stats->mean_flight_time_ms = mean_in_milliseconds(s->flight_times, s->flight_times_length);
+	stats->syn_dropped_count = s->syn_dropped_count;
+	stats->discarded_events = s->discarded_events;
+	stats->tainted_keystrokes = s->tainted_keystrokes;
+	return KDT_STATUS_OK;
+}
+
+int kdt_capture_session_statistic(const kdt_capture *capture, size_t session_index, enum kdt_statistic_kind kind, const unsigned long **values, size_t *length) {
+	if(capture == NULL || values == NULL || length == NULL || session_index >= capture->sessions_length)
+		return KDT_STATUS_INVALID_ARGUMENT;
+
+	const struct session *s = &capture->sessions[session_index];
+	switch(kind) {
+		case KDT_STATISTIC_TIME_DELTAS:
+			*values = s->time_deltas;
+			*length = s->time_deltas_length;
+			break;
+		case KDT_STATISTIC_DWELL_TIMES:
+			*values = s->dwell_times;
+			*length = s->dwell_times_length;
+			break;
+		case KDT_STATISTIC_FLIGHT_TIMES:
+			*values = s->flight_times;
+			*length = s->flight_times_length;
+			break;
+		default:
+			return KDT_STATUS_INVALID_ARGUMENT;
+	}
+
+	return KDT_STATUS_OK;
+}
+
+static double signed_mean(const long *values, size_t length) {
+	if(values == NULL || length == 0)
+		return 0.0;
+
+	double sum = 0.0;
+	for(size_t i = 0; i < length; i++)
+		sum += values[i];
+	return sum / length;
+}
+
+int kdt_capture_session_overlap(const kdt_capture *capture, size_t session_index, struct kdt_session_overlap *overlap) {
+	if(capture == NULL || overlap == NULL || session_index >= capture->sessions_length)
+		return KDT_STATUS_INVALID_ARGUMENT;
+
+	const struct session *s = &capture->sessions[session_index];
+	overlap->overlapped_keystrokes = s->overlapped_keystrokes;
+	overlap->max_rollover = s->max_rollover;
+	overlap->mean_release_to_press_ms = signed_mean(s->release_to_press, s->release_to_press_length);
+	overlap->mean_release_to_release_ms = signed_mean(s->release_to_release, s->release_to_release_length);
+	return KDT_STATUS_OK;
+}
+
+int kdt_capture_session_signed_statistic(const kdt_capture *capture, size_t session_index, enum kdt_signed_statistic_kind kind, const long **values, size_t *length) {
+	if(capture == NULL || values == NULL || length == NULL || session_index >= capture->sessions_length)
+		return KDT_STATUS_INVALID_ARGUMENT;
+
+	const struct session *s = &capture->sessions[session_index];
+	switch(kind) {
+		case KDT_STATISTIC_RELEASE_TO_PRESS:
+			*values = s->release_to_press;
+			*length = s->release_to_press_length;
+			break;
+		case KDT_STATISTIC_RELEASE_TO_RELEASE:
+			*values = s->release_to_release;
+			*length = s->release_to_release_length;
+			break;
+		default:
+			return KDT_STATUS_INVALID_ARGUMENT;
+	}
+
+	return KDT_STATUS_OK;
+}
+
+int kdt_capture_write(const kdt_capture *capture, const char *path) {
+	if(capture == NULL || path == NULL)
+		return KDT_STATUS_INVALID_ARGUMENT;
+
+	// save_sessions only reads through these pointers
+	struct user_info user_info = capture->user_info;
+	if(save_sessions_to_path(path, &user_info, capture->sessions, capture->sessions_length) != 0)
+		return KDT_STATUS_IO_ERROR;
+
+	return KDT_STATUS_OK;
+}
@@ -0,0 +1,111 @@
+#include <stddef.h>
+#include <time.h>
+#ifndef LIBKDTAPI_H
+#define LIBKDTAPI_H
+
+/*
+ * Public interface of libkdt.so, for programs that collect keystrokes themselves instead of
+ * running kdt. This is the only header such a program includes; everything in libkdt.h is
+ * internal and may change. A kdt_capture handle owns a device, the keystroke assembly state
+ * and the sessions captured so far. Nothing is shared between handles and the library keeps
+ * no global state, so a process may use any number of handles (one per thread at a time).
+ *
+ *	kdt_capture *capture = kdt_capture_open("/dev/input/event3", NULL, &status);
+ *	kdt_capture_set_user(capture, "dave", "dave@coolmail.com", "cs", 60);
+ *	kdt_capture_start_session(capture);
+ *	while(still_collecting)
+ *		kdt_capture_poll(capture, 100, keystrokes, 64, &count);
+ *	kdt_capture_stop_session(capture);
+ *	kdt_capture_write(capture, "dave.bin");
+ *	kdt_capture_close(capture);
+ *
+ * Compatible changes bump KDT_API_VERSION_MINOR. Anything that breaks existing callers bumps
+ * KDT_API_VERSION_MAJOR, which is also the library's soname version (libkdt.so.1).
+ *
+ * 1.1: kdt_keystroke.rollover (in what was padding, so the layout is unchanged), and the
+ *      overlap features: kdt_capture_session_overlap and kdt_capture_session_signed_statistic.
+ */
+#define KDT_API_VERSION_MAJOR 1
+#define KDT_API_VERSION_MINOR 1
+#define KDT_API_VERSION ((KDT_API_VERSION_MAJOR << 16) | KDT_API_VERSION_MINOR)
+
+#define KDT_API __attribute__((visibility("default")))
+
+enum kdt_status {	KDT_STATUS_OK = 0,
+			KDT_STATUS_INVALID_ARGUMENT = -1,
+			KDT_STATUS_IO_ERROR = -2,	// the device or a file could not be opened, read or written
+			KDT_STATUS_NO_MEMORY = -3,
+			KDT_STATUS_WRONG_STATE = -4,	// e.g. polling with no session started
+			KDT_STATUS_STREAM_ENDED = -5	// the device went away (or a FIFO's writer closed it)
+		};
+
+enum kdt_statistic_kind {	KDT_STATISTIC_TIME_DELTAS,	// press to next press
+				KDT_STATISTIC_DWELL_TIMES,	// press to release of one key
+				KDT_STATISTIC_FLIGHT_TIMES	// release to next press
+			};
+
+// Overlap features, signed: negative when the next key was pressed (or released) before this
+// one was released
+enum kdt_signed_statistic_kind {	KDT_STATISTIC_RELEASE_TO_PRESS,		// release to next press
+					KDT_STATISTIC_RELEASE_TO_RELEASE	// release to next release
+				};
+
+// Identical in layout to the keystrokes kdt stores
+struct kdt_keystroke {
+	char c;				// 127 for backspace
+	unsigned char flags;		// KDT_KEYSTROKE_TAINTED: events were dropped while it was held
+	unsigned char rollover;		// other keys held when it was pressed (at most 255)
+	struct timespec press_time;	// CLOCK_MONOTONIC
+	struct timespec release_time;
+};
+#define KDT_KEYSTROKE_TAINTED 0x01
+
+struct kdt_session_stats {
+	size_t keystrokes;
+	double mean_time_delta_ms;
+	double mean_dwell_time_ms;
+	double mean_flight_time_ms;
+	size_t syn_dropped_count;
+	size_t discarded_events;
+	size_t tainted_keystrokes;
+};
+
+struct kdt_session_overlap {
+	size_t overlapped_keystrokes;		// keystrokes pressed while another key was held
+	size_t max_rollover;			// most keys held at once
+	double mean_release_to_press_ms;
+	double mean_release_to_release_ms;
+};
+
+typedef struct kdt_capture kdt_capture;
+
+KDT_API unsigned int kdt_api_version(void);
+KDT_API const char *kdt_status_string(int status);
+
+// keymap_path is a keymap file (see res/keymaps) or NULL for US QWERTY. Returns NULL on
+// failure, with the reason in *status if status is not NULL.
+KDT_API kdt_capture *kdt_capture_open(const char *device_path, const char *keymap_path, int *status);
+KDT_API void kdt_capture_close(kdt_capture *capture);
+
+// Who is typing, stored in the file kdt_capture_write produces
+KDT_API int kdt_capture_set_user(kdt_capture *capture, const char *user, const char *email, const char *major, short typing_duration);
+
+KDT_API int kdt_capture_start_session(kdt_capture *capture);
+KDT_API int kdt_capture_stop_session(kdt_capture *capture);
+
+// Wait up to timeout_ms (0 to not wait, -1 forever) for input, then process everything the
+// device has queued. Keystrokes completed since the last poll are copied into keystrokes (at
+// most capacity of them; the rest are returned by the next poll) and counted in *count.
+KDT_API int kdt_capture_poll(kdt_capture *capture, int timeout_ms, struct kdt_keystroke *keystrokes, size_t capacity, size_t *count);
+
+// Sessions completed with kdt_capture_stop_session, counted from 0
+KDT_API size_t kdt_capture_session_count(const kdt_capture *capture);
+KDT_API int kdt_capture_session_stats(const kdt_capture *capture, size_t session_index, struct kdt_session_stats *stats);
+KDT_API int kdt_capture_session_statistic(const kdt_capture *capture, size_t session_index, enum kdt_statistic_kind kind, const unsigned long **values, size_t *length);
+KDT_API int kdt_capture_session_overlap(const kdt_capture *capture, size_t session_index, struct kdt_session_overlap *overlap);
+KDT_API int kdt_capture_session_signed_statistic(const kdt_capture *capture, size_t session_index, enum kdt_signed_statistic_kind kind, const long **values, size_t *length);
+
+// Write every completed session to path in kdt's file format
+KDT_API int kdt_capture_write(const kdt_capture *capture, const char *path);
+
+#endif
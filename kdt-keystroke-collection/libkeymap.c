@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "libkeymap.h"
+
+// keycode, character without shift, character with shift
+#define US_QWERTY_KEYS(X) \
+	X(KEY_1, '1', '!') X(KEY_2, '2', '@') X(KEY_3, '3', '#') X(KEY_4, '4', '$') X(KEY_5, '5', '%') \
+	X(KEY_6, '6', '^') X(KEY_7, '7', '&') X(KEY_8, '8', '*') X(KEY_9, '9', '(') X(KEY_0, '0', ')') \
+	\
+	X(KEY_Q, 'q', 'Q') X(KEY_W, 'w', 'W') X(KEY_E, 'e', 'E') X(KEY_R, 'r', 'R') X(KEY_T, 't', 'T') \
+	X(KEY_Y, 'y', 'Y') X(KEY_U, 'u', 'U') X(KEY_I, 'i', 'I') X(KEY_O, 'o', 'O') X(KEY_P, 'p', 'P') \
+	X(KEY_A, 'a', 'A') X(KEY_S, 's', 'S') X(KEY_D, 'd', 'D') X(KEY_F, 'f', 'F') X(KEY_G, 'g', 'G') \
+	X(KEY_H, 'h', 'H') X(KEY_J, 'j', 'J') X(KEY_K, 'k', 'K') X(KEY_L, 'l', 'L') \
+	X(KEY_Z, 'z', 'Z') X(KEY_X, 'x', 'X') X(KEY_C, 'c', 'C') X(KEY_V, 'v', 'V') X(KEY_B, 'b', 'B') \
+	X(KEY_N, 'n', 'N') X(KEY_M, 'm', 'M') \
+	\
+	X(KEY_SPACE, ' ', ' ') X(KEY_ENTER, '\n', '\n') X(KEY_BACKSPACE, '\b', '\b') \
+	\
+	X(KEY_COMMA, ',', '<') X(KEY_DOT, '.', '>') X(KEY_SEMICOLON, ';', ':') X(KEY_APOSTROPHE, '\'', '"') \
+	X(KEY_SLASH, '/', '?') X(KEY_LEFTBRACE, '[', '{') X(KEY_RIGHTBRACE, ']', '}') X(KEY_BACKSLASH, '\\', '|') \
+	X(KEY_MINUS, '-', '_') X(KEY_EQUAL, '=', '+') X(KEY_GRAVE, '`', '~')
+
+// Caps lock swaps the case of letters and leaves everything else alone
+#define IS_LOWERCASE_LETTER(c) ((c) >= 'a' && (c) <= 'z')
+#define CAPS_LOCK_CHARACTER(lower, upper) (IS_LOWERCASE_LETTER(lower) ? (upper) : (lower))
+#define CAPS_LOCK_SHIFT_CHARACTER(lower, upper) (IS_LOWERCASE_LETTER(lower) ? (lower) : (upper))
+
+#define PLAIN_ENTRY(code, lower, upper) [code] = (lower),
+#define SHIFT_ENTRY(code, lower, upper) [code] = (upper),
+#define CAPS_LOCK_ENTRY(code, lower, upper) [code] = CAPS_LOCK_CHARACTER(lower, upper),
+#define CAPS_LOCK_SHIFT_ENTRY(code, lower, upper) [code] = CAPS_LOCK_SHIFT_CHARACTER(lower, upper),
+
+const struct keymap keymap_us_qwerty = {
+	.name = "us-qwerty",
+	.table = {
+		[0]                                                 = { US_QWERTY_KEYS(PLAIN_ENTRY) },
+		[KEYMAP_MODIFIER_SHIFT]                             = { US_QWERTY_KEYS(SHIFT_ENTRY) },
+		[KEYMAP_MODIFIER_CAPS_LOCK]                         = { US_QWERTY_KEYS(CAPS_LOCK_ENTRY) },
+		[KEYMAP_MODIFIER_CAPS_LOCK | KEYMAP_MODIFIER_SHIFT] = { US_QWERTY_KEYS(CAPS_LOCK_SHIFT_ENTRY) }
+	}
+};
+
+void keymap_clear(struct keymap *keymap, const char *name) {
+	memset(keymap->table, 0, sizeof(keymap->table));
+	strncpy(keymap->name, name, sizeof(keymap->name) - 1);
+	keymap->name[sizeof(keymap->name) - 1] = '\0';
+}
+
+void keymap_set_key(struct keymap *keymap, int keycode, char lower, char upper) {
+	if(keycode < 0 || keycode > KEY_MAX)
+		return;
+
+	keymap->table[0][keycode] = lower;
+	keymap->table[KEYMAP_MODIFIER_SHIFT][keycode] = upper;
+	keymap->table[KEYMAP_MODIFIER_CAPS_LOCK][keycode] = CAPS_LOCK_CHARACTER(lower, upper);
+	keymap->table[KEYMAP_MODIFIER_CAPS_LOCK | KEYMAP_MODIFIER_SHIFT][keycode] = CAPS_LOCK_SHIFT_CHARACTER(lower, upper);
+}
+
+// A character in a keymap file is either itself (one byte), a name for a character that
+// cannot be written on its own, or a byte value such as 0xE9.
+static int parse_keymap_character(const char *token, char *c) {
+	if(strlen(token) == 1)                 { *c = token[0]; return 0; }
+	if(strcmp(token, "space") == 0)        { *c = ' ';      return 0; }
+	if(strcmp(token, "enter") == 0)        { *c = '\n';     return 0; }
+	if(strcmp(token, "backspace") == 0)    { *c = '\b';     return 0; }
+	if(strcmp(token, "none") == 0)         { *c = 0;        return 0; }
+
+	if(strncmp(token, "0x", 2) == 0) {
+		char *end;
+		long value = strtol(token, &end, 16);
+		if(*end == '\0' && value > 0 && value <= 0xFF) {
+			*c = (char) value;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * Load a layout from a text file. Blank lines and lines starting with '#' are ignored.
+ * "name LAYOUT" names the keymap, and every other line is "KEYCODE LOWER UPPER", where
+ * KEYCODE is the number from linux/input-event-codes.h (e.g. 16 for KEY_Q). The file
+ * describes the whole layout; keys it does not mention produce no character.
+ */
+int keymap_load(struct keymap *keymap, const char *path) {
+	FILE *keymap_fh = fopen(path, "r");
+	if(keymap_fh == NULL) {
+		fprintf(stderr, "[keymap_load] Failed to open keymap file \"%s\".\n", path);
+		return -1;
+	}
+
+	keymap_clear(keymap, path);
+
+	char line[128];
+	int line_number = 0;
+	while(fgets(line, sizeof(line), keymap_fh) != NULL) {
+		line_number++;
+
+		char *start = line;
+		while(isspace((unsigned char) *start))
+			start++;
+		if(*start == '\0' || *start == '#')
+			continue;
+
+		char first[32], lower_token[16], upper_token[16];
+		int fields = sscanf(start, "%31s %15s %15s", first, lower_token, upper_token);
+
+		if(fields >= 2 && strcmp(first, "name") == 0) {
+			strncpy(keymap->name, lower_token, sizeof(keymap->name) - 1);
+			continue;
+		}
+
+		char *end;
+		long keycode = strtol(first, &end, 10);
+		char lower, upper;
+		if(fields != 3 || *end != '\0' || keycode < 0 || keycode > KEY_MAX || parse_keymap_character(lower_token, &lower) != 0 || parse_keymap_character(upper_token, &upper) != 0) {
+			fprintf(stderr, "[keymap_load] Line %d of \"%s\" is malformed. Expected \"KEYCODE LOWER UPPER\".\n", line_number, path);
+			fclose(keymap_fh);
+			return -1;
+		}
+
+		keymap_set_key(keymap, (int) keycode, lower, upper);
+	}
+
+	fclose(keymap_fh);
+	return 0;
+}
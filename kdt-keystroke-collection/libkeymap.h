@@ -0,0 +1,37 @@
+#include <stdbool.h>
+#include <linux/input-event-codes.h>
+#ifndef LIBKEYMAP_H
+#define LIBKEYMAP_H
+
+/*
+ * A keymap is a [modifier state][keycode] table of characters, filled in ahead of time so
+ * that turning a key event into a character is a single indexed load. Caps lock only
+ * affects letters, so the caps lock planes are derived from the plain and shifted planes
+ * when a key is set. Keymaps are never modified after they are built, so any number of
+ * threads may look characters up in the same one.
+ */
+#define KEYMAP_MODIFIER_SHIFT 0x01
+#define KEYMAP_MODIFIER_CAPS_LOCK 0x02
+#define KEYMAP_MODIFIER_STATES 4
+
+struct keymap {
+	char name[32];
+	char table[KEYMAP_MODIFIER_STATES][KEY_MAX + 1];
+};
+
+// US QWERTY, built at compile time
+extern const struct keymap keymap_us_qwerty;
+
+void keymap_clear(struct keymap *keymap, const char *name);
+void keymap_set_key(struct keymap *keymap, int keycode, char lower, char upper);
+int keymap_load(struct keymap *keymap, const char *path);
+
+static inline char keymap_lookup(const struct keymap *keymap, int keycode, int shift, int caps_lock) {
+	// Unsigned comparison rejects negative keycodes as well
+	if((unsigned int) keycode > KEY_MAX)
+		return 0;
+
+	return keymap->table[(shift != 0) | ((caps_lock != 0) << 1)][keycode];
+}
+
+#endif
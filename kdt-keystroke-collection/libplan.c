@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "libplan.h"
+
+static int plan_add_step(struct test_plan *plan, long typing_duration, long repetitions) {
+	if(typing_duration <= 0 || typing_duration > 0x7FFF || repetitions <= 0 || repetitions > 0x7FFF)
+		return -1;
+	if(plan->steps_length >= PLAN_MAX_STEPS)
+		return -1;
+
+	plan->steps[plan->steps_length].typing_duration = (short) typing_duration;
+	plan->steps[plan->steps_length].repetitions = (short) repetitions;
+	plan->steps_length++;
+	return 0;
+}
+
+/*
+ * Load a test plan from a text file. Blank lines and lines starting with '#' are ignored,
+ * and every other line is one of:
+ *
+ *	output PATTERN				where each test is saved (see plan_output_path)
+ *	pause SECONDS | enter			rest between tests (default: wait for ENTER)
+ *	tests DURATION REPETITIONS		REPETITIONS tests of DURATION seconds
+ *	range FIRST LAST STEP REPETITIONS	the same for FIRST, FIRST + STEP, ... up to LAST
+ *	checkpoint				before each step after the first, report progress and
+ *						ask whether to go on
+ *	retry					take a test that failed again, instead of ending the run
+ *
+ * Tests are taken in the order their lines appear.
+ */
+int plan_load(struct test_plan *plan, const char *path) {
+	FILE *plan_fh = fopen(path, "r");
+	if(plan_fh == NULL) {
+		fprintf(stderr, "[plan_load] Failed to open plan file \"%s\".\n", path);
+		return -1;
+	}
+
+	memset(plan, 0, sizeof(struct test_plan));
+	plan->pause_seconds = PLAN_PAUSE_FOR_ENTER;
+
+	char line[256];
+	int line_number = 0;
+	while(fgets(line, sizeof(line), plan_fh) != NULL) {
+		line_number++;
+
+		char *start = line;
+		while(isspace((unsigned char) *start))
+			start++;
+		if(*start == '\0' || *start == '#')
+			continue;
+
+		char directive[16], value[PLAN_MAX_PATH];
+		long first, last, step, repetitions;
+		bool malformed = false;
+
+		if(sscanf(start, "%15s", directive) != 1) {
+			malformed = true;
+		}
+		else if(strcmp(directive, "output") == 0) {
+			malformed = sscanf(start, "%*s %127s", value) != 1;
+			if(!malformed)
+				strcpy(plan->output_pattern, value);
+		}
+		else if(strcmp(directive, "pause") == 0) {
+			malformed = sscanf(start, "%*s %127s", value) != 1;
+			if(!malformed && strcmp(value, "enter") == 0)
+				plan->pause_seconds = PLAN_PAUSE_FOR_ENTER;
+			else if(!malformed) {
+				char *end;
+				plan->pause_seconds = (int) strtol(value, &end, 10);
+				malformed = *end != '\0' || plan->pause_seconds < 0;
+			}
+		}
+		else if(strcmp(directive, "checkpoint") == 0) {
+			plan->checkpoint = true;
+			malformed = sscanf(start, "%*s %127s", value) == 1;
+		}
+		else if(strcmp(directive, "retry") == 0) {
+			plan->retry = true;
+			malformed = sscanf(start, "%*s %127s", value) == 1;
+		}
+		else if(strcmp(directive, "tests") == 0) {
+			malformed = sscanf(start, "%*s %ld %ld", &first, &repetitions) != 2 || plan_add_step(plan, first, repetitions) != 0;
+		}
+		else if(strcmp(directive, "range") == 0) {
+			malformed = sscanf(start, "%*s %ld %ld %ld %ld", &first, &last, &step, &repetitions) != 4 || step <= 0 || first > last;
+			for(long duration = first; !malformed && duration <= last; duration += step)
+				malformed = plan_add_step(plan, duration, repetitions) != 0;
+		}
+		else {
+			malformed = true;
+		}
+
+		if(malformed) {
+			fprintf(stderr, "[plan_load] Line %d of \"%s\" is malformed or exceeds a limit (%d steps, %d character paths).\n", line_number, path, PLAN_MAX_STEPS, PLAN_MAX_PATH - 1);
+			fclose(plan_fh);
+			return -1;
+		}
+	}
+	fclose(plan_fh);
+
+	if(plan->steps_length == 0 || plan->output_pattern[0] == '\0') {
+		fprintf(stderr, "[plan_load] \"%s\" needs an output line and at least one tests or range line.\n", path);
+		return -1;
+	}
+	if(plan_test_count(plan) <= 0) {
+		fprintf(stderr, "[plan_load] \"%s\" describes more tests than kdt can take in one run.\n", path);
+		return -1;
+	}
+
+	return 0;
+}
+
+// Total number of tests in the plan, or -1 if it does not fit in a short
+short plan_test_count(const struct test_plan *plan) {
+	long count = 0;
+	for(size_t i = 0; i < plan->steps_length; i++)
+		count += plan->steps[i].repetitions;
+
+	return count > 0x7FFF ? -1 : (short) count;
+}
+
+// Find the duration of the index-th test (counting from 0) and its number among the tests of
+// that duration, so that a duration listed twice keeps counting instead of starting over
+void plan_test_at(const struct test_plan *plan, short index, short *typing_duration, short *test_number) {
+	for(size_t i = 0; i < plan->steps_length; i++) {
+		if(index < plan->steps[i].repetitions) {
+			*typing_duration = plan->steps[i].typing_duration;
+			*test_number = index + 1;
+			for(size_t j = 0; j < i; j++) {
+				if(plan->steps[j].typing_duration == *typing_duration)
+					*test_number += plan->steps[j].repetitions;
+			}
+			return;
+		}
+		index -= plan->steps[i].repetitions;
+	}
+
+	*typing_duration = 0;
+	*test_number = 0;
+}
+
+// The step the index-th test (counting from 0) belongs to, or -1 if the plan is shorter.
+// first is set if it is the step's first test.
+int plan_step_of(const struct test_plan *plan, short index, bool *first) {
+	for(size_t i = 0; i < plan->steps_length; i++) {
+		if(index < plan->steps[i].repetitions) {
+			*first = index == 0;
+			return (int) i;
+		}
+		index -= plan->steps[i].repetitions;
+	}
+
+	*first = false;
+	return -1;
+}
+
+/*
+ * Expand the plan's output pattern for one test. {user}, {duration} and {test} (the test's
+ * number among the tests of its duration, from 1) are replaced, as is {index} (its position
+ * in the whole plan, from 1). "data/{user}-d{duration}-{test}.bin" names files the way
+ * runner always has. Returns -1 if the expanded path does not fit in the buffer.
+ */
+int plan_output_path(const struct test_plan *plan, const char *user, short typing_duration, short test_number, short index, char *buffer, size_t buffer_size) {
+	size_t length = 0;
+	const char *pattern = plan->output_pattern;
+
+	while(*pattern != '\0') {
+		char expansion[64];
+		const char *piece = expansion;
+		size_t consumed = 1;
+
+		if(strncmp(pattern, "{user}", 6) == 0)          { piece = user; consumed = 6; }
+		else if(strncmp(pattern, "{duration}", 10) == 0) { snprintf(expansion, sizeof(expansion), "%d", typing_duration); consumed = 10; }
+		else if(strncmp(pattern, "{test}", 6) == 0)      { snprintf(expansion, sizeof(expansion), "%d", test_number); consumed = 6; }
+		else if(strncmp(pattern, "{index}", 7) == 0)     { snprintf(expansion, sizeof(expansion), "%d", index + 1); consumed = 7; }
+		else                                             { expansion[0] = *pattern; expansion[1] = '\0'; }
+
+		size_t piece_length = strlen(piece);
+		if(length + piece_length >= buffer_size)
+			return -1;
+		memcpy(buffer + length, piece, piece_length);
+		length += piece_length;
+		pattern += consumed;
+	}
+
+	buffer[length] = '\0';
+	return 0;
+}
@@ -0,0 +1,38 @@
+#include <stdbool.h>
+#include <stddef.h>
+#ifndef LIBPLAN_H
+#define LIBPLAN_H
+
+/*
+ * A test plan describes a whole collection run (every duration, how many tests of each,
+ * where each test is saved and how long to rest between them) so that kdt can take all
+ * of the tests in one process instead of being launched once per test.
+ */
+#define PLAN_MAX_STEPS 64
+#define PLAN_MAX_PATH 128
+#define PLAN_PAUSE_FOR_ENTER -1		// wait for ENTER between tests instead of a fixed pause
+#define PLAN_DECLINED_EXIT_STATUS 2	// kdt's exit status when the user stops at a checkpoint
+
+struct plan_step {
+	short typing_duration;		// seconds
+	short repetitions;
+};
+
+struct test_plan {
+	struct plan_step steps[PLAN_MAX_STEPS];
+	size_t steps_length;
+
+	int pause_seconds;
+	char output_pattern[PLAN_MAX_PATH];	// see plan_output_path for the placeholders
+
+	bool checkpoint;		// ask before starting each step after the first
+	bool retry;			// take a failed test again instead of ending the run
+};
+
+int plan_load(struct test_plan *plan, const char *path);
+short plan_test_count(const struct test_plan *plan);
+void plan_test_at(const struct test_plan *plan, short index, short *typing_duration, short *test_number);
+int plan_step_of(const struct test_plan *plan, short index, bool *first);
+int plan_output_path(const struct test_plan *plan, const char *user, short typing_duration, short test_number, short index, char *buffer, size_t buffer_size);
+
+#endif
@@ -0,0 +1,411 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "libwriter.h"
+
+enum async_write_state {	ASYNC_WRITE_WRITING,	// write in flight (or about to be)
+				ASYNC_WRITE_UNSYNCED,	// written, waiting for its fsync batch
+				ASYNC_WRITE_SYNCING,	// fsync in flight
+				ASYNC_WRITE_DONE	// in place (or failed), waiting to be reaped
+			};
+
+// One file being written. A file only ever has one operation in flight, so its state says
+// which operation a completion belongs to.
+struct async_write {
+	char path[PATH_MAX];
+	char temporary_path[PATH_MAX];
+	int fd;
+	enum async_write_state state;
+	int result;
+
+	unsigned char *buffer;
+	size_t length;			// bytes of data
+	size_t padded_length;		// bytes written, which O_DIRECT rounds up to whole blocks
+	size_t written;
+
+	void *tag;
+	struct async_write *next;
+};
+
+static void start_write(struct async_writer *writer, struct async_write *file);
+
+static int io_uring_setup(unsigned int entries, struct io_uring_params *parameters) {
+	return (int) syscall(__NR_io_uring_setup, entries, parameters);
+}
+
+static int io_uring_enter(int ring_fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags) {
+	return (int) syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+// Map the rings of a new io_uring instance. Returns -1 (and leaves the writer on the pwrite()
+// fallback) if the kernel does not support io_uring or it is disabled.
+static int ring_setup(struct async_writer *writer) {
+	struct io_uring_params parameters;
+	memset(&parameters, 0, sizeof(parameters));
+
+	int ring_fd = io_uring_setup(ASYNC_WRITER_QUEUE_DEPTH, &parameters);
+	if(ring_fd < 0)
+		return -1;
+
+	writer->sq_ring_size = parameters.sq_off.array + parameters.sq_entries * sizeof(unsigned int);
+	writer->cq_ring_size = parameters.cq_off.cqes + parameters.cq_entries * sizeof(struct io_uring_cqe);
+	writer->sqes_size = parameters.sq_entries * sizeof(struct io_uring_sqe);
+
+	writer->sq_ring = mmap(NULL, writer->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+	writer->cq_ring = mmap(NULL, writer->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+	writer->sqes = mmap(NULL, writer->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+	if(writer->sq_ring == MAP_FAILED || writer->cq_ring == MAP_FAILED || writer->sqes == MAP_FAILED) {
+		if(writer->sq_ring != MAP_FAILED)
+			munmap(writer->sq_ring, writer->sq_ring_size);
+		if(writer->cq_ring != MAP_FAILED)
+			munmap(writer->cq_ring, writer->cq_ring_size);
+		if(writer->sqes != MAP_FAILED)
+			munmap(writer->sqes, writer->sqes_size);
+		close(ring_fd);
+		return -1;
+	}
+
+	unsigned char *sq_ring = writer->sq_ring;
+	unsigned char *cq_ring = writer->cq_ring;
+	writer->sq_tail = (unsigned int *) (sq_ring + parameters.sq_off.tail);
+	writer->sq_mask = (unsigned int *) (sq_ring + parameters.sq_off.ring_mask);
+	writer->sq_array = (unsigned int *) (sq_ring + parameters.sq_off.array);
+	writer->cq_head = (unsigned int *) (cq_ring + parameters.cq_off.head);
+	writer->cq_tail = (unsigned int *) (cq_ring + parameters.cq_off.tail);
+	writer->cq_mask = (unsigned int *) (cq_ring + parameters.cq_off.ring_mask);
+	writer->cqes = (struct io_uring_cqe *) (cq_ring + parameters.cq_off.cqes);
+	writer->sq_entries = parameters.sq_entries;
+	writer->ring_fd = ring_fd;
+	return 0;
+}
+
+// Tell the kernel about the queued operations, optionally waiting for min_complete of the
+// operations in flight to complete
+static void submit_queued(struct async_writer *writer, unsigned int min_complete) {
+	while(writer->queued > 0 || min_complete > 0) {
+		int submitted = io_uring_enter(writer->ring_fd, writer->queued, min_complete, min_complete > 0 ? IORING_ENTER_GETEVENTS : 0);
+		if(submitted < 0) {
+			if(errno == EINTR)
+				continue;
+			fprintf(stderr, "[submit_queued] io_uring_enter failed: %s.\n", strerror(errno));
+			return;
+		}
+		writer->queued -= (unsigned int) submitted;
+		writer->in_kernel += (unsigned int) submitted;
+		min_complete = 0;
+	}
+}
+
+static void fail_file(struct async_write *file, int result) {
+	if(file->fd >= 0)
+		close(file->fd);
+	file->fd = -1;
+	unlink(file->temporary_path);
+	file->result = result;
+	file->state = ASYNC_WRITE_DONE;
+}
+
+// All of a file has been written, so it joins the fsync batch
+static void finish_write(struct async_writer *writer, struct async_write *file) {
+	// Drop the padding O_DIRECT needed
+	if(file->padded_length != file->length && ftruncate(file->fd, (off_t) file->length) != 0) {
+		fail_file(file, -errno);
+		return;
+	}
+
+	file->state = ASYNC_WRITE_UNSYNCED;
+	writer->unsynced++;
+	if(writer->unsynced >= writer->sync_batch || writer->flushing)
+		async_writer_flush(writer);
+}
+
+// Advance a file once its operation in flight has completed with result (bytes written, 0
+// for an fsync, or a negative errno)
+static void complete_operation(struct async_writer *writer, struct async_write *file, int result) {
+	if(result < 0) {
+		fail_file(file, result);
+		return;
+	}
+
+	if(file->state == ASYNC_WRITE_WRITING) {
+		if(result == 0) {
+			fail_file(file, -EIO);
+			return;
+		}
+		file->written += (size_t) result;
+		if(file->written < file->padded_length)
+			start_write(writer, file);
+		else
+			finish_write(writer, file);
+	}
+	else if(file->state == ASYNC_WRITE_SYNCING) {
+		close(file->fd);
+		file->fd = -1;
+		if(rename(file->temporary_path, file->path) != 0) {
+			fail_file(file, -errno);
+			return;
+		}
+		file->result = 0;
+		file->state = ASYNC_WRITE_DONE;
+	}
+}
+
+static void process_completions(struct async_writer *writer, bool wait) {
+	if(writer->ring_fd < 0)
+		return;
+
+	submit_queued(writer, wait && writer->in_kernel + writer->queued > 0 ? 1 : 0);
+
+	unsigned int head = *writer->cq_head;
+	while(head != __atomic_load_n(writer->cq_tail, __ATOMIC_ACQUIRE)) {
+		struct io_uring_cqe *cqe = &writer->cqes[head & *writer->cq_mask];
+		struct async_write *file = (struct async_write *) (uintptr_t) cqe->user_data;
+		int result = cqe->res;
+
+		head++;
+		__atomic_store_n(writer->cq_head, head, __ATOMIC_RELEASE);
+		writer->in_kernel--;
+
+		// May queue the file's next operation, which may in turn consume completions if the
+		// ring is full, so the head is read again
+		complete_operation(writer, file, result);
+		head = *writer->cq_head;
+	}
+
+	submit_queued(writer, 0);
+}
+
+// Room for one more operation, waiting for some in flight to complete if the ring is full.
+// The entry is not visible to the kernel until commit_sqe is called once it is filled in.
+static struct io_uring_sqe *next_sqe(struct async_writer *writer) {
+	while(writer->queued + writer->in_kernel >= writer->sq_entries)
+		process_completions(writer, true);
+
+	unsigned int index = *writer->sq_tail & *writer->sq_mask;
+	struct io_uring_sqe *sqe = &writer->sqes[index];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	return sqe;
+}
+
+// Publish the entry next_sqe returned. The release store orders the writes filling it in
+// before the new tail.
+static void commit_sqe(struct async_writer *writer) {
+	unsigned int tail = *writer->sq_tail;
+	unsigned int index = tail & *writer->sq_mask;
+
+	writer->sq_array[index] = index;
+	__atomic_store_n(writer->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	writer->queued++;
+}
+
+static void start_write(struct async_writer *writer, struct async_write *file) {
+	unsigned char *data = file->buffer + file->written;
+	size_t remaining = file->padded_length - file->written;
+
+	if(writer->ring_fd < 0) {
+		ssize_t written = pwrite(file->fd, data, remaining, (off_t) file->written);
+		complete_operation(writer, file, written < 0 ? -errno : (int) written);
+		return;
+	}
+
+	struct io_uring_sqe *sqe = next_sqe(writer);
+	sqe->opcode = IORING_OP_WRITE;
+	sqe->fd = file->fd;
+	sqe->addr = (uintptr_t) data;
+	sqe->len = remaining > 0x7FFFF000 ? 0x7FFFF000 : (unsigned int) remaining;
+	sqe->off = file->written;
+	sqe->user_data = (uintptr_t) file;
+	commit_sqe(writer);
+}
+
+static void start_sync(struct async_writer *writer, struct async_write *file) {
+	file->state = ASYNC_WRITE_SYNCING;
+
+	if(writer->ring_fd < 0) {
+		complete_operation(writer, file, fsync(file->fd) == 0 ? 0 : -errno);
+		return;
+	}
+
+	struct io_uring_sqe *sqe = next_sqe(writer);
+	sqe->opcode = IORING_OP_FSYNC;
+	sqe->fd = file->fd;
+	sqe->user_data = (uintptr_t) file;
+	commit_sqe(writer);
+}
+
+/*
+ * Set up a writer. sync_batch is how many written files wait for an fsync before they are
+ * synced together (1 syncs every file as soon as it is written). Falls back to pwrite()
+ * when io_uring cannot be used; see async_writer_backend.
+ */
+int async_writer_open(struct async_writer *writer, unsigned int sync_batch, int flags) {
+	memset(writer, 0, sizeof(struct async_writer));
+	writer->ring_fd = -1;
+	writer->flags = flags;
+	writer->sync_batch = sync_batch == 0 ? 1 : sync_batch;
+
+	ring_setup(writer);
+	return 0;
+}
+
+/*
+ * Start writing length bytes of data to path. The writer takes ownership of data (allocated
+ * with malloc) and frees it once the file is done. tag is handed back by async_writer_reap
+ * when the file is in place or has failed. Returns -1 if memory ran out, in which case
+ * nothing is written.
+ */
+int async_writer_submit(struct async_writer *writer, const char *path, void *data, size_t length, void *tag) {
+	struct async_write *file = calloc(1, sizeof(struct async_write));
+	if(file == NULL) {
+		fprintf(stderr, "[async_writer_submit] Failed to allocate memory to write \"%s\".\n", path);
+		free(data);
+		return -1;
+	}
+	file->fd = -1;
+	file->tag = tag;
+	file->buffer = data;
+	file->length = length;
+	file->padded_length = length;
+	file->state = ASYNC_WRITE_WRITING;
+
+	// Files are kept in the order they were handed over, so they are synced and reaped in it
+	struct async_write **link = &writer->files;
+	while(*link != NULL)
+		link = &(*link)->next;
+	*link = file;
+
+	if(snprintf(file->path, sizeof(file->path), "%s", path) >= (int) sizeof(file->path) || snprintf(file->temporary_path, sizeof(file->temporary_path), "%s.tmp", path) >= (int) sizeof(file->temporary_path)) {
+		fprintf(stderr, "[async_writer_submit] Path \"%s\" is too long.\n", path);
+		file->result = -ENAMETOOLONG;
+		file->state = ASYNC_WRITE_DONE;
+		return 0;
+	}
+
+	// O_DIRECT needs whole, aligned blocks. Filesystems without it (tmpfs) get a normal write.
+	if(writer->flags & ASYNC_WRITER_DIRECT) {
+		file->fd = open(file->temporary_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0666);
+		if(file->fd >= 0) {
+			size_t padded_length = (length + ASYNC_WRITER_DIRECT_ALIGNMENT - 1) / ASYNC_WRITER_DIRECT_ALIGNMENT * ASYNC_WRITER_DIRECT_ALIGNMENT;
+			void *aligned;
+			if(posix_memalign(&aligned, ASYNC_WRITER_DIRECT_ALIGNMENT, padded_length) != 0) {
+				fprintf(stderr, "[async_writer_submit] Failed to allocate memory to write \"%s\".\n", path);
+				fail_file(file, -ENOMEM);
+				return 0;
+			}
+			memcpy(aligned, data, length);
+			memset((unsigned char *) aligned + length, 0, padded_length - length);
+			free(data);
+			file->buffer = aligned;
+			file->padded_length = padded_length;
+		}
+	}
+	if(file->fd < 0)
+		file->fd = open(file->temporary_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if(file->fd < 0) {
+		fprintf(stderr, "[async_writer_submit] Error opening file \"%s\" for writing.\n", file->temporary_path);
+		fail_file(file, -errno);
+		return 0;
+	}
+
+	if(length == 0)
+		finish_write(writer, file);
+	else
+		start_write(writer, file);
+
+	if(writer->ring_fd >= 0)
+		submit_queued(writer, 0);
+	return 0;
+}
+
+// Sync every file handed over so far instead of waiting for the batch to fill up: those
+// already written now, and those still being written as soon as they are
+void async_writer_flush(struct async_writer *writer) {
+	writer->flushing = false;
+	for(struct async_write *file = writer->files; file != NULL; file = file->next) {
+		if(file->state == ASYNC_WRITE_UNSYNCED) {
+			writer->unsynced--;
+			start_sync(writer, file);
+		}
+		else if(file->state == ASYNC_WRITE_WRITING) {
+			writer->flushing = true;
+		}
+	}
+
+	if(writer->ring_fd >= 0)
+		submit_queued(writer, 0);
+}
+
+// Whether any write or fsync is in flight. Files waiting for their fsync batch are not.
+bool async_writer_busy(const struct async_writer *writer) {
+	return writer->queued + writer->in_kernel > 0;
+}
+
+/*
+ * Collect up to capacity files that are in place or have failed. With wait, block until at
+ * least one operation in flight completes first (nothing is waited for if none is in
+ * flight, so flush a partial fsync batch before waiting for it). Returns how many
+ * completions were stored.
+ */
+size_t async_writer_reap(struct async_writer *writer, bool wait, struct async_writer_completion *completions, size_t capacity) {
+	process_completions(writer, wait);
+
+	size_t count = 0;
+	struct async_write **link = &writer->files;
+	while(*link != NULL && count < capacity) {
+		struct async_write *file = *link;
+		if(file->state != ASYNC_WRITE_DONE) {
+			link = &file->next;
+			continue;
+		}
+
+		completions[count].tag = file->tag;
+		completions[count].result = file->result;
+		count++;
+
+		*link = file->next;
+		free(file->buffer);
+		free(file);
+	}
+
+	return count;
+}
+
+// Finish every file (they are not reported) and release the writer
+void async_writer_close(struct async_writer *writer) {
+	for(;;) {
+		async_writer_flush(writer);
+		if(!async_writer_busy(writer))
+			break;
+		process_completions(writer, true);
+	}
+
+	while(writer->files != NULL) {
+		struct async_write *file = writer->files;
+		writer->files = file->next;
+		if(file->fd >= 0)
+			close(file->fd);
+		free(file->buffer);
+		free(file);
+	}
+
+	if(writer->ring_fd >= 0) {
+		munmap(writer->sq_ring, writer->sq_ring_size);
+		munmap(writer->cq_ring, writer->cq_ring_size);
+		munmap(writer->sqes, writer->sqes_size);
+		close(writer->ring_fd);
+		writer->ring_fd = -1;
+	}
+}
+
+const char *async_writer_backend(const struct async_writer *writer) {
+	return writer->ring_fd >= 0 ? "io_uring" : "pwrite";
+}
@@ -0,0 +1,66 @@
+#include <stdbool.h>
+#include <stddef.h>
+#ifndef LIBWRITER_H
+#define LIBWRITER_H
+
+/*
+ * Asynchronous file writer. Each file is handed over as one block that is already
+ * serialized, and is written to PATH.tmp, fsynced and renamed over PATH, exactly as
+ * save_sessions_to_path does, but without the caller waiting for the disk. The writes and
+ * fsyncs go through io_uring when the kernel allows it, and otherwise through pwrite() and
+ * fsync() when the file is handed over (so the same code works everywhere, just not
+ * asynchronously). liburing is not needed: the rings are set up with the raw system calls.
+ *
+ * fsyncs are batched: a written file waits until sync_batch files are waiting, and they are
+ * then synced together. A file only appears at its path once it has been synced, so batching
+ * delays files but never exposes a partial one. A writer is not thread safe; use it from one
+ * thread.
+ */
+#define ASYNC_WRITER_QUEUE_DEPTH 64
+#define ASYNC_WRITER_DIRECT 0x01	// open files with O_DIRECT, bypassing the page cache
+#define ASYNC_WRITER_DIRECT_ALIGNMENT 4096
+
+struct async_write;
+
+struct async_writer {
+	int ring_fd;			// -1 if io_uring is unavailable and files are written with pwrite()
+	int flags;
+	unsigned int sync_batch;
+
+	// Ring mappings, shared with the kernel
+	void *sq_ring;
+	size_t sq_ring_size;
+	void *cq_ring;
+	size_t cq_ring_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+	unsigned int sq_entries;
+
+	unsigned int queued;		// operations in the submission queue the kernel has not been told about
+	unsigned int in_kernel;		// operations submitted and not yet completed
+	size_t unsynced;		// files written and waiting for their fsync batch
+	bool flushing;			// files still being written are synced as soon as they are
+	struct async_write *files;	// every file not yet reaped
+};
+
+struct async_writer_completion {
+	void *tag;			// as given to async_writer_submit
+	int result;			// 0 once the file is in place, otherwise a negative errno
+};
+
+int async_writer_open(struct async_writer *writer, unsigned int sync_batch, int flags);
+int async_writer_submit(struct async_writer *writer, const char *path, void *data, size_t length, void *tag);
+void async_writer_flush(struct async_writer *writer);
+bool async_writer_busy(const struct async_writer *writer);
+size_t async_writer_reap(struct async_writer *writer, bool wait, struct async_writer_completion *completions, size_t capacity);
+void async_writer_close(struct async_writer *writer);
+const char *async_writer_backend(const struct async_writer *writer);
+
+#endif
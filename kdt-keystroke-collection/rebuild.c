@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <linux/input.h>
+#include "libkdt.h"
+
+/*
+ * kdt-rebuild: turns a raw log written by kdt --raw into an ordinary session file. All of
+ * the work kdt normally does while the user types (pairing presses with releases, keymap
+ * lookups, statistics) happens here instead, and can be redone with a different keymap.
+ *
+ *	./kdt -u dave -e dave@coolmail.com -m cs -d 10 -n 3 -f -r -o dave.raw -v /dev/input/event3
+ *	./kdt-rebuild --input dave.raw --output dave.bin [--keymap res/keymaps/us-dvorak.txt]
+ */
+
+static void display_usage(char *program) {
+	fprintf(stderr, "Usage: %s --input RAW_LOG --output FILE [--keymap FILE]\n", program);
+}
+
+static void free_sessions(struct user_info *user_info, struct session *sessions, size_t session_count) {
+	for(size_t i = 0; i < session_count; i++) {
+		free(sessions[i].keystrokes);
+		free(sessions[i].time_deltas);
+		free(sessions[i].dwell_times);
+		free(sessions[i].flight_times);
+		free(sessions[i].release_to_press);
+		free(sessions[i].release_to_release);
+	}
+	free(sessions);
+	free(user_info);
+}
+
+int main(int argc, char **argv) {
+	char *input_path = NULL;
+	char *output_path = NULL;
+	const struct keymap *keymap = &keymap_us_qwerty;
+	struct keymap loaded_keymap;
+
+	for(int i = 1; i < argc; i++) {
+		bool has_value = i + 1 < argc;
+		if(strcmp(argv[i], "--input") == 0 && has_value)
+			input_path = argv[++i];
+		else if(strcmp(argv[i], "--output") == 0 && has_value)
+			output_path = argv[++i];
+		else if(strcmp(argv[i], "--keymap") == 0 && has_value) {
+			if(keymap_load(&loaded_keymap, argv[++i]) != 0)
+				return EXIT_FAILURE;
+			keymap = &loaded_keymap;
+		}
+		else {
+			display_usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if(input_path == NULL || output_path == NULL) {
+		display_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	struct raw_log log;
+	if(raw_log_open(&log, input_path) != KDT_NO_ERROR)
+		return EXIT_FAILURE;
+
+	printf("Rebuilding %u session(s) from %lu raw events using keymap \"%s\"...\n", log.header->sessions_length, (unsigned long) log.header->events_length, keymap->name);
+
+	struct user_info *user_info = NULL;
+	struct session *sessions = NULL;
+	size_t session_count = 0;
+	enum kdt_error error_code = rebuild_sessions_from_raw_log(&log, keymap, &user_info, &sessions, &session_count);
+	raw_log_close(&log);
+	if(error_code != KDT_NO_ERROR) {
+		fprintf(stderr, "Failed to rebuild sessions. KDT error code was %d.\n", error_code);
+		return EXIT_FAILURE;
+	}
+
+	for(size_t i = 0; i < session_count; i++) {
+		printf("  Session #%zu: %zu keystrokes", i + 1, sessions[i].keystrokes_length);
+		if(sessions[i].syn_dropped_count > 0)
+			printf(", %zu SYN_DROPPED, %zu tainted keystrokes", sessions[i].syn_dropped_count, sessions[i].tainted_keystrokes);
+		printf("\n");
+	}
+
+	FILE *output_file_fh = fopen(output_path, "wb");
+	if(output_file_fh == NULL) {
+		fprintf(stderr, "Error opening file \"%s\" for writing.\n", output_path);
+		free_sessions(user_info, sessions, session_count);
+		return EXIT_FAILURE;
+	}
+
+	if(save_sessions(output_file_fh, user_info, sessions, session_count) != 0) {
+		fprintf(stderr, "Error saving session data to file.\n");
+		fclose(output_file_fh);
+		free_sessions(user_info, sessions, session_count);
+		return EXIT_FAILURE;
+	}
+	fclose(output_file_fh);
+	printf("Session data successfully saved to %s\n", output_path);
+
+	free_sessions(user_info, sessions, session_count);
+	return EXIT_SUCCESS;
+}
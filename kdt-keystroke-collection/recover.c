@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include "libkdt.h"
+#include "libjournal.h"
+
+/*
+ * kdt-recover: turns the journal a kdt --journal run left behind (because it died before
+ * saving its output file) into an ordinary session file. Every test that was started is
+ * recovered, including the one kdt died during, with the keystrokes that reached the
+ * journal.
+ *
+ *	./kdt -u dave -e dave@coolmail.com -m cs -d 60 -n 10 -f -o dave.bin -v /dev/input/event3 -j 1000
+ *	./kdt-recover --journal dave.bin.journal --output dave.bin
+ */
+
+static void display_usage(char *program) {
+	fprintf(stderr, "Usage: %s --journal JOURNAL --output FILE\n", program);
+}
+
+static void free_sessions(struct user_info *user_info, struct session *sessions, size_t session_count) {
+	for(size_t i = 0; i < session_count; i++) {
+		free(sessions[i].keystrokes);
+		free(sessions[i].time_deltas);
+		free(sessions[i].dwell_times);
+		free(sessions[i].flight_times);
+		free(sessions[i].release_to_press);
+		free(sessions[i].release_to_release);
+	}
+	free(sessions);
+	free(user_info);
+}
+
+int main(int argc, char **argv) {
+	char *journal_path = NULL;
+	char *output_path = NULL;
+
+	for(int i = 1; i < argc; i++) {
+		bool has_value = i + 1 < argc;
+		if(strcmp(argv[i], "--journal") == 0 && has_value)
+			journal_path = argv[++i];
+		else if(strcmp(argv[i], "--output") == 0 && has_value)
+			output_path = argv[++i];
+		else {
+			display_usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if(journal_path == NULL || output_path == NULL) {
+		display_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	struct user_info *user_info = NULL;
+	struct session *sessions = NULL;
+	size_t session_count = 0;
+	struct journal_recovery recovery;
+	enum kdt_error error_code = journal_recover(journal_path, &user_info, &sessions, &session_count, &recovery);
+	if(error_code != KDT_NO_ERROR) {
+		fprintf(stderr, "Failed to recover sessions. KDT error code was %d.\n", error_code);
+		return EXIT_FAILURE;
+	}
+
+	printf("Recovered %zu complete and %zu partial session(s) from %zu records.\n", recovery.complete_sessions, recovery.partial_sessions, recovery.records);
+	if(recovery.valid_bytes < recovery.file_bytes)
+		printf("The last %zu bytes of the journal were torn by the crash and were ignored.\n", recovery.file_bytes - recovery.valid_bytes);
+	for(size_t i = 0; i < session_count; i++) {
+		printf("  Session #%zu: %zu keystrokes", i + 1, sessions[i].keystrokes_length);
+		if(sessions[i].syn_dropped_count > 0)
+			printf(", %zu SYN_DROPPED, %zu tainted keystrokes", sessions[i].syn_dropped_count, sessions[i].tainted_keystrokes);
+		printf("\n");
+	}
+
+	if(save_sessions_to_path(output_path, user_info, sessions, session_count) != 0) {
+		fprintf(stderr, "Error saving session data to file.\n");
+		free_sessions(user_info, sessions, session_count);
+		return EXIT_FAILURE;
+	}
+	printf("Session data successfully saved to %s\n", output_path);
+
+	free_sessions(user_info, sessions, session_count);
+	return EXIT_SUCCESS;
+}
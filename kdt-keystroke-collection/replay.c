@@ -0,0 +1,428 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <linux/input.h>
+#include <linux/input-event-codes.h>
+#include "libkdt.h"
+
+/*
+ * kdt-replay: turns a kdt session file (or a synthetic trace) into a timed stream of
+ * struct input_event records, so that kdt can be driven without a keyboard, a
+ * /dev/input device file or superuser permissions.
+ *
+ *	mkfifo /tmp/kdt.fifo
+ *	./kdt-replay --input data/dave-d10-1.bin --speed 1 --output /tmp/kdt.fifo &
+ *	./kdt -u dave -e dave@coolmail.com -m cs -d 10 -n 1 -f -o replayed.bin -v /tmp/kdt.fifo
+ *	./kdt-replay --compare data/dave-d10-1.bin replayed.bin
+ *
+ * Every record is stamped with the CLOCK_MONOTONIC time at which it was written,
+ * which is the same clock kdt uses for press and release times.
+ */
+
+#define REPLAY_SPEED_UNTHROTTLED 0.0
+#define SYNTHETIC_TEXT "the quick brown fox jumps over the lazy dog. "
+
+struct replay_event {
+	struct timespec at;	// offset from the start of the trace
+	unsigned short code;
+	int value;
+	size_t order;		// keeps the sort stable for events that share a timestamp
+};
+
+struct replay_keycode {
+	unsigned short code;
+	bool shift;
+};
+
+static struct replay_keycode reverse_map[128];
+
+// Invert the keymap so characters stored in a session file can be turned back into the
+// key (and shift state) that produced them.
+static void build_reverse_map(const struct keymap *keymap) {
+	for(int shift = 0; shift <= 1; shift++) {
+		for(int keycode = 0; keycode <= KEY_MAX; keycode++) {
+			int ascii_character = (unsigned char) keymap_lookup(keymap, keycode, shift, 0);
+			if(ascii_character <= 0 || ascii_character > 127 || reverse_map[ascii_character].code != 0)
+				continue;
+
+			reverse_map[ascii_character].code = keycode;
+			reverse_map[ascii_character].shift = shift;
+		}
+	}
+
+	// kdt stores backspaces as 127 rather than '\b'
+	reverse_map[BACKSPACE] = reverse_map['\b'];
+}
+
+static long timespec_to_ns(struct timespec t) {
+	return (t.tv_sec * 1000000000L) + t.tv_nsec;
+}
+
+static struct timespec ns_to_timespec(long ns) {
+	struct timespec t = {
+		.tv_sec = ns / 1000000000L,
+		.tv_nsec = ns % 1000000000L
+	};
+	return t;
+}
+
+static int compare_replay_events(const void *a, const void *b) {
+	const struct replay_event *ea = (const struct replay_event *)a;
+	const struct replay_event *eb = (const struct replay_event *)b;
+	long difference = timespec_to_ns(ea->at) - timespec_to_ns(eb->at);
+
+	if(difference < 0) return -1;
+	if(difference > 0) return 1;
+	if(ea->order < eb->order) return -1;
+	if(ea->order > eb->order) return 1;
+	return 0;
+}
+
+static size_t push_event(struct replay_event *events, size_t events_length, struct timespec at, unsigned short code, int value) {
+	events[events_length].at = at;
+	events[events_length].code = code;
+	events[events_length].value = value;
+	events[events_length].order = events_length;
+	return events_length + 1;
+}
+
+// Append the press/release events of one keystroke. Times are relative to origin_ns.
+static size_t append_keystroke_events(struct replay_event *events, size_t events_length, struct keystroke *k, long origin_ns) {
+	unsigned char c = (unsigned char) k->c;
+	if(c > 127 || reverse_map[c].code == 0) {
+		fprintf(stderr, "[append_keystroke_events] No key produces character %d. It will be skipped.\n", (int) c);
+		return events_length;
+	}
+
+	struct timespec press = ns_to_timespec(timespec_to_ns(k->press_time) - origin_ns);
+	struct timespec release = ns_to_timespec(timespec_to_ns(k->release_time) - origin_ns);
+
+	// Shift only matters to kdt at the moment the key goes down
+	if(reverse_map[c].shift)
+		events_length = push_event(events, events_length, press, KEY_LEFTSHIFT, 1);
+
+	events_length = push_event(events, events_length, press, reverse_map[c].code, 1);
+
+	if(reverse_map[c].shift)
+		events_length = push_event(events, events_length, press, KEY_LEFTSHIFT, 0);
+
+	return push_event(events, events_length, release, reverse_map[c].code, 0);
+}
+
+// Build a trace from every session in a kdt output file, played back to back.
+static struct replay_event* events_from_file(char *path, size_t *events_length) {
+	FILE *file = fopen(path, "rb");
+	if(file == NULL) {
+		fprintf(stderr, "[events_from_file] Could not open \"%s\" for reading.\n", path);
+		return NULL;
+	}
+
+	struct user_info *user_info = NULL;
+	struct session *sessions = NULL;
+	size_t session_count = 0;
+	if(load_sessions(file, &user_info, &sessions, &session_count) != 0) {
+		fprintf(stderr, "[events_from_file] Failed to load sessions from \"%s\".\n", path);
+		fclose(file);
+		return NULL;
+	}
+	fclose(file);
+
+	size_t total_keystrokes = 0;
+	for(size_t i = 0; i < session_count; i++)
+		total_keystrokes += sessions[i].keystrokes_length;
+
+	// At most 4 events per keystroke (shift down, key down, shift up, key up)
+	struct replay_event *events = malloc(sizeof(struct replay_event) * (total_keystrokes * 4 + 1));
+	if(events == NULL) {
+		fprintf(stderr, "[events_from_file] Failed to allocate memory for %zu keystrokes worth of events.\n", total_keystrokes);
+		return NULL;
+	}
+
+	// Sessions are laid end to end with a one second gap, regardless of when they were recorded
+	long session_start_ns = 0;
+	*events_length = 0;
+	for(size_t i = 0; i < session_count; i++) {
+		if(sessions[i].keystrokes_length == 0)
+			continue;
+
+		long origin_ns = timespec_to_ns(sessions[i].keystrokes[0].press_time) - session_start_ns;
+		long session_end_ns = 0;
+		for(size_t j = 0; j < sessions[i].keystrokes_length; j++) {
+			*events_length = append_keystroke_events(events, *events_length, &sessions[i].keystrokes[j], origin_ns);
+			long release_ns = timespec_to_ns(sessions[i].keystrokes[j].release_time) - origin_ns;
+			if(release_ns > session_end_ns)
+				session_end_ns = release_ns;
+		}
+		session_start_ns = session_end_ns + 1000000000L;
+
+		free(sessions[i].keystrokes);
+		free(sessions[i].time_deltas);
+		free(sessions[i].dwell_times);
+		free(sessions[i].flight_times);
+		free(sessions[i].release_to_press);
+		free(sessions[i].release_to_release);
+	}
+	free(sessions);
+	free(user_info);
+
+	qsort(events, *events_length, sizeof(struct replay_event), compare_replay_events);
+	return events;
+}
+
+// Build a trace by typing SYNTHETIC_TEXT over and over with fixed inter-key and dwell times.
+static struct replay_event* events_from_synthetic(size_t keystrokes_length, long interval_ms, long dwell_ms, size_t *events_length) {
+	struct replay_event *events = malloc(sizeof(struct replay_event) * (keystrokes_length * 4 + 1));
+	if(events == NULL) {
+		fprintf(stderr, "[events_from_synthetic] Failed to allocate memory for %zu keystrokes worth of events.\n", keystrokes_length);
+		return NULL;
+	}
+
+	size_t text_length = strlen(SYNTHETIC_TEXT);
+	*events_length = 0;
+	for(size_t i = 0; i < keystrokes_length; i++) {
+		struct keystroke k = {
+			.c = SYNTHETIC_TEXT[i % text_length],
+			.press_time = ns_to_timespec(i * interval_ms * 1000000L),
+			.release_time = ns_to_timespec((i * interval_ms + dwell_ms) * 1000000L)
+		};
+		*events_length = append_keystroke_events(events, *events_length, &k, 0);
+	}
+
+	qsort(events, *events_length, sizeof(struct replay_event), compare_replay_events);
+	return events;
+}
+
+static int open_output(char *path) {
+	if(strcmp(path, "-") == 0)
+		return STDOUT_FILENO;
+
+	struct stat st;
+	if(stat(path, &st) != 0) {
+		if(mkfifo(path, 0666) != 0) {
+			perror("Error creating FIFO");
+			return -1;
+		}
+		printf("[SYSTEM] Created FIFO %s\n", path);
+	}
+
+	// Blocks until the reader (kdt) opens its end of the FIFO
+	printf("[SYSTEM] Waiting for a reader on %s...\n", path);
+	fflush(stdout);
+	int fd = open(path, O_WRONLY);
+	if(fd == -1)
+		perror("Error opening output");
+
+	return fd;
+}
+
+static bool write_event(int fd, unsigned short type, unsigned short code, int value) {
+	struct input_event ev;
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	ev.input_event_sec = now.tv_sec;
+	ev.input_event_usec = now.tv_nsec / 1000;
+	ev.type = type;
+	ev.code = code;
+	ev.value = value;
+
+	return write(fd, &ev, sizeof(struct input_event)) == sizeof(struct input_event);
+}
+
+// Emit the trace. speed scales the time axis: 1 is real time, 2 is twice as fast, and
+// REPLAY_SPEED_UNTHROTTLED writes everything as fast as the reader will take it.
+static int replay(int fd, struct replay_event *events, size_t events_length, double speed) {
+	struct timespec start, now;
+	long max_lateness_ns = 0;
+	long total_lateness_ns = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(size_t i = 0; i < events_length; i++) {
+		long due_ns = 0;
+		if(speed != REPLAY_SPEED_UNTHROTTLED) {
+			due_ns = (long) (timespec_to_ns(events[i].at) / speed);
+			struct timespec due = ns_to_timespec(timespec_to_ns(start) + due_ns);
+			while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR);
+		}
+
+		if(!write_event(fd, EV_KEY, events[i].code, events[i].value) || !write_event(fd, EV_SYN, SYN_REPORT, 0)) {
+			perror("Error writing event");
+			return -1;
+		}
+
+		if(speed != REPLAY_SPEED_UNTHROTTLED) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			long lateness_ns = timespec_to_ns(now) - timespec_to_ns(start) - due_ns;
+			total_lateness_ns += lateness_ns;
+			if(lateness_ns > max_lateness_ns)
+				max_lateness_ns = lateness_ns;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	double elapsed_s = (timespec_to_ns(now) - timespec_to_ns(start)) / 1e9;
+	fprintf(stderr, "[SYSTEM] Replayed %zu key events in %.3f s (%.0f events/s).\n", events_length, elapsed_s, elapsed_s > 0 ? events_length / elapsed_s : 0.0);
+	if(speed != REPLAY_SPEED_UNTHROTTLED && events_length > 0)
+		fprintf(stderr, "[SYSTEM] Send lateness: mean %ld us, max %ld us.\n", total_lateness_ns / (long) events_length / 1000, max_lateness_ns / 1000);
+
+	return 0;
+}
+
+// Compare a captured file against the file it was replayed from. Keystrokes are paired
+// by position; dwell times and press-to-press intervals are compared after scaling the
+// original by the replay speed. Returns -1 if a session, keystroke or character was lost
+// or changed on the way (timing errors are only reported, since they depend on the load).
+static int compare(char *original_path, char *captured_path, double speed) {
+	FILE *files[2] = { fopen(original_path, "rb"), fopen(captured_path, "rb") };
+	struct user_info *user_info[2] = { NULL, NULL };
+	struct session *sessions[2] = { NULL, NULL };
+	size_t session_count[2] = { 0, 0 };
+
+	for(int f = 0; f < 2; f++) {
+		if(files[f] == NULL || load_sessions(files[f], &user_info[f], &sessions[f], &session_count[f]) != 0) {
+			fprintf(stderr, "[compare] Failed to load sessions from \"%s\".\n", f == 0 ? original_path : captured_path);
+			return -1;
+		}
+		fclose(files[f]);
+	}
+
+	if(speed == REPLAY_SPEED_UNTHROTTLED)
+		speed = 1.0;
+
+	size_t pairs = 0, mismatched_characters = 0;
+	long dwell_error_sum = 0, dwell_error_max = 0;
+	long delta_error_sum = 0, delta_error_max = 0;
+	size_t sessions_to_compare = session_count[0] < session_count[1] ? session_count[0] : session_count[1];
+	bool lost = session_count[0] != session_count[1];
+	if(lost)
+		printf("%zu sessions replayed, %zu captured.\n", session_count[0], session_count[1]);
+	for(size_t i = 0; i < sessions_to_compare; i++) {
+		struct session *o = &sessions[0][i];
+		struct session *c = &sessions[1][i];
+		size_t n = o->keystrokes_length < c->keystrokes_length ? o->keystrokes_length : c->keystrokes_length;
+
+		for(size_t j = 0; j < n; j++) {
+			if(o->keystrokes[j].c != c->keystrokes[j].c)
+				mismatched_characters++;
+
+			long expected = (long) ((timespec_to_ns(o->keystrokes[j].release_time) - timespec_to_ns(o->keystrokes[j].press_time)) / speed);
+			long actual = timespec_to_ns(c->keystrokes[j].release_time) - timespec_to_ns(c->keystrokes[j].press_time);
+			long error = labs(actual - expected);
+			dwell_error_sum += error;
+			if(error > dwell_error_max) dwell_error_max = error;
+
+			if(j > 0) {
+				expected = (long) ((timespec_to_ns(o->keystrokes[j].press_time) - timespec_to_ns(o->keystrokes[j-1].press_time)) / speed);
+				actual = timespec_to_ns(c->keystrokes[j].press_time) - timespec_to_ns(c->keystrokes[j-1].press_time);
+				error = labs(actual - expected);
+				delta_error_sum += error;
+				if(error > delta_error_max) delta_error_max = error;
+			}
+			pairs++;
+		}
+
+		if(o->keystrokes_length != c->keystrokes_length) {
+			lost = true;
+			printf("Session %zu: %zu keystrokes replayed, %zu captured.\n", i + 1, o->keystrokes_length, c->keystrokes_length);
+		}
+	}
+
+	printf("Compared %zu keystrokes (%zu with a different character).\n", pairs, mismatched_characters);
+	if(pairs > 0) {
+		printf("  Dwell time error:    mean %ld us, max %ld us\n", dwell_error_sum / (long) pairs / 1000, dwell_error_max / 1000);
+		printf("  Time delta error:    mean %ld us, max %ld us\n", pairs > 1 ? delta_error_sum / (long) (pairs - 1) / 1000 : 0, delta_error_max / 1000);
+	}
+
+	return lost || mismatched_characters > 0 ? -1 : 0;
+}
+
+static void display_usage(char *program) {
+	fprintf(stderr, "Usage: %s (--input FILE | --synthetic N) [--speed X] [--interval MS] [--dwell MS] [--keymap FILE] --output FIFO|-\n", program);
+	fprintf(stderr, "       %s --compare ORIGINAL CAPTURED [--speed X]\n", program);
+	fprintf(stderr, "\n  --speed X   1 replays in real time, 2 twice as fast, 0 as fast as possible (default 1).\n");
+}
+
+int main(int argc, char **argv) {
+	char *input_path = NULL;
+	char *output_path = NULL;
+	char *compare_paths[2] = { NULL, NULL };
+	size_t synthetic_keystrokes = 0;
+	long interval_ms = 150;
+	long dwell_ms = 90;
+	double speed = 1.0;
+	const struct keymap *keymap = &keymap_us_qwerty;
+	struct keymap loaded_keymap;
+
+	for(int i = 1; i < argc; i++) {
+		bool has_value = i + 1 < argc;
+		if(strcmp(argv[i], "--input") == 0 && has_value)
+			input_path = argv[++i];
+		else if(strcmp(argv[i], "--output") == 0 && has_value)
+			output_path = argv[++i];
+		else if(strcmp(argv[i], "--synthetic") == 0 && has_value)
+			synthetic_keystrokes = strtoul(argv[++i], NULL, 10);
+		else if(strcmp(argv[i], "--interval") == 0 && has_value)
+			interval_ms = atol(argv[++i]);
+		else if(strcmp(argv[i], "--dwell") == 0 && has_value)
+			dwell_ms = atol(argv[++i]);
+		else if(strcmp(argv[i], "--speed") == 0 && has_value)
+			speed = atof(argv[++i]);
+		else if(strcmp(argv[i], "--keymap") == 0 && has_value) {
+			if(keymap_load(&loaded_keymap, argv[++i]) != 0)
+				return EXIT_FAILURE;
+			keymap = &loaded_keymap;
+		}
+		else if(strcmp(argv[i], "--compare") == 0 && i + 2 < argc) {
+			compare_paths[0] = argv[++i];
+			compare_paths[1] = argv[++i];
+		}
+		else {
+			display_usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if(speed < 0) {
+		fprintf(stderr, "Speed must be zero (as fast as possible) or positive.\n");
+		return EXIT_FAILURE;
+	}
+
+	build_reverse_map(keymap);
+
+	if(compare_paths[0] != NULL)
+		return compare(compare_paths[0], compare_paths[1], speed) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+
+	if(output_path == NULL || (input_path == NULL) == (synthetic_keystrokes == 0)) {
+		display_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	size_t events_length = 0;
+	struct replay_event *events;
+	if(input_path != NULL)
+		events = events_from_file(input_path, &events_length);
+	else
+		events = events_from_synthetic(synthetic_keystrokes, interval_ms, dwell_ms, &events_length);
+
+	if(events == NULL)
+		return EXIT_FAILURE;
+
+	int fd = open_output(output_path);
+	if(fd == -1) {
+		free(events);
+		return EXIT_FAILURE;
+	}
+
+	int result = replay(fd, events, events_length, speed);
+	if(fd != STDOUT_FILENO)
+		close(fd);
+	free(events);
+
+	return result == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}